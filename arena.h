@@ -0,0 +1,483 @@
+#pragma once
+
+// Allocators and containers for the compiler helpers' own data structures
+// (caches of files and modules, and the blobs we hand to compilers), as
+// opposed to the compilers' internals.
+
+// If defined, the helpers use an arena-backed open-addressing map with
+// interned keys for their path-keyed caches, and allocate each blob and its
+// data together, by default, instead of std::unordered_map<std::string, ...>
+// and blobs that own a separate std::vector. This sets the default for
+// PathMap and for SlangHelperSettings::arena_glue, which can be changed at run
+// time; comparing runs with and without it (`--ab arena-glue`) shows how much
+// of each compile is spent in our glue code.
+#define USE_ARENA_GLUE
+
+#include "utilities.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// A bump allocator. Allocations are freed all at once by reset() or when the
+// arena is destroyed; destructors aren't run.
+class Arena
+{
+public:
+  Arena() = default;
+  Arena(const Arena&)            = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+  {
+    size_t offset = (m_used + alignment - 1) & ~(alignment - 1);
+    if(m_blocks.empty() || offset + size > m_blockSize)
+    {
+      // Large allocations get their own block.
+      m_blockSize = std::max(kBlockSize, size + alignment);
+      m_blocks.push_back(std::make_unique<char[]>(m_blockSize));
+      offset = (reinterpret_cast<uintptr_t>(m_blocks.back().get()) + alignment - 1) & ~(alignment - 1);
+      offset -= reinterpret_cast<uintptr_t>(m_blocks.back().get());
+    }
+    m_used = offset + size;
+    m_bytesAllocated += size;
+    return m_blocks.back().get() + offset;
+  }
+
+  // Copies a string into the arena; the result stays valid until reset().
+  std::string_view copy_string(std::string_view str)
+  {
+    char* data = static_cast<char*>(allocate(str.size() + 1, 1));
+    memcpy(data, str.data(), str.size());
+    data[str.size()] = '\0';
+    return std::string_view(data, str.size());
+  }
+
+  void reset()
+  {
+    m_blocks.clear();
+    m_used           = 0;
+    m_blockSize      = 0;
+    m_bytesAllocated = 0;
+  }
+
+  size_t bytes_allocated() const { return m_bytesAllocated; }
+
+  void swap(Arena& other)
+  {
+    m_blocks.swap(other.m_blocks);
+    std::swap(m_used, other.m_used);
+    std::swap(m_blockSize, other.m_blockSize);
+    std::swap(m_bytesAllocated, other.m_bytesAllocated);
+  }
+
+private:
+  static constexpr size_t              kBlockSize = 64 * 1024;
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  size_t                               m_used           = 0;  // In the last block
+  size_t                               m_blockSize      = 0;  // Of the last block
+  size_t                               m_bytesAllocated = 0;
+};
+
+// An open-addressing hash map from paths (or other strings) to values, with
+// linear probing. Keys are interned in an arena that the map owns, so an
+// entry costs no allocations beyond its slot, and lookups take string_views.
+// Supports the subset of std::unordered_map that the helpers use.
+//
+// Unlike std::unordered_map, inserting or erasing can move other entries, so
+// references and iterators are only valid until the next change. Erased keys
+// stay in the arena until they take up half of it; then erase() copies the
+// live keys to a new arena, so that long-running sessions don't grow it
+// forever.
+template <class Value>
+class FlatPathMap
+{
+public:
+  using value_type = std::pair<const std::string_view, Value>;
+
+  class iterator
+  {
+  public:
+    iterator(FlatPathMap* map, size_t index)
+        : m_map(map)
+        , m_index(index)
+    {
+      skipEmpty();
+    }
+    value_type& operator*() const { return *m_map->m_slots[m_index].entry; }
+    value_type* operator->() const { return &*m_map->m_slots[m_index].entry; }
+    iterator&   operator++()
+    {
+      m_index++;
+      skipEmpty();
+      return *this;
+    }
+    bool operator==(const iterator& other) const { return m_index == other.m_index; }
+
+  private:
+    void skipEmpty()
+    {
+      while(m_index < m_map->m_slots.size() && !m_map->m_slots[m_index].entry.has_value())
+      {
+        m_index++;
+      }
+    }
+    FlatPathMap* m_map;
+    size_t       m_index;
+  };
+  using const_iterator = iterator;
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, m_slots.size()); }
+  // The map's const interface only hands out const entries, but iterators
+  // don't distinguish them, so cast away constness here.
+  iterator begin() const { return const_cast<FlatPathMap*>(this)->begin(); }
+  iterator end() const { return const_cast<FlatPathMap*>(this)->end(); }
+
+  size_t size() const { return m_size; }
+  bool   empty() const { return m_size == 0; }
+
+  iterator find(std::string_view key) const
+  {
+    const size_t index = findIndex(key, hash(key));
+    return (index == kNotFound) ? end() : iterator(const_cast<FlatPathMap*>(this), index);
+  }
+
+  size_t count(std::string_view key) const { return findIndex(key, hash(key)) == kNotFound ? 0 : 1; }
+
+  Value& operator[](std::string_view key)
+  {
+    const uint64_t key_hash = hash(key);
+    const size_t   index    = findIndex(key, key_hash);
+    if(index != kNotFound)
+    {
+      return m_slots[index].entry->second;
+    }
+    if((m_size + 1) * 4 > m_slots.size() * 3)
+    {
+      rehash(std::max<size_t>(16, m_slots.size() * 2));
+    }
+    Slot& slot = m_slots[probeForEmpty(key_hash)];
+    slot.hash  = key_hash;
+    slot.entry.emplace(m_keys.copy_string(key), Value());
+    m_size++;
+    return slot.entry->second;
+  }
+
+  size_t erase(std::string_view key)
+  {
+    size_t index = findIndex(key, hash(key));
+    if(index == kNotFound)
+    {
+      return 0;
+    }
+    // Backward-shift deletion: move later entries in the same probe sequence
+    // into the hole, so that lookups never need tombstones.
+    const size_t mask = m_slots.size() - 1;
+    m_slots[index].entry.reset();
+    for(size_t next = (index + 1) & mask; m_slots[next].entry.has_value(); next = (next + 1) & mask)
+    {
+      const size_t ideal = m_slots[next].hash & mask;
+      // Can the entry at `next` move to `index` without passing its ideal slot?
+      if(((next - ideal) & mask) >= ((next - index) & mask))
+      {
+        m_slots[index].hash = m_slots[next].hash;
+        m_slots[index].entry.emplace(std::move(*m_slots[next].entry));
+        m_slots[next].entry.reset();
+        index = next;
+      }
+    }
+    m_size--;
+    m_erasedKeyBytes += key.size() + 1;
+    if(m_erasedKeyBytes > kMinCompactBytes && m_erasedKeyBytes * 2 > m_keys.bytes_allocated())
+    {
+      compactKeys();
+    }
+    return 1;
+  }
+
+  void clear()
+  {
+    m_slots.clear();
+    m_size           = 0;
+    m_erasedKeyBytes = 0;
+    m_keys.reset();
+  }
+
+private:
+  struct Slot
+  {
+    uint64_t                  hash = 0;
+    std::optional<value_type> entry;
+  };
+
+  static constexpr size_t kNotFound = ~size_t(0);
+  // Erased keys smaller than this in total aren't worth compacting.
+  static constexpr size_t kMinCompactBytes = 16 * 1024;
+
+  static uint64_t hash(std::string_view key) { return Hasher().add_bytes(key.data(), key.size()).get(); }
+
+  size_t findIndex(std::string_view key, uint64_t key_hash) const
+  {
+    if(m_slots.empty())
+    {
+      return kNotFound;
+    }
+    const size_t mask = m_slots.size() - 1;
+    for(size_t index = key_hash & mask;; index = (index + 1) & mask)
+    {
+      const Slot& slot = m_slots[index];
+      if(!slot.entry.has_value())
+      {
+        return kNotFound;
+      }
+      if(slot.hash == key_hash && slot.entry->first == key)
+      {
+        return index;
+      }
+    }
+  }
+
+  size_t probeForEmpty(uint64_t key_hash) const
+  {
+    const size_t mask  = m_slots.size() - 1;
+    size_t       index = key_hash & mask;
+    while(m_slots[index].entry.has_value())
+    {
+      index = (index + 1) & mask;
+    }
+    return index;
+  }
+
+  void rehash(size_t new_capacity)
+  {
+    std::vector<Slot> old_slots = std::move(m_slots);
+    m_slots                     = std::vector<Slot>(new_capacity);
+    for(Slot& old_slot : old_slots)
+    {
+      if(old_slot.entry.has_value())
+      {
+        Slot& slot = m_slots[probeForEmpty(old_slot.hash)];
+        slot.hash  = old_slot.hash;
+        slot.entry.emplace(std::move(*old_slot.entry));
+      }
+    }
+  }
+
+  // Copies the keys of the entries we still have to a new arena, and frees
+  // the old one.
+  void compactKeys()
+  {
+    Arena keys;
+    for(Slot& slot : m_slots)
+    {
+      if(slot.entry.has_value())
+      {
+        Value value = std::move(slot.entry->second);
+        slot.entry.emplace(keys.copy_string(slot.entry->first), std::move(value));
+      }
+    }
+    m_keys.swap(keys);
+    m_erasedKeyBytes = 0;
+  }
+
+  std::vector<Slot> m_slots;  // The size is 0 or a power of 2.
+  size_t            m_size           = 0;
+  size_t            m_erasedKeyBytes = 0;  // Of keys erased from m_keys
+  Arena             m_keys;
+};
+
+// Hashes std::strings and string_views the same way, so that
+// std::unordered_map<std::string, ...> can look up string_views.
+struct TransparentStringHash
+{
+  using is_transparent = void;
+  size_t operator()(std::string_view str) const { return std::hash<std::string_view>()(str); }
+};
+
+// The map the helpers use for caches keyed by paths: a FlatPathMap, or, after
+// set_arena(false), a std::unordered_map<std::string, ...>, so that the two
+// can be compared at run time. Both accept string_views everywhere. Entries
+// are (key, value reference) pairs, since the two maps store different keys;
+// bind them with `const auto&` or `auto&&`.
+template <class Value>
+class PathMap
+{
+  using StdMap = std::unordered_map<std::string, Value, TransparentStringHash, std::equal_to<>>;
+
+public:
+  using reference = std::pair<std::string_view, Value&>;
+
+  class iterator
+  {
+  public:
+    explicit iterator(typename FlatPathMap<Value>::iterator it)
+        : m_it(it)
+    {
+    }
+    explicit iterator(typename StdMap::iterator it)
+        : m_it(it)
+    {
+    }
+    reference operator*() const
+    {
+      return std::visit([](const auto& it) { return reference(it->first, it->second); }, m_it);
+    }
+    // Lets `it->second` work even though *it is a temporary.
+    struct Arrow
+    {
+      reference        entry;
+      const reference* operator->() const { return &entry; }
+    };
+    Arrow     operator->() const { return {**this}; }
+    iterator& operator++()
+    {
+      std::visit([](auto& it) { ++it; }, m_it);
+      return *this;
+    }
+    bool operator==(const iterator& other) const { return m_it == other.m_it; }
+
+  private:
+    std::variant<typename FlatPathMap<Value>::iterator, typename StdMap::iterator> m_it;
+  };
+  using const_iterator = iterator;
+
+  // Switches between FlatPathMap (if `arena`) and std::unordered_map; this
+  // clears the map if it changes which one is used.
+  void set_arena(bool arena)
+  {
+    if(arena != m_arena)
+    {
+      clear();
+      m_arena = arena;
+    }
+  }
+  bool arena() const { return m_arena; }
+
+  iterator begin() const { return m_arena ? iterator(m_flat.begin()) : iterator(mutableStd().begin()); }
+  iterator end() const { return m_arena ? iterator(m_flat.end()) : iterator(mutableStd().end()); }
+
+  size_t size() const { return m_arena ? m_flat.size() : m_std.size(); }
+  bool   empty() const { return size() == 0; }
+
+  iterator find(std::string_view key) const { return m_arena ? iterator(m_flat.find(key)) : iterator(mutableStd().find(key)); }
+  size_t   count(std::string_view key) const { return m_arena ? m_flat.count(key) : m_std.count(key); }
+
+  Value& operator[](std::string_view key)
+  {
+    if(m_arena)
+    {
+      return m_flat[key];
+    }
+    const auto& it = m_std.find(key);
+    return (it != m_std.end()) ? it->second : m_std.emplace(std::string(key), Value()).first->second;
+  }
+
+  size_t erase(std::string_view key)
+  {
+    if(m_arena)
+    {
+      return m_flat.erase(key);
+    }
+    const auto& it = m_std.find(key);
+    if(it == m_std.end())
+    {
+      return 0;
+    }
+    m_std.erase(it);
+    return 1;
+  }
+
+  void clear()
+  {
+    m_flat.clear();
+    m_std.clear();
+  }
+
+private:
+  // Like FlatPathMap, the const interface hands out iterators to mutable
+  // entries.
+  StdMap& mutableStd() const { return const_cast<StdMap&>(m_std); }
+
+  FlatPathMap<Value> m_flat;
+  StdMap             m_std;
+#ifdef USE_ARENA_GLUE
+  bool m_arena = true;
+#else
+  bool m_arena = false;
+#endif
+};
+
+// Remembers paths computed from pairs of strings (e.g. joining a directory and
+// a relative path, or making a path absolute), so that looking one up again
+// only hashes the two strings. This avoids building std::filesystem::paths or
+// calling into the OS on every file load.
+class PathInterner
+{
+public:
+  // Returns the path for (`first`, `second`), calling `compute(first, second)`
+  // to create it the first time. The result stays valid until clear() or
+  // trim().
+  template <class Compute>
+  std::string_view get(std::string_view first, std::string_view second, Compute&& compute)
+  {
+    // The key is both strings separated by a character paths can't contain.
+    m_key.assign(first);
+    m_key.push_back('\0');
+    m_key.append(second);
+    std::string_view& path = m_paths[m_key];
+    if(path.data() == nullptr)
+    {
+      path = m_strings.copy_string(compute(first, second));
+    }
+    return path;
+  }
+
+  // Returns (fs::path(directory) / fs::path(relative)).string().
+  std::string_view join(std::string_view directory, std::string_view relative)
+  {
+    return get(directory, relative, [](std::string_view a, std::string_view b) {
+      return (fs::path(a) / fs::path(b)).string();
+    });
+  }
+
+  void clear()
+  {
+    m_paths.clear();
+    m_strings.reset();
+  }
+
+  // Forgets every path if they take up more than `max_bytes`. Callers do this
+  // between compiles, while none of the paths we returned are in use, so that
+  // a long-running session that keeps seeing new paths stays bounded.
+  void trim(size_t max_bytes)
+  {
+    if(m_strings.bytes_allocated() > max_bytes)
+    {
+      clear();
+    }
+  }
+
+  // Uses FlatPathMap or std::unordered_map for lookups; see PathMap.
+  void set_arena(bool arena)
+  {
+    clear();
+    m_paths.set_arena(arena);
+  }
+
+private:
+  std::string                m_key;  // Reused to avoid allocating
+  PathMap<std::string_view> m_paths;
+  Arena                      m_strings;
+};
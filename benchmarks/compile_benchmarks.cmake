@@ -0,0 +1,208 @@
+# Runs the compile-time regression suite, for the compile-benchmarks and
+# compile-benchmarks-update-baselines targets (see CMakeLists.txt).
+#
+# The suite compiles the simple and pathtrace examples with each backend in
+# BACKENDS, in three configurations: with the compiler's caches off (cold),
+# with them on (warm: Slang's module cache, or shaderc's and DXC's
+# preprocessed-source cache), and on THREADS threads at once. Each case
+# writes its JSON results to OUTPUT_DIR/<case>.json. Its median compile time
+# and peak RSS are compared to BASELINE_DIR/<case>.json, and the script fails
+# if either grew by more than THRESHOLD or MEMORY_THRESHOLD percent. If any
+# case has no baseline, the script fails before running anything, since it
+# couldn't catch a regression; with SKIP_MISSING_BASELINES (for CTest), it
+# warns and prints "Skipping compile benchmarks: missing baselines" instead.
+# With UPDATE_BASELINES, the results replace the baselines.
+#
+# Usage:
+#   cmake -DEXECUTABLE=<slang-compile-timer> -DSOURCE_DIR=<this repository>
+#         -DBACKENDS=slang,shaderc,dxc -DOUTPUT_DIR=<dir> -DBASELINE_DIR=<dir>
+#         [-DTHRESHOLD=10] [-DMEMORY_THRESHOLD=10] [-DREPETITIONS=32]
+#         [-DTHREADS=4] [-DUPDATE_BASELINES=ON] [-DSKIP_MISSING_BASELINES=ON]
+#         -P compile_benchmarks.cmake
+
+cmake_minimum_required(VERSION 3.21)
+
+foreach(_required EXECUTABLE SOURCE_DIR BACKENDS OUTPUT_DIR BASELINE_DIR)
+  if(NOT DEFINED ${_required})
+    message(FATAL_ERROR "compile_benchmarks.cmake needs -D${_required}=...")
+  endif()
+endforeach()
+if(NOT DEFINED THRESHOLD)
+  set(THRESHOLD 10)
+endif()
+if(NOT DEFINED MEMORY_THRESHOLD)
+  set(MEMORY_THRESHOLD 10)
+endif()
+if(NOT DEFINED REPETITIONS)
+  set(REPETITIONS 32)
+endif()
+if(NOT DEFINED THREADS)
+  set(THREADS 4)
+endif()
+string(REPLACE "," ";" BACKENDS "${BACKENDS}")
+
+# The shaders each backend compiles, as <name>=<path relative to SOURCE_DIR>.
+set(_slang_shaders
+    simple=examples/simple/shader.slang
+    pathtrace=examples/pathtrace-slang/gltf_pathtrace.slang)
+set(_shaderc_shaders
+    simple=examples/simple/shader.comp.glsl
+    pathtrace=examples/pathtrace-glsl/gltf_pathtrace.comp.glsl)
+set(_dxc_shaders
+    simple=examples/simple/shader.hlsl
+    pathtrace=examples/pathtrace-hlsl/gltf_pathtrace.hlsl)
+
+# Sets `out` to the JSON number `number` times 10^`digits`, as an integer,
+# since math(EXPR) only does integer arithmetic. The JSON writer uses %.9g,
+# so numbers may have an exponent. Extra digits are truncated.
+function(_scaled_integer number digits out)
+  if(NOT number MATCHES "^(-?)([0-9]+)(\\.([0-9]+))?([eE]([-+]?[0-9]+))?$")
+    message(FATAL_ERROR "Not a number: ${number}")
+  endif()
+  set(_sign "${CMAKE_MATCH_1}")
+  set(_digits "${CMAKE_MATCH_2}${CMAKE_MATCH_4}")
+  string(LENGTH "${CMAKE_MATCH_4}" _fraction_length)
+  set(_exponent "${CMAKE_MATCH_6}")
+  if(_exponent STREQUAL "")
+    set(_exponent 0)
+  endif()
+  math(EXPR _shift "${_exponent} + ${digits} - ${_fraction_length}")
+  if(_shift GREATER_EQUAL 0)
+    string(REPEAT "0" ${_shift} _zeros)
+    string(APPEND _digits "${_zeros}")
+  else()
+    string(LENGTH "${_digits}" _length)
+    math(EXPR _length "${_length} + ${_shift}")
+    if(_length LESS_EQUAL 0)
+      set(_digits 0)
+    else()
+      string(SUBSTRING "${_digits}" 0 ${_length} _digits)
+    endif()
+  endif()
+  # Removes leading zeros, which math(EXPR) would read as octal.
+  string(REGEX REPLACE "^0+([0-9])" "\\1" _digits "${_digits}")
+  set(${out} "${_sign}${_digits}" PARENT_SCOPE)
+endfunction()
+
+# Sets `median_ms` and `peak_rss_bytes` from the JSON results in `file`.
+function(_read_result file median_ms peak_rss_bytes)
+  file(READ "${file}" _json)
+  string(JSON _median GET "${_json}" summary_ms median)
+  string(JSON _peak GET "${_json}" peak_rss_bytes)
+  set(${median_ms} "${_median}" PARENT_SCOPE)
+  set(${peak_rss_bytes} "${_peak}" PARENT_SCOPE)
+endfunction()
+
+# Sets `out` to TRUE if `current` is more than `threshold` percent above
+# `baseline`. Values are scaled by 10^`digits` first.
+function(_regressed current baseline threshold digits out)
+  _scaled_integer("${current}" ${digits} _current)
+  _scaled_integer("${baseline}" ${digits} _baseline)
+  math(EXPR _limit "${_baseline} * (100 + ${threshold})")
+  math(EXPR _current "${_current} * 100")
+  if(_current GREATER _limit)
+    set(${out} TRUE PARENT_SCOPE)
+  else()
+    set(${out} FALSE PARENT_SCOPE)
+  endif()
+endfunction()
+
+# Check for baselines before spending time on the cases.
+if(NOT UPDATE_BASELINES)
+  set(_missing "")
+  foreach(_backend IN LISTS BACKENDS)
+    foreach(_shader IN LISTS _${_backend}_shaders)
+      string(REGEX REPLACE "=.*" "" _shader_name "${_shader}")
+      foreach(_config cold warm j${THREADS})
+        if(NOT EXISTS "${BASELINE_DIR}/${_backend}-${_shader_name}-${_config}.json")
+          list(APPEND _missing "${_backend}-${_shader_name}-${_config}")
+        endif()
+      endforeach()
+    endforeach()
+  endforeach()
+  if(NOT _missing STREQUAL "")
+    list(JOIN _missing ", " _missing_list)
+    set(_message "No baselines in ${BASELINE_DIR} for: ${_missing_list}. Build compile-benchmarks-update-baselines "
+                 "on the machine that runs the checks to record them.")
+    if(SKIP_MISSING_BASELINES)
+      message(WARNING ${_message})
+      message(STATUS "Skipping compile benchmarks: missing baselines")
+      return()
+    endif()
+    message(FATAL_ERROR ${_message})
+  endif()
+endif()
+
+file(MAKE_DIRECTORY "${OUTPUT_DIR}")
+if(UPDATE_BASELINES)
+  file(MAKE_DIRECTORY "${BASELINE_DIR}")
+endif()
+
+set(_regressions "")
+set(_report "")
+foreach(_backend IN LISTS BACKENDS)
+  if(NOT DEFINED _${_backend}_shaders)
+    message(FATAL_ERROR "No shaders for backend ${_backend}.")
+  endif()
+  if(_backend STREQUAL "slang")
+    set(_cold_args --module-cache off)
+    set(_warm_args --module-cache on)
+  else()
+    set(_cold_args "")
+    set(_warm_args --preprocess-cache)
+  endif()
+
+  foreach(_shader IN LISTS _${_backend}_shaders)
+    string(REGEX REPLACE "=.*" "" _shader_name "${_shader}")
+    string(REGEX REPLACE "^[^=]*=" "" _shader_path "${_shader}")
+    foreach(_config cold warm j${THREADS})
+      if(_config STREQUAL "cold")
+        set(_config_args ${_cold_args})
+      elseif(_config STREQUAL "warm")
+        set(_config_args ${_warm_args})
+      else()
+        set(_config_args -j ${THREADS})
+      endif()
+      set(_case "${_backend}-${_shader_name}-${_config}")
+      set(_result "${OUTPUT_DIR}/${_case}.json")
+      message(STATUS "Running ${_case}")
+      execute_process(
+        COMMAND "${EXECUTABLE}" --backends ${_backend} -r ${REPETITIONS} ${_config_args} --json "${_result}"
+                "${SOURCE_DIR}/${_shader_path}"
+        RESULT_VARIABLE _exit_code
+        OUTPUT_FILE "${OUTPUT_DIR}/${_case}.txt")
+      if(NOT _exit_code EQUAL 0)
+        message(FATAL_ERROR "${_case} failed (${_exit_code}); see ${OUTPUT_DIR}/${_case}.txt")
+      endif()
+      _read_result("${_result}" _median _peak)
+
+      set(_baseline "${BASELINE_DIR}/${_case}.json")
+      if(UPDATE_BASELINES)
+        file(COPY_FILE "${_result}" "${_baseline}")
+        string(APPEND _report "  ${_case}: median ${_median} ms, peak RSS ${_peak} bytes (new baseline)\n")
+      else()
+        _read_result("${_baseline}" _baseline_median _baseline_peak)
+        # Times are compared in nanoseconds.
+        _regressed("${_median}" "${_baseline_median}" ${THRESHOLD} 6 _slower)
+        _regressed("${_peak}" "${_baseline_peak}" ${MEMORY_THRESHOLD} 0 _bigger)
+        set(_verdict "ok")
+        if(_slower OR _bigger)
+          set(_verdict "REGRESSED")
+          list(APPEND _regressions "${_case}")
+        endif()
+        string(APPEND _report "  ${_case}: median ${_median} ms (baseline ${_baseline_median}), peak RSS ${_peak} "
+                              "bytes (baseline ${_baseline_peak}): ${_verdict}\n")
+      endif()
+    endforeach()
+  endforeach()
+endforeach()
+
+message(STATUS "Compile benchmarks:\n${_report}")
+if(_regressions)
+  list(JOIN _regressions ", " _regression_list)
+  message(FATAL_ERROR "Compile time or peak memory regressed past ${THRESHOLD}% / ${MEMORY_THRESHOLD}% in: "
+                      "${_regression_list}")
+endif()
+if(UPDATE_BASELINES)
+  message(STATUS "Wrote baselines to ${BASELINE_DIR}")
+endif()
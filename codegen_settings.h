@@ -0,0 +1,38 @@
+#pragma once
+
+// Code generation settings that every compiler helper understands, so that
+// --sweep can try the same configurations with each backend.
+//
+// Each helper maps these to its closest options, and says which ones it can
+// change with codegen_knobs(); see each helper's set_codegen().
+
+#include "utilities.h"
+
+#include <stdint.h>
+
+struct CodegenSettings
+{
+  // 0 (none) to 3 (maximal), like Slang's -O0 to -O3.
+  int optimization = 0;
+  // 0 (none) to 3 (maximal), like Slang's -g0 to -g3.
+  int debug_info = 0;
+  // Run the compiler's SPIR-V validation.
+  bool validation = true;
+  // Slang only: emit SPIR-V directly instead of going through GLSL and glslang.
+  bool emit_spirv_directly = true;
+
+  // Feeds these into a hash, e.g. for a compiler helper's fingerprint.
+  Hasher& hash(Hasher& hasher) const
+  {
+    return hasher.add_int(optimization).add_int(debug_info).add_int(validation).add_int(emit_spirv_directly);
+  }
+};
+
+// Bits for the CodegenSettings members a compiler helper can change.
+enum CodegenKnob : uint32_t
+{
+  kCodegenOptimization      = 1u << 0,
+  kCodegenDebugInfo         = 1u << 1,
+  kCodegenValidation        = 1u << 2,
+  kCodegenEmitSpirvDirectly = 1u << 3,
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+// Recompiles a shader on a background thread as its files change, the way an
+// editor with hot reloading might.
+//
+// Each change is submitted with the files it touched. The scheduler waits
+// until no change has arrived for a debounce interval (an editor often saves
+// several times in quick succession), then compiles once for all the changes
+// it collected. Only one compile per shader is ever in flight. Slang can't
+// abort a compile that's running, so when newer changes arrive during one, the
+// scheduler marks its result as stale and starts over with the newest source
+// as soon as it finishes. The newest SPIR-V that compiled successfully is
+// always available.
+//
+// With coalescing turned off, it instead compiles once per change in order,
+// with no debounce -- the naive approach we compare against.
+
+#include "compiler_slang.h"
+#include "cpu_control.h"
+#include "utilities.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What happened to one compile the scheduler ran.
+struct ScheduledCompileResult
+{
+  // The newest change the compile included; changes are numbered from 1.
+  uint64_t generation  = 0;
+  size_t   num_changes = 0;  // How many changes it included
+  bool     success     = false;
+  // True if a newer change arrived before the compile finished, so that its
+  // output was already out of date.
+  bool              stale      = false;
+  double            compile_ms = 0.0;
+  timer::time_point finished;
+};
+
+class CompileScheduler
+{
+public:
+  // `compiler` must be initialized, and only the scheduler's thread may use it
+  // until the scheduler is destroyed.
+  CompileScheduler(SlangCompilerHelper& compiler, std::string shader_path, std::string source, double debounce_ms, bool coalesce)
+      : m_compiler(compiler)
+      , m_shaderPath(std::move(shader_path))
+      , m_source(std::move(source))
+      , m_debounce(std::chrono::duration_cast<timer::duration>(std::chrono::duration<double, std::milli>(debounce_ms)))
+      , m_coalesce(coalesce)
+  {
+    m_worker = std::thread([this]() {
+      pin_helper_thread();
+      run();
+    });
+  }
+
+  ~CompileScheduler()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    m_worker.join();
+  }
+
+  CompileScheduler(const CompileScheduler&)            = delete;
+  CompileScheduler& operator=(const CompileScheduler&) = delete;
+
+  // Requests a recompile after the files at `changed_paths` changed.
+  // `source` is the main shader's new source, if it changed. If
+  // `clear_cache` is set, the whole module cache is thrown away first (e.g.
+  // because change notifications were lost). Returns the change's generation.
+  uint64_t submit(std::vector<std::string> changed_paths, std::optional<std::string> source, bool clear_cache = false)
+  {
+    uint64_t generation = 0;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      generation   = ++m_generation;
+      m_lastSubmit = timer::now();
+      m_pending.push_back(Change{.generation  = generation,
+                                 .paths       = std::move(changed_paths),
+                                 .source      = std::move(source),
+                                 .clear_cache = clear_cache});
+    }
+    m_wake.notify_all();
+    return generation;
+  }
+
+  // Waits until every submitted change has been compiled.
+  void wait_idle()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_pending.empty() && !m_busy; });
+  }
+
+  // Returns the results of the compiles finished since the last call.
+  std::vector<ScheduledCompileResult> take_results()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::move(m_results);
+  }
+
+  // Returns the newest SPIR-V that compiled successfully, and the generation
+  // it includes changes up to (0 if nothing has compiled yet).
+  std::vector<char> last_good_spirv(uint64_t* generation = nullptr) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(generation)
+    {
+      *generation = m_lastGoodGeneration;
+    }
+    return m_lastGoodSpirv;
+  }
+
+private:
+  struct Change
+  {
+    uint64_t                   generation = 0;
+    std::vector<std::string>   paths;
+    std::optional<std::string> source;
+    bool                       clear_cache = false;
+  };
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+      m_wake.wait(lock, [this]() { return m_stop || !m_pending.empty(); });
+      if(m_stop)
+      {
+        return;
+      }
+      // Debounce: wait until changes stop arriving.
+      if(m_coalesce)
+      {
+        while(!m_stop && timer::now() < m_lastSubmit + m_debounce)
+        {
+          m_wake.wait_until(lock, m_lastSubmit + m_debounce);
+        }
+        if(m_stop)
+        {
+          return;
+        }
+      }
+
+      // Take one change, or all of them.
+      Change job         = std::move(m_pending.front());
+      size_t num_changes = 1;
+      m_pending.pop_front();
+      while(m_coalesce && !m_pending.empty())
+      {
+        Change& next = m_pending.front();
+        job.generation = next.generation;
+        job.paths.insert(job.paths.end(), next.paths.begin(), next.paths.end());
+        if(next.source.has_value())
+        {
+          job.source = std::move(next.source);
+        }
+        job.clear_cache = job.clear_cache || next.clear_cache;
+        num_changes++;
+        m_pending.pop_front();
+      }
+      m_busy = true;
+      lock.unlock();
+
+      if(job.clear_cache)
+      {
+        m_compiler.clear_module_cache();
+      }
+      m_compiler.invalidate_files(job.paths);
+      if(job.source.has_value())
+      {
+        m_source = std::move(job.source.value());
+      }
+      const timer::time_point start   = timer::now();
+      const bool              success = m_compiler.compile(m_shaderPath.c_str(), m_source.c_str());
+      const timer::time_point end     = timer::now();
+      std::vector<char>       spirv;
+      if(success)
+      {
+        const char* data = static_cast<const char*>(m_compiler.get_spirv_data());
+        spirv.assign(data, data + m_compiler.get_spirv_size());
+      }
+
+      lock.lock();
+      if(success && job.generation > m_lastGoodGeneration)
+      {
+        m_lastGoodSpirv      = std::move(spirv);
+        m_lastGoodGeneration = job.generation;
+      }
+      m_results.push_back({.generation  = job.generation,
+                           .num_changes = num_changes,
+                           .success     = success,
+                           .stale       = m_generation > job.generation,
+                           .compile_ms  = milliseconds_between(start, end),
+                           .finished    = end});
+      m_busy = false;
+      m_idle.notify_all();
+    }
+  }
+
+  SlangCompilerHelper& m_compiler;
+  const std::string    m_shaderPath;
+  std::string          m_source;  // Only used by the worker thread
+  const timer::duration m_debounce;
+  const bool            m_coalesce;
+
+  mutable std::mutex                  m_mutex;
+  std::condition_variable             m_wake;  // Changes arrived, or stopping
+  std::condition_variable             m_idle;  // A compile finished
+  std::deque<Change>                  m_pending;
+  uint64_t                            m_generation = 0;  // Of the newest change
+  timer::time_point                   m_lastSubmit;
+  bool                                m_busy = false;
+  bool                                m_stop = false;
+  std::vector<ScheduledCompileResult> m_results;
+  std::vector<char>                   m_lastGoodSpirv;
+  uint64_t                            m_lastGoodGeneration = 0;
+  std::thread                         m_worker;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+// The compiler helpers the benchmark knows about, and what it expects of one.
+//
+// Benchmarks are templates on the helper they run, so that the compile loop
+// calls it directly instead of through virtual functions. ShaderCompiler
+// checks that a helper has everything they use, and `Backends` lists the
+// helpers in this build; Backends::for_each() runs a templated function on
+// each one selected on the command line, so that a mode written once works
+// with every compiler.
+
+#ifdef HAS_DXC
+#include "compiler_dxc.h"
+#endif
+#ifdef HAS_SHADERC
+#include "compiler_shaderc.h"
+#endif
+#include "codegen_settings.h"
+#include "compiler_slang.h"
+#include "output_cache.h"
+#include "output_sink.h"
+
+#include <concepts>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+template <class T>
+concept ShaderCompiler = requires(T& compiler, const T& const_compiler, const char* path, const char* source, bool enable_glsl,
+                                  bool track_changes, const CodegenSettings& codegen) {
+  { compiler.init(enable_glsl) } -> std::same_as<bool>;
+  { compiler.compile(path, source) } -> std::same_as<bool>;
+  { const_compiler.get_spirv_data() } -> std::convertible_to<const void*>;
+  { const_compiler.get_spirv_size() } -> std::convertible_to<size_t>;
+  { const_compiler.spirv_output() } -> std::same_as<CompiledOutput>;
+  { compiler.output_cache() } -> std::same_as<OutputCache&>;
+  { const_compiler.codegen() } -> std::convertible_to<CodegenSettings>;
+  { const_compiler.version() } -> std::convertible_to<std::string>;
+  compiler.set_codegen(codegen);
+  compiler.set_track_changes(track_changes);
+  { T::codegen_knobs() } -> std::convertible_to<uint32_t>;
+  { T::name() } -> std::convertible_to<const char*>;
+  { T::extension() } -> std::convertible_to<const char*>;
+};
+
+// A set of backends, selected by a bit mask: bit i selects the i-th compiler.
+template <ShaderCompiler... Compilers>
+struct BackendList
+{
+  static constexpr size_t kCount = sizeof...(Compilers);
+  static_assert(kCount <= 32, "Backend masks are 32 bits");
+
+  // Returns the index of the backend called `name`, or -1 if there isn't one
+  // in this build.
+  static int find(std::string_view name)
+  {
+    for(size_t i = 0; i < kCount; i++)
+    {
+      if(name == BackendList::name(i))
+      {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  }
+
+  static const char* name(size_t index)
+  {
+    const char* const names[] = {Compilers::name()...};
+    return names[index];
+  }
+
+  // Calls `function.template operator()<Compiler>()` for each compiler in
+  // `mask`, in order, and stops at the first that returns false. Returns false
+  // if any did.
+  template <class Function>
+  static bool for_each(uint32_t mask, Function&& function)
+  {
+    uint32_t   index = 0;
+    const auto visit = [&]<class Compiler>() {
+      const bool selected = ((mask >> index++) & 1) != 0;
+      return !selected || function.template operator()<Compiler>();
+    };
+    return (visit.template operator()<Compilers>() && ...);
+  }
+};
+
+// Every backend in this build. Slang is always first, and the default.
+using Backends = BackendList<SlangCompilerHelper
+#ifdef HAS_SHADERC
+                             ,
+                             ShadercGlslCompilerHelper
+#endif
+#ifdef HAS_DXC
+                             ,
+                             DXCompilerHelper
+#endif
+                             >;
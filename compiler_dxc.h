@@ -3,17 +3,37 @@
 
 // DirectXShaderCompiler compilation helper.
 // Based off the example in https://github.com/microsoft/DirectXShaderCompiler/wiki/Using-dxc.exe-and-dxcompiler.dll#using-the-compiler-interface
+//
+// On Windows, this uses ATL's CComPtr; elsewhere, dxcapi.h includes DXC's
+// WinAdapter.h, which provides CComPtr, HRESULT, IUnknown and __uuidof()
+// for libdxcompiler.so. So this sticks to what both have: e.g. S_OK rather
+// than NOERROR, and __uuidof(IUnknown) rather than IID_IUnknown.
 
-// Turns off as many validation settings as possible.
+// If defined, turns off validation by default (-Vd); see set_codegen().
 // #define DXC_HELPER_NO_VALIDATION
 
+#include "codegen_settings.h"
+#include "output_cache.h"
+#include "output_sink.h"
+#include "trace.h"
 #include "utilities.h"
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #include <atlbase.h>
+#endif
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "dxc/dxcapi.h"
 
@@ -21,7 +41,7 @@ bool check_hresult(HRESULT hresult, const char* expression)
 {
   if(FAILED(hresult))
   {
-    fprintf(stderr, "%s failed with HRESULT %lx\n", expression, hresult);
+    fprintf(stderr, "%s failed with HRESULT %x\n", expression, static_cast<uint32_t>(hresult));
     return false;
   }
   return true;
@@ -39,7 +59,7 @@ bool check_hresult(HRESULT hresult, const char* expression)
 class MyDxcBlob : public IDxcBlob
 {
 private:
-  std::vector<char>     m_data;
+  std::string           m_data;
   std::atomic<uint32_t> m_ref_count = 0;
 
   MyDxcBlob() = default;
@@ -51,6 +71,12 @@ private:
     memcpy(m_data.data(), data, size);
   }
 
+  // Takes ownership of the data.
+  explicit MyDxcBlob(std::string&& data)
+      : m_data(std::move(data))
+  {
+  }
+
   virtual ~MyDxcBlob() { assert(m_ref_count == 0); }
 
 public:
@@ -64,11 +90,11 @@ public:
     }
     *ppvObj = nullptr;
 
-    if(IID_IUnknown == riid || __uuidof(IDxcBlob) == riid)
+    if(__uuidof(IUnknown) == riid || __uuidof(IDxcBlob) == riid)
     {
       *ppvObj = this;
       AddRef();
-      return NOERROR;
+      return S_OK;
     }
     return E_NOINTERFACE;
   }
@@ -95,6 +121,9 @@ public:
   {
     return CComPtr<IDxcBlob>(new MyDxcBlob(inData, size));
   }
+
+  // Moves the given data into a new blob without copying it.
+  static CComPtr<IDxcBlob> create(std::string&& data) { return CComPtr<IDxcBlob>(new MyDxcBlob(std::move(data))); }
 };
 
 // Include handler that caches files in memory.
@@ -104,10 +133,43 @@ private:
   std::atomic<ULONG> m_ref_count = 0;
   // Maps [wide string used by DXC, including search path] -> [file content].
   //  and [file that doesn't exist] -> [nullptr]
-  std::unordered_map<std::wstring, CComPtr<IDxcBlob>> m_file_cache;
+  // With set_track_changes(true), each entry is reloaded if its file's stamp
+  // changes, since a server keeps the includer while files are edited;
+  // otherwise, cached files are used without asking the OS.
+  struct CachedFile
+  {
+    CComPtr<IDxcBlob> blob;
+    FileStamp         stamp;  // From before it was read
+    // OutputCache::hash_contents() of `blob`, computed when a cache first
+    // needs it.
+    std::optional<uint64_t> hash;
+  };
+  std::unordered_map<std::wstring, CachedFile> m_file_cache;
+
+  // Hashes std::wstrings and wstring_views the same way.
+  struct WideStringHash
+  {
+    using is_transparent = void;
+    size_t operator()(std::wstring_view str) const { return std::hash<std::wstring_view>()(str); }
+  };
+  // An absolute path in the search path, as a wide string for DXC and a
+  // narrow one for the output cache.
+  struct ResolvedPath
+  {
+    std::wstring wide;
+    std::string  narrow;
+  };
+  // Maps [file name requested by DXC] -> [absolute path in the search path],
+  // so that we don't build std::filesystem::paths and ask the OS for the
+  // working directory on every include.
+  std::unordered_map<std::wstring, ResolvedPath, WideStringHash, std::equal_to<>> m_resolved_paths;
 
   fs::path m_include_path;
 
+  // Files loaded since the last take_included(), in m_resolved_paths.
+  std::vector<const ResolvedPath*> m_included;
+  bool                          m_trackChanges = false;
+
 public:
   MyDXIncluder() = default;
   virtual ~MyDXIncluder() { assert(m_ref_count == 0); }
@@ -122,12 +184,12 @@ public:
     }
     *ppvObj = nullptr;
 
-    if(IID_IUnknown == riid || __uuidof(IDxcIncludeHandler) == riid)
+    if(__uuidof(IUnknown) == riid || __uuidof(IDxcIncludeHandler) == riid)
     {
       // Increment the reference count and return the pointer.
       *ppvObj = this;
       AddRef();
-      return NOERROR;
+      return S_OK;
     }
     return E_NOINTERFACE;
   }
@@ -155,18 +217,29 @@ public:
     *ppIncludeSource = nullptr;
 
     // Construct the search path
-    const std::filesystem::path full_path = fs::absolute(m_include_path / fs::path(pFilename));
-    const std::wstring          filename  = full_path.wstring();
+    auto resolved = m_resolved_paths.find(std::wstring_view(pFilename));
+    if(resolved == m_resolved_paths.end())
+    {
+      const fs::path path = fs::absolute(m_include_path / fs::path(pFilename));
+      resolved            = m_resolved_paths.emplace(pFilename, ResolvedPath{path.wstring(), path.string()}).first;
+    }
+    const std::wstring& filename = resolved->second.wide;
 
-    // Is this file already in the cache?
-    const auto& it = m_file_cache.find(filename);
-    if(it != m_file_cache.end())
+    // Is this file already in the cache, and unchanged?
+    const auto& it     = m_file_cache.find(filename);
+    const bool  cached = (it != m_file_cache.end());
+    FileStamp   stamp;
+    if(!cached || m_trackChanges)
+    {
+      stamp = file_stamp(filename);
+    }
+    if(cached && (!m_trackChanges || it->second.stamp == stamp))
     {
-      IDxcBlob* blob = it->second;
+      IDxcBlob* blob = it->second.blob;
       if(nullptr == blob)
       {
         // We tried to find this before but failed.
-        return MAKE_HRESULT(SEVERITY_ERROR, FACILITY_WIN32, ERROR_FILE_NOT_FOUND);
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
       }
       // Add a reference to it since we're returning it.
       // It should have a reference count of at least 2: one in
@@ -174,31 +247,70 @@ public:
       blob->AddRef();
       assert(blob->AddRef() >= 3 && blob->Release());
       *ppIncludeSource = blob;
-      return NOERROR;
+      m_included.push_back(&resolved->second);
+      return S_OK;
     }
 
-    // Otherwise, try to load it.
+    // Otherwise, try to read it.
     std::optional<std::string> contents = load_file(filename.c_str());
     if(!contents.has_value())
     {
       // Cache that we couldn't find it.
-      m_file_cache[filename] = nullptr;
-      return MAKE_HRESULT(SEVERITY_ERROR, FACILITY_WIN32, ERROR_FILE_NOT_FOUND);
+      m_file_cache[filename] = {nullptr, stamp};
+      return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
     }
 
-    CComPtr<IDxcBlob> blob = MyDxcBlob::create(contents.value().data(), contents.value().size());
+    CComPtr<IDxcBlob> blob = MyDxcBlob::create(std::move(contents.value()));
     // Cache it.
-    m_file_cache[filename] = blob;
+    m_file_cache[filename] = {blob, stamp};
     // blob should have a reference count of 2;
     // one reference is in m_file_cache, and the other reference is the pointer
     // we're returning to the caller.
     assert((*blob).AddRef() == 3 && (*blob).Release());
     *ppIncludeSource = blob.Detach();
-    return NOERROR;
+    // Only files DXC found are dependencies; it probes several search paths.
+    m_included.push_back(&resolved->second);
+    return S_OK;
   }
 
   // Other functions
-  void set_include_path(const fs::path& include_path) { m_include_path = include_path; }
+
+  // Returns the files loaded since the last call, as DXC read them.
+  std::vector<OutputCache::Dependency> take_included()
+  {
+    std::vector<OutputCache::Dependency> included;
+    for(const ResolvedPath* path : m_included)
+    {
+      CachedFile& file = m_file_cache.find(path->wide)->second;
+      if(!file.hash.has_value())
+      {
+        file.hash = OutputCache::hash_contents(
+            std::string_view(static_cast<const char*>(file.blob->GetBufferPointer()), file.blob->GetBufferSize()));
+      }
+      included.push_back({.path       = path->narrow,
+                          .write_time = static_cast<int64_t>(file.stamp.write_time.time_since_epoch().count()),
+                          .size       = static_cast<uint64_t>(file.stamp.size),
+                          .hash       = file.hash.value()});
+    }
+    m_included.clear();
+    return included;
+  }
+
+  // Forgets the files loaded so far, without copying them.
+  void clear_included() { m_included.clear(); }
+
+  // If enabled, each include checks whether its cached file changed.
+  void set_track_changes(bool track_changes) { m_trackChanges = track_changes; }
+
+  void set_include_path(const fs::path& include_path)
+  {
+    if(include_path != m_include_path)
+    {
+      m_include_path = include_path;
+      m_included.clear();  // It points into m_resolved_paths.
+      m_resolved_paths.clear();
+    }
+  }
 };
 
 class DXCompilerHelper
@@ -206,37 +318,96 @@ class DXCompilerHelper
 private:
   // CComPtr<IDxcUtils> m_utils;
   CComPtr<IDxcCompiler3>    m_compiler;
+#ifdef DXC_HELPER_NO_VALIDATION
+  CodegenSettings m_codegen{.validation = false};
+#else
+  CodegenSettings m_codegen;
+#endif
   std::vector<std::wstring> m_arguments;
   CComPtr<IDxcBlob>         m_compiled_shader;
   CComPtr<MyDXIncluder>     m_includer;
+  std::string               m_mainShaderPath;
+  // The DXC version as text, and hashed; see init().
+  std::string               m_version;
+  uint64_t                  m_versionHash = 0;
+  // Hash of the DXC version and m_arguments, for the output cache.
+  uint64_t            m_fingerprint = 0;
+  OutputCache         m_outputCache;
+  OutputCache::Output m_cachedSpirv;  // If the last compile() was a hit
+  OutputCache         m_preprocessCache;
+  PreprocessTimes     m_preprocessTimes;
 
 public:
   bool init(bool /* enable_glsl */)
   {
+    TraceZone zone("init");
     // CHECK_HRESULT(DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&m_utils)));
     CHECK_HRESULT(DxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&m_compiler)));
 
     m_includer = CComPtr<MyDXIncluder>(new MyDXIncluder());
 
-    m_arguments = {
-        L"-fspv-target-env=vulkan1.3",  // Vulkan target
-        L"-T",
-        L"cs_6_8",  // HLSL profile
-        L"-spirv",  // Output SPIR-V
-        L"-Od",     // No optimization
-#ifdef DXC_HELPER_NO_VALIDATION
-        L"-Vd",  // No validation
-#endif
-    };
+    Hasher                   hasher;
+    CComPtr<IDxcVersionInfo> version_info;
+    UINT32                   major = 0, minor = 0;
+    if(SUCCEEDED(m_compiler->QueryInterface(IID_PPV_ARGS(&version_info))) && SUCCEEDED(version_info->GetVersion(&major, &minor)))
+    {
+      hasher.add_int(major).add_int(minor);
+      m_version = std::to_string(major) + "." + std::to_string(minor);
+    }
+    // Minor releases and SDK drops can share a major and minor version, but
+    // not a commit.
+    CComPtr<IDxcVersionInfo2> version_info2;
+    UINT32                    commit_count = 0;
+    char*                     commit_hash  = nullptr;
+    if(SUCCEEDED(m_compiler->QueryInterface(IID_PPV_ARGS(&version_info2)))
+       && SUCCEEDED(version_info2->GetCommitInfo(&commit_count, &commit_hash)))
+    {
+      hasher.add_int(commit_count).add_string(commit_hash ? commit_hash : "");
+      m_version += " (commit " + std::to_string(commit_count) + " " + (commit_hash ? commit_hash : "") + ")";
+      CoTaskMemFree(commit_hash);
+    }
+    m_versionHash = hasher.get();
 
+    buildArguments();
     return true;
   }
 
   bool compile(const char* mainShaderPath, const char* source)
   {
-    m_includer->set_include_path(std::filesystem::path(mainShaderPath).parent_path());
+    TraceZone zone("compile");
+    if(m_mainShaderPath != mainShaderPath)
+    {
+      m_mainShaderPath = mainShaderPath;
+      m_includer->set_include_path(std::filesystem::path(mainShaderPath).parent_path());
+    }
 
-    DxcBuffer dxc_source{.Ptr = source, .Size = strlen(source), .Encoding = DXC_CP_UTF8};
+    m_cachedSpirv       = nullptr;
+    uint64_t output_key = 0;
+    if(m_outputCache.enabled())
+    {
+      output_key    = OutputCache::make_key(m_fingerprint, mainShaderPath, source);
+      m_cachedSpirv = m_outputCache.find(output_key);
+      if(m_cachedSpirv)
+      {
+        return true;
+      }
+    }
+    m_includer->clear_included();
+    m_preprocessTimes = {};
+    // Files the output depends on, for the output cache.
+    std::vector<OutputCache::Dependency> included;
+
+    DxcBuffer           dxc_source{.Ptr = source, .Size = strlen(source), .Encoding = DXC_CP_UTF8};
+    OutputCache::Output preprocessed;
+    if(m_preprocessCache.enabled())
+    {
+      if(!preprocess(mainShaderPath, dxc_source, preprocessed, included))
+      {
+        return false;
+      }
+      dxc_source.Ptr  = preprocessed->data();
+      dxc_source.Size = preprocessed->size();
+    }
 
     // Convert arguments in a vector of pointers.
     std::vector<const wchar_t*> m_argumentPointers(m_arguments.size());
@@ -245,12 +416,14 @@ public:
       m_argumentPointers[i] = m_arguments[i].c_str();
     }
 
-    CComPtr<IDxcResult> results;
+    CComPtr<IDxcResult>     results;
+    const timer::time_point compile_start = timer::now();
     check_hresult(m_compiler->Compile(&dxc_source,  // Source buffer
                                       m_argumentPointers.data(), static_cast<UINT32>(m_argumentPointers.size()),  // Arguments
                                       m_includer,  // Include handler
                                       IID_PPV_ARGS(&results)),
                   "m_compiler->Compile(...)");
+    m_preprocessTimes.compile_ms = milliseconds_between(compile_start, timer::now());
 
     if(!results)
     {
@@ -274,13 +447,147 @@ public:
     CComPtr<IDxcBlob> compiled_shader;
     CHECK_HRESULT(results->GetOutput(DXC_OUT_OBJECT, IID_PPV_ARGS(&compiled_shader), nullptr));
     m_compiled_shader = compiled_shader;
+
+    if(m_outputCache.enabled())
+    {
+      if(!m_preprocessCache.enabled())
+      {
+        included = m_includer->take_included();
+      }
+      m_outputCache.store(output_key, std::move(included), m_compiled_shader->GetBufferPointer(), m_compiled_shader->GetBufferSize());
+    }
     return true;
   }
 
-  const void* get_spirv_data() const { return m_compiled_shader->GetBufferPointer(); }
-  size_t      get_spirv_size() const { return m_compiled_shader->GetBufferSize(); }
+  const void* get_spirv_data() const { return m_cachedSpirv ? m_cachedSpirv->data() : m_compiled_shader->GetBufferPointer(); }
+  size_t get_spirv_size() const { return m_cachedSpirv ? m_cachedSpirv->size() : m_compiled_shader->GetBufferSize(); }
+
+  // The last compile()'s SPIR-V, sharing ownership instead of copying it.
+  CompiledOutput spirv_output() const
+  {
+    if(m_cachedSpirv)
+    {
+      return CompiledOutput::share(m_cachedSpirv, m_cachedSpirv->data(), m_cachedSpirv->size());
+    }
+    return CompiledOutput::share(std::make_shared<CComPtr<IDxcBlob>>(m_compiled_shader),
+                                 m_compiled_shader->GetBufferPointer(), m_compiled_shader->GetBufferSize());
+  }
+
+  // The cache in front of compile(); it's disabled by default.
+  OutputCache& output_cache() { return m_outputCache; }
+
+  // The cache of preprocessed sources in compile(); it's disabled by default.
+  // When it's enabled, compile() preprocesses the source with -P only if it
+  // or its includes changed, and compiles the flattened source.
+  OutputCache&           preprocess_cache() { return m_preprocessCache; }
+  const PreprocessTimes& preprocess_times() const { return m_preprocessTimes; }
+
+  // If enabled, each compile checks whether included files changed (for a
+  // server, which keeps the helper while files are edited). Otherwise, we
+  // assume files are constant, and cached includes cost no file system calls.
+  void set_track_changes(bool track_changes) { m_includer->set_track_changes(track_changes); }
+
+  // Code generation settings. Optimization level 0 is -Od, and 1 to 3 are -O1
+  // to -O3. Debug info level 1 is -Zi, which emits OpLine and OpSource; 2 and
+  // 3 add -fspv-debug=vulkan-with-source, which emits
+  // NonSemantic.Shader.DebugInfo.100 for debuggers. There's no
+  // EmitSpirvDirectly.
+  const CodegenSettings& codegen() const { return m_codegen; }
+  void                   set_codegen(const CodegenSettings& codegen)
+  {
+    m_codegen = codegen;
+    if(m_compiler)
+    {
+      buildArguments();
+    }
+  }
+  static uint32_t codegen_knobs() { return kCodegenOptimization | kCodegenDebugInfo | kCodegenValidation; }
+
+  // Identifies the DXC build (its version and commit), e.g. for comparing
+  // results between versions.
+  const std::string& version() const { return m_version; }
 
   static const char* name() { return "dxc"; }
+  // The extension of the shaders this helper compiles, e.g. for --dir.
+  static const char* extension() { return ".hlsl"; }
+
+private:
+  // Sets m_arguments from m_codegen, and m_fingerprint from them.
+  void buildArguments()
+  {
+    m_arguments = {
+        L"-fspv-target-env=vulkan1.3",  // Vulkan target
+        L"-T",
+        L"cs_6_8",  // HLSL profile
+        L"-spirv",  // Output SPIR-V
+    };
+    static const wchar_t* optimization_levels[] = {L"-Od", L"-O1", L"-O2", L"-O3"};
+    m_arguments.push_back(optimization_levels[std::clamp(m_codegen.optimization, 0, 3)]);
+    if(m_codegen.debug_info > 0)
+    {
+      m_arguments.push_back(L"-Zi");
+    }
+    if(m_codegen.debug_info > 1)
+    {
+      m_arguments.push_back(L"-fspv-debug=vulkan-with-source");
+    }
+    if(!m_codegen.validation)
+    {
+      m_arguments.push_back(L"-Vd");  // No validation
+    }
+
+    Hasher hasher;
+    hasher.add_int(m_versionHash);
+    for(const std::wstring& argument : m_arguments)
+    {
+      hasher.add_bytes(argument.data(), argument.size() * sizeof(wchar_t)).add_int(0);
+    }
+    m_fingerprint = hasher.get();
+  }
+
+  // Sets `preprocessed` to `source` with its includes flattened, and appends
+  // the files it includes to `included`. Returns false on failure.
+  bool preprocess(const char* mainShaderPath, const DxcBuffer& source, OutputCache::Output& preprocessed, std::vector<OutputCache::Dependency>& included)
+  {
+    const std::string_view source_view(static_cast<const char*>(source.Ptr), source.Size);
+    const uint64_t key = OutputCache::make_key(Hasher().add_int(m_fingerprint).add_string("preprocess").get(), mainShaderPath, source_view);
+    preprocessed       = m_preprocessCache.find(key, &included);
+    if(preprocessed)
+    {
+      return true;
+    }
+
+    TraceZone zone("preprocess");
+    // -P writes the preprocessed source to DXC_OUT_HLSL instead of compiling.
+    std::vector<const wchar_t*> arguments;
+    for(const std::wstring& argument : m_arguments)
+    {
+      arguments.push_back(argument.c_str());
+    }
+    arguments.push_back(L"-P");
+
+    const timer::time_point start = timer::now();
+    CComPtr<IDxcResult>     results;
+    CHECK_HRESULT(m_compiler->Compile(&source, arguments.data(), static_cast<UINT32>(arguments.size()), m_includer, IID_PPV_ARGS(&results)));
+    HRESULT preprocess_hresult{};
+    CHECK_HRESULT(results->GetStatus(&preprocess_hresult));
+    if(FAILED(preprocess_hresult))
+    {
+      CComPtr<IDxcBlobUtf8> diagnostics;
+      if(SUCCEEDED(results->GetOutput(DXC_OUT_ERRORS, IID_PPV_ARGS(&diagnostics), nullptr)) && diagnostics)
+      {
+        fprintf(stderr, "DXC preprocessing failed: %s\n", diagnostics->GetStringPointer());
+      }
+      return false;
+    }
+    CComPtr<IDxcBlobUtf8> flattened;
+    CHECK_HRESULT(results->GetOutput(DXC_OUT_HLSL, IID_PPV_ARGS(&flattened), nullptr));
+    m_preprocessTimes.preprocess_ms = milliseconds_between(start, timer::now());
+
+    included     = m_includer->take_included();
+    preprocessed = m_preprocessCache.store(key, included, flattened->GetStringPointer(), flattened->GetStringLength());
+    return true;
+  }
 };
 
 #endif  // #ifdef HAS_DXC
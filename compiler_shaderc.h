@@ -3,14 +3,23 @@
 
 // ShaderC compilation helper.
 
+#include "arena.h"
+#include "codegen_settings.h"
+#include "output_cache.h"
+#include "output_sink.h"
+#include "process.h"
+#include "trace.h"
 #include "utilities.h"
 
 #include <shaderc/shaderc.hpp>
 
+#include <memory>
 #include <optional>
 #include <stddef.h>
+#include <string.h>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 // This implements the ShaderC includer interface.
 // ShaderC can't cache compilation results. But we can at least store files in
@@ -19,53 +28,121 @@
 class GlslIncluder : public shaderc::CompileOptions::IncluderInterface
 {
 private:
-  std::unordered_map<std::string, std::string> m_fileCache;
+  // Files are read once, and include results share the buffers, so that we
+  // never copy their contents again. (We don't map them: an editor can
+  // truncate a file in place, which makes reading its mapping fault.) With
+  // set_track_changes(true), each is reread if its stamp changes, since a
+  // server keeps the includer while files are edited; otherwise, cached files
+  // are used without asking the OS.
+  struct CachedFile
+  {
+    std::shared_ptr<const std::string> contents;
+    FileStamp                          stamp;  // From before it was read
+    // OutputCache::hash_contents() of `contents`, computed when a cache first
+    // needs it.
+    std::optional<uint64_t> hash;
+  };
+  PathMap<CachedFile> m_fileCache;
+  // Absolute include paths, by requesting and requested source; see
+  // clear_included().
+  PathInterner m_includePaths;
+  // clear_included() starts m_includePaths over once it's larger than this.
+  static constexpr size_t kMaxIncludePathBytes = 1024 * 1024;
+  // Files included since the last take_included(), in m_includePaths.
+  std::vector<std::string_view> m_included;
+  bool                          m_trackChanges = false;
 
 public:
   GlslIncluder() {}
 
+  // If enabled, each include checks whether its cached file changed.
+  void set_track_changes(bool track_changes) { m_trackChanges = track_changes; }
+
   // Subtype of shaderc_include_result that holds the include data we found.
   struct IncludeResult : public shaderc_include_result
   {
-    IncludeResult(const std::string& content, const std::string& filenameFound)
+    // `filenameFound` must outlive the result; it's in m_includePaths.
+    IncludeResult(std::shared_ptr<const std::string> content, std::string_view filenameFound)
         : m_filenameFound(filenameFound)
-        , m_content(content)
+        , m_content(std::move(content))
     {
-      this->source_name        = m_filenameFound.c_str();
+      this->source_name        = m_filenameFound.data();
       this->source_name_length = m_filenameFound.size();
-      this->content            = m_content.c_str();
-      this->content_length     = m_content.size();
+      this->content            = m_content->data();
+      this->content_length     = m_content->size();
       this->user_data          = nullptr;
     }
 
-    const std::string m_filenameFound;
-    const std::string m_content;
+    const std::string_view                   m_filenameFound;
+    const std::shared_ptr<const std::string> m_content;
   };
 
   void ReleaseInclude(shaderc_include_result* data) override { delete static_cast<IncludeResult*>(data); };
 
+  // Returns the files included since the last call, as the compiler read
+  // them.
+  std::vector<OutputCache::Dependency> take_included()
+  {
+    std::vector<OutputCache::Dependency> included;
+    for(const std::string_view path : m_included)
+    {
+      CachedFile& file = m_fileCache.find(path)->second;
+      if(!file.hash.has_value())
+      {
+        file.hash = OutputCache::hash_contents(*file.contents);
+      }
+      included.push_back({.path       = std::string(path),
+                          .write_time = static_cast<int64_t>(file.stamp.write_time.time_since_epoch().count()),
+                          .size       = static_cast<uint64_t>(file.stamp.size),
+                          .hash       = file.hash.value()});
+    }
+    m_included.clear();
+    return included;
+  }
+
+  // Forgets the files included so far, without copying them. This is done
+  // between compiles, so it also bounds the interned include paths, which
+  // would otherwise keep growing while watching or serving.
+  void clear_included()
+  {
+    m_included.clear();
+    m_includePaths.trim(kMaxIncludePathBytes);
+  }
+
   shaderc_include_result* GetInclude(const char* requested_source, shaderc_include_type type, const char* requesting_source, size_t include_depth) override
   {
     // For this simple benchmark, we only support relative includes -- i.e.
     // we don't look at `type`.
-    const fs::path    search_path     = fs::absolute(fs::path(requesting_source).parent_path() / requested_source);
-    const std::string search_path_str = search_path.string();
+    // fs::absolute() asks the OS for the working directory, so only do this
+    // once per include. Interned paths are null-terminated.
+    const std::string_view search_path_str = m_includePaths.get(requesting_source, requested_source, [](std::string_view from, std::string_view to) {
+      return fs::absolute(fs::path(from).parent_path() / fs::path(to)).string();
+    });
 
     const auto& find_result = m_fileCache.find(search_path_str);
-    if(find_result != m_fileCache.end())
+    const bool  cached      = (find_result != m_fileCache.end());
+    FileStamp   stamp;
+    if(!cached || m_trackChanges)
     {
-      return new IncludeResult(find_result->second, search_path_str);
+      stamp = file_stamp(search_path_str);
+    }
+    if(cached && (!m_trackChanges || find_result->second.stamp == stamp))
+    {
+      m_included.push_back(search_path_str);
+      return new IncludeResult(find_result->second.contents, search_path_str);
     }
 
-    std::optional<std::string> src_code = load_file(search_path_str.c_str());
-    if(!src_code.has_value())
+    std::optional<std::string> loaded = load_file(search_path_str.data());
+    if(!loaded.has_value())
     {
       printf("Could not find include for %s relative to %s!\n", requested_source, requesting_source);
       exit(EXIT_FAILURE);
     }
+    const std::shared_ptr<const std::string> src_code = std::make_shared<const std::string>(std::move(loaded.value()));
 
-    m_fileCache[search_path_str] = src_code.value();
-    return new IncludeResult(src_code.value(), search_path_str);
+    m_fileCache[search_path_str] = {src_code, stamp};
+    m_included.push_back(search_path_str);
+    return new IncludeResult(src_code, search_path_str);
   }
 };
 
@@ -74,34 +151,198 @@ class ShadercGlslCompilerHelper : public shaderc::Compiler
 public:
   bool init(bool /* enable_glsl */)
   {
-    m_compilerOptions.SetTargetSpirv(shaderc_spirv_version::shaderc_spirv_version_1_6);
-    m_compilerOptions.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_4);
-    m_compilerOptions.SetOptimizationLevel(shaderc_optimization_level_zero);
-    m_compilerOptions.SetIncluder(std::make_unique<GlslIncluder>());
+    TraceZone zone("init");
+    // shaderc has no version query (shaderc_get_spv_version() is the SPIR-V
+    // version), so cached outputs are tied to the library file instead: a new
+    // shaderc build has a different path, size or timestamp.
+    const std::string library = module_path_containing(reinterpret_cast<const void*>(&shaderc_compiler_initialize));
+    const FileStamp   stamp   = file_stamp(library);
+    m_libraryHash = Hasher().add_string(library).add_int(stamp.size).add_int(stamp.write_time.time_since_epoch().count()).get();
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016llx", static_cast<unsigned long long>(m_libraryHash));
+    m_version = library + " (" + hash_str + ")";
+    buildOptions();
     return true;
   }
 
   bool compile(const char* mainShaderPath, const char* source)
   {
-    m_compileResult = CompileGlslToSpv(source, shaderc_shader_kind::shaderc_compute_shader, mainShaderPath, m_compilerOptions);
-    if(shaderc_compilation_status_success != m_compileResult.GetCompilationStatus())
+    TraceZone zone("compile");
+    m_cachedSpirv       = nullptr;
+    uint64_t output_key = 0;
+    if(m_outputCache.enabled())
+    {
+      output_key    = OutputCache::make_key(fingerprint(), mainShaderPath, source);
+      m_cachedSpirv = m_outputCache.find(output_key);
+      if(m_cachedSpirv)
+      {
+        return true;
+      }
+    }
+
+    m_includer->clear_included();
+    m_preprocessTimes = {};
+    // Files the output depends on, for the output cache.
+    std::vector<OutputCache::Dependency> included;
+    const char*                          compile_source      = source;
+    size_t                               compile_source_size = strlen(source);
+    OutputCache::Output      preprocessed;
+    if(m_preprocessCache.enabled())
     {
-      const std::string message = m_compileResult.GetErrorMessage();
+      if(!preprocess(mainShaderPath, source, preprocessed, included))
+      {
+        return false;
+      }
+      compile_source      = preprocessed->data();
+      compile_source_size = preprocessed->size();
+    }
+
+    // Results are shared with spirv_output()s, so each compile gets a new one.
+    const timer::time_point compile_start = timer::now();
+    m_compileResult = std::make_shared<shaderc::SpvCompilationResult>(CompileGlslToSpv(
+        compile_source, compile_source_size, shaderc_shader_kind::shaderc_compute_shader, mainShaderPath, *m_compilerOptions));
+    m_preprocessTimes.compile_ms = milliseconds_between(compile_start, timer::now());
+    if(shaderc_compilation_status_success != m_compileResult->GetCompilationStatus())
+    {
+      const std::string message = m_compileResult->GetErrorMessage();
       fprintf(stderr, "Shaderc compilation failed: %s\n", message.c_str());
       return false;
     }
 
+    if(m_outputCache.enabled())
+    {
+      if(!m_preprocessCache.enabled())
+      {
+        included = m_includer->take_included();
+      }
+      m_outputCache.store(output_key, std::move(included), get_spirv_data(), get_spirv_size());
+    }
     return true;
   }
 
-  const void* get_spirv_data() const { return m_compileResult.begin(); }
-  size_t      get_spirv_size() const { return (m_compileResult.end() - m_compileResult.begin()) * sizeof(uint32_t); }
+  const void* get_spirv_data() const { return m_cachedSpirv ? m_cachedSpirv->data() : static_cast<const void*>(m_compileResult->begin()); }
+  size_t      get_spirv_size() const
+  {
+    return m_cachedSpirv ? m_cachedSpirv->size() : (m_compileResult->end() - m_compileResult->begin()) * sizeof(uint32_t);
+  }
+
+  // The last compile()'s SPIR-V, sharing ownership instead of copying it.
+  CompiledOutput spirv_output() const
+  {
+    if(m_cachedSpirv)
+    {
+      return CompiledOutput::share(m_cachedSpirv, m_cachedSpirv->data(), m_cachedSpirv->size());
+    }
+    return CompiledOutput::share(m_compileResult, get_spirv_data(), get_spirv_size());
+  }
+
+  // The cache in front of compile(); it's disabled by default.
+  OutputCache& output_cache() { return m_outputCache; }
+
+  // The cache of preprocessed sources in compile(); it's disabled by default.
+  // When it's enabled, compile() preprocesses the source with PreprocessGlsl()
+  // only if it or its includes changed, and compiles the flattened source.
+  OutputCache&           preprocess_cache() { return m_preprocessCache; }
+  const PreprocessTimes& preprocess_times() const { return m_preprocessTimes; }
+
+  // If enabled, each compile checks whether included files changed (for a
+  // server, which keeps the helper while files are edited). Otherwise, we
+  // assume files are constant, and cached includes cost no file system calls.
+  void set_track_changes(bool track_changes)
+  {
+    m_trackChanges = track_changes;
+    m_includer->set_track_changes(track_changes);
+  }
+
+  // Code generation settings. shaderc's optimization levels are zero, size
+  // and performance, so 1 means size and 2 and 3 mean performance; any debug
+  // info level generates the same debug info. glslang's SPIR-V validation
+  // can't be turned off, and there's no EmitSpirvDirectly.
+  const CodegenSettings& codegen() const { return m_codegen; }
+  void                   set_codegen(const CodegenSettings& codegen)
+  {
+    m_codegen = codegen;
+    buildOptions();
+  }
+  static uint32_t codegen_knobs() { return kCodegenOptimization | kCodegenDebugInfo; }
+
+  // Identifies the shaderc build by its library's path and hash (see init()),
+  // e.g. for comparing results between versions.
+  const std::string& version() const { return m_version; }
 
   static const char* name() { return "shaderc"; }
+  // The extension of the shaders this helper compiles, e.g. for --dir.
+  static const char* extension() { return ".glsl"; }
 
 private:
-  shaderc::CompileOptions       m_compilerOptions;
-  shaderc::SpvCompilationResult m_compileResult;
+  // Sets up m_compilerOptions from m_codegen. Debug info can't be turned off
+  // once it's on, so this starts from new options, with a new includer.
+  void buildOptions()
+  {
+    // CompileOptions can't be assigned, so this constructs new ones in place.
+    m_compilerOptions.emplace();
+    m_compilerOptions->SetTargetSpirv(shaderc_spirv_version::shaderc_spirv_version_1_6);
+    m_compilerOptions->SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_4);
+    m_compilerOptions->SetOptimizationLevel(m_codegen.optimization <= 0 ? shaderc_optimization_level_zero :
+                                           m_codegen.optimization == 1 ? shaderc_optimization_level_size :
+                                                                         shaderc_optimization_level_performance);
+    if(m_codegen.debug_info > 0)
+    {
+      m_compilerOptions->SetGenerateDebugInfo();
+    }
+    std::unique_ptr<GlslIncluder> includer = std::make_unique<GlslIncluder>();
+    includer->set_track_changes(m_trackChanges);
+    m_includer                             = includer.get();
+    m_compilerOptions->SetIncluder(std::move(includer));
+  }
+
+  // Sets `preprocessed` to `source` with its includes flattened, and appends
+  // the files it includes to `included`. Returns false on failure.
+  bool preprocess(const char* mainShaderPath, const char* source, OutputCache::Output& preprocessed, std::vector<OutputCache::Dependency>& included)
+  {
+    const uint64_t key = OutputCache::make_key(Hasher().add_int(fingerprint()).add_string("preprocess").get(), mainShaderPath, source);
+    preprocessed       = m_preprocessCache.find(key, &included);
+    if(preprocessed)
+    {
+      return true;
+    }
+
+    TraceZone               zone("preprocess");
+    const timer::time_point start = timer::now();
+    const shaderc::PreprocessedSourceCompilationResult result =
+        PreprocessGlsl(source, shaderc_shader_kind::shaderc_compute_shader, mainShaderPath, *m_compilerOptions);
+    m_preprocessTimes.preprocess_ms = milliseconds_between(start, timer::now());
+    if(shaderc_compilation_status_success != result.GetCompilationStatus())
+    {
+      const std::string message = result.GetErrorMessage();
+      fprintf(stderr, "Shaderc preprocessing failed: %s\n", message.c_str());
+      return false;
+    }
+
+    included = m_includer->take_included();
+    preprocessed = m_preprocessCache.store(key, included, result.begin(), static_cast<size_t>(result.end() - result.begin()));
+    return true;
+  }
+
+  // Hashes the shaderc library and the options set in buildOptions().
+  uint64_t fingerprint() const
+  {
+    Hasher hasher;
+    hasher.add_string(name()).add_int(m_libraryHash).add_string("spv1.6 vulkan1.4 comp");
+    return m_codegen.hash(hasher).get();
+  }
+
+  CodegenSettings                                m_codegen;
+  uint64_t                                       m_libraryHash = 0;  // See init()
+  std::string                                    m_version;
+  std::optional<shaderc::CompileOptions>         m_compilerOptions;  // Set by buildOptions()
+  std::shared_ptr<shaderc::SpvCompilationResult> m_compileResult;
+  GlslIncluder*                                  m_includer = nullptr;  // Owned by m_compilerOptions
+  bool                                           m_trackChanges = false;
+  OutputCache                                    m_outputCache;
+  OutputCache::Output                            m_cachedSpirv;  // If the last compile() was a hit
+  OutputCache                                    m_preprocessCache;
+  PreprocessTimes                                m_preprocessTimes;
 };
 
 #endif  // HAS_SHADERC
\ No newline at end of file
@@ -3,9 +3,12 @@
 // Compiler helper for Slang. Compiles a shader in memory to SPIR-V; optionally,
 // tries to cache modules as much as it can.
 
-// The following options can be used to configure the helper:
+// The following options can be used to configure the helper. Each one sets
+// the default for the corresponding SlangHelperSettings member; they can also
+// be changed at run time with `SlangCompilerHelper::set_settings()`, which is
+// how `--ab` compares them.
 
-// If defined, makes the Slang compiler helper use a module cache.
+// If defined, makes the Slang compiler helper use a module cache by default.
 //
 // Specifically, the first time the Slang compiler tries to load a Slang module,
 // the compiler helper will load the corresponding .slang file, start another
@@ -19,54 +22,224 @@
 // calls by Slang to load .slang-module files.
 #define USE_MODULE_CACHE
 
-// If defined, makes the Slang compiler helper implement IFilesystemEXT instead
-// of only IFilesystem. This makes it so that Slang doesn't try to wrap it in
-// its own file cache, but also means that the implementation's more complex.
-// This might not be statistically significant; p = 0.14 across 4 runs
-// with and without it.
+// The module cache can also be backed by a directory on disk (see
+// `SlangCompilerHelper::set_disk_cache_directory()`), so that serialized modules
+// survive across processes. Entries are keyed by a hash of the module's path
+// and source, the compiler options and targets, and the Slang build, and are
+// memory-mapped when loaded instead of being recompiled.
+//
+// While it compiles modules, the helper records which files each module
+// loaded, building a dependency graph. With
+// `SlangCompilerHelper::set_track_changes(true)`, this lets it invalidate only
+// the modules that changed or that transitively import something that changed.
+
+// If defined, makes the Slang compiler helper's file system expose
+// IFilesystemEXT instead of only IFilesystem by default. This makes it so that
+// Slang doesn't try to wrap it in its own file cache, but also means that the
+// implementation's more complex. This only matters with the module cache.
+// This might not be statistically significant; use
+// `--ab filesystem-ext` to measure it.
 // #define IMPLEMENT_FILESYSTEMEXT
 
-// Turns off as many validation settings as possible.
+// Turns off as many validation settings as possible by default.
 #define SLANG_HELPER_NO_VALIDATION
 
+#include "arena.h"
+#include "codegen_settings.h"
+#include "cpu_control.h"
+#include "disk_cache.h"
+#include "mapped_file.h"
+#include "output_cache.h"
+#include "output_sink.h"
+#include "shader_archive.h"
+#include "trace.h"
 #include "utilities.h"
 
 #include <slang-com-helper.h>
 #include <slang-com-ptr.h>
 #include <slang.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <ctype.h>
+#include <deque>
 #include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
-#ifdef USE_MODULE_CACHE
 // A simple blob that owns its raw data.
 // Based on slang-blob.h.
+// With SlangHelperSettings::arena_glue, the data is stored right after the
+// blob in the same allocation; otherwise, it's in a separate std::vector.
 class MyRawBlob : public ISlangBlob
 {
 private:
-  std::vector<char> m_data;
+  std::vector<char> m_data;  // Unless m_inline
+  size_t            m_size     = 0;
   uint32_t          m_refCount = 0;
-
-  MyRawBlob() = default;
+  bool              m_inline   = false;
 
   // Copies the input.
-  MyRawBlob(const void* data, size_t size)
+  MyRawBlob(const void* data, size_t size, bool inline_data)
+      : m_size(size)
+      , m_inline(inline_data)
   {
-    m_data.resize(size);
-    memcpy(m_data.data(), data, size);
+    if(!m_inline)
+    {
+      m_data.resize(size);
+    }
+    memcpy(bufferData(), data, size);
   }
 
+  char* bufferData() { return m_inline ? reinterpret_cast<char*>(this + 1) : m_data.data(); }
+
   virtual ~MyRawBlob()
   {
     // printf("deleting a raw blob at %p\n", this);
     assert(m_refCount == 0);
   }
 
+public:
+  SLANG_REF_OBJECT_IUNKNOWN_ALL
+
+  uint32_t addReference() { return ++m_refCount; }
+  uint32_t releaseReference()
+  {
+    assert(m_refCount != 0);
+    if(--m_refCount == 0)
+    {
+      if(m_inline)
+      {
+        this->~MyRawBlob();
+        ::operator delete(static_cast<void*>(this));
+      }
+      else
+      {
+        delete this;
+      }
+      return 0;
+    }
+    return m_refCount;
+  }
+
+  ISlangUnknown* getInterface(const Slang::Guid& guid)
+  {
+    if(guid == ISlangUnknown::getTypeGuid() || guid == ISlangBlob::getTypeGuid())
+    {
+      return static_cast<ISlangBlob*>(this);
+    }
+    return nullptr;
+  }
+
+  virtual SLANG_NO_THROW void const* SLANG_MCALL getBufferPointer() override { return bufferData(); };
+  virtual SLANG_NO_THROW size_t SLANG_MCALL      getBufferSize() override { return m_size; }
+
+  // Copies the given data into a new blob; if `arena_glue`, in the same
+  // allocation as the blob.
+  static Slang::ComPtr<ISlangBlob> create(const void* inData, size_t size, bool arena_glue)
+  {
+    if(arena_glue)
+    {
+      void* memory = ::operator new(sizeof(MyRawBlob) + size);
+      return Slang::ComPtr<ISlangBlob>(new(memory) MyRawBlob(inData, size, true));
+    }
+    return Slang::ComPtr<ISlangBlob>(new MyRawBlob(inData, size, false));
+  }
+};
+
+// A blob that owns a read-only file mapping; used for modules loaded from the
+// disk cache, which are renamed into place rather than rewritten, so that we
+// don't have to copy them.
+class MyMappedBlob : public ISlangBlob
+{
+private:
+  MappedFile m_file;
+  size_t     m_size     = 0;
+  uint32_t   m_refCount = 0;
+
+  MyMappedBlob(MappedFile&& file, size_t size)
+      : m_file(std::move(file))
+      , m_size(size)
+  {
+    assert(m_size <= m_file.size());
+  }
+
+  virtual ~MyMappedBlob() { assert(m_refCount == 0); }
+
+public:
+  SLANG_REF_OBJECT_IUNKNOWN_ALL
+
+  uint32_t addReference() { return ++m_refCount; }
+  uint32_t releaseReference()
+  {
+    assert(m_refCount != 0);
+    if(--m_refCount == 0)
+    {
+      delete this;
+      return 0;
+    }
+    return m_refCount;
+  }
+
+  ISlangUnknown* getInterface(const Slang::Guid& guid)
+  {
+    if(guid == ISlangUnknown::getTypeGuid() || guid == ISlangBlob::getTypeGuid())
+    {
+      return static_cast<ISlangBlob*>(this);
+    }
+    return nullptr;
+  }
+
+  virtual SLANG_NO_THROW void const* SLANG_MCALL getBufferPointer() override { return m_file.data(); };
+  virtual SLANG_NO_THROW size_t SLANG_MCALL      getBufferSize() override { return m_size; }
+
+  // Takes ownership of the mapping; the blob contains its first `size` bytes.
+  static Slang::ComPtr<ISlangBlob> create(MappedFile&& file, size_t size)
+  {
+    return Slang::ComPtr<ISlangBlob>(new MyMappedBlob(std::move(file), size));
+  }
+
+  // Takes ownership of the mapping; the blob contains the whole file.
+  static Slang::ComPtr<ISlangBlob> create(MappedFile&& file)
+  {
+    const size_t size = file.size();
+    return create(std::move(file), size);
+  }
+};
+
+// A blob that points into memory kept alive by a shared_ptr; used for modules
+// served from a shader archive, which share the archive's mapping, and for
+// source files, which are read once into a string the blob then owns.
+class MySharedBlob : public ISlangBlob
+{
+private:
+  std::shared_ptr<const void> m_owner;
+  const void*                 m_data     = nullptr;
+  size_t                      m_size     = 0;
+  uint32_t                    m_refCount = 0;
+
+  MySharedBlob(std::shared_ptr<const void> owner, const void* data, size_t size)
+      : m_owner(std::move(owner))
+      , m_data(data)
+      , m_size(size)
+  {
+  }
+
+  virtual ~MySharedBlob() { assert(m_refCount == 0); }
+
 public:
   SLANG_REF_OBJECT_IUNKNOWN_ALL
 
@@ -82,132 +255,1545 @@ public:
     return m_refCount;
   }
 
-  ISlangUnknown* getInterface(const Slang::Guid& guid)
+  ISlangUnknown* getInterface(const Slang::Guid& guid)
+  {
+    if(guid == ISlangUnknown::getTypeGuid() || guid == ISlangBlob::getTypeGuid())
+    {
+      return static_cast<ISlangBlob*>(this);
+    }
+    return nullptr;
+  }
+
+  virtual SLANG_NO_THROW void const* SLANG_MCALL getBufferPointer() override { return m_data; };
+  virtual SLANG_NO_THROW size_t SLANG_MCALL      getBufferSize() override { return m_size; }
+
+  static Slang::ComPtr<ISlangBlob> create(std::shared_ptr<const void> owner, const void* data, size_t size)
+  {
+    return Slang::ComPtr<ISlangBlob>(new MySharedBlob(std::move(owner), data, size));
+  }
+
+  // Takes ownership of `contents` without copying it.
+  static Slang::ComPtr<ISlangBlob> create(std::string&& contents)
+  {
+    std::shared_ptr<const std::string> owner = std::make_shared<const std::string>(std::move(contents));
+    const void*                        data  = owner->data();
+    const size_t                       size  = owner->size();
+    return create(std::move(owner), data, size);
+  }
+};
+
+// Finds the modules that Slang source code imports, and returns their paths
+// relative to the search path (e.g. `import foo.bar;` -> "foo/bar.slang").
+// This only understands plain `import` declarations and doesn't run the
+// preprocessor, so it can both miss imports and find ones in disabled #if
+// blocks; treat the result as a hint.
+inline std::vector<std::string> find_slang_imports(std::string_view source)
+{
+  std::vector<std::string> imports;
+  // The path of the import declaration we're in the middle of, if any.
+  std::optional<std::string> current;
+  bool                       expect_name = false;
+
+  size_t i = 0;
+  while(i < source.size())
+  {
+    const char c = source[i];
+    if(isspace(static_cast<unsigned char>(c)))
+    {
+      i++;
+    }
+    else if(source.substr(i, 2) == "//")
+    {
+      i = source.find('\n', i);
+      i = (i == source.npos) ? source.size() : i;
+    }
+    else if(source.substr(i, 2) == "/*")
+    {
+      i = source.find("*/", i + 2);
+      i = (i == source.npos) ? source.size() : i + 2;
+    }
+    else if(c == '"')
+    {
+      const size_t end = std::min(source.find('"', i + 1), source.size());
+      if(current.has_value() && expect_name && current->empty())
+      {
+        current = std::string(source.substr(i + 1, end - i - 1));
+      }
+      else
+      {
+        current.reset();
+      }
+      expect_name = false;
+      i           = end + 1;
+    }
+    else if(isalnum(static_cast<unsigned char>(c)) || c == '_')
+    {
+      const size_t start = i;
+      while(i < source.size() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_'))
+      {
+        i++;
+      }
+      const std::string_view word = source.substr(start, i - start);
+      if(current.has_value() && expect_name)
+      {
+        current->append(word);
+        expect_name = false;
+      }
+      else if(word == "import" || word == "__import")
+      {
+        current     = std::string();
+        expect_name = true;
+      }
+      else
+      {
+        current.reset();
+      }
+    }
+    else
+    {
+      if(current.has_value() && !expect_name && c == '.')
+      {
+        current->push_back('/');
+        expect_name = true;
+      }
+      else if(current.has_value() && !expect_name && c == ';' && !current->empty())
+      {
+        if(!current->ends_with(".slang"))
+        {
+          current->append(".slang");
+        }
+        imports.push_back(std::move(current.value()));
+        current.reset();
+      }
+      else
+      {
+        current.reset();
+      }
+      i++;
+    }
+  }
+  return imports;
+}
+
+// File system for sessions that precompile modules on worker threads.
+// It serves modules that other workers already compiled, and reads other files
+// from disk. Unlike SlangCompilerHelper's file system, it's safe to use from
+// several threads at once.
+class PrecompiledModuleFileSystem : public ISlangFileSystem
+{
+public:
+  PrecompiledModuleFileSystem(const std::string&                                                search_path,
+                              std::mutex&                                                       mutex,
+                              const std::unordered_map<std::string, Slang::ComPtr<ISlangBlob>>& modules)
+      : m_searchPath(search_path)
+      , m_mutex(mutex)
+      , m_modules(modules)
+  {
+  }
+
+  SLANG_REF_OBJECT_IUNKNOWN_ALL
+
+  // Like SlangCompilerHelper, this is owned by the code that creates sessions.
+  uint32_t addReference() { return ++m_fakeReferenceCount; }
+  uint32_t releaseReference() { return --m_fakeReferenceCount; }
+
+  ISlangUnknown* getInterface(const Slang::Guid& guid)
+  {
+    if(ISlangUnknown::getTypeGuid() == guid || ISlangFileSystem::getTypeGuid() == guid)
+    {
+      return static_cast<ISlangFileSystem*>(this);
+    }
+    return nullptr;
+  }
+
+  void* castAs(const Slang::Guid& guid) override { return getInterface(guid); }
+
+  virtual SLANG_NO_THROW SlangResult SLANG_MCALL loadFile(char const* path, ISlangBlob** outBlob) override
+  {
+    // This must compute keys the same way as SlangCompilerHelper::loadFile().
+    const std::string path_string = (fs::path(m_searchPath) / fs::path(path)).string();
+    if(path_string.ends_with("-module"))
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto&                 it = m_modules.find(path_string);
+      if(it == m_modules.end() || !it->second)
+      {
+        return SLANG_E_NOT_FOUND;
+      }
+      *outBlob = Slang::ComPtr<ISlangBlob>(it->second).detach();
+      return SLANG_OK;
+    }
+
+    // Read source files the same way as SlangCompilerHelper::loadFile().
+    std::optional<std::string> contents = load_file(path);
+    if(!contents.has_value())
+    {
+      return SLANG_E_NOT_FOUND;
+    }
+    *outBlob = MySharedBlob::create(std::move(contents.value())).detach();
+    return SLANG_OK;
+  }
+
+private:
+  const std::string&                                                m_searchPath;
+  std::mutex&                                                       m_mutex;
+  const std::unordered_map<std::string, Slang::ComPtr<ISlangBlob>>& m_modules;
+  std::atomic<uint32_t>                                             m_fakeReferenceCount = 1;
+};
+
+// Where a global session gets Slang's core module (the standard library) from.
+enum class SlangCoreModule
+{
+  // createGlobalSession() decides; it uses the precompiled core module
+  // embedded in the Slang library if there is one.
+  kDefault,
+  // Always load the embedded core module; fails if there isn't one.
+  kEmbedded,
+  // Compile the core module from source.
+  kFromSource,
+};
+
+// Creates a Slang global session, printing an error on failure.
+// Slang doesn't take global session settings when it loads the core module
+// separately, so `enable_glsl` only applies with SlangCoreModule::kDefault.
+inline bool createGlobalSession(bool                                  enable_glsl,
+                                Slang::ComPtr<slang::IGlobalSession>& global_session,
+                                SlangCoreModule                       core_module = SlangCoreModule::kDefault)
+{
+  SlangResult result = SLANG_OK;
+  if(core_module == SlangCoreModule::kDefault)
+  {
+    SlangGlobalSessionDesc global_session_desc{.enableGLSL = enable_glsl};
+    result = slang::createGlobalSession(&global_session_desc, global_session.writeRef());
+  }
+  else
+  {
+    result = slang_createGlobalSessionWithoutCoreModule(SLANG_API_VERSION, global_session.writeRef());
+    if(SLANG_SUCCEEDED(result) && core_module == SlangCoreModule::kEmbedded)
+    {
+      ISlangBlob* embedded = slang_getEmbeddedCoreModule();
+      if(!embedded)
+      {
+        fprintf(stderr, "This Slang library doesn't contain an embedded core module.\n");
+        return false;
+      }
+      result = global_session->loadCoreModule(embedded->getBufferPointer(), embedded->getBufferSize());
+    }
+    else if(SLANG_SUCCEEDED(result))
+    {
+      result = global_session->compileCoreModule(0);
+    }
+  }
+  if(SLANG_FAILED(result))
+  {
+    fprintf(stderr, "Slang compiler initialization failed with code %d, facility %d.\n",
+            SLANG_GET_RESULT_CODE(result), SLANG_GET_RESULT_FACILITY(result));
+    return false;
+  }
+  return true;
+}
+
+// A global session that several SlangCompilerHelpers can share, e.g. across
+// threads. Global sessions aren't thread-safe, and the sessions created from
+// one share its state, so helpers hold `mutex` for the duration of each init()
+// and compile(): threads sharing one compile one at a time, and their
+// throughput measures this lock rather than contention inside Slang.
+struct SharedSlangGlobalSession
+{
+  Slang::ComPtr<slang::IGlobalSession> session;
+  bool                                 enable_glsl = false;
+  std::mutex                           mutex;
+
+  // Returns nullptr on failure.
+  static std::shared_ptr<SharedSlangGlobalSession> create(bool enable_glsl)
+  {
+    std::shared_ptr<SharedSlangGlobalSession> shared = std::make_shared<SharedSlangGlobalSession>();
+    shared->enable_glsl                              = enable_glsl;
+    if(!createGlobalSession(enable_glsl, shared->session))
+    {
+      return nullptr;
+    }
+    return shared;
+  }
+};
+
+// Global sessions for SlangCompilerHelper::precompileImports() workers, so
+// that they're created once per process instead of once per helper and worker
+// thread. Since global sessions aren't thread-safe, each is lent to one thread
+// at a time.
+class SlangWorkerSessionPool
+{
+public:
+  static SlangWorkerSessionPool& get()
+  {
+    static SlangWorkerSessionPool pool;
+    return pool;
+  }
+
+  // Returns an idle global session, or creates one; nullptr on failure.
+  Slang::ComPtr<slang::IGlobalSession> acquire(bool enable_glsl)
+  {
+    {
+      std::lock_guard<std::mutex>                        lock(m_mutex);
+      std::vector<Slang::ComPtr<slang::IGlobalSession>>& idle = m_idle[enable_glsl];
+      if(!idle.empty())
+      {
+        Slang::ComPtr<slang::IGlobalSession> session = std::move(idle.back());
+        idle.pop_back();
+        return session;
+      }
+    }
+    Slang::ComPtr<slang::IGlobalSession> session;
+    if(!createGlobalSession(enable_glsl, session))
+    {
+      return nullptr;
+    }
+    return session;
+  }
+
+  // Returns a session from acquire() to the pool.
+  void release(bool enable_glsl, Slang::ComPtr<slang::IGlobalSession> session)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle[enable_glsl].push_back(std::move(session));
+  }
+
+private:
+  std::mutex                                        m_mutex;
+  std::vector<Slang::ComPtr<slang::IGlobalSession>> m_idle[2];  // By enable_glsl
+};
+
+// How long each phase of a SlangCompilerHelper::compile() took, in
+// milliseconds.
+struct SlangPhaseTimes
+{
+  // With set_precompile_threads(): all of precompileImports(), and the part
+  // of it that workers waited for global sessions from
+  // SlangWorkerSessionPool (the longest wait; they wait in parallel). The
+  // other phases come afterwards.
+  double precompile_ms         = 0.0;
+  double precompile_session_ms = 0.0;
+  // Creating (or fetching a pooled) session for the main module.
+  double session_ms = 0.0;
+  // loadModuleFromSourceString() for the main module (parsing and semantic
+  // checking), excluding import_fetch_ms.
+  double load_module_ms = 0.0;
+  // Loading the main module's imports through our file system. On cache
+  // misses, this includes compiling the imported modules.
+  double import_fetch_ms    = 0.0;
+  size_t num_import_fetches = 0;
+  // getTargetCode(): IR lowering and SPIR-V emission.
+  double get_target_code_ms = 0.0;
+  // Copying file contents and modules into blobs we own. This should be 0 once
+  // everything's cached.
+  double blob_copy_ms = 0.0;
+  // With set_reflection(true): composing the module with its entry points and
+  // linking it, so that it has a layout; and getLayout() plus walking it.
+  double layout_link_ms = 0.0;
+  double reflection_ms  = 0.0;
+};
+
+// What the last reflection walk (see SlangCompilerHelper::set_reflection())
+// visited.
+struct SlangReflectionStats
+{
+  size_t num_entry_points      = 0;
+  size_t num_parameters        = 0;  // Global and entry point parameters
+  size_t num_variables         = 0;  // Including fields, at any depth
+  size_t num_binding_ranges    = 0;
+  size_t num_descriptor_sets   = 0;
+  size_t num_descriptor_ranges = 0;
+};
+
+// An entry point to compile with SlangCompilerHelper::compile_permutations().
+struct SlangPermutation
+{
+  // The entry point's name, or empty for every entry point in the module.
+  std::string entry_point;
+  // Names of types to specialize the module's and entry point's generic
+  // parameters (e.g. `type_param` declarations or generic entry points) with,
+  // in order.
+  std::vector<std::string> type_args;
+};
+
+// Settings that change how SlangCompilerHelper compiles. The defaults come
+// from the #defines at the top of this file.
+struct SlangHelperSettings
+{
+  // Intercept module loads and cache serialized modules; see USE_MODULE_CACHE.
+#ifdef USE_MODULE_CACHE
+  bool module_cache = true;
+#else
+  bool module_cache = false;
+#endif
+  // Expose ISlangFileSystemExt; see IMPLEMENT_FILESYSTEMEXT.
+#ifdef IMPLEMENT_FILESYSTEMEXT
+  bool filesystem_ext = true;
+#else
+  bool filesystem_ext = false;
+#endif
+  // Keep Slang's validation passes; see SLANG_HELPER_NO_VALIDATION.
+#ifdef SLANG_HELPER_NO_VALIDATION
+  bool validation = false;
+#else
+  bool validation = true;
+#endif
+  // Slang's -O level (SlangOptimizationLevel) and -g level
+  // (SlangDebugInfoLevel); see CodegenSettings.
+  int optimization = 0;
+  int debug_info   = 0;
+  // Emit SPIR-V directly instead of going through GLSL and glslang.
+  bool emit_spirv_directly = true;
+  // Use arena-backed maps for our caches, and allocate blobs together with
+  // their data; see USE_ARENA_GLUE.
+#ifdef USE_ARENA_GLUE
+  bool arena_glue = true;
+#else
+  bool arena_glue = false;
+#endif
+};
+
+class SlangCompilerHelper : public ISlangFileSystemExt
+{
+public:
+  // Creates a global session. If `shared` is provided, uses its global session
+  // instead, so that several helpers can share one.
+  bool init(bool enable_glsl, std::shared_ptr<SharedSlangGlobalSession> shared = nullptr)
+  {
+    TraceZone zone("init");
+    m_enableGlsl          = enable_glsl;
+    m_sharedGlobalSession = std::move(shared);
+    std::unique_lock<std::mutex> lock;
+    if(m_sharedGlobalSession)
+    {
+      lock            = std::unique_lock<std::mutex>(m_sharedGlobalSession->mutex);
+      m_globalSession = m_sharedGlobalSession->session;
+      m_enableGlsl    = m_sharedGlobalSession->enable_glsl;
+    }
+    else if(!createGlobalSession(enable_glsl, m_globalSession, m_coreModule))
+    {
+      return false;
+    }
+
+    m_targets = {slang::TargetDesc{.format = SLANG_SPIRV, .profile = m_globalSession->findProfile("spirv_1_6")}};
+    buildOptions();
+
+    return true;
+  }
+
+  // Sets where init() gets the core module from, when it creates its own
+  // global session.
+  void set_core_module(SlangCoreModule core_module) { m_coreModule = core_module; }
+
+  const SlangHelperSettings& settings() const { return m_settings; }
+
+  // Changes settings. This can be called before or after init(); afterwards,
+  // it throws away cached modules and pooled sessions, since they may have
+  // been compiled with different settings.
+  void set_settings(const SlangHelperSettings& settings)
+  {
+    m_settings = settings;
+    if(m_globalSession)
+    {
+      buildOptions();
+      clear_module_cache();
+    }
+    m_sessionPool.clear();
+    // These empty the maps if they switch implementations.
+    m_moduleCache.set_arena(m_settings.arena_glue);
+    m_moduleRecords.set_arena(m_settings.arena_glue);
+    m_canonicalSourcePaths.set_arena(m_settings.arena_glue);
+    m_paths.set_arena(m_settings.arena_glue);
+    m_combinedPaths[0].set_arena(m_settings.arena_glue);
+    m_combinedPaths[1].set_arena(m_settings.arena_glue);
+  }
+
+  // The code generation settings in settings(), for --sweep. Slang can change
+  // all of them.
+  CodegenSettings codegen() const
+  {
+    return CodegenSettings{.optimization        = m_settings.optimization,
+                           .debug_info          = m_settings.debug_info,
+                           .validation          = m_settings.validation,
+                           .emit_spirv_directly = m_settings.emit_spirv_directly};
+  }
+  void set_codegen(const CodegenSettings& codegen)
+  {
+    SlangHelperSettings settings = m_settings;
+    settings.optimization        = codegen.optimization;
+    settings.debug_info          = codegen.debug_info;
+    settings.validation          = codegen.validation;
+    settings.emit_spirv_directly = codegen.emit_spirv_directly;
+    set_settings(settings);
+  }
+  static uint32_t codegen_knobs() { return kCodegenOptimization | kCodegenDebugInfo | kCodegenValidation | kCodegenEmitSpirvDirectly; }
+
+private:
+  void buildOptions()
+  {
+    m_settingsHash.reset();
+    m_options = {
+        {slang::CompilerOptionName::EmitSpirvDirectly, {slang::CompilerOptionValueKind::Int, m_settings.emit_spirv_directly ? 1 : 0}},  //
+        {slang::CompilerOptionName::VulkanUseEntryPointName, {slang::CompilerOptionValueKind::Int, 1}},                                 //
+        {slang::CompilerOptionName::Optimization, {slang::CompilerOptionValueKind::Int, m_settings.optimization}},                      //
+        {slang::CompilerOptionName::DebugInformation, {slang::CompilerOptionValueKind::Int, m_settings.debug_info}},                    //
+        {slang::CompilerOptionName::MinimumSlangOptimization, {slang::CompilerOptionValueKind::Int, 1}},                                //
+        {slang::CompilerOptionName::Capability,
+         {slang::CompilerOptionValueKind::Int, m_globalSession->findCapability("spvRayQueryKHR")}},
+    };
+    if(!m_settings.validation)
+    {
+      m_options.insert(m_options.end(), {
+          {slang::CompilerOptionName::SkipSPIRVValidation, {slang::CompilerOptionValueKind::Int, 1}},             //
+          {slang::CompilerOptionName::DisableNonEssentialValidations, {slang::CompilerOptionValueKind::Int, 1}},  //
+          {slang::CompilerOptionName::ValidateIr, {slang::CompilerOptionValueKind::Int, 0}},         // (default value)
+          {slang::CompilerOptionName::ValidateUniformity, {slang::CompilerOptionValueKind::Int, 0}}  // (default value)
+      });
+    }
+  }
+
+  // Creates a session. By default, it uses our global session and file system.
+  // (Capability and profile IDs in m_options and m_targets are the same for
+  // all global sessions from the same Slang build.)
+  Slang::ComPtr<slang::ISession> makeSession(slang::IGlobalSession* global_session = nullptr, ISlangFileSystem* file_system = nullptr)
+  {
+    TraceZone zone("makeSession");
+    slang::SessionDesc desc{.targets{m_targets.data()},
+                            .targetCount{SlangInt(m_targets.size())},
+                            .compilerOptionEntries{m_options.data()},
+                            .compilerOptionEntryCount{uint32_t(m_options.size())}};
+    // Without the module cache, Slang uses its own file system.
+    desc.fileSystem = file_system ? file_system : (m_settings.module_cache ? this : nullptr);
+    desc.searchPaths     = &m_currentSearchPathCString;
+    desc.searchPathCount = 1;
+
+    Slang::ComPtr<slang::ISession> session;
+    (global_session ? global_session : m_globalSession.get())->createSession(desc, session.writeRef());
+    return session;
+  }
+
+  // Compiles a string to a module.
+  Slang::ComPtr<slang::IModule> compileModule(slang::ISession* session, const char* shaderPath, const char* source)
+  {
+    TraceZone zone("compileModule");
+    Slang::ComPtr<slang::IBlob>   diagnostics;
+    Slang::ComPtr<slang::IModule> shader_module;
+    shader_module = session->loadModuleFromSourceString(shaderPath, nullptr, source, diagnostics.writeRef());
+    if(diagnostics)
+    {
+      fprintf(stderr, "Diagnostics:\n%s\n", reinterpret_cast<const char*>(diagnostics->getBufferPointer()));
+      return nullptr;
+    }
+
+    return shader_module;
+  }
+
+  // Appends the files `shader_module` was compiled from (Slang includes the
+  // modules it imports, transitively) to `dependencies`, other than the main
+  // shader, whose source we're given. Files in the module cache are described
+  // by the contents loadFile() read; others are read now. Returns false if
+  // one can't be read.
+  bool outputDependencies(slang::IModule* shader_module, const char* mainShaderPath, std::vector<OutputCache::Dependency>& dependencies)
+  {
+    for(SlangInt32 i = 0; i < shader_module->getDependencyFileCount(); i++)
+    {
+      const char* slang_path = shader_module->getDependencyFilePath(i);
+      // Cached files' paths are the ones loadFile() saw.
+      const auto& it = m_moduleRecords.find(m_paths.join(m_currentSearchPath, slang_path));
+      if(it != m_moduleRecords.end() && !it->second.missing)
+      {
+        const CacheRecord& record = it->second;
+        if(record.source_path != mainShaderPath)
+        {
+          dependencies.push_back({.path       = record.source_path,
+                                  .write_time = static_cast<int64_t>(record.write_time.time_since_epoch().count()),
+                                  .size       = static_cast<uint64_t>(record.file_size),
+                                  .hash       = record.source_hash});
+        }
+        continue;
+      }
+
+      std::string path = slang_path;
+      if(path.ends_with("-module"))
+      {
+        path.resize(path.size() - 7);
+      }
+      std::error_code error;
+      count_filesystem_call();
+      if(!fs::exists(path, error))
+      {
+        path = std::string(m_paths.join(m_currentSearchPath, path));
+      }
+      if(path == mainShaderPath)
+      {
+        continue;
+      }
+      std::optional<OutputCache::Dependency> dependency = OutputCache::read_dependency(std::move(path));
+      if(!dependency.has_value())
+      {
+        return false;
+      }
+      dependencies.push_back(std::move(dependency.value()));
+    }
+    return true;
+  }
+
+  // Hashes every setting that can change compilation results: the Slang build,
+  // global session settings, compiler options, and targets.
+  void hashSettings(Hasher& hasher)
+  {
+    hasher.add_string(m_globalSession->getBuildTagString());
+    hasher.add_int(m_enableGlsl);
+    for(const slang::CompilerOptionEntry& entry : m_options)
+    {
+      hasher.add_int(static_cast<uint64_t>(entry.name));
+      hasher.add_int(static_cast<uint64_t>(entry.value.kind));
+      hasher.add_int(static_cast<uint64_t>(entry.value.intValue0));
+      hasher.add_int(static_cast<uint64_t>(entry.value.intValue1));
+      hasher.add_string(entry.value.stringValue0 ? entry.value.stringValue0 : "");
+      hasher.add_string(entry.value.stringValue1 ? entry.value.stringValue1 : "");
+    }
+    for(const slang::TargetDesc& target : m_targets)
+    {
+      hasher.add_int(static_cast<uint64_t>(target.format));
+      hasher.add_int(static_cast<uint64_t>(target.profile));
+      hasher.add_int(target.flags);
+      hasher.add_int(target.forceGLSLScalarBufferLayout);
+    }
+  }
+
+  // hashSettings(), computed again only after buildOptions() changes them.
+  uint64_t settingsHash()
+  {
+    if(!m_settingsHash.has_value())
+    {
+      Hasher hasher;
+      hashSettings(hasher);
+      m_settingsHash = hasher.get();
+    }
+    return m_settingsHash.value();
+  }
+
+  // Identifies a main module compile: the settings, the main module's path
+  // (which determines the search path), and its source. This is also the
+  // output cache key, so compile() computes it once for both.
+  uint64_t sourceKey(const char* mainShaderPath, const char* source)
+  {
+    return OutputCache::make_key(settingsHash(), mainShaderPath, source);
+  }
+
+  // Returns a session for compiling the main module. With session pooling,
+  // this reuses a session from a previous compile() with the same sourceKey()
+  // (which the caller can pass in, if it has it) if no cached modules were
+  // invalidated since (a session keeps every module it loaded, so it'd
+  // otherwise keep using the old versions).
+  Slang::ComPtr<slang::ISession> getSession(const char* mainShaderPath, const char* source, std::optional<uint64_t> source_key)
+  {
+    if(!m_poolSessions)
+    {
+      return makeSession();
+    }
+
+    if(!source_key.has_value())
+    {
+      source_key = sourceKey(mainShaderPath, source);
+    }
+    const uint64_t key = Hasher().add_int(source_key.value()).add_int(m_moduleCacheGeneration).get();
+
+    // Most recently used sessions are at the front.
+    for(size_t i = 0; i < m_sessionPool.size(); i++)
+    {
+      if(m_sessionPool[i].first == key)
+      {
+        std::rotate(m_sessionPool.begin(), m_sessionPool.begin() + i, m_sessionPool.begin() + i + 1);
+        return m_sessionPool.front().second;
+      }
+    }
+
+    Slang::ComPtr<slang::ISession> session = makeSession();
+    m_sessionPool.insert(m_sessionPool.begin(), {key, session});
+    if(m_sessionPool.size() > kMaxPooledSessions)
+    {
+      m_sessionPool.pop_back();
+    }
+    return session;
+  }
+
+  // Computes the disk cache key for a module: a hash of everything that can
+  // change its serialized form.
+  uint64_t moduleCacheKey(const std::string& path, const std::string& source)
+  {
+    Hasher hasher;
+    hasher.add_int(settingsHash());
+    hasher.add_string(path);
+    hasher.add_string(source);
+    return hasher.get();
+  }
+
+  // Before the main module is compiled, finds the modules it transitively
+  // imports that aren't cached yet, and compiles them on worker threads (each
+  // with a global session from SlangWorkerSessionPool, since those aren't
+  // thread-safe). Modules that the module archive or disk cache has valid
+  // entries for are loaded from there first, as loadFile() would. A module is
+  // compiled once all the modules it imports are done. Anything this skips or
+  // fails to compile will be compiled by loadFile() as usual.
+  void precompileImports(const char* source)
+  {
+    const timer::time_point start = timer::now();
+    TraceZone               zone("precompileImports");
+
+    struct Node
+    {
+      std::string              key;
+      std::string              source_path;
+      FileStamp                stamp;  // From before `contents` were read
+      std::string              contents;
+      std::vector<std::string> dependencies;  // Keys
+      std::vector<size_t>      dependents;    // Indices into `nodes`
+      size_t                   num_pending = 0;
+      bool                     schedulable = true;
+      bool                     failed      = false;
+    };
+    std::vector<Node>                       nodes;
+    std::unordered_map<std::string, size_t> node_indices;
+
+    // Discover the import graph.
+    const auto key_for = [this](const std::string& import) {
+      return (fs::path(m_currentSearchPath) / fs::path(import + "-module")).string();
+    };
+    std::vector<std::string> to_visit;
+    for(const std::string& import : find_slang_imports(source))
+    {
+      to_visit.push_back(key_for(import));
+    }
+    while(!to_visit.empty())
+    {
+      std::string key = std::move(to_visit.back());
+      to_visit.pop_back();
+      if(m_moduleCache.count(key) != 0 || node_indices.count(key) != 0)
+      {
+        continue;
+      }
+
+      Node node{.key = key, .source_path = key.substr(0, key.size() - 7)};
+      node.stamp                          = file_stamp(node.source_path);
+      std::optional<std::string> contents = load_file(node.source_path.c_str());
+      if(!contents.has_value())
+      {
+        continue;  // We'll let Slang report this.
+      }
+      node.contents = std::move(contents.value());
+      for(const std::string& import : find_slang_imports(node.contents))
+      {
+        node.dependencies.push_back(key_for(import));
+        to_visit.push_back(node.dependencies.back());
+      }
+      node_indices[key] = nodes.size();
+      nodes.push_back(std::move(node));
+    }
+
+    // If a previous process compiled a module, load it the same way
+    // loadFile() would, which checks that the entry is intact and that its
+    // dependencies are unchanged. Dependencies go first, so that checking an
+    // entry finds them cached instead of compiling them; modules with stale or
+    // corrupt entries are compiled below instead.
+    if(m_moduleArchive || m_diskCache.enabled())
+    {
+      std::vector<bool> tried(nodes.size(), false);
+      for(bool progress = true; progress;)
+      {
+        progress = false;
+        for(size_t i = 0; i < nodes.size(); i++)
+        {
+          Node&      node  = nodes[i];
+          const bool ready = std::all_of(node.dependencies.begin(), node.dependencies.end(), [&](const std::string& dependency) {
+            const auto& it = m_moduleCache.find(dependency);
+            return it != m_moduleCache.end() && it->second;
+          });
+          if(tried[i] || !ready)
+          {
+            continue;
+          }
+          tried[i]                  = true;
+          progress                  = true;
+          CacheRecord               record = makeRecord(node.source_path, node.stamp, node.contents);
+          Slang::ComPtr<ISlangBlob> blob;
+          loadStoredModule(node.key, moduleCacheKey(node.source_path, node.contents), record, blob.writeRef());
+        }
+      }
+
+      // Only schedule what's still missing.
+      std::vector<Node> missing;
+      node_indices.clear();
+      for(Node& node : nodes)
+      {
+        if(m_moduleCache.count(node.key) == 0)
+        {
+          node_indices[node.key] = missing.size();
+          missing.push_back(std::move(node));
+        }
+      }
+      nodes = std::move(missing);
+    }
+
+    // Workers' sessions look dependencies up in `results`. Modules that are
+    // already cached go there too; otherwise, each worker would compile them
+    // again from source.
+    std::unordered_map<std::string, Slang::ComPtr<ISlangBlob>> results;
+    for(const Node& node : nodes)
+    {
+      for(const std::string& dependency : node.dependencies)
+      {
+        const auto& it = m_moduleCache.find(dependency);
+        if(node_indices.count(dependency) == 0 && it != m_moduleCache.end() && it->second)
+        {
+          results.emplace(dependency, it->second);
+        }
+      }
+    }
+
+    // Only modules whose dependencies are all cached or schedulable can be
+    // precompiled.
+    for(bool changed = true; changed;)
+    {
+      changed = false;
+      for(Node& node : nodes)
+      {
+        for(const std::string& dependency : node.dependencies)
+        {
+          const auto& it = node_indices.find(dependency);
+          const bool  available =
+              (it == node_indices.end()) ? (results.count(dependency) != 0) : nodes[it->second].schedulable;
+          if(node.schedulable && !available)
+          {
+            node.schedulable = false;
+            changed          = true;
+          }
+        }
+      }
+    }
+
+    size_t             num_remaining = 0;
+    std::deque<size_t> ready;
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+      if(!nodes[i].schedulable)
+      {
+        continue;
+      }
+      num_remaining++;
+      for(const std::string& dependency : nodes[i].dependencies)
+      {
+        const auto& it = node_indices.find(dependency);
+        if(it != node_indices.end())
+        {
+          nodes[it->second].dependents.push_back(i);
+          nodes[i].num_pending++;
+        }
+      }
+      if(nodes[i].num_pending == 0)
+      {
+        ready.push_back(i);
+      }
+    }
+    if(num_remaining == 0)
+    {
+      m_phaseTimes.precompile_ms = milliseconds_between(start, timer::now());
+      return;
+    }
+
+    // Everything in this block that's shared between threads, including
+    // `results`, is protected by `mutex`.
+    std::mutex              mutex;
+    std::condition_variable condition;
+    std::vector<size_t>     completion_order;
+    const size_t num_threads        = std::min(num_remaining, m_precompileThreads);
+    double       longest_session_ms = 0.0;
+
+    const auto worker = [&]() {
+      pin_helper_thread();
+      const timer::time_point              session_start  = timer::now();
+      Slang::ComPtr<slang::IGlobalSession> global_session = SlangWorkerSessionPool::get().acquire(m_enableGlsl);
+      const double                         session_ms     = milliseconds_between(session_start, timer::now());
+      PrecompiledModuleFileSystem          file_system(m_currentSearchPath, mutex, results);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      longest_session_ms = std::max(longest_session_ms, session_ms);
+      while(true)
+      {
+        condition.wait(lock, [&] { return num_remaining == 0 || !ready.empty(); });
+        if(ready.empty())
+        {
+          if(global_session)
+          {
+            SlangWorkerSessionPool::get().release(m_enableGlsl, std::move(global_session));
+          }
+          return;
+        }
+        Node& node = nodes[ready.front()];
+        ready.pop_front();
+
+        // Compile and serialize it:
+        Slang::ComPtr<ISlangBlob> serialized_module;
+        if(global_session && !node.failed)
+        {
+          lock.unlock();
+          Slang::ComPtr<slang::ISession> session = makeSession(global_session, &file_system);
+          Slang::ComPtr<slang::IModule>  shader_module =
+              compileModule(session, node.source_path.c_str(), node.contents.c_str());
+          if(shader_module)
+          {
+            TraceZone serialize_zone("serialize");
+            shader_module->serialize(serialized_module.writeRef());
+          }
+          lock.lock();
+        }
+
+        if(serialized_module)
+        {
+          results[node.key] = serialized_module;
+          completion_order.push_back(node_indices[node.key]);
+        }
+        for(size_t dependent : node.dependents)
+        {
+          nodes[dependent].failed |= !serialized_module;
+          if(--nodes[dependent].num_pending == 0)
+          {
+            ready.push_back(dependent);
+          }
+        }
+        num_remaining--;
+        condition.notify_all();
+      }
+    };
+    {
+      std::vector<std::thread> threads;
+      for(size_t i = 0; i < num_threads; i++)
+      {
+        threads.emplace_back(worker);
+      }
+      for(std::thread& thread : threads)
+      {
+        thread.join();
+      }
+    }
+
+    // Add the results to the cache, dependencies first so that we can compute
+    // fingerprints.
+    for(size_t index : completion_order)
+    {
+      Node&          node = nodes[index];
+      const uint64_t key  = moduleCacheKey(node.source_path, node.contents);
+      CacheRecord    record = makeRecord(node.source_path, node.stamp, node.contents);
+      record.dependencies   = std::move(node.dependencies);
+      record.fingerprint    = fingerprint(key, record.dependencies);
+      ISlangBlob* serialized_module = results[node.key].get();
+      if(m_diskCache.enabled())
+      {
+        const std::vector<char> entry = makeDiskEntry(serialized_module, record.dependencies);
+        m_diskCache.store(key, ".slang-module", entry.data(), entry.size());
+      }
+      m_moduleRecords[node.key] = std::move(record);
+      m_moduleCache[node.key]   = results[node.key];
+    }
+    m_numModulesCompiled += completion_order.size();
+
+    m_phaseTimes.precompile_ms         = milliseconds_between(start, timer::now());
+    m_phaseTimes.precompile_session_ms = longest_session_ms;
+    printf("Parallel precompilation time: %f ms (%zu modules on %zu threads; %f ms waiting for global sessions)\n",
+           m_phaseTimes.precompile_ms, completion_order.size(), num_threads, longest_session_ms);
+  }
+
+  // Prepares for compiling a main module, then creates (or, unless
+  // `allow_pooled_session` is false, fetches) a session and loads the main
+  // module in it, recording phase times. `source_key` is sourceKey(), if the
+  // caller already computed it.
+  Slang::ComPtr<slang::IModule> loadMainModule(const char*             mainShaderPath,
+                                               const char*             source,
+                                               bool                    allow_pooled_session = true,
+                                               std::optional<uint64_t> source_key           = {})
+  {
+    // Usually, we compile the same shader over and over.
+    if(m_currentMainShaderPath != mainShaderPath)
+    {
+      m_currentMainShaderPath    = mainShaderPath;
+      m_currentSearchPath        = fs::path(mainShaderPath).parent_path().string();
+      m_currentSearchPathCString = m_currentSearchPath.c_str();
+    }
+
+    if(m_settings.module_cache && m_trackChanges)
+    {
+      const size_t num_invalidated = invalidateChangedFiles();
+#ifdef VERBOSE
+      if(num_invalidated > 0)
+      {
+        fprintf(stderr, "Invalidated %zu module cache entries.\n", num_invalidated);
+      }
+#endif
+    }
+
+    m_phaseTimes = {};
+    if(m_settings.module_cache && m_precompileThreads > 0)
+    {
+      precompileImports(source);
+    }
+
+    timer::time_point              phase_start = timer::now();
+    Slang::ComPtr<slang::ISession> session     = allow_pooled_session ? getSession(mainShaderPath, source, source_key) : makeSession();
+    timer::time_point              phase_end   = timer::now();
+    m_phaseTimes.session_ms                    = milliseconds_between(phase_start, phase_end);
+
+    phase_start                                 = phase_end;
+    Slang::ComPtr<slang::IModule> shader_module = compileModule(session, mainShaderPath, source);
+    phase_end                                   = timer::now();
+    // loadFile() measures imports separately.
+    m_phaseTimes.load_module_ms = milliseconds_between(phase_start, phase_end) - m_phaseTimes.import_fetch_ms;
+    return shader_module;
+  }
+
+  // Specializes and links one entry point of `shader_module`, and appends its
+  // SPIR-V to m_permutationOutputs. Returns false on failure.
+  bool linkPermutation(slang::IModule* shader_module, slang::IEntryPoint* entry_point, const std::vector<std::string>& type_args)
+  {
+    Slang::ComPtr<slang::IBlob>         diagnostics;
+    slang::IComponentType*              components[] = {shader_module, entry_point};
+    Slang::ComPtr<slang::IComponentType> program;
+    if(SLANG_FAILED(shader_module->getSession()->createCompositeComponentType(components, 2, program.writeRef(),
+                                                                              diagnostics.writeRef())))
+    {
+      printDiagnostics(diagnostics);
+      return false;
+    }
+
+    if(!type_args.empty())
+    {
+      slang::ProgramLayout*                 layout = program->getLayout();
+      std::vector<slang::SpecializationArg> args;
+      for(const std::string& type_name : type_args)
+      {
+        slang::TypeReflection* type = layout ? layout->findTypeByName(type_name.c_str()) : nullptr;
+        if(!type)
+        {
+          fprintf(stderr, "Could not find type %s to specialize with.\n", type_name.c_str());
+          return false;
+        }
+        args.push_back(slang::SpecializationArg::fromType(type));
+      }
+      Slang::ComPtr<slang::IComponentType> specialized;
+      if(SLANG_FAILED(program->specialize(args.data(), SlangInt(args.size()), specialized.writeRef(), diagnostics.writeRef())))
+      {
+        printDiagnostics(diagnostics);
+        return false;
+      }
+      program = specialized;
+    }
+
+    Slang::ComPtr<slang::IComponentType> linked;
+    if(SLANG_FAILED(program->link(linked.writeRef(), diagnostics.writeRef())))
+    {
+      printDiagnostics(diagnostics);
+      return false;
+    }
+
+    Slang::ComPtr<ISlangBlob> spirv;
+    if(SLANG_FAILED(linked->getEntryPointCode(0, 0, spirv.writeRef(), diagnostics.writeRef())))
+    {
+      printDiagnostics(diagnostics);
+      return false;
+    }
+    m_permutationOutputs.push_back(spirv);
+    return true;
+  }
+
+  // Links `shader_module` with all of its entry points, and walks the layout
+  // of every parameter and entry point; see set_reflection(). Returns false on
+  // failure.
+  bool reflectProgram(slang::IModule* shader_module)
+  {
+    TraceZone               zone("reflection");
+    const timer::time_point link_start = timer::now();
+
+    std::vector<Slang::ComPtr<slang::IEntryPoint>> entry_points;
+    std::vector<slang::IComponentType*>            components = {shader_module};
+    for(SlangInt32 i = 0; i < shader_module->getDefinedEntryPointCount(); i++)
+    {
+      Slang::ComPtr<slang::IEntryPoint> entry_point;
+      if(SLANG_SUCCEEDED(shader_module->getDefinedEntryPoint(i, entry_point.writeRef())))
+      {
+        components.push_back(entry_point);
+        entry_points.push_back(entry_point);
+      }
+    }
+    Slang::ComPtr<slang::IBlob>          diagnostics;
+    Slang::ComPtr<slang::IComponentType> program, linked;
+    if(SLANG_FAILED(shader_module->getSession()->createCompositeComponentType(components.data(), SlangInt(components.size()),
+                                                                              program.writeRef(), diagnostics.writeRef()))
+       || SLANG_FAILED(program->link(linked.writeRef(), diagnostics.writeRef())))
+    {
+      printDiagnostics(diagnostics);
+      return false;
+    }
+    const timer::time_point reflect_start = timer::now();
+    m_phaseTimes.layout_link_ms           = milliseconds_between(link_start, reflect_start);
+
+    slang::ProgramLayout* layout = linked->getLayout(0, diagnostics.writeRef());
+    if(!layout)
+    {
+      printDiagnostics(diagnostics);
+      return false;
+    }
+    m_reflectionStats = {};
+    // getGlobalParamsVarLayout() and each entry point's getVarLayout() hold the
+    // same parameters again, so only the parameters themselves are walked.
+    for(unsigned i = 0; i < layout->getParameterCount(); i++)
+    {
+      m_reflectionStats.num_parameters++;
+      walkVariableLayout(layout->getParameterByIndex(i), 0);
+    }
+    for(SlangUInt i = 0; i < layout->getEntryPointCount(); i++)
+    {
+      slang::EntryPointReflection* entry_point = layout->getEntryPointByIndex(i);
+      m_reflectionStats.num_entry_points++;
+      m_reflectionChecksum += static_cast<uint64_t>(entry_point->getStage());
+      SlangUInt thread_group_size[3] = {};
+      entry_point->getComputeThreadGroupSize(3, thread_group_size);
+      m_reflectionChecksum += thread_group_size[0] * thread_group_size[1] * thread_group_size[2];
+      for(unsigned j = 0; j < entry_point->getParameterCount(); j++)
+      {
+        m_reflectionStats.num_parameters++;
+        walkVariableLayout(entry_point->getParameterByIndex(j), 0);
+      }
+      walkVariableLayout(entry_point->getResultVarLayout(), 0);
+    }
+    m_phaseTimes.reflection_ms = milliseconds_between(reflect_start, timer::now());
+    return true;
+  }
+
+  // Types can refer to themselves through pointers, so reflection walks don't
+  // follow pointers, and stop at this depth.
+  static constexpr int kMaxReflectionDepth = 64;
+
+  void walkVariableLayout(slang::VariableLayoutReflection* variable, int depth)
+  {
+    if(!variable)
+    {
+      return;
+    }
+    m_reflectionStats.num_variables++;
+    const char* name = variable->getName();
+    m_reflectionChecksum += name ? strlen(name) : 0;
+    for(unsigned i = 0; i < variable->getCategoryCount(); i++)
+    {
+      const SlangParameterCategory category = static_cast<SlangParameterCategory>(variable->getCategoryByIndex(i));
+      m_reflectionChecksum += variable->getOffset(category) + variable->getBindingSpace(category);
+    }
+    walkTypeLayout(variable->getTypeLayout(), depth + 1);
+  }
+
+  void walkTypeLayout(slang::TypeLayoutReflection* type_layout, int depth)
+  {
+    if(!type_layout || depth > kMaxReflectionDepth)
+    {
+      return;
+    }
+    for(unsigned i = 0; i < type_layout->getCategoryCount(); i++)
+    {
+      m_reflectionChecksum += type_layout->getSize(static_cast<SlangParameterCategory>(type_layout->getCategoryByIndex(i)));
+    }
+    // Binding and descriptor ranges are what descriptor set layouts are built
+    // from.
+    const SlangInt num_binding_ranges = type_layout->getBindingRangeCount();
+    for(SlangInt i = 0; i < num_binding_ranges; i++)
+    {
+      m_reflectionChecksum += static_cast<uint64_t>(type_layout->getBindingRangeType(i)) + type_layout->getBindingRangeBindingCount(i);
+    }
+    m_reflectionStats.num_binding_ranges += static_cast<size_t>(num_binding_ranges);
+    const SlangInt num_sets = type_layout->getDescriptorSetCount();
+    for(SlangInt set = 0; set < num_sets; set++)
+    {
+      m_reflectionChecksum += type_layout->getDescriptorSetSpaceOffset(set);
+      const SlangInt num_ranges = type_layout->getDescriptorSetDescriptorRangeCount(set);
+      for(SlangInt range = 0; range < num_ranges; range++)
+      {
+        m_reflectionChecksum += static_cast<uint64_t>(type_layout->getDescriptorSetDescriptorRangeType(set, range))
+                                + type_layout->getDescriptorSetDescriptorRangeDescriptorCount(set, range);
+      }
+      m_reflectionStats.num_descriptor_ranges += static_cast<size_t>(num_ranges);
+    }
+    m_reflectionStats.num_descriptor_sets += static_cast<size_t>(num_sets);
+
+    switch(type_layout->getKind())
+    {
+      case slang::TypeReflection::Kind::Struct:
+        for(unsigned i = 0; i < type_layout->getFieldCount(); i++)
+        {
+          walkVariableLayout(type_layout->getFieldByIndex(i), depth);
+        }
+        break;
+      case slang::TypeReflection::Kind::Array:
+        walkTypeLayout(type_layout->getElementTypeLayout(), depth + 1);
+        break;
+      case slang::TypeReflection::Kind::ConstantBuffer:
+      case slang::TypeReflection::Kind::ParameterBlock:
+      case slang::TypeReflection::Kind::TextureBuffer:
+      case slang::TypeReflection::Kind::ShaderStorageBuffer:
+        walkVariableLayout(type_layout->getElementVarLayout(), depth);
+        break;
+      default:
+        break;
+    }
+  }
+
+  static void printDiagnostics(slang::IBlob* diagnostics)
+  {
+    if(diagnostics)
+    {
+      fprintf(stderr, "Diagnostics:\n%s\n", reinterpret_cast<const char*>(diagnostics->getBufferPointer()));
+    }
+  }
+
+public:
+  bool compile(const char* mainShaderPath, const char* source)
+  {
+    TraceZone zone("compile");
+    // Other helpers may be using the same global session.
+    std::unique_lock<std::mutex> lock;
+    if(m_sharedGlobalSession)
+    {
+      lock = std::unique_lock<std::mutex>(m_sharedGlobalSession->mutex);
+    }
+
+    trimInternedPaths();
+    m_cachedSpirv = nullptr;
+    // This is both the output cache key and the session pool key.
+    std::optional<uint64_t> source_key;
+    if(m_outputCache.enabled() || m_poolSessions)
+    {
+      source_key = sourceKey(mainShaderPath, source);
+    }
+    if(m_outputCache.enabled())
+    {
+      m_cachedSpirv = m_outputCache.find(source_key.value());
+      if(m_cachedSpirv)
+      {
+        m_phaseTimes = {};
+        return true;
+      }
+    }
+
+    Slang::ComPtr<slang::IModule> shader_module = loadMainModule(mainShaderPath, source, true, source_key);
+    if(!shader_module)
+    {
+      return false;
+    }
+
+    const timer::time_point phase_start = timer::now();
+    m_spirv                             = nullptr;
+    SlangResult result                  = SLANG_OK;
+    {
+      TraceZone zone("getTargetCode");
+      result = shader_module->getTargetCode(0, m_spirv.writeRef());
+    }
+    m_phaseTimes.get_target_code_ms = milliseconds_between(phase_start, timer::now());
+    if(SLANG_FAILED(result))
+    {
+      fprintf(stderr, "Slang compilation failed with code %d, facility %d.\n", SLANG_GET_RESULT_CODE(result),
+              SLANG_GET_RESULT_FACILITY(result));
+      return false;
+    }
+    if(m_reflection && !reflectProgram(shader_module))
+    {
+      return false;
+    }
+
+    if(m_outputCache.enabled())
+    {
+      std::vector<OutputCache::Dependency> dependencies;
+      if(outputDependencies(shader_module, mainShaderPath, dependencies))
+      {
+        m_outputCache.store(source_key.value(), std::move(dependencies), m_spirv->getBufferPointer(), m_spirv->getBufferSize());
+      }
+    }
+    return true;
+  }
+
+  // Compiles each permutation to its own SPIR-V blob; see
+  // permutation_outputs(). With `share_module`, loads the main module once and
+  // specializes and links each permutation from it; otherwise, compiles the
+  // module from source again, in a new session (never a pooled one), for each
+  // entry point of each permutation, as a tool that ran once per entry point
+  // would. The phase times are for the last module load, and
+  // get_target_code_ms is the time spent specializing and linking.
+  bool compile_permutations(const char*                           mainShaderPath,
+                            const char*                           source,
+                            const std::vector<SlangPermutation>& permutations,
+                            bool                                  share_module)
+  {
+    std::unique_lock<std::mutex> lock;
+    if(m_sharedGlobalSession)
+    {
+      lock = std::unique_lock<std::mutex>(m_sharedGlobalSession->mutex);
+    }
+
+    m_permutationOutputs.clear();
+    Slang::ComPtr<slang::IModule> shader_module;
+    // Whether shader_module has already been used for an entry point.
+    bool   module_used = false;
+    double link_ms     = 0.0;
+    for(const SlangPermutation& permutation : permutations)
+    {
+      if(!shader_module && !(shader_module = loadMainModule(mainShaderPath, source, share_module)))
+      {
+        return false;
+      }
+      // An empty name means every entry point the module defines. Every
+      // module loaded from the same source defines the same ones.
+      const SlangInt32 num_entry_points = permutation.entry_point.empty() ? shader_module->getDefinedEntryPointCount() : 1;
+      for(SlangInt32 i = 0; i < num_entry_points; i++)
+      {
+        if(!share_module && module_used)
+        {
+          if(!(shader_module = loadMainModule(mainShaderPath, source, false)))
+          {
+            return false;
+          }
+        }
+        module_used = true;
+
+        const timer::time_point           link_start = timer::now();
+        Slang::ComPtr<slang::IEntryPoint> entry_point;
+        if(permutation.entry_point.empty())
+        {
+          if(SLANG_FAILED(shader_module->getDefinedEntryPoint(i, entry_point.writeRef())))
+          {
+            continue;
+          }
+        }
+        else if(SLANG_FAILED(shader_module->findEntryPointByName(permutation.entry_point.c_str(), entry_point.writeRef())))
+        {
+          fprintf(stderr, "Could not find entry point %s.\n", permutation.entry_point.c_str());
+          return false;
+        }
+        if(!linkPermutation(shader_module, entry_point, permutation.type_args))
+        {
+          return false;
+        }
+        link_ms += milliseconds_between(link_start, timer::now());
+      }
+    }
+    m_phaseTimes.get_target_code_ms = link_ms;
+    return true;
+  }
+
+  // The SPIR-V for each entry point compiled by the last
+  // compile_permutations(), in order.
+  const std::vector<Slang::ComPtr<ISlangBlob>>& permutation_outputs() const { return m_permutationOutputs; }
+
+  const void* get_spirv_data() const { return m_cachedSpirv ? m_cachedSpirv->data() : m_spirv->getBufferPointer(); }
+  size_t      get_spirv_size() const { return m_cachedSpirv ? m_cachedSpirv->size() : m_spirv->getBufferSize(); }
+
+  // The last compile()'s SPIR-V, sharing ownership instead of copying it.
+  CompiledOutput spirv_output() const
   {
-    if(guid == ISlangUnknown::getTypeGuid() || guid == ISlangBlob::getTypeGuid())
+    if(m_cachedSpirv)
     {
-      return static_cast<ISlangBlob*>(this);
+      return CompiledOutput::share(m_cachedSpirv, m_cachedSpirv->data(), m_cachedSpirv->size());
     }
-    return nullptr;
+    return share_blob(m_spirv);
+  }
+
+  // Wraps a blob, e.g. one of permutation_outputs(), without copying it.
+  static CompiledOutput share_blob(const Slang::ComPtr<ISlangBlob>& blob)
+  {
+    return CompiledOutput::share(std::make_shared<Slang::ComPtr<ISlangBlob>>(blob), blob->getBufferPointer(),
+                                 blob->getBufferSize());
   }
 
-  virtual SLANG_NO_THROW void const* SLANG_MCALL getBufferPointer() override { return m_data.data(); };
-  virtual SLANG_NO_THROW size_t SLANG_MCALL      getBufferSize() override { return m_data.size(); }
+  // The cache in front of compile(); it's disabled by default.
+  OutputCache& output_cache() { return m_outputCache; }
+
+  static const char* name() { return "slang"; }
+  // The extension of the shaders this helper compiles, e.g. for --dir.
+  static const char* extension() { return ".slang"; }
+
+  // Identifies the Slang build, e.g. for comparing results between versions.
+  std::string version() const { return m_globalSession->getBuildTagString(); }
 
-  // Copies the given data into a new blob.
-  static Slang::ComPtr<ISlangBlob> create(const void* inData, size_t size)
+  // If enabled, compile() reuses sessions when nothing they depend on changed;
+  // see getSession().
+  void set_pool_sessions(bool pool_sessions)
   {
-    return Slang::ComPtr<ISlangBlob>(new MyRawBlob(inData, size));
+    m_poolSessions = pool_sessions;
+    m_sessionPool.clear();
   }
-};
-#endif
 
-class SlangCompilerHelper
-#ifdef USE_MODULE_CACHE
-#ifdef IMPLEMENT_FILESYSTEMEXT
-    : public ISlangFileSystemExt
-#else
-    : public ISlangFileSystem
-#endif
-#endif
-{
-public:
-  bool init(bool enable_glsl)
+  // How long each phase of the last compile() took.
+  const SlangPhaseTimes& phase_times() const { return m_phaseTimes; }
+
+  // If enabled, compile() also links the main module with all of its entry
+  // points and walks the whole layout, as an app building descriptor set
+  // layouts from reflection would; see layout_link_ms and reflection_ms.
+  // Output cache hits skip this, since they don't load the module.
+  void                        set_reflection(bool reflection) { m_reflection = reflection; }
+  const SlangReflectionStats& reflection_stats() const { return m_reflectionStats; }
+
+  // Stores serialized modules in `directory` in addition to memory, and loads
+  // them from there in later processes. An empty path disables this.
+  // Returns false if the directory couldn't be created.
+  bool set_disk_cache_directory(const fs::path& directory) { return m_diskCache.set_directory(directory); }
+
+  // Serves modules from the shader archive at `path` (see
+  // export_module_archive()) when they're not in memory; entries are used in
+  // place unless they're compressed. An empty path stops using the archive.
+  // Returns false if the archive couldn't be opened.
+  bool set_module_archive(const fs::path& path)
   {
-    SlangGlobalSessionDesc global_session_desc{.enableGLSL = enable_glsl};
-    SlangResult            result = slang::createGlobalSession(&global_session_desc, m_globalSession.writeRef());
-    if(SLANG_FAILED(result))
+    m_moduleArchive = nullptr;
+    if(path.empty())
+    {
+      return true;
+    }
+    std::shared_ptr<ArchiveReader> archive = std::make_shared<ArchiveReader>();
+    if(!archive->open(path))
     {
-      fprintf(stderr, "Slang compiler initialization failed with code %d, facility %d.\n",
-              SLANG_GET_RESULT_CODE(result), SLANG_GET_RESULT_FACILITY(result));
       return false;
     }
-
-    // Set up default options and target
-    m_options = {
-        {slang::CompilerOptionName::EmitSpirvDirectly, {slang::CompilerOptionValueKind::Int, 1}},         //
-        {slang::CompilerOptionName::VulkanUseEntryPointName, {slang::CompilerOptionValueKind::Int, 1}},   //
-        {slang::CompilerOptionName::Optimization, {slang::CompilerOptionValueKind::Int, 0}},              //
-        {slang::CompilerOptionName::MinimumSlangOptimization, {slang::CompilerOptionValueKind::Int, 1}},  //
-        {slang::CompilerOptionName::Capability,
-         {slang::CompilerOptionValueKind::Int, m_globalSession->findCapability("spvRayQueryKHR")}},
-#ifdef SLANG_HELPER_NO_VALIDATION
-        {slang::CompilerOptionName::SkipSPIRVValidation, {slang::CompilerOptionValueKind::Int, 1}},             //
-        {slang::CompilerOptionName::DisableNonEssentialValidations, {slang::CompilerOptionValueKind::Int, 1}},  //
-        {slang::CompilerOptionName::ValidateIr, {slang::CompilerOptionValueKind::Int, 0}},         // (default value)
-        {slang::CompilerOptionName::ValidateUniformity, {slang::CompilerOptionValueKind::Int, 0}}  // (default value)
-#endif
-    };
-    m_targets = {slang::TargetDesc{.format = SLANG_SPIRV, .profile = m_globalSession->findProfile("spirv_1_6")}};
-
+    m_moduleArchive = std::move(archive);
     return true;
   }
 
-private:
-  // Creates a session.
-  Slang::ComPtr<slang::ISession> makeSession()
+  // Writes every module in the in-memory module cache to a shader archive at
+  // `path`, keyed like the disk cache. Returns false on failure.
+  bool export_module_archive(const fs::path& path, ArchiveCompression compression = ArchiveCompression::kNone)
   {
-    slang::SessionDesc desc{.targets{m_targets.data()},
-                            .targetCount{SlangInt(m_targets.size())},
-                            .compilerOptionEntries{m_options.data()},
-                            .compilerOptionEntryCount{uint32_t(m_options.size())}};
-#ifdef USE_MODULE_CACHE
-    desc.fileSystem = this;
-#endif
-    desc.searchPaths     = &m_currentSearchPathCString;
-    desc.searchPathCount = 1;
-
-    Slang::ComPtr<slang::ISession> session;
-    m_globalSession->createSession(desc, session.writeRef());
-    return session;
+    ArchiveWriter writer;
+    if(!writer.set_compression(compression) || !writer.open(path))
+    {
+      return false;
+    }
+    for(const auto& [path_string, record] : m_moduleRecords)
+    {
+      const auto& it = m_moduleCache.find(path_string);
+      if(!path_string.ends_with("-module") || it == m_moduleCache.end() || !it->second)
+      {
+        continue;
+      }
+      std::optional<std::string> contents = load_file(record.source_path.c_str());
+      if(!contents.has_value())
+      {
+        continue;
+      }
+      const std::vector<char> entry = makeDiskEntry(it->second.get(), record.dependencies);
+      if(!writer.add(moduleCacheKey(record.source_path, contents.value()), record.source_path, entry.data(), entry.size()))
+      {
+        return false;
+      }
+    }
+    printf("Wrote %zu modules to %s\n", writer.num_entries(), path.string().c_str());
+    return writer.finish();
   }
 
-  // Compiles a string to a module.
-  Slang::ComPtr<slang::IModule> compileModule(slang::ISession* session, const char* shaderPath, const char* source)
+  // If enabled, each compile() checks whether the files in the module cache
+  // changed, and throws away the entries for changed files and every module
+  // that transitively imports them. Otherwise, we assume files are constant.
+  void set_track_changes(bool track_changes) { m_trackChanges = track_changes; }
+
+  // Throws away the module cache entries made from the files at `paths`, along
+  // with every entry that imports them. This is for callers that find out
+  // which files changed some other way (e.g. by watching the file system), so
+  // that compile() doesn't need to check every file. Returns how many entries
+  // were removed.
+  size_t invalidate_files(const std::vector<std::string>& paths)
   {
-    Slang::ComPtr<slang::IBlob>   diagnostics;
-    Slang::ComPtr<slang::IModule> shader_module;
-    shader_module = session->loadModuleFromSourceString(shaderPath, nullptr, source, diagnostics.writeRef());
-    if(diagnostics)
+    std::unordered_set<std::string> canonical_paths;
+    for(const std::string& path : paths)
     {
-      fprintf(stderr, "Diagnostics:\n%s\n", reinterpret_cast<const char*>(diagnostics->getBufferPointer()));
-      return nullptr;
+      std::error_code error;
+      canonical_paths.insert(fs::weakly_canonical(fs::path(path), error).string());
     }
-
-    return shader_module;
+    std::vector<std::string> changed;
+    for(const auto& [key, record] : m_moduleRecords)
+    {
+      // Records' source paths are cache keys (without "-module"), so they
+      // only need to be made canonical once.
+      std::string& canonical = m_canonicalSourcePaths[record.source_path];
+      if(canonical.empty())
+      {
+        std::error_code error;
+        canonical = fs::weakly_canonical(fs::path(record.source_path), error).string();
+      }
+      if(canonical_paths.count(canonical) > 0)
+      {
+        changed.emplace_back(key);
+      }
+    }
+    return invalidateEntries(std::move(changed));
   }
 
-public:
-  bool compile(const char* mainShaderPath, const char* source)
+  // Empties the in-memory module cache, so that the next compile() rebuilds
+  // (or reloads from disk) every module.
+  void clear_module_cache()
   {
-    m_currentSearchPath        = fs::path(mainShaderPath).parent_path().string();
-    m_currentSearchPathCString = m_currentSearchPath.c_str();
+    m_moduleCache.clear();
+    m_moduleRecords.clear();
+    m_moduleCacheGeneration++;
+  }
 
-    Slang::ComPtr<slang::ISession> session       = makeSession();
-    Slang::ComPtr<slang::IModule>  shader_module = compileModule(session, mainShaderPath, source);
-    if(!shader_module)
+  // If nonzero, compile() first compiles the modules the main module imports
+  // on up to this many threads. See precompileImports().
+  void set_precompile_threads(size_t num_threads) { m_precompileThreads = num_threads; }
+
+  // How many modules we've compiled from source so far.
+  size_t num_modules_compiled() const { return m_numModulesCompiled; }
+
+  // Returns the source path of the cached module that imports nothing and is
+  // transitively imported by the most other modules, or an empty string if
+  // there are no cached modules.
+  std::string find_leaf_module() const
+  {
+    std::string best_path;
+    size_t      best_dependents = 0;
+    for(const auto& [key, record] : m_moduleRecords)
     {
-      return false;
+      if(!key.ends_with("-module") || record.missing || !record.dependencies.empty())
+      {
+        continue;
+      }
+      size_t num_dependents = 0;
+      for(const auto& other : m_moduleRecords)
+      {
+        num_dependents += (other.first != key && dependsOn(other.first, key)) ? 1 : 0;
+      }
+      if(best_path.empty() || num_dependents > best_dependents)
+      {
+        best_path       = record.source_path;
+        best_dependents = num_dependents;
+      }
     }
+    return best_path;
+  }
 
-    m_spirv            = nullptr;
-    SlangResult result = shader_module->getTargetCode(0, m_spirv.writeRef());
-    if(SLANG_FAILED(result))
+private:
+  // Returns whether cache entry `from` transitively depends on `to`.
+  bool dependsOn(std::string_view from, std::string_view to) const
+  {
+    const auto& it = m_moduleRecords.find(from);
+    if(it == m_moduleRecords.end())
     {
-      fprintf(stderr, "Slang compilation failed with code %d, facility %d.\n", SLANG_GET_RESULT_CODE(result),
-              SLANG_GET_RESULT_FACILITY(result));
       return false;
     }
-
-    return true;
+    for(const std::string& dependency : it->second.dependencies)
+    {
+      // The graph is acyclic, since Slang rejects circular imports.
+      if(dependency == to || dependsOn(dependency, to))
+      {
+        return true;
+      }
+    }
+    return false;
   }
 
-  const void* get_spirv_data() const { return m_spirv->getBufferPointer(); }
-  size_t      get_spirv_size() const { return m_spirv->getBufferSize(); }
-
-  static const char* name() { return "slang"; }
-
-#ifdef USE_MODULE_CACHE
+public:
   // Module cache implementation
   // We use this to intercept Slang `import` calls and return pre-compiled
   // modules.
@@ -218,12 +1804,11 @@ public:
 
   ISlangUnknown* getInterface(const Slang::Guid& guid)
   {
-#ifdef IMPLEMENT_FILESYSTEMEXT
-    if(ISlangFileSystemExt::getTypeGuid() == guid)
+    // Without this, Slang wraps us in its own file cache.
+    if(m_settings.filesystem_ext && ISlangFileSystemExt::getTypeGuid() == guid)
     {
       return static_cast<ISlangFileSystemExt*>(this);
     }
-#endif
     if(ISlangUnknown::getTypeGuid() == guid || ISlangFileSystem::getTypeGuid() == guid)
     {
       return static_cast<ISlangFileSystem*>(this);
@@ -240,7 +1825,6 @@ public:
     return nullptr;
   }
 
-#ifdef IMPLEMENT_FILESYSTEMEXT
   virtual SLANG_NO_THROW SlangResult SLANG_MCALL getFileUniqueIdentity(const char* path, ISlangBlob** outUniqueIdentity) override
   {
     // Since we assume files are constant over the lifetime of this application,
@@ -248,7 +1832,7 @@ public:
     // It seems like we don't need to call std::filesystem::absolute() here.
     // Also, a full implementation would catch exceptions for all of these
     // functions.
-    *outUniqueIdentity = MyRawBlob::create(path, strlen(path)).detach();
+    *outUniqueIdentity = MyRawBlob::create(path, strlen(path), m_settings.arena_glue).detach();
     return SLANG_OK;
   }
 
@@ -258,14 +1842,17 @@ public:
                                                                   ISlangBlob**  pathOut) override
   {
     // NOTE: A full implementation would need to specify UTF-8 here
-    fs::path parent = fs::path(fromPath);
-    if(fromPathType == SLANG_PATH_TYPE_FILE)
-    {
-      parent = parent.parent_path();
-    }
-    const std::string path_string = (parent / fs::path(path)).string();
+    const bool             from_file   = (fromPathType == SLANG_PATH_TYPE_FILE);
+    const std::string_view path_string = m_combinedPaths[from_file].get(fromPath, path, [&](std::string_view from, std::string_view to) {
+      fs::path parent = fs::path(from);
+      if(from_file)
+      {
+        parent = parent.parent_path();
+      }
+      return (parent / fs::path(to)).string();
+    });
     // And this would ideally be a move
-    *pathOut = MyRawBlob::create(path_string.c_str(), path_string.size()).detach();
+    *pathOut = MyRawBlob::create(path_string.data(), path_string.size(), m_settings.arena_glue).detach();
     return SLANG_OK;
   }
 
@@ -312,13 +1899,59 @@ public:
   {
     return OSPathKind::Direct;  // I think
   }
-#endif
 
   virtual SLANG_NO_THROW SlangResult SLANG_MCALL loadFile(char const* path, ISlangBlob** outBlob) override
+  {
+    const timer::time_point start       = timer::now();
+    const std::string_view  path_string = m_paths.join(m_currentSearchPath, path);
+    // Only look the file up twice if we're tracing.
+    TraceZone         zone(trace_enabled() && m_moduleCache.find(path_string) != m_moduleCache.end() ? "loadFile hit" : "loadFile miss");
+    const SlangResult result = loadCachedFile(path_string, path, outBlob);
+    if(m_compileStack.empty())
+    {
+      // This is an import of the main module; nested loads are part of this one.
+      m_phaseTimes.import_fetch_ms += milliseconds_between(start, timer::now());
+      m_phaseTimes.num_import_fetches++;
+    }
+    // If we're compiling a module, it depends on this file.
+    if(SLANG_SUCCEEDED(result) && !m_compileStack.empty())
+    {
+      std::vector<std::string>& dependencies = m_compileStack.back();
+      if(std::find(dependencies.begin(), dependencies.end(), path_string) == dependencies.end())
+      {
+        dependencies.emplace_back(path_string);
+      }
+    }
+    return result;
+  }
+
+private:
+  // Interned paths are only used during a compile, so between compiles, we
+  // start over once a generation of cached modules is gone, or once they take
+  // up more than this; otherwise, watching or serving for a long time would
+  // keep growing them.
+  static constexpr size_t kMaxInternedPathBytes = 1024 * 1024;
+  void                    trimInternedPaths()
+  {
+    if(m_internedPathsGeneration != m_moduleCacheGeneration)
+    {
+      m_paths.clear();
+      m_combinedPaths[0].clear();
+      m_combinedPaths[1].clear();
+      m_internedPathsGeneration = m_moduleCacheGeneration;
+      return;
+    }
+    m_paths.trim(kMaxInternedPathBytes);
+    m_combinedPaths[0].trim(kMaxInternedPathBytes);
+    m_combinedPaths[1].trim(kMaxInternedPathBytes);
+  }
+
+  // Loads a file through m_moduleCache. `path_string` is the cache key;
+  // `path` is the path Slang gave us.
+  SlangResult loadCachedFile(std::string_view path_string, const char* path, ISlangBlob** outBlob)
   {
     // Is this file already in our cache?
-    const std::string path_string = (fs::path(m_currentSearchPath) / fs::path(path)).string();
-    const auto&       it          = m_moduleCache.find(path_string);
+    const auto& it = m_moduleCache.find(path_string);
     if(it != m_moduleCache.end())
     {
       ISlangBlob* blob = it->second.get();
@@ -342,14 +1975,23 @@ public:
     // Otherwise, is it a .slang-module file?
     if(path_string.ends_with("-module"))
     {
-      const std::string          original_path = path_string.substr(0, path_string.size() - 7);
+      const std::string          original_path = std::string(path_string.substr(0, path_string.size() - 7));
+      const FileStamp            stamp         = file_stamp(original_path);
       std::optional<std::string> contents      = load_file(original_path.c_str());
       if(!contents.has_value())
       {
         // This file doesn't exist.
         // Cache that information:
-        m_moduleCache[path_string] = nullptr;
-        return SLANG_E_NOT_FOUND;
+        return cacheMissingFile(path_string, original_path);
+      }
+
+      const uint64_t key    = moduleCacheKey(original_path, contents.value());
+      CacheRecord    record = makeRecord(original_path, stamp, contents.value());
+
+      // Is it in the module archive or the disk cache?
+      if(SLANG_SUCCEEDED(loadStoredModule(path_string, key, record, outBlob)))
+      {
+        return SLANG_OK;
       }
 
       // Compile it to a module:
@@ -358,12 +2000,17 @@ public:
       {
         const timer::time_point start = timer::now();
 
-        session       = makeSession();
-        shader_module = compileModule(session, original_path.c_str(), contents.value().c_str());
+        // Files loaded while compiling this module are its dependencies.
+        m_compileStack.emplace_back();
+        session             = makeSession();
+        shader_module       = compileModule(session, original_path.c_str(), contents.value().c_str());
+        record.dependencies = std::move(m_compileStack.back());
+        m_compileStack.pop_back();
         if(!shader_module)
         {
           return SLANG_FAIL;
         }
+        m_numModulesCompiled++;
 
         const timer::time_point                         end      = timer::now();
         const std::chrono::duration<double, std::milli> duration = (end - start);
@@ -374,6 +2021,7 @@ public:
       ISlangBlob* serialized_module = nullptr;
       {
         const timer::time_point start = timer::now();
+        TraceZone               zone("serialize");
 
         SlangResult result = shader_module->serialize(&serialized_module);
         if(SLANG_FAILED(result))
@@ -390,7 +2038,16 @@ public:
       }
 
       // Cache it.
-      m_moduleCache[path_string] = Slang::ComPtr<ISlangBlob>(serialized_module);
+      record.fingerprint = fingerprint(key, record.dependencies);
+      if(m_diskCache.enabled())
+      {
+        const timer::time_point copy_start = timer::now();
+        const std::vector<char> entry      = makeDiskEntry(serialized_module, record.dependencies);
+        m_phaseTimes.blob_copy_ms += milliseconds_between(copy_start, timer::now());
+        m_diskCache.store(key, ".slang-module", entry.data(), entry.size());
+      }
+      m_moduleRecords[path_string] = std::move(record);
+      m_moduleCache[path_string]   = Slang::ComPtr<ISlangBlob>(serialized_module);
       // serialized_module should have a reference count of 2;
       // one reference is in m_moduleCache, and the other reference is the
       // pointer we're returning to the caller.
@@ -399,19 +2056,29 @@ public:
       return SLANG_OK;
     }
 
-    // Otherwise, it's a regular file. Load it and add it to our cache.
+    // Otherwise, it's a regular file. Read it and add it to our cache.
     // Note: This path doesn't occur during this benchmark.
+    // Unlike the disk cache's entries, which are renamed into place, source
+    // files can be truncated and rewritten in place by an editor while
+    // m_moduleCache holds them, and reading a mapping of such a file faults;
+    // so we read it once into a buffer that the blob takes over.
     {
-      std::optional<std::string> contents = load_file(path);
+      const timer::time_point    copy_start = timer::now();
+      const FileStamp            stamp      = file_stamp(path);
+      std::optional<std::string> contents   = load_file(path);
       if(!contents.has_value())
       {
         // This file doesn't exist.
         // Cache that information:
-        m_moduleCache[path_string] = nullptr;
-        return SLANG_E_NOT_FOUND;
+        return cacheMissingFile(path_string, std::string(path_string));
       }
 
-      const auto& blob = m_moduleCache[path_string] = MyRawBlob::create(contents.value().data(), contents.value().size());
+      CacheRecord record           = makeRecord(std::string(path_string), stamp, contents.value());
+      record.fingerprint           = record.source_hash;
+      m_moduleRecords[path_string] = std::move(record);
+
+      const auto& blob = m_moduleCache[path_string] = MySharedBlob::create(std::move(contents.value()));
+      m_phaseTimes.blob_copy_ms += milliseconds_between(copy_start, timer::now());
       // The blob should have a reference count of 2; one in m_moduleCache,
       // and the other in the pointer we're returning.
       blob->addRef();
@@ -420,23 +2087,372 @@ public:
       return SLANG_OK;
     }
   }
-#endif
+
+  // What we know about each file in m_moduleCache. We use this to tell when
+  // cache entries are out of date.
+  struct CacheRecord
+  {
+    // The file the entry was made from; for modules, this is the .slang file.
+    std::string        source_path;
+    fs::file_time_type write_time{};
+    uintmax_t          file_size   = 0;
+    uint64_t           source_hash = 0;  // OutputCache::hash_contents()
+    // Combines the entry's own key and its dependencies' fingerprints, so it
+    // changes whenever the entry or anything it transitively depends on does.
+    uint64_t fingerprint = 0;
+    // Keys of the m_moduleCache entries Slang loaded while compiling this one.
+    std::vector<std::string> dependencies;
+    // If set, the file didn't exist, and m_moduleCache holds nullptr for it.
+    // The record lets creating the file invalidate that entry.
+    bool missing = false;
+  };
+
+  // Caches that the file at `source_path` doesn't exist.
+  SlangResult cacheMissingFile(std::string_view path_string, std::string source_path)
+  {
+    m_moduleCache[path_string]   = nullptr;
+    m_moduleRecords[path_string] = CacheRecord{.source_path = std::move(source_path), .missing = true};
+    return SLANG_E_NOT_FOUND;
+  }
+
+  // `stamp` must be from before `contents` were read, so that a change while
+  // reading is seen as a change later.
+  static CacheRecord makeRecord(std::string source_path, const FileStamp& stamp, std::string_view contents)
+  {
+    return {.source_path = std::move(source_path),
+            .write_time  = stamp.write_time,
+            .file_size   = stamp.size,
+            .source_hash = OutputCache::hash_contents(contents)};
+  }
+
+  // Serves the module for `path_string` from the module archive or the disk
+  // cache, if either has an intact entry for `key` whose dependencies haven't
+  // changed. Otherwise, returns SLANG_E_NOT_FOUND and leaves `record` alone.
+  SlangResult loadStoredModule(std::string_view path_string, uint64_t key, CacheRecord& record, ISlangBlob** outBlob)
+  {
+    // Is it in the module archive? Its entries have the same format as the
+    // disk cache's.
+    if(m_moduleArchive)
+    {
+      const timer::time_point start = timer::now();
+      TraceZone               zone("module archive load");
+
+      const ArchiveIndexEntry*                     entry = m_moduleArchive->find(key);
+      std::shared_ptr<const void>                  owner = m_moduleArchive;
+      std::vector<char>                            decompressed;
+      std::string_view                             payload;
+      size_t                                       module_size = 0;
+      std::vector<std::pair<std::string, uint64_t>> dependencies;
+      if(entry && m_moduleArchive->read(*entry, decompressed, payload))
+      {
+        if(entry->compression != ArchiveCompression::kNone)
+        {
+          // The blob owns the decompressed copy instead.
+          std::shared_ptr<std::vector<char>> copy = std::make_shared<std::vector<char>>(std::move(decompressed));
+          payload                                 = std::string_view(copy->data(), copy->size());
+          owner                                   = std::move(copy);
+        }
+        if(parseDiskEntry(payload, module_size, dependencies) && dependenciesMatch(dependencies))
+        {
+          printf("Module archive load time: %f ms\n", milliseconds_between(start, timer::now()));
+          return useStoredModule(path_string, key, std::move(record), dependencies,
+                                 MySharedBlob::create(std::move(owner), payload.data(), module_size), outBlob);
+        }
+      }
+    }
+
+    // Did a previous process already compile it?
+    if(m_diskCache.enabled())
+    {
+      const timer::time_point start = timer::now();
+      TraceZone               zone("disk cache load");
+
+      MappedFile                                   mapped;
+      size_t                                       module_size = 0;
+      std::vector<std::pair<std::string, uint64_t>> dependencies;
+      if(m_diskCache.load(key, ".slang-module", mapped) && parseDiskEntry(mapped.view(), module_size, dependencies)
+         && dependenciesMatch(dependencies))
+      {
+        const timer::time_point                         end      = timer::now();
+        const std::chrono::duration<double, std::milli> duration = (end - start);
+        printf("Module disk cache load time: %f ms\n", duration.count());
+        return useStoredModule(path_string, key, std::move(record), dependencies,
+                               MyMappedBlob::create(std::move(mapped), module_size), outBlob);
+      }
+    }
+    return SLANG_E_NOT_FOUND;
+  }
+
+  // Caches a module that was loaded from the disk cache or the module archive
+  // instead of compiled, and returns it.
+  SlangResult useStoredModule(std::string_view                                     path_string,
+                              uint64_t                                             key,
+                              CacheRecord&&                                        record,
+                              const std::vector<std::pair<std::string, uint64_t>>& dependencies,
+                              Slang::ComPtr<ISlangBlob>                            blob,
+                              ISlangBlob**                                         outBlob)
+  {
+    for(const auto& dependency : dependencies)
+    {
+      record.dependencies.push_back(dependency.first);
+    }
+    record.fingerprint           = fingerprint(key, record.dependencies);
+    m_moduleRecords[path_string] = std::move(record);
+    m_moduleCache[path_string]   = blob;
+    // The blob should have a reference count of 2; one in m_moduleCache,
+    // and the other in the pointer we're returning.
+    assert(blob->addRef() == 3 && blob->release());
+    *outBlob = blob.detach();
+    return SLANG_OK;
+  }
+
+  uint64_t fingerprint(uint64_t key, const std::vector<std::string>& dependencies) const
+  {
+    Hasher hasher;
+    hasher.add_int(key);
+    for(const std::string& dependency : dependencies)
+    {
+      const auto& it = m_moduleRecords.find(dependency);
+      hasher.add_string(dependency);
+      hasher.add_int(it == m_moduleRecords.end() ? 0 : it->second.fingerprint);
+    }
+    return hasher.get();
+  }
+
+  // Disk cache entries are the serialized module followed by a table of its
+  // dependencies and their fingerprints at the time it was compiled:
+  // [module][{fingerprint: u64, path length: u32, path}...]
+  // [dependency count: u32][module size: u64][kDiskEntryMagic: u64]
+  static constexpr uint64_t kDiskEntryMagic = 0x3130506544434753ULL;  // "SGCDeP01"
+
+  std::vector<char> makeDiskEntry(ISlangBlob* serialized_module, const std::vector<std::string>& dependencies) const
+  {
+    std::vector<char> entry;
+    const auto        append = [&entry](const void* data, size_t size) {
+      entry.insert(entry.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+    };
+    const uint64_t module_size = serialized_module->getBufferSize();
+    append(serialized_module->getBufferPointer(), module_size);
+    for(const std::string& dependency : dependencies)
+    {
+      const auto&    it          = m_moduleRecords.find(dependency);
+      const uint64_t fingerprint = (it == m_moduleRecords.end() ? 0 : it->second.fingerprint);
+      const uint32_t path_length = static_cast<uint32_t>(dependency.size());
+      append(&fingerprint, sizeof(fingerprint));
+      append(&path_length, sizeof(path_length));
+      append(dependency.data(), dependency.size());
+    }
+    const uint32_t dependency_count = static_cast<uint32_t>(dependencies.size());
+    append(&dependency_count, sizeof(dependency_count));
+    append(&module_size, sizeof(module_size));
+    append(&kDiskEntryMagic, sizeof(kDiskEntryMagic));
+    return entry;
+  }
+
+  // Returns false if the entry is malformed.
+  static bool parseDiskEntry(std::string_view entry, size_t& module_size, std::vector<std::pair<std::string, uint64_t>>& dependencies)
+  {
+    const char*    data = entry.data();
+    const size_t   size = entry.size();
+    uint64_t       magic{}, stored_module_size{};
+    uint32_t       dependency_count{};
+    constexpr auto footer_size = sizeof(dependency_count) + sizeof(stored_module_size) + sizeof(magic);
+    if(size < footer_size)
+    {
+      return false;
+    }
+    memcpy(&dependency_count, data + size - footer_size, sizeof(dependency_count));
+    memcpy(&stored_module_size, data + size - sizeof(magic) - sizeof(stored_module_size), sizeof(stored_module_size));
+    memcpy(&magic, data + size - sizeof(magic), sizeof(magic));
+    if(magic != kDiskEntryMagic || stored_module_size > size - footer_size)
+    {
+      return false;
+    }
+
+    size_t offset = static_cast<size_t>(stored_module_size);
+    for(uint32_t i = 0; i < dependency_count; i++)
+    {
+      uint64_t fingerprint{};
+      uint32_t path_length{};
+      if(size - footer_size - offset < sizeof(fingerprint) + sizeof(path_length))
+      {
+        return false;
+      }
+      memcpy(&fingerprint, data + offset, sizeof(fingerprint));
+      memcpy(&path_length, data + offset + sizeof(fingerprint), sizeof(path_length));
+      offset += sizeof(fingerprint) + sizeof(path_length);
+      if(size - footer_size - offset < path_length)
+      {
+        return false;
+      }
+      dependencies.emplace_back(std::string(data + offset, path_length), fingerprint);
+      offset += path_length;
+    }
+
+    module_size = static_cast<size_t>(stored_module_size);
+    return true;
+  }
+
+  // Loads each dependency of a disk cache entry, and returns whether they all
+  // still have the fingerprints they had when the entry was written.
+  bool dependenciesMatch(const std::vector<std::pair<std::string, uint64_t>>& dependencies)
+  {
+    for(const auto& [dependency, expected_fingerprint] : dependencies)
+    {
+      Slang::ComPtr<ISlangBlob> blob;
+      if(SLANG_FAILED(loadCachedFile(dependency, dependency.c_str(), blob.writeRef())))
+      {
+        return false;
+      }
+      const auto& it = m_moduleRecords.find(dependency);
+      if(it == m_moduleRecords.end() || it->second.fingerprint != expected_fingerprint)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Removes the cache entries whose files changed since they were loaded,
+  // along with every entry that depends on them. Returns how many entries were
+  // removed.
+  size_t invalidateChangedFiles()
+  {
+    std::vector<std::string> changed;
+    for(auto&& [key, record] : m_moduleRecords)
+    {
+      // Only rehash files whose size or timestamp changed.
+      count_filesystem_call(2);
+      std::error_code error;
+      const fs::file_time_type write_time = fs::last_write_time(record.source_path, error);
+      const uintmax_t          file_size  = error ? 0 : fs::file_size(record.source_path, error);
+      if(record.missing)
+      {
+        // Only creating the file changes a missing one.
+        if(!error)
+        {
+          changed.emplace_back(key);
+        }
+        continue;
+      }
+      if(!error && write_time == record.write_time && file_size == record.file_size)
+      {
+        continue;
+      }
+
+      // Saving a file without editing it changes its timestamp but not its hash.
+      std::optional<std::string> contents;
+      if(!error)
+      {
+        contents = load_file(record.source_path.c_str());
+      }
+      if(contents.has_value() && OutputCache::hash_contents(contents.value()) == record.source_hash)
+      {
+        record.write_time = write_time;
+        record.file_size  = file_size;
+        continue;
+      }
+      changed.emplace_back(key);
+    }
+    return invalidateEntries(std::move(changed));
+  }
+
+  // Removes the cache entries with the given keys, along with every entry that
+  // depends on them. Returns how many entries were removed.
+  size_t invalidateEntries(std::vector<std::string> changed)
+  {
+    if(changed.empty())
+    {
+      return 0;
+    }
+
+    // Walk the dependency graph backwards from the changed files.
+    std::unordered_map<std::string, std::vector<std::string>> dependents;
+    for(const auto& [key, record] : m_moduleRecords)
+    {
+      for(const std::string& dependency : record.dependencies)
+      {
+        dependents[dependency].emplace_back(key);
+      }
+    }
+    std::unordered_set<std::string> invalid;
+    while(!changed.empty())
+    {
+      const std::string key = std::move(changed.back());
+      changed.pop_back();
+      if(!invalid.insert(key).second)
+      {
+        continue;
+      }
+      const auto& it = dependents.find(key);
+      if(it != dependents.end())
+      {
+        changed.insert(changed.end(), it->second.begin(), it->second.end());
+      }
+    }
+
+    for(const std::string& key : invalid)
+    {
+      m_moduleCache.erase(key);
+      m_moduleRecords.erase(key);
+    }
+    m_moduleCacheGeneration++;
+    return invalid.size();
+  }
 
 private:
-  Slang::ComPtr<slang::IGlobalSession>    m_globalSession;
-  std::vector<slang::TargetDesc>          m_targets;
-  std::vector<slang::CompilerOptionEntry> m_options;
-  std::string                             m_currentSearchPath;
-  const char*                             m_currentSearchPathCString;
-  Slang::ComPtr<ISlangBlob>               m_spirv;
+  Slang::ComPtr<slang::IGlobalSession>      m_globalSession;
+  std::vector<slang::TargetDesc>            m_targets;
+  std::vector<slang::CompilerOptionEntry>   m_options;
+  std::string                               m_currentMainShaderPath;
+  std::string                               m_currentSearchPath;
+  const char*                               m_currentSearchPathCString;
+  // Paths joined by loadFile() and calcCombinedPath() (from directories and
+  // from files).
+  PathInterner m_paths;
+  PathInterner m_combinedPaths[2];
+  Slang::ComPtr<ISlangBlob>                 m_spirv;
+  SlangCoreModule                           m_coreModule = SlangCoreModule::kDefault;
+  OutputCache                               m_outputCache;
+  OutputCache::Output                       m_cachedSpirv;  // If the last compile() was a hit
+  bool                                      m_enableGlsl = false;
+  std::shared_ptr<SharedSlangGlobalSession> m_sharedGlobalSession;
+  bool                                      m_poolSessions = false;
+  std::optional<uint64_t>                   m_settingsHash;  // See settingsHash()
+  // Pooled sessions and their keys; see getSession().
+  static constexpr size_t                                          kMaxPooledSessions = 8;
+  std::vector<std::pair<uint64_t, Slang::ComPtr<slang::ISession>>> m_sessionPool;
+  SlangPhaseTimes                                                  m_phaseTimes;
+  bool                                                             m_reflection = false;
+  SlangReflectionStats                                             m_reflectionStats;
+  // Sums values the reflection walk reads, so that each query is used.
+  uint64_t m_reflectionChecksum = 0;
+  SlangHelperSettings                                              m_settings;
+  std::vector<Slang::ComPtr<ISlangBlob>>                           m_permutationOutputs;
 
-#ifdef USE_MODULE_CACHE
   // Fake reference count used so that we can implement IUnknown.
   uint32_t m_fakeReferenceCount = 1;
   // Map of the following:
   // [include path with .slang-module extension] -> [.slang precompiled to a .slang-module blob]
   // [other file type] -> [file contents]
   // [file that doesn't exist] -> nullptr
-  std::unordered_map<std::string, Slang::ComPtr<ISlangBlob>> m_moduleCache;
-#endif
+  PathMap<Slang::ComPtr<ISlangBlob>> m_moduleCache;
+  // Records for every entry in m_moduleCache, with the same keys.
+  PathMap<CacheRecord> m_moduleRecords;
+  // weakly_canonical() of CacheRecord::source_paths, for invalidate_files().
+  PathMap<std::string> m_canonicalSourcePaths;
+  // While we compile modules inside loadFile(), this contains one list of
+  // dependencies for each module being compiled.
+  std::vector<std::vector<std::string>> m_compileStack;
+  bool                                  m_trackChanges       = false;
+  size_t                                m_numModulesCompiled = 0;
+  size_t                                m_precompileThreads  = 0;
+  // Incremented whenever entries are removed from m_moduleCache.
+  uint64_t m_moduleCacheGeneration = 0;
+  // m_moduleCacheGeneration when we last cleared the interned paths.
+  uint64_t m_internedPathsGeneration = 0;
+  // Optional on-disk tier below m_moduleCache.
+  DiskCache m_diskCache;
+  // Optional archive of modules, checked before m_diskCache.
+  std::shared_ptr<ArchiveReader> m_moduleArchive;
 };
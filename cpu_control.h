@@ -0,0 +1,193 @@
+#pragma once
+
+// Controls for making timings less noisy: pinning threads to cores, raising
+// the process's priority, and checking whether the CPU's frequency boost is
+// on. A pinned thread doesn't migrate between cores (losing its caches), and
+// a high-priority one is interrupted less. Boost makes clock speeds depend on
+// temperature and on what other cores are doing, so consecutive runs can
+// differ; --cooldown and --ab's interleaving make that affect every sample
+// alike.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#endif
+
+#include <optional>
+#include <span>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string_view>
+#include <vector>
+
+// Parses a comma-separated list of CPU numbers and ranges (e.g. "2,4-7", like
+// taskset) into `cpus`. Returns false if it isn't one.
+inline bool parse_cpu_list(std::string_view list, std::vector<uint32_t>& cpus)
+{
+  cpus.clear();
+  while(!list.empty())
+  {
+    const size_t           comma = list.find(',');
+    const std::string_view item  = list.substr(0, comma);
+    const size_t           dash  = item.find('-');
+
+    // The first and last CPU in the range.
+    const std::string_view parts[2] = {item.substr(0, dash), dash == std::string_view::npos ? item : item.substr(dash + 1)};
+    uint32_t               range[2] = {0, 0};
+    for(size_t i = 0; i < 2; i++)
+    {
+      if(parts[i].empty())
+      {
+        return false;
+      }
+      for(const char c : parts[i])
+      {
+        if(c < '0' || c > '9')
+        {
+          return false;
+        }
+        range[i] = range[i] * 10 + static_cast<uint32_t>(c - '0');
+      }
+    }
+    if(range[1] < range[0] || range[1] > 65535)
+    {
+      return false;
+    }
+    for(uint32_t cpu = range[0]; cpu <= range[1]; cpu++)
+    {
+      cpus.push_back(cpu);
+    }
+    list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+  }
+  return !cpus.empty();
+}
+
+// Pins the calling thread to the logical CPUs in `cpus` (it may run on any
+// of them). On Windows, a thread can only run in one processor group, so this
+// only uses the CPUs in the first one's group. Returns false on failure.
+inline bool pin_current_thread(std::span<const uint32_t> cpus)
+{
+  if(cpus.empty())
+  {
+    return false;
+  }
+#ifdef _WIN32
+  // Processor groups hold up to 64 logical CPUs each.
+  GROUP_AFFINITY affinity{};
+  affinity.Group = static_cast<WORD>(cpus[0] / 64);
+  for(const uint32_t cpu : cpus)
+  {
+    if(cpu / 64 == affinity.Group)
+    {
+      affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+    }
+  }
+  if(!SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr))
+  {
+    fprintf(stderr, "Could not pin thread to CPU %u (error %lu).\n", cpus[0], GetLastError());
+    return false;
+  }
+#else
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(const uint32_t cpu : cpus)
+  {
+    if(cpu >= CPU_SETSIZE)
+    {
+      fprintf(stderr, "CPU %u is out of range.\n", cpu);
+      return false;
+    }
+    CPU_SET(cpu, &set);
+  }
+  const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if(error != 0)
+  {
+    fprintf(stderr, "Could not pin thread to CPU %u: %s\n", cpus[0], strerror(error));
+    return false;
+  }
+#endif
+  return true;
+}
+
+inline bool pin_current_thread(uint32_t cpu)
+{
+  return pin_current_thread(std::span<const uint32_t>(&cpu, 1));
+}
+
+// CPUs for threads that help the compiling thread (precompile workers,
+// output sinks, compile schedulers), or empty to leave them alone. Threads
+// start with their creator's affinity, so without this, helpers started by a
+// thread pinned to one CPU would all share it. Set before starting threads.
+inline std::vector<uint32_t> g_helper_cpus;
+
+// Helper threads call this when they start.
+inline void pin_helper_thread()
+{
+  if(!g_helper_cpus.empty())
+  {
+    pin_current_thread(g_helper_cpus);
+  }
+}
+
+// Raises the priority of the process and the calling thread. On Linux,
+// lowering niceness needs CAP_SYS_NICE (or root). Returns false on failure.
+inline bool raise_priority()
+{
+#ifdef _WIN32
+  // HIGH rather than REALTIME, which can starve the system's own threads.
+  if(!SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS)
+     || !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST))
+  {
+    fprintf(stderr, "Could not raise priority (error %lu).\n", GetLastError());
+    return false;
+  }
+#else
+  if(setpriority(PRIO_PROCESS, 0, -20) != 0)
+  {
+    fprintf(stderr, "Could not raise priority: %s (this needs CAP_SYS_NICE or root).\n", strerror(errno));
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Returns whether the CPU's frequency boost (Turbo Boost, Precision Boost) is
+// on, or nullopt if we can't tell.
+inline std::optional<bool> cpu_boost_enabled()
+{
+#ifdef _WIN32
+  return std::nullopt;
+#else
+  const auto read_flag = [](const char* path) -> std::optional<bool> {
+    FILE* file = fopen(path, "r");
+    if(!file)
+    {
+      return std::nullopt;
+    }
+    int       value = 0;
+    const int read  = fscanf(file, "%d", &value);
+    fclose(file);
+    return (read == 1) ? std::optional<bool>(value != 0) : std::nullopt;
+  };
+  // acpi-cpufreq and amd-pstate
+  if(const std::optional<bool> boost = read_flag("/sys/devices/system/cpu/cpufreq/boost"))
+  {
+    return boost;
+  }
+  // intel_pstate
+  if(const std::optional<bool> no_turbo = read_flag("/sys/devices/system/cpu/intel_pstate/no_turbo"))
+  {
+    return !no_turbo.value();
+  }
+  return std::nullopt;
+#endif
+}
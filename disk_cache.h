@@ -0,0 +1,104 @@
+#pragma once
+
+// A directory of cache entries keyed by 64-bit hashes.
+// Entries are written to a temporary file and then renamed into place, so
+// readers never see (or map) a partially-written entry, and entries are never
+// modified after they're created.
+
+#include "mapped_file.h"
+#include "utilities.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <system_error>
+
+class DiskCache
+{
+public:
+  // Sets the directory to store entries in, creating it if necessary.
+  // An empty path disables the cache. Returns false on failure.
+  bool set_directory(const fs::path& directory)
+  {
+    m_directory.clear();
+    if(directory.empty())
+    {
+      return true;
+    }
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if(error)
+    {
+      fprintf(stderr, "Could not create cache directory %s: %s\n", directory.string().c_str(), error.message().c_str());
+      return false;
+    }
+    m_directory = directory;
+    return true;
+  }
+
+  bool            enabled() const { return !m_directory.empty(); }
+  const fs::path& directory() const { return m_directory; }
+
+  fs::path entry_path(uint64_t key, const char* extension) const
+  {
+    return m_directory / (hex_string(key) + extension);
+  }
+
+  // Maps the entry for `key`; returns false if there isn't one.
+  bool load(uint64_t key, const char* extension, MappedFile& out) const
+  {
+    if(!enabled())
+    {
+      return false;
+    }
+    count_filesystem_call();
+    return out.open(entry_path(key, extension));
+  }
+
+  // Stores an entry; returns false on failure.
+  bool store(uint64_t key, const char* extension, const void* data, size_t size) const
+  {
+    if(!enabled())
+    {
+      return false;
+    }
+
+    // Writing and renaming
+    count_filesystem_call(2);
+
+    // The temporary name only needs to be unique among concurrent writers.
+    static std::atomic<uint64_t> s_counter = 0;
+    const fs::path               final_path = entry_path(key, extension);
+    fs::path                     temp_path  = final_path;
+    temp_path += "." + hex_string(timer::now().time_since_epoch().count() ^ s_counter++) + ".tmp";
+
+    {
+      std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+      file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+      if(!file)
+      {
+        fprintf(stderr, "Could not write cache entry %s.\n", temp_path.string().c_str());
+        std::error_code ignored;
+        fs::remove(temp_path, ignored);
+        return false;
+      }
+    }
+
+    std::error_code error;
+    fs::rename(temp_path, final_path, error);
+    if(error)
+    {
+      // This can happen if another process is mapping the same entry; since
+      // entries with the same key have the same contents, that's fine.
+      fs::remove(temp_path, error);
+      return false;
+    }
+    return true;
+  }
+
+private:
+  fs::path m_directory;
+};
@@ -0,0 +1,238 @@
+#pragma once
+
+// Watches a directory tree for changed files, using inotify on Linux and
+// ReadDirectoryChangesW on Windows. Other platforms aren't supported.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "utilities.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+class FileWatcher
+{
+public:
+  FileWatcher() = default;
+  ~FileWatcher() { close(); }
+
+  FileWatcher(const FileWatcher&)            = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // Starts watching `directory` and its subdirectories. Returns false on
+  // failure.
+  bool watch(const fs::path& directory)
+  {
+    close();
+    m_root = directory;
+#ifdef _WIN32
+    m_directory = CreateFileW(directory.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if(m_directory == INVALID_HANDLE_VALUE)
+    {
+      fprintf(stderr, "Could not open %s to watch it.\n", directory.string().c_str());
+      return false;
+    }
+    m_overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if(!m_overlapped.hEvent || !beginRead())
+    {
+      fprintf(stderr, "Could not watch %s for changes.\n", directory.string().c_str());
+      close();
+      return false;
+    }
+    return true;
+#elif defined(__linux__)
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_fd < 0)
+    {
+      fprintf(stderr, "inotify_init1() failed: %s\n", strerror(errno));
+      return false;
+    }
+    if(!addWatch(directory))
+    {
+      close();
+      return false;
+    }
+    // inotify doesn't watch subdirectories, so add them one at a time.
+    std::error_code error;
+    for(const fs::directory_entry& entry : fs::recursive_directory_iterator(directory, error))
+    {
+      if(entry.is_directory(error) && !addWatch(entry.path()))
+      {
+        close();
+        return false;
+      }
+    }
+    return true;
+#else
+    fprintf(stderr, "Watching files isn't supported on this platform.\n");
+    return false;
+#endif
+  }
+
+  // Waits up to `timeout_ms` milliseconds for files to change, and appends the
+  // paths of changed (created, written, renamed or deleted) files to `changed`.
+  // If events were lost, appends the watched directory itself; then, any file
+  // might have changed. Returns false on error.
+  bool wait(int timeout_ms, std::vector<std::string>& changed)
+  {
+#ifdef _WIN32
+    if(WaitForSingleObject(m_overlapped.hEvent, static_cast<DWORD>(timeout_ms)) != WAIT_OBJECT_0)
+    {
+      return true;
+    }
+    DWORD num_bytes = 0;
+    if(!GetOverlappedResult(m_directory, &m_overlapped, &num_bytes, FALSE))
+    {
+      fprintf(stderr, "ReadDirectoryChangesW() failed.\n");
+      return false;
+    }
+    if(num_bytes == 0)
+    {
+      // The buffer overflowed.
+      changed.push_back(m_root.string());
+    }
+    for(size_t offset = 0; num_bytes > 0;)
+    {
+      const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(m_buffer + offset);
+      const std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+      changed.push_back((m_root / fs::path(name)).string());
+      if(info->NextEntryOffset == 0)
+      {
+        break;
+      }
+      offset += info->NextEntryOffset;
+    }
+    return beginRead();
+#elif defined(__linux__)
+    pollfd poll_fd{.fd = m_fd, .events = POLLIN, .revents = 0};
+    const int num_ready = poll(&poll_fd, 1, timeout_ms);
+    if(num_ready < 0 && errno != EINTR)
+    {
+      fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+      return false;
+    }
+    if(num_ready <= 0)
+    {
+      return true;
+    }
+    while(true)
+    {
+      const ssize_t num_bytes = read(m_fd, m_buffer, sizeof(m_buffer));
+      if(num_bytes < 0)
+      {
+        if(errno == EAGAIN || errno == EINTR)
+        {
+          return true;
+        }
+        fprintf(stderr, "Reading inotify events failed: %s\n", strerror(errno));
+        return false;
+      }
+      for(ssize_t offset = 0; offset < num_bytes;)
+      {
+        const inotify_event* event = reinterpret_cast<const inotify_event*>(m_buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+        if(event->mask & IN_Q_OVERFLOW)
+        {
+          changed.push_back(m_root.string());
+          continue;
+        }
+        const auto& it = m_watches.find(event->wd);
+        if(it == m_watches.end() || event->len == 0)
+        {
+          continue;
+        }
+        const fs::path path = it->second / event->name;
+        if(event->mask & IN_ISDIR)
+        {
+          // Watch new directories too; files in them are reported as they're
+          // written.
+          if(event->mask & (IN_CREATE | IN_MOVED_TO))
+          {
+            addWatch(path);
+          }
+          continue;
+        }
+        changed.push_back(path.string());
+      }
+    }
+#else
+    return false;
+#endif
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if(m_directory != INVALID_HANDLE_VALUE)
+    {
+      CancelIo(m_directory);
+      CloseHandle(m_directory);
+      m_directory = INVALID_HANDLE_VALUE;
+    }
+    if(m_overlapped.hEvent)
+    {
+      CloseHandle(m_overlapped.hEvent);
+    }
+    m_overlapped = {};
+#elif defined(__linux__)
+    if(m_fd >= 0)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+    m_watches.clear();
+#endif
+  }
+
+private:
+#ifdef _WIN32
+  bool beginRead()
+  {
+    ResetEvent(m_overlapped.hEvent);
+    return ReadDirectoryChangesW(m_directory, m_buffer, sizeof(m_buffer), TRUE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                                 nullptr, &m_overlapped, nullptr);
+  }
+
+  HANDLE     m_directory  = INVALID_HANDLE_VALUE;
+  OVERLAPPED m_overlapped = {};
+  // ReadDirectoryChangesW requires DWORD alignment.
+  alignas(DWORD) char m_buffer[64 * 1024];
+#elif defined(__linux__)
+  bool addWatch(const fs::path& directory)
+  {
+    // Editors either write files in place or write a temporary file and rename
+    // it over the original.
+    const int wd = inotify_add_watch(m_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+    if(wd < 0)
+    {
+      fprintf(stderr, "Could not watch %s: %s\n", directory.string().c_str(), strerror(errno));
+      return false;
+    }
+    m_watches[wd] = directory;
+    return true;
+  }
+
+  int                               m_fd = -1;
+  std::unordered_map<int, fs::path> m_watches;  // Watch descriptor -> directory
+  alignas(inotify_event) char m_buffer[64 * 1024];
+#endif
+  fs::path m_root;
+};
@@ -0,0 +1,326 @@
+#pragma once
+
+// Blocking byte streams between processes on the same machine: Unix domain
+// sockets on Linux and macOS, and named pipes on Windows. Used by the compile
+// server and its clients.
+//
+// Names without a slash are turned into a socket file in the temporary
+// directory, or a pipe in \\.\pipe\; other names are used as socket paths.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "utilities.h"
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <utility>
+
+class LocalConnection
+{
+public:
+  LocalConnection() = default;
+  ~LocalConnection() { close(); }
+
+  LocalConnection(const LocalConnection&)            = delete;
+  LocalConnection& operator=(const LocalConnection&) = delete;
+  LocalConnection(LocalConnection&& other) noexcept { *this = std::move(other); }
+  LocalConnection& operator=(LocalConnection&& other) noexcept
+  {
+    if(this != &other)
+    {
+      close();
+      std::swap(m_handle, other.m_handle);
+      std::swap(m_isServer, other.m_isServer);
+    }
+    return *this;
+  }
+
+  // Connects to a server listening on `name`. Returns false on failure.
+  bool connect(const char* name)
+  {
+    close();
+#ifdef _WIN32
+    const std::wstring path = endpoint_path(name);
+    while(true)
+    {
+      m_handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+      if(m_handle != INVALID_HANDLE_VALUE)
+      {
+        return true;
+      }
+      // All instances are busy; wait for one.
+      if(GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(path.c_str(), 5000))
+      {
+        fprintf(stderr, "Could not connect to %s.\n", name);
+        return false;
+      }
+    }
+#else
+    sockaddr_un address{};
+    if(!make_address(name, address))
+    {
+      return false;
+    }
+    m_handle = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_handle < 0 || ::connect(m_handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+      fprintf(stderr, "Could not connect to %s: %s\n", address.sun_path, strerror(errno));
+      close();
+      return false;
+    }
+    return true;
+#endif
+  }
+
+  bool is_open() const { return m_handle != kInvalid; }
+
+  // Sends or receives exactly `size` bytes. Returns false on failure, or if
+  // the other end closed the connection.
+  bool send(const void* data, size_t size)
+  {
+    const char* bytes = static_cast<const char*>(data);
+    while(size > 0)
+    {
+#ifdef _WIN32
+      DWORD written = 0;
+      if(!WriteFile(m_handle, bytes, static_cast<DWORD>(std::min<size_t>(size, 1 << 30)), &written, nullptr))
+      {
+        return false;
+      }
+#else
+      const ssize_t written = ::send(m_handle, bytes, size, MSG_NOSIGNAL);
+      if(written < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if(written <= 0)
+      {
+        return false;
+      }
+#endif
+      bytes += written;
+      size -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  bool receive(void* data, size_t size)
+  {
+    char* bytes = static_cast<char*>(data);
+    while(size > 0)
+    {
+#ifdef _WIN32
+      DWORD num_read = 0;
+      if(!ReadFile(m_handle, bytes, static_cast<DWORD>(std::min<size_t>(size, 1 << 30)), &num_read, nullptr) || num_read == 0)
+      {
+        return false;
+      }
+#else
+      const ssize_t num_read = ::recv(m_handle, bytes, size, 0);
+      if(num_read < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if(num_read <= 0)
+      {
+        return false;
+      }
+#endif
+      bytes += num_read;
+      size -= static_cast<size_t>(num_read);
+    }
+    return true;
+  }
+
+  // Strings longer than this are refused, so that a bad length from the peer
+  // can't make us allocate gigabytes.
+  static constexpr uint64_t kMaxBytes = uint64_t(256) << 20;
+
+  // Integers are sent as native-endian uint64_ts, and strings with their
+  // length first.
+  bool send_u64(uint64_t value) { return send(&value, sizeof(value)); }
+  bool send_bytes(std::string_view bytes)
+  {
+    if(bytes.size() > kMaxBytes)
+    {
+      fprintf(stderr, "Can't send %zu bytes; the limit is %llu.\n", bytes.size(), static_cast<unsigned long long>(kMaxBytes));
+      return false;
+    }
+    return send_u64(bytes.size()) && send(bytes.data(), bytes.size());
+  }
+  bool receive_u64(uint64_t& value) { return receive(&value, sizeof(value)); }
+  bool receive_bytes(std::string& bytes)
+  {
+    uint64_t size = 0;
+    if(!receive_u64(size))
+    {
+      return false;
+    }
+    if(size > kMaxBytes)
+    {
+      fprintf(stderr, "Refusing to receive %llu bytes; the limit is %llu.\n", static_cast<unsigned long long>(size),
+              static_cast<unsigned long long>(kMaxBytes));
+      return false;
+    }
+    bytes.resize(static_cast<size_t>(size));
+    return receive(bytes.data(), size);
+  }
+
+  void close()
+  {
+    if(m_handle == kInvalid)
+    {
+      return;
+    }
+#ifdef _WIN32
+    if(m_isServer)
+    {
+      FlushFileBuffers(m_handle);
+      DisconnectNamedPipe(m_handle);
+    }
+    CloseHandle(m_handle);
+#else
+    ::close(m_handle);
+#endif
+    m_handle = kInvalid;
+  }
+
+#ifdef _WIN32
+  static std::wstring endpoint_path(const char* name)
+  {
+    return L"\\\\.\\pipe\\" + fs::path(name).wstring();
+  }
+#else
+  static bool make_address(const char* name, sockaddr_un& address)
+  {
+    const std::string path = strchr(name, '/') ? std::string(name) : (fs::temp_directory_path() / (std::string(name) + ".sock")).string();
+    if(path.size() >= sizeof(address.sun_path))
+    {
+      fprintf(stderr, "Socket path %s is too long.\n", path.c_str());
+      return false;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+  }
+#endif
+
+private:
+  friend class LocalListener;
+#ifdef _WIN32
+  using Handle                      = HANDLE;
+  static inline const Handle kInvalid = INVALID_HANDLE_VALUE;
+#else
+  using Handle                      = int;
+  static constexpr Handle kInvalid  = -1;
+#endif
+  Handle m_handle   = kInvalid;
+  bool   m_isServer = false;  // Windows: disconnect the pipe instance on close
+};
+
+class LocalListener
+{
+public:
+  LocalListener() = default;
+  ~LocalListener() { close(); }
+
+  LocalListener(const LocalListener&)            = delete;
+  LocalListener& operator=(const LocalListener&) = delete;
+
+  // Starts listening on `name`. Returns false on failure.
+  bool listen(const char* name)
+  {
+    close();
+#ifdef _WIN32
+    m_path = LocalConnection::endpoint_path(name);
+    return true;
+#else
+    sockaddr_un address{};
+    if(!LocalConnection::make_address(name, address))
+    {
+      return false;
+    }
+    // Remove the socket file a previous server left behind.
+    unlink(address.sun_path);
+    m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(m_fd < 0 || bind(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(m_fd, 8) != 0)
+    {
+      fprintf(stderr, "Could not listen on %s: %s\n", address.sun_path, strerror(errno));
+      close();
+      return false;
+    }
+    m_path = address.sun_path;
+    return true;
+#endif
+  }
+
+  // Waits for a client to connect. Returns a closed connection on failure.
+  LocalConnection accept()
+  {
+    LocalConnection connection;
+#ifdef _WIN32
+    // Each client gets its own pipe instance.
+    HANDLE pipe = CreateNamedPipeW(m_path.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                                   PIPE_UNLIMITED_INSTANCES, 64 * 1024, 64 * 1024, 0, nullptr);
+    if(pipe == INVALID_HANDLE_VALUE)
+    {
+      fprintf(stderr, "CreateNamedPipeW() failed.\n");
+      return connection;
+    }
+    if(!ConnectNamedPipe(pipe, nullptr) && GetLastError() != ERROR_PIPE_CONNECTED)
+    {
+      CloseHandle(pipe);
+      return connection;
+    }
+    connection.m_handle   = pipe;
+    connection.m_isServer = true;
+#else
+    int fd = -1;
+    do
+    {
+      fd = ::accept(m_fd, nullptr, nullptr);
+    } while(fd < 0 && errno == EINTR);
+    connection.m_handle = fd;
+#endif
+    return connection;
+  }
+
+  void close()
+  {
+#ifndef _WIN32
+    if(m_fd >= 0)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+      unlink(m_path.c_str());
+    }
+#endif
+    m_path.clear();
+  }
+
+  // The socket path or pipe name.
+  std::string path() const { return fs::path(m_path).string(); }
+
+private:
+#ifdef _WIN32
+  std::wstring m_path;
+#else
+  int         m_fd = -1;
+  std::string m_path;
+#endif
+};
@@ -1,108 +1,3159 @@
-#ifdef HAS_DXC
-#include "compiler_dxc.h"
-#endif
-#ifdef HAS_SHADERC
-#include "compiler_shaderc.h"
-#endif
-#include "compiler_slang.h"
+#include "compile_scheduler.h"
+#include "compiler_backends.h"
+#include "cpu_control.h"
+#include "file_watcher.h"
+#include "ipc.h"
+#include "process.h"
+#include "memory_stats.h"
+#include "output_sink.h"
+#include "perf_counters.h"
+#include "report.h"
+#include "shader_generator.h"
+#include "statistics.h"
+#include "trace.h"
 #include "utilities.h"
 
+#include <algorithm>
+#include <bit>
+#include <csignal>
+#include <ctype.h>
 #include <fstream>
+#include <latch>
 #include <memory>
 #include <optional>
+#include <span>
 #include <stddef.h>
 #include <string.h>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
 
 //-----------------------------------------------------------------------------
 // Benchmark
 
-// Prints how long it takes the compiler to compile a given file.
-// Returns true if an operation failed.
-template <class Compiler>
-bool benchmark(const char* shader_path, const char* shader_source, const size_t num_repetitions, const bool enable_glsl)
+// Settings from the command line.
+struct BenchmarkOptions
 {
-  std::unique_ptr<Compiler> compiler;
+  size_t num_repetitions = 128;
+  bool   enable_glsl     = false;
+  // Slang only: directory for the on-disk module cache, or nullptr.
+  const char* module_cache_dir = nullptr;
+  // Slang only: number of threads to precompile imported modules on, or 0 to
+  // compile them one at a time as Slang loads them.
+  size_t precompile_threads = 0;
+  // Slang only: run benchmark_incremental() instead of benchmark().
+  bool incremental = false;
+  // Module for benchmark_incremental() to edit, relative to the shader's
+  // directory, or nullptr to pick one automatically.
+  const char* edit_module = nullptr;
+  // Slang only: run benchmark_watch() instead of benchmark().
+  bool watch = false;
+  // If not negative, benchmark_watch() compiles in the background, waiting
+  // for changes to stop arriving for this long first.
+  double debounce_ms = -1.0;
+  // If nonzero, run benchmark_bursts() with this many saves per burst, this
+  // far apart.
+  size_t save_burst       = 0;
+  double save_interval_ms = 20.0;
+  // If nonzero, run benchmark_threads() with this many threads.
+  size_t num_threads = 0;
+  // Slang only: reuse sessions between compiles when possible.
+  bool pool_sessions = false;
+  // Slang only: make benchmark_threads() share one global session between
+  // all threads.
+  bool share_global_session = false;
+  // Number of compiles before timing starts; the first is always reported.
+  size_t num_warmups = 1;
+  // If positive, stop timing repetitions after this many seconds.
+  double time_budget_s = 0.0;
+  // If positive, exclude samples whose MAD-based modified z-score exceeds
+  // this from summary statistics.
+  double mad_threshold = 0.0;
+  // Files to write machine-readable results to, or nullptr.
+  const char* json_path = nullptr;
+  const char* csv_path  = nullptr;
+  // If set, record trace zones and write them here as Chrome trace JSON.
+  const char* trace_path = nullptr;
+  // Slang only: settings for SlangCompilerHelper::set_settings().
+  SlangHelperSettings slang_settings;
+  // If set, run benchmark_ab() with this setting (see find_toggle()) flipped
+  // in the second configuration.
+  const char* ab_setting = nullptr;
+  // If set, run benchmark_batch() on the shaders listed in this file, or on
+  // the main shaders in this directory, instead of on one shader.
+  const char* manifest_path = nullptr;
+  const char* batch_dir     = nullptr;
+  // If set, benchmark() reports allocations and RSS.
+  bool track_memory = false;
+  // If set, put an OutputCache in front of the compiler, optionally also
+  // storing entries in this directory.
+  bool        output_cache     = false;
+  const char* output_cache_dir = nullptr;
+  // shaderc and DXC only: preprocess each source once, and compile the
+  // flattened source while neither it nor its includes change.
+  bool preprocess_cache = false;
+  // If set, write each shader's SPIR-V (with --dir, --manifest or
+  // --permutation) through an AsyncOutputSink to this archive or directory.
+  const char* output_archive = nullptr;
+  const char* output_dir     = nullptr;
+  // Compression for archives we write (see kArchiveCompressions).
+  ArchiveCompression archive_compression = ArchiveCompression::kNone;
+  // Slang only: if set, serve modules from this shader archive.
+  const char* module_archive = nullptr;
+  // Slang only: if set, run benchmark_module_archive() with this archive.
+  const char* archive_benchmark = nullptr;
+  // Slang only: walk the program's layout after each compile (see
+  // SlangCompilerHelper::set_reflection()).
+  bool reflection = false;
+  // Slang only: run benchmark_reflection() instead of benchmark().
+  bool reflection_benchmark = false;
+  // If set, run run_server() or benchmark_client() on this socket or pipe.
+  const char* server_name = nullptr;
+  const char* client_name = nullptr;
+  // With a client, ask the server to shut down afterwards.
+  bool stop_server = false;
+  // If nonzero, run benchmark_cold_start() with this many child processes.
+  size_t num_cold_starts = 0;
+  // If set, this is a child process started by benchmark_cold_start() at
+  // this process_clock_ns() time, and main() started at main_start_ns.
+  const char* cold_start_child = nullptr;
+  int64_t     main_start_ns    = 0;
+  // Slang only: where to get the core module from (see kCoreModules), or
+  // nullptr to compare the default to compiling it from source.
+  const char* core_module = nullptr;
+  // argv[0], in case we can't find our own executable another way.
+  const char* executable = nullptr;
+  // Slang only: if not empty, run benchmark_permutations() with these.
+  std::vector<SlangPermutation> permutations;
+  // If set, run benchmark_sweep() over these optimization and debug info
+  // levels (see CodegenSettings), with validation and EmitSpirvDirectly on
+  // and off.
+  bool             sweep              = false;
+  std::vector<int> sweep_optimization = {0, 2};
+  std::vector<int> sweep_debug_info   = {0, 2};
+  // If set, run benchmark_scaling(), multiplying this GeneratorSettings member
+  // (called scaling_name on the command line) by each of scaling_sizes.
+  size_t GeneratorSettings::*scaling_dimension = nullptr;
+  const char*                scaling_name      = nullptr;
+  std::vector<size_t>        scaling_sizes     = {1, 2, 4, 8};
+  // If set, fit compile time against the dimension's value instead of source
+  // size (see ScalingDimension::grows_source).
+  bool scaling_by_value = false;
+  // If set, skip sizes whose value is above this member (see
+  // ScalingDimension::limit).
+  size_t GeneratorSettings::*scaling_limit = nullptr;
+  // If not empty, pin the main thread to the first of these CPUs, -j's
+  // threads to each in turn, and helper threads to all of them.
+  std::vector<uint32_t> pin_cpus;
+  // If set, raise the process's priority (see raise_priority()).
+  bool high_priority = false;
+  // If positive, sleep this long before each timed compile, so that every
+  // sample starts from a similarly cool (and so similarly boosted) CPU.
+  double cooldown_ms = 0.0;
+  // If set, benchmark() reads hardware counters (see PerfCounters) around
+  // each repetition.
+  bool perf_counters = false;
+};
+
+// Returns the on/off setting in `options` called `name`, or nullptr if there
+// isn't one.
+bool* find_toggle(BenchmarkOptions& options, const char* name)
+{
+  const struct
+  {
+    const char* name;
+    bool*       value;
+  } toggles[] = {
+      {"module-cache", &options.slang_settings.module_cache},
+      {"filesystem-ext", &options.slang_settings.filesystem_ext},
+      {"validation", &options.slang_settings.validation},
+      {"arena-glue", &options.slang_settings.arena_glue},
+      {"pool-sessions", &options.pool_sessions},
+  };
+  for(const auto& toggle : toggles)
+  {
+    if(strcmp(toggle.name, name) == 0)
+    {
+      return toggle.value;
+    }
+  }
+  return nullptr;
+}
+
+// Values for --core-module.
+const struct
+{
+  const char*     name;
+  SlangCoreModule value;
+} kCoreModules[] = {
+    {"default", SlangCoreModule::kDefault},
+    {"embedded", SlangCoreModule::kEmbedded},
+    {"source", SlangCoreModule::kFromSource},
+};
+
+// Returns the core module option called `name`, or the default for nullptr.
+SlangCoreModule find_core_module(const char* name)
+{
+  for(const auto& core_module : kCoreModules)
+  {
+    if(name && strcmp(core_module.name, name) == 0)
+    {
+      return core_module.value;
+    }
+  }
+  return SlangCoreModule::kDefault;
+}
+
+// Values for --archive-compression.
+const struct
+{
+  const char*        name;
+  ArchiveCompression value;
+} kArchiveCompressions[] = {
+    {"none", ArchiveCompression::kNone},
+    {"lz4", ArchiveCompression::kLz4},
+    {"zstd", ArchiveCompression::kZstd},
+};
+
+// Adds the backends in the comma-separated list `list` (e.g.
+// "slang,shaderc") to the mask `backends`. Returns false if one isn't in this
+// build.
+bool parse_backends(std::string_view list, uint32_t& backends)
+{
+  while(!list.empty())
+  {
+    const size_t           comma = list.find(',');
+    const std::string_view name  = list.substr(0, comma);
+    const int              index = Backends::find(name);
+    if(index < 0)
+    {
+      fprintf(stderr, "Unknown backend %.*s; this build has:", static_cast<int>(name.size()), name.data());
+      for(size_t i = 0; i < Backends::kCount; i++)
+      {
+        fprintf(stderr, " %s", Backends::name(i));
+      }
+      fprintf(stderr, "\n");
+      return false;
+    }
+    backends |= uint32_t(1) << index;
+    list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+  }
+  return true;
+}
+
+// Parses a comma-separated list of levels from 0 to 3 (e.g. "0,2") into
+// `levels`. Returns false if it isn't one.
+bool parse_levels(std::string_view list, std::vector<int>& levels)
+{
+  levels.clear();
+  while(!list.empty())
+  {
+    const size_t           comma = list.find(',');
+    const std::string_view level = list.substr(0, comma);
+    if(level.size() != 1 || level[0] < '0' || level[0] > '3')
+    {
+      return false;
+    }
+    levels.push_back(level[0] - '0');
+    list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+  }
+  return !levels.empty();
+}
+
+// Parses a comma-separated list of positive numbers (e.g. "1,2,4") into
+// `sizes`. Returns false if it isn't one.
+bool parse_sizes(std::string_view list, std::vector<size_t>& sizes)
+{
+  sizes.clear();
+  while(!list.empty())
+  {
+    const size_t      comma = list.find(',');
+    const std::string size(list.substr(0, comma));
+    char*             end   = nullptr;
+    const size_t      value = strtoull(size.c_str(), &end, 10);
+    if(size.empty() || *end != '\0' || value == 0)
+    {
+      return false;
+    }
+    sizes.push_back(value);
+    list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+  }
+  return !sizes.empty();
+}
+
+// The GeneratorSettings members --scaling can grow.
+struct ScalingDimension
+{
+  const char*                name;
+  size_t GeneratorSettings::*member;
+  // False if growing this barely changes the source size (the import depth
+  // only rearranges the same modules), so compile time is fit against the
+  // value itself: against a nearly constant size, noise becomes huge exponents.
+  bool grows_source = true;
+  // If set, values above this member give the same shader.
+  size_t GeneratorSettings::*limit = nullptr;
+};
+constexpr ScalingDimension kScalingDimensions[] = {
+    {"modules", &GeneratorSettings::num_modules},
+    {"depth", &GeneratorSettings::import_depth, false, &GeneratorSettings::num_modules},
+    {"functions", &GeneratorSettings::functions_per_module},
+    {"generics", &GeneratorSettings::generic_instantiations},
+    {"entry-points", &GeneratorSettings::num_entry_points},
+};
+
+// Finds the shader in `filenames` for a backend whose shaders end in
+// `extension` (the only one, if there's only one), and loads it, searching up
+// at most 3 directories. Returns false on failure.
+bool load_shader(const std::vector<const char*>& filenames, const char* extension, std::string& shader_path, std::string& shader_code)
+{
+  const char* filename = (filenames.size() == 1) ? filenames[0] : nullptr;
+  for(size_t i = 0; !filename && i < filenames.size(); i++)
+  {
+    if(std::string_view(filenames[i]).ends_with(extension))
+    {
+      filename = filenames[i];
+    }
+  }
+  if(!filename)
+  {
+    fprintf(stderr, "None of the shaders given ends in %s.\n", extension);
+    return false;
+  }
+  std::optional<std::string> code = find_file(filename, &shader_path);
+  if(!code.has_value())
+  {
+    fprintf(stderr, "Could not load %s.\n", filename);
+    return false;
+  }
+  shader_code = std::move(code.value());
+  return true;
+}
+
+// Calls `function.template operator()<Compiler>(shader_path, shader_source)`
+// for each backend in `backends`, with the shader in `filenames` that it
+// compiles (see load_shader()). Returns false if any call failed.
+template <class Function>
+bool for_each_backend_shader(uint32_t backends, const std::vector<const char*>& filenames, Function&& function)
+{
+  return Backends::for_each(backends, [&]<ShaderCompiler Compiler>() {
+    std::string shader_path, shader_code;
+    return load_shader(filenames, Compiler::extension(), shader_path, shader_code)
+           && function.template operator()<Compiler>(shader_path.c_str(), shader_code.c_str());
+  });
+}
+
+// Applies compiler-specific options after init().
+// Returns false if an operation failed.
+template <ShaderCompiler Compiler>
+bool configure(Compiler& compiler, const BenchmarkOptions& options)
+{
+  compiler.output_cache().set_enabled(options.output_cache);
+  if(options.output_cache_dir && !compiler.output_cache().set_directory(options.output_cache_dir))
+  {
+    return false;
+  }
+  if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+  {
+    compiler.set_settings(options.slang_settings);
+    if(options.module_cache_dir && !compiler.set_disk_cache_directory(options.module_cache_dir))
+    {
+      return false;
+    }
+    compiler.set_precompile_threads(options.precompile_threads);
+    compiler.set_pool_sessions(options.pool_sessions);
+    compiler.set_reflection(options.reflection || options.reflection_benchmark);
+    if(options.module_archive && !compiler.set_module_archive(options.module_archive))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    compiler.preprocess_cache().set_enabled(options.preprocess_cache);
+  }
+  return true;
+}
+
+// Returns command-line arguments that make another process running this
+// program set up its compiler the same way: everything init() and
+// configure() take from `options`, and the process's priority and CPU
+// pinning. Used for benchmark_cold_start()'s child processes.
+std::vector<std::string> settings_arguments(const BenchmarkOptions& options)
+{
+  const auto               on_off = [](bool value) { return value ? "on" : "off"; };
+  std::vector<std::string> args;
+  if(options.enable_glsl)
+  {
+    args.push_back("--enable-glsl");
+  }
+  if(options.output_cache)
+  {
+    args.push_back("--output-cache");
+  }
+  if(options.output_cache_dir)
+  {
+    args.insert(args.end(), {"--output-cache-dir", options.output_cache_dir});
+  }
+  const SlangHelperSettings& slang = options.slang_settings;
+  args.insert(args.end(), {"--module-cache", on_off(slang.module_cache), "--filesystem-ext", on_off(slang.filesystem_ext),
+                           "--validation", on_off(slang.validation), "--arena-glue", on_off(slang.arena_glue)});
+  if(options.module_cache_dir)
+  {
+    args.insert(args.end(), {"--module-cache-dir", options.module_cache_dir});
+  }
+  if(options.precompile_threads > 0)
+  {
+    args.insert(args.end(), {"--precompile-threads", std::to_string(options.precompile_threads)});
+  }
+  if(options.pool_sessions)
+  {
+    args.push_back("--pool-sessions");
+  }
+  if(options.reflection)
+  {
+    args.push_back("--reflection");
+  }
+  if(options.module_archive)
+  {
+    args.insert(args.end(), {"--module-archive", options.module_archive});
+  }
+  if(options.preprocess_cache)
+  {
+    args.push_back("--preprocess-cache");
+  }
+  if(options.high_priority)
+  {
+    args.push_back("--high-priority");
+  }
+  if(!options.pin_cpus.empty())
+  {
+    std::string cpus;
+    for(const uint32_t cpu : options.pin_cpus)
+    {
+      cpus += (cpus.empty() ? "" : ",") + std::to_string(cpu);
+    }
+    args.insert(args.end(), {"--pin", cpus});
+  }
+  return args;
+}
+
+// Creates the sink selected by options.output_archive or options.output_dir,
+// or leaves `sink` null if neither is set. Returns false on failure.
+bool make_output_sink(const BenchmarkOptions& options, std::unique_ptr<AsyncOutputSink>& sink)
+{
+  sink = nullptr;
+  if(options.output_archive)
+  {
+    std::unique_ptr<ArchiveSink> archive = std::make_unique<ArchiveSink>();
+    if(!archive->open(options.output_archive, options.archive_compression))
+    {
+      return false;
+    }
+    sink = std::make_unique<AsyncOutputSink>(std::move(archive));
+  }
+  else if(options.output_dir)
+  {
+    sink = std::make_unique<AsyncOutputSink>(std::make_unique<MappedFileSink>(options.output_dir));
+  }
+  return true;
+}
+
+// Finishes writing `sink`'s outputs, and prints how long writing took and
+// how much of that the compiling thread had to wait for.
+bool finish_output_sink(AsyncOutputSink& sink)
+{
+  const bool                    ok    = sink.finish();
+  const AsyncOutputSink::Stats& stats = sink.stats();
+  printf("Output sink: wrote %llu outputs (%llu bytes) in %llu batches; %f ms on the writer thread, %f ms waiting at the end\n",
+         static_cast<unsigned long long>(stats.num_outputs), static_cast<unsigned long long>(stats.num_bytes),
+         static_cast<unsigned long long>(stats.num_batches), stats.write_ms, stats.finish_wait_ms);
+  return ok;
+}
+
+// The phases in SlangPhaseTimes, for printing and writing results.
+const struct
+{
+  const char* name;
+  const char* id;
+  double SlangPhaseTimes::*member;
+} kSlangPhases[] = {
+    {"Precompile imports", "precompile", &SlangPhaseTimes::precompile_ms},
+    {"Precompile sessions", "precompile_session", &SlangPhaseTimes::precompile_session_ms},
+    {"Session creation", "session", &SlangPhaseTimes::session_ms},
+    {"Load module", "load_module", &SlangPhaseTimes::load_module_ms},
+    {"Import fetches", "import_fetch", &SlangPhaseTimes::import_fetch_ms},
+    {"getTargetCode", "get_target_code", &SlangPhaseTimes::get_target_code_ms},
+    {"Blob copies", "blob_copy", &SlangPhaseTimes::blob_copy_ms},
+    {"Layout link", "layout_link", &SlangPhaseTimes::layout_link_ms},
+    {"Reflection", "reflection", &SlangPhaseTimes::reflection_ms},
+};
+
+// Returns the values of one phase across `samples`.
+std::vector<double> phase_values(const std::vector<SlangPhaseTimes>& samples, double SlangPhaseTimes::*member)
+{
+  std::vector<double> values(samples.size());
+  for(size_t i = 0; i < samples.size(); i++)
+  {
+    values[i] = samples[i].*member;
+  }
+  return values;
+}
+
+// Prints min/median/p95/max for each phase of the Slang compiles in
+// `samples`, and how much of the average compilation time each phase is.
+void print_phase_breakdown(const std::vector<SlangPhaseTimes>& samples, double average_ms)
+{
+  printf("%-18s %12s %12s %12s %12s %8s\n", "Phase (ms)", "min", "median", "p95", "max", "% avg");
+  for(const auto& phase : kSlangPhases)
+  {
+    const SampleSummary summary = summarize(phase_values(samples, phase.member));
+    printf("%-18s %12.6f %12.6f %12.6f %12.6f %7.2f%%\n", phase.name, summary.min, summary.median, summary.p95,
+           summary.max, 100.0 * summary.mean / average_ms);
+  }
+  if(!samples.empty())
+  {
+    printf("Imports fetched per compile: %zu\n", samples.back().num_import_fetches);
+  }
+}
+
+// Everything benchmark() measured, for writing machine-readable results.
+struct BenchmarkResult
+{
+  std::string         compiler;
+  std::string         compiler_version;
+  std::string         shader;
+  double              init_ms          = 0.0;
+  double              first_compile_ms = 0.0;
+  size_t              num_warmups      = 0;
+  std::vector<double> samples;  // Milliseconds per repetition, in order
+  size_t              num_rejected = 0;
+  SampleSummary       summary;  // After outlier rejection
+  // Slang only
+  std::vector<SlangPhaseTimes> phase_samples;
+  // With --memory: memory used by init() and the first compile, each
+  // repetition, and the state after each repetition.
+  MemoryDelta                 init_memory;
+  MemoryDelta                 first_compile_memory;
+  std::vector<MemoryDelta>    memory_samples;
+  std::vector<MemorySnapshot> memory_after;
+  // File system calls (file opens and stats) made by each repetition.
+  std::vector<uint64_t> filesystem_calls;
+  // With --output-cache: lookups made during repetitions.
+  std::optional<OutputCache::Stats> output_cache;
+  // With --preprocess-cache: time the first compile spent preprocessing and
+  // compiling, preprocessed-source lookups made during repetitions, and
+  // preprocessing time per repetition in milliseconds.
+  std::optional<PreprocessTimes>    first_compile_preprocess;
+  std::optional<OutputCache::Stats> preprocess_cache;
+  std::vector<double>               preprocess_samples;
+  // With -j: the number of threads, and compiles per second on all of them.
+  size_t num_threads = 1;
+  double throughput  = 0.0;
+  // The process's peak RSS when the benchmark finished.
+  uint64_t peak_rss_bytes = 0;
+  // With --perf-counters: the compiling thread's hardware counters for each
+  // repetition.
+  std::vector<PerfCounterValues> perf_samples;
+  // In batch mode, for Slang: the modules the first compile of this shader
+  // compiled.
+  std::optional<size_t> modules_compiled;
+};
+
+// What we report from PerfCounterValues, as (name, JSON key, PerfCounter
+// bits it needs, value).
+struct PerfMetric
+{
+  const char* name;
+  const char* id;
+  uint32_t    counters;
+  double (*value)(const PerfCounterValues&);
+};
+constexpr PerfMetric kPerfMetrics[] = {
+    {"Cycles", "cycles", kPerfCycles, [](const PerfCounterValues& values) { return double(values.cycles); }},
+    {"Instructions", "instructions", kPerfInstructions, [](const PerfCounterValues& values) { return double(values.instructions); }},
+    {"IPC", "ipc", kPerfCycles | kPerfInstructions, [](const PerfCounterValues& values) { return values.instructions_per_cycle(); }},
+    {"LLC miss rate", "llc_miss_rate", kPerfLlcReferences | kPerfLlcMisses,
+     [](const PerfCounterValues& values) { return values.llc_miss_rate(); }},
+    {"LLC MPKI", "llc_mpki", kPerfLlcMisses | kPerfInstructions, [](const PerfCounterValues& values) { return values.llc_mpki(); }},
+    {"Branch miss rate", "branch_miss_rate", kPerfBranches | kPerfBranchMisses,
+     [](const PerfCounterValues& values) { return values.branch_miss_rate(); }},
+};
+
+// Returns one metric across the `samples` that counted what it needs.
+std::vector<double> perf_values(const std::vector<PerfCounterValues>& samples, const PerfMetric& metric)
+{
+  std::vector<double> values;
+  values.reserve(samples.size());
+  for(const PerfCounterValues& sample : samples)
+  {
+    if(sample.has(metric.counters))
+    {
+      values.push_back(metric.value(sample));
+    }
+  }
+  return values;
+}
+
+// Prints min/median/p95/max of each metric. Low IPC with a high LLC miss
+// rate (or MPKI) means the compiler spends its time waiting on memory.
+// Repetitions in which a counter wasn't counted are left out of the metrics
+// that need it.
+void print_perf_counters(const std::vector<PerfCounterValues>& samples)
+{
+  printf("%-18s %14s %14s %14s %14s %8s\n", "Counter", "min", "median", "p95", "max", "samples");
+  bool incomplete = false;
+  for(const PerfMetric& metric : kPerfMetrics)
+  {
+    const std::vector<double> values = perf_values(samples, metric);
+    if(values.empty())
+    {
+      printf("%-18s %14s %14s %14s %14s %8d\n", metric.name, "-", "-", "-", "-", 0);
+      continue;
+    }
+    const SampleSummary summary = summarize(values);
+    printf("%-18s %14.6g %14.6g %14.6g %14.6g %8zu\n", metric.name, summary.min, summary.median, summary.p95,
+           summary.max, values.size());
+    incomplete = incomplete || values.size() < samples.size();
+  }
+  if(incomplete)
+  {
+    fprintf(stderr,
+            "Warning: some counters weren't scheduled during some repetitions (e.g. because the NMI watchdog or\n"
+            "another profiler holds a counter); those repetitions are left out of their metrics.\n");
+  }
+}
+
+// Repetitions are considered to leak if the live heap or RSS grows by at least
+// this much across the second half of them (after caches should have settled).
+constexpr double kLeakThresholdBytes = 64.0 * 1024.0;
+
+// Returns how much `member` grows per repetition across the second half of
+// `snapshots`.
+double growth_over_second_half(const std::vector<MemorySnapshot>& snapshots, double (*member)(const MemorySnapshot&))
+{
+  std::vector<double> values;
+  for(size_t i = snapshots.size() / 2; i < snapshots.size(); i++)
+  {
+    values.push_back(member(snapshots[i]));
+  }
+  return growth_per_sample(values);
+}
+
+double live_bytes_of(const MemorySnapshot& snapshot)
+{
+  return static_cast<double>(snapshot.live_bytes);
+}
+double rss_bytes_of(const MemorySnapshot& snapshot)
+{
+  return static_cast<double>(snapshot.rss_bytes);
+}
+
+void print_memory_delta(const char* label, const MemoryDelta& delta)
+{
+  printf("%-22s %12llu %16llu %14lld %14lld\n", label, static_cast<unsigned long long>(delta.allocations),
+         static_cast<unsigned long long>(delta.allocated_bytes), static_cast<long long>(delta.live_bytes),
+         static_cast<long long>(delta.rss_bytes));
+}
+
+// Prints allocations and RSS changes for init(), the first compile, and the
+// median repetition, and warns if memory kept growing across repetitions.
+void print_memory_report(const BenchmarkResult& result)
+{
+  printf("%-22s %12s %16s %14s %14s\n", "Memory", "allocations", "bytes allocated", "live bytes +/-", "RSS +/-");
+  print_memory_delta("Initialization", result.init_memory);
+  print_memory_delta("First compilation", result.first_compile_memory);
+  if(result.memory_samples.empty())
+  {
+    return;
+  }
+
+  std::vector<double> allocations, allocated_bytes, live_bytes, rss_bytes;
+  for(const MemoryDelta& delta : result.memory_samples)
+  {
+    allocations.push_back(static_cast<double>(delta.allocations));
+    allocated_bytes.push_back(static_cast<double>(delta.allocated_bytes));
+    live_bytes.push_back(static_cast<double>(delta.live_bytes));
+    rss_bytes.push_back(static_cast<double>(delta.rss_bytes));
+  }
+  printf("%-22s %12.0f %16.0f %14.0f %14.0f\n", "Median repetition", summarize(allocations).median,
+         summarize(allocated_bytes).median, summarize(live_bytes).median, summarize(rss_bytes).median);
+  printf("Peak RSS: %llu bytes\n", static_cast<unsigned long long>(result.memory_samples.back().peak_rss_bytes));
+
+  const double num_half   = static_cast<double>(result.memory_after.size() - result.memory_after.size() / 2);
+  const double live_slope = growth_over_second_half(result.memory_after, live_bytes_of);
+  const double rss_slope  = growth_over_second_half(result.memory_after, rss_bytes_of);
+  printf("Growth per repetition over the second half: live heap %.0f bytes, RSS %.0f bytes\n", live_slope, rss_slope);
+  if(live_slope * num_half >= kLeakThresholdBytes || rss_slope * num_half >= kLeakThresholdBytes)
+  {
+    printf("WARNING: Memory grew steadily across repetitions; this may be a leak (e.g. in cached modules or "
+           "sessions).\n");
+  }
+}
+
+// Prints how many file system calls repetitions made. Once caches are warm,
+// recompiling an unchanged shader shouldn't need any.
+void print_filesystem_calls(const std::vector<uint64_t>& filesystem_calls)
+{
+  if(filesystem_calls.empty())
+  {
+    return;
+  }
+  std::vector<double> values(filesystem_calls.begin(), filesystem_calls.end());
+  const SampleSummary summary = summarize(values);
+  printf("File system calls per repetition: median %.0f, max %.0f\n", summary.median, summary.max);
+  if(summary.max == 0.0)
+  {
+    printf("Repetitions did not touch the file system.\n");
+  }
+}
+
+// Prints an output cache's hit rate and how long hits took; `label` is e.g.
+// "Output cache".
+void print_output_cache_stats(const char* label, const OutputCache::Stats& stats)
+{
+  const uint64_t hits = stats.memory_hits + stats.disk_hits;
+  printf("%s: %llu lookups, %.1f%% hits (%llu in memory, %llu on disk, %llu stale)\n", label,
+         static_cast<unsigned long long>(stats.lookups), stats.lookups ? 100.0 * hits / stats.lookups : 0.0,
+         static_cast<unsigned long long>(stats.memory_hits), static_cast<unsigned long long>(stats.disk_hits),
+         static_cast<unsigned long long>(stats.stale));
+  if(hits > 0)
+  {
+    printf("Average %s hit latency: %f us\n", label, 1000.0 * stats.hit_ms / hits);
+  }
+}
+
+void write_output_cache_json(JsonWriter& json, const OutputCache::Stats& stats)
+{
+  json.begin_object()
+      .field("lookups", stats.lookups)
+      .field("memory_hits", stats.memory_hits)
+      .field("disk_hits", stats.disk_hits)
+      .field("stale", stats.stale)
+      .field("hit_ms", stats.hit_ms)
+      .end_object();
+}
+
+void write_memory_delta_json(JsonWriter& json, const MemoryDelta& delta)
+{
+  json.begin_object()
+      .field("allocations", delta.allocations)
+      .field("allocated_bytes", delta.allocated_bytes)
+      .field("live_bytes_delta", static_cast<double>(delta.live_bytes))
+      .field("rss_bytes_delta", static_cast<double>(delta.rss_bytes))
+      .field("peak_rss_bytes", delta.peak_rss_bytes)
+      .end_object();
+}
+
+void write_summary_json(JsonWriter& json, const SampleSummary& summary)
+{
+  json.begin_object()
+      .field("count", uint64_t(summary.count))
+      .field("min", summary.min)
+      .field("median", summary.median)
+      .field("p90", summary.p90)
+      .field("p95", summary.p95)
+      .field("p99", summary.p99)
+      .field("max", summary.max)
+      .field("mean", summary.mean)
+      .field("stddev", summary.stddev)
+      .end_object();
+}
+
+void write_result_json(JsonWriter& json, const BenchmarkResult& result)
+{
+  json.begin_object()
+      .field("compiler", result.compiler)
+      .field("compiler_version", result.compiler_version)
+      .field("shader", result.shader)
+      .field("init_ms", result.init_ms)
+      .field("first_compile_ms", result.first_compile_ms)
+      .field("warmups", uint64_t(result.num_warmups))
+      .field("outliers_rejected", uint64_t(result.num_rejected))
+      .field("threads", uint64_t(result.num_threads))
+      .field("peak_rss_bytes", result.peak_rss_bytes);
+  if(result.num_threads > 1)
+  {
+    json.field("throughput_per_s", result.throughput);
+  }
+  if(result.modules_compiled.has_value())
+  {
+    json.field("modules_compiled", uint64_t(result.modules_compiled.value()));
+  }
+  json.key("summary_ms");
+  write_summary_json(json, result.summary);
+  if(!result.phase_samples.empty())
+  {
+    json.key("phases_ms").begin_object();
+    for(const auto& phase : kSlangPhases)
+    {
+      json.key(phase.id);
+      write_summary_json(json, summarize(phase_values(result.phase_samples, phase.member)));
+    }
+    json.end_object();
+  }
+  if(!result.perf_samples.empty())
+  {
+    json.key("perf_counters").begin_object();
+    for(const PerfMetric& metric : kPerfMetrics)
+    {
+      const std::vector<double> values = perf_values(result.perf_samples, metric);
+      if(!values.empty())
+      {
+        json.key(metric.id);
+        write_summary_json(json, summarize(values));
+      }
+    }
+    json.end_object();
+  }
+  if(!result.memory_after.empty())
+  {
+    json.key("memory").begin_object();
+    json.key("init");
+    write_memory_delta_json(json, result.init_memory);
+    json.key("first_compile");
+    write_memory_delta_json(json, result.first_compile_memory);
+    json.field("live_bytes_growth_per_repetition", growth_over_second_half(result.memory_after, live_bytes_of))
+        .field("rss_bytes_growth_per_repetition", growth_over_second_half(result.memory_after, rss_bytes_of));
+    json.key("repetitions").begin_array();
+    for(const MemoryDelta& delta : result.memory_samples)
+    {
+      write_memory_delta_json(json, delta);
+    }
+    json.end_array().end_object();
+  }
+  if(result.output_cache.has_value())
+  {
+    json.key("output_cache");
+    write_output_cache_json(json, result.output_cache.value());
+  }
+  if(result.preprocess_cache.has_value())
+  {
+    json.key("preprocess_cache");
+    write_output_cache_json(json, result.preprocess_cache.value());
+    if(result.first_compile_preprocess.has_value())
+    {
+      json.field("first_compile_preprocess_ms", result.first_compile_preprocess.value().preprocess_ms)
+          .field("first_compile_compile_ms", result.first_compile_preprocess.value().compile_ms);
+    }
+    json.key("preprocess_samples_ms").begin_array();
+    for(double sample : result.preprocess_samples)
+    {
+      json.value(sample);
+    }
+    json.end_array();
+  }
+  json.key("filesystem_calls").begin_array();
+  for(uint64_t calls : result.filesystem_calls)
+  {
+    json.value(calls);
+  }
+  json.end_array();
+  json.key("samples_ms").begin_array();
+  for(double sample : result.samples)
+  {
+    json.value(sample);
+  }
+  json.end_array().end_object();
+}
+
+// Writes one result as a JSON object, or several (e.g. from --backends) as
+// an object with a "results" array.
+bool write_json_results(const char* path, std::span<const BenchmarkResult> results)
+{
+  FILE* file = fopen(path, "w");
+  if(!file)
+  {
+    fprintf(stderr, "Could not open %s for writing.\n", path);
+    return false;
+  }
+  {
+    JsonWriter json(file);
+    if(results.size() == 1)
+    {
+      write_result_json(json, results[0]);
+    }
+    else
+    {
+      json.begin_object().key("results").begin_array();
+      for(const BenchmarkResult& result : results)
+      {
+        write_result_json(json, result);
+      }
+      json.end_array().end_object();
+    }
+  }
+  return fclose(file) == 0;
+}
+
+bool write_json_result(const char* path, const BenchmarkResult& result)
+{
+  return write_json_results(path, std::span<const BenchmarkResult>(&result, 1));
+}
+
+// Writes the results of benchmark_batch(): the time of the first pass over
+// every shader, a summary of the later passes, and each shader's result.
+bool write_batch_json(const char* path, std::span<const BenchmarkResult> results, double first_pass_ms, const SampleSummary& pass_summary)
+{
+  FILE* file = fopen(path, "w");
+  if(!file)
+  {
+    fprintf(stderr, "Could not open %s for writing.\n", path);
+    return false;
+  }
+  {
+    JsonWriter json(file);
+    json.begin_object().field("first_pass_ms", first_pass_ms);
+    json.key("pass_summary_ms");
+    write_summary_json(json, pass_summary);
+    json.key("results").begin_array();
+    for(const BenchmarkResult& result : results)
+    {
+      write_result_json(json, result);
+    }
+    json.end_array().end_object();
+  }
+  return fclose(file) == 0;
+}
+
+// Writes one row per repetition of each result. Columns that only some
+// results have (e.g. Slang's phases) are empty in the others' rows.
+bool write_csv_results(const char* path, std::span<const BenchmarkResult> results)
+{
+  FILE* file = fopen(path, "w");
+  if(!file)
+  {
+    fprintf(stderr, "Could not open %s for writing.\n", path);
+    return false;
+  }
+  const bool has_phases = std::any_of(results.begin(), results.end(), [](const BenchmarkResult& result) {
+    return !result.phase_samples.empty();
+  });
+  const bool has_memory = std::any_of(results.begin(), results.end(), [](const BenchmarkResult& result) {
+    return !result.memory_after.empty();
+  });
+  const bool has_perf_counters = std::any_of(results.begin(), results.end(), [](const BenchmarkResult& result) {
+    return !result.perf_samples.empty();
+  });
+  fprintf(file, "compiler,shader,repetition,compile_ms,filesystem_calls");
+  if(has_phases)
+  {
+    for(const auto& phase : kSlangPhases)
+    {
+      fprintf(file, ",%s_ms", phase.id);
+    }
+  }
+  if(has_memory)
+  {
+    fprintf(file, ",allocations,allocated_bytes,live_bytes,rss_bytes");
+  }
+  if(has_perf_counters)
+  {
+    fprintf(file, ",cycles,instructions,llc_references,llc_misses,branches,branch_misses");
+  }
+  fprintf(file, "\n");
+  for(const BenchmarkResult& result : results)
+  {
+    for(size_t i = 0; i < result.samples.size(); i++)
+    {
+      fprintf(file, "%s,%s,%zu,%.9g,", result.compiler.c_str(), result.shader.c_str(), i + 1, result.samples[i]);
+      if(i < result.filesystem_calls.size())
+      {
+        fprintf(file, "%llu", static_cast<unsigned long long>(result.filesystem_calls[i]));
+      }
+      if(has_phases)
+      {
+        for(const auto& phase : kSlangPhases)
+        {
+          if(i < result.phase_samples.size())
+          {
+            fprintf(file, ",%.9g", result.phase_samples[i].*phase.member);
+          }
+          else
+          {
+            fprintf(file, ",");
+          }
+        }
+      }
+      if(has_memory)
+      {
+        if(i < result.memory_after.size())
+        {
+          fprintf(file, ",%llu,%llu,%lld,%llu", static_cast<unsigned long long>(result.memory_samples[i].allocations),
+                  static_cast<unsigned long long>(result.memory_samples[i].allocated_bytes),
+                  static_cast<long long>(result.memory_after[i].live_bytes),
+                  static_cast<unsigned long long>(result.memory_after[i].rss_bytes));
+        }
+        else
+        {
+          fprintf(file, ",,,,");
+        }
+      }
+      if(has_perf_counters)
+      {
+        // Counters that weren't counted are empty.
+        for(size_t counter = 0; counter < PerfCounters::kNumCounters; counter++)
+        {
+          if(i < result.perf_samples.size() && result.perf_samples[i].has(1u << counter))
+          {
+            fprintf(file, ",%llu", static_cast<unsigned long long>(result.perf_samples[i].*kPerfCounterMembers[counter]));
+          }
+          else
+          {
+            fprintf(file, ",");
+          }
+        }
+      }
+      fprintf(file, "\n");
+    }
+  }
+  return fclose(file) == 0;
+}
+
+bool write_csv_result(const char* path, const BenchmarkResult& result)
+{
+  return write_csv_results(path, std::span<const BenchmarkResult>(&result, 1));
+}
+
+// Prints the main numbers from each result (e.g. one per backend) side by
+// side.
+void print_backend_comparison(std::span<const BenchmarkResult> results)
+{
+  printf("%-10s %12s %14s %12s %12s %12s\n", "Backend", "init (ms)", "first (ms)", "min (ms)", "median (ms)", "p90 (ms)");
+  for(const BenchmarkResult& result : results)
+  {
+    printf("%-10s %12.6f %14.6f %12.6f %12.6f %12.6f\n", result.compiler.c_str(), result.init_ms, result.first_compile_ms,
+           result.summary.min, result.summary.median, result.summary.p90);
+  }
+}
+
+// Prints how long it takes the compiler to compile a given file, and appends
+// the results to `results`.
+// Returns true if an operation failed.
+template <ShaderCompiler Compiler>
+bool benchmark(const char* shader_path, const char* shader_source, const BenchmarkOptions& options, std::vector<BenchmarkResult>& results)
+{
+  const size_t              num_repetitions = options.num_repetitions;
+  std::unique_ptr<Compiler> compiler;
+  BenchmarkResult           result{.compiler = Compiler::name(), .shader = shader_path};
+
+  // Initialization
+  MemorySnapshot memory_before = MemorySnapshot::capture();
+  {
+    const timer::time_point start = timer::now();
+    compiler                      = std::make_unique<Compiler>();
+    if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      compiler->set_core_module(find_core_module(options.core_module));
+    }
+    if(!compiler->init(options.enable_glsl))
+    {
+      return false;
+    }
+    const timer::time_point                         end      = timer::now();
+    const std::chrono::duration<double, std::milli> duration = (end - start);
+    printf("Compiler initialization time: %f ms\n", duration.count());
+    result.init_ms = duration.count();
+  }
+  MemorySnapshot memory_after = MemorySnapshot::capture();
+  result.init_memory          = MemoryDelta::between(memory_before, memory_after);
+
+  if(!configure(*compiler, options))
+  {
+    return false;
+  }
+  result.compiler_version = compiler->version();
+
+  // First compilation to warm up caches
+  {
+    TraceZone               zone("first compile");
+    const timer::time_point start = timer::now();
+    if(!compiler->compile(shader_path, shader_source))
+    {
+      return false;
+    }
+    const timer::time_point                         end      = timer::now();
+    const std::chrono::duration<double, std::milli> duration = (end - start);
+    printf("First compilation (building caches): %f ms\n", duration.count());
+    result.first_compile_ms     = duration.count();
+    memory_before               = memory_after;
+    memory_after                = MemorySnapshot::capture();
+    result.first_compile_memory = MemoryDelta::between(memory_before, memory_after);
+    if constexpr(!std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      if(options.preprocess_cache)
+      {
+        result.first_compile_preprocess = compiler->preprocess_times();
+        printf("First compilation: %f ms preprocessing, %f ms compiling the preprocessed source\n",
+               result.first_compile_preprocess.value().preprocess_ms, result.first_compile_preprocess.value().compile_ms);
+      }
+    }
+
+    const CompiledOutput spirv = compiler->spirv_output();
+    fprintf(stderr, "SPIR-V output is %zu bytes long.\n", spirv.size);
+    MappedFileSink(".").write(std::string(Compiler::name()) + ".spv", spirv);
+  }
+
+  // Further untimed warm-up compilations
+  result.num_warmups = std::max<size_t>(options.num_warmups, 1);
+  for(size_t warmup = 1; warmup < options.num_warmups; warmup++)
+  {
+    TraceZone zone("warmup");
+    if(!compiler->compile(shader_path, shader_source))
+    {
+      return false;
+    }
+  }
+
+  // Benchmark
+  {
+    fprintf(stderr, "Compiling %zu times...\n", num_repetitions);
+    // Preallocated so that recording samples doesn't allocate during the loop.
+    std::vector<double> samples(num_repetitions);
+    size_t              num_samples = 0;
+    // Slang only: samples of each SlangPhaseTimes member.
+    std::vector<SlangPhaseTimes> phase_samples;
+    compiler->output_cache().reset_stats();
+    if constexpr(!std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      compiler->preprocess_cache().reset_stats();
+    }
+    result.preprocess_samples.reserve(num_repetitions);
+    phase_samples.reserve(num_repetitions);
+    result.filesystem_calls.reserve(num_repetitions);
+    if(options.track_memory)
+    {
+      result.memory_samples.reserve(num_repetitions);
+      result.memory_after.reserve(num_repetitions);
+    }
+    // Counters are opened here, on the thread that compiles.
+    PerfCounters perf_counters;
+    if(options.perf_counters)
+    {
+      if(perf_counters.open())
+      {
+        result.perf_samples.reserve(num_repetitions);
+      }
+      else
+      {
+        fprintf(stderr, "Continuing without hardware counters.\n");
+      }
+    }
+    const timer::time_point loop_start = timer::now();
+    for(size_t repetition = 1; repetition <= num_repetitions; repetition++)
+    {
+#ifdef VERBOSE
+      // Power of 2 iteration printer
+      if((repetition & (repetition - 1)) == 0)
+      {
+        fprintf(stderr, "Repetition %zu\n", repetition);
+      }
+#endif
+
+      if(options.cooldown_ms > 0.0)
+      {
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(options.cooldown_ms));
+      }
+      // Snapshots are taken outside the timed region.
+      if(options.track_memory)
+      {
+        memory_before = MemorySnapshot::capture();
+      }
+      TraceZone      zone("repetition");
+      const uint64_t filesystem_calls_before = filesystem_call_count();
+      perf_counters.start();
+      const timer::time_point start = timer::now();
+      if(!compiler->compile(shader_path, shader_source))
+      {
+        return false;
+      }
+      const timer::time_point end = timer::now();
+      if(perf_counters.is_open())
+      {
+        result.perf_samples.push_back(perf_counters.stop());
+      }
+      samples[num_samples++] = milliseconds_between(start, end);
+      result.filesystem_calls.push_back(filesystem_call_count() - filesystem_calls_before);
+      if(options.track_memory)
+      {
+        memory_after = MemorySnapshot::capture();
+        result.memory_samples.push_back(MemoryDelta::between(memory_before, memory_after));
+        result.memory_after.push_back(memory_after);
+      }
+      if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+      {
+        phase_samples.push_back(compiler->phase_times());
+      }
+      else if(options.preprocess_cache)
+      {
+        result.preprocess_samples.push_back(compiler->preprocess_times().preprocess_ms);
+      }
+
+      if(options.time_budget_s > 0.0 && milliseconds_between(loop_start, end) > 1000.0 * options.time_budget_s)
+      {
+        fprintf(stderr, "Time budget reached after %zu repetitions.\n", num_samples);
+        break;
+      }
+    }
+    samples.resize(num_samples);
+
+    double total_ms = 0.0;
+    for(double sample : samples)
+    {
+      total_ms += sample;
+    }
+    const double average_ms = total_ms / static_cast<double>(num_samples);
+    printf("Average compilation time: %f ms\n", average_ms);
+
+    std::vector<double> kept = samples;
+    if(options.mad_threshold > 0.0)
+    {
+      result.num_rejected = reject_outliers_mad(kept, options.mad_threshold);
+      printf("Rejected %zu outliers (modified z-score > %g)\n", result.num_rejected, options.mad_threshold);
+    }
+    result.summary = summarize(kept);
+    printf("Compilation time (ms): min %f, median %f, p90 %f, p99 %f, max %f, stddev %f\n", result.summary.min,
+           result.summary.median, result.summary.p90, result.summary.p99, result.summary.max, result.summary.stddev);
+
+    if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      print_phase_breakdown(phase_samples, average_ms);
+    }
+    print_filesystem_calls(result.filesystem_calls);
+    if(options.output_cache)
+    {
+      result.output_cache = compiler->output_cache().stats();
+      print_output_cache_stats("Output cache", result.output_cache.value());
+    }
+    if constexpr(!std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      if(options.preprocess_cache)
+      {
+        result.preprocess_cache = compiler->preprocess_cache().stats();
+        print_output_cache_stats("Preprocess cache", result.preprocess_cache.value());
+        double preprocess_ms = 0.0;
+        for(double sample : result.preprocess_samples)
+        {
+          preprocess_ms += sample;
+        }
+        printf("Preprocessing took %.1f%% of repetitions' compile time\n",
+               total_ms > 0.0 ? 100.0 * preprocess_ms / total_ms : 0.0);
+      }
+    }
+    if(options.track_memory)
+    {
+      print_memory_report(result);
+    }
+    if(!result.perf_samples.empty())
+    {
+      print_perf_counters(result.perf_samples);
+    }
+    result.samples       = std::move(samples);
+    result.phase_samples = std::move(phase_samples);
+  }
+
+  result.peak_rss_bytes = MemorySnapshot::capture().peak_rss_bytes;
+  results.push_back(std::move(result));
+  return true;
+}
+
+// Measures throughput when several threads compile at once: each of
+// `options.num_threads` threads gets its own compiler, warms it up, and then
+// compiles the shader `options.num_repetitions` times. (With
+// --share-global-session, Slang helpers share one global session, and so take
+// turns using it: each holds its lock for a whole compile, so this measures
+// the lock, not contention inside Slang.) Compares this to a
+// single thread doing the same, which shows whether a compiler has internal
+// locks or shared state that stop it from scaling. Adds a result whose
+// samples are each thread's average compile time.
+template <ShaderCompiler Compiler>
+bool benchmark_threads(const char* shader_path, const char* shader_source, const BenchmarkOptions& options, std::vector<BenchmarkResult>& results)
+{
+  const size_t num_repetitions = options.num_repetitions;
+
+  // Returns the wall-clock duration of `num_threads` threads compiling in
+  // parallel, and fills `per_thread` with each thread's average compile time.
+  // Returns a negative duration on failure.
+  const auto run = [&](size_t num_threads, std::vector<double>& per_thread) -> double {
+    std::vector<std::unique_ptr<Compiler>> compilers(num_threads);
+    std::vector<char>                      succeeded(num_threads, 0);
+    per_thread.assign(num_threads, 0.0);
+    std::latch warmed_up(static_cast<ptrdiff_t>(num_threads) + 1);
+    std::latch go(1);
+
+    std::shared_ptr<SharedSlangGlobalSession> shared_session;
+    if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      if(options.share_global_session && !(shared_session = SharedSlangGlobalSession::create(options.enable_glsl)))
+      {
+        return -1.0;
+      }
+    }
+
+    const auto worker = [&](size_t thread_index) {
+      if(!options.pin_cpus.empty())
+      {
+        pin_current_thread(options.pin_cpus[thread_index % options.pin_cpus.size()]);
+      }
+      compilers[thread_index] = std::make_unique<Compiler>();
+      Compiler& compiler      = *compilers[thread_index];
+      bool      ok            = false;
+      if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+      {
+        ok = compiler.init(options.enable_glsl, shared_session);
+      }
+      else
+      {
+        ok = compiler.init(options.enable_glsl);
+      }
+      ok = ok && configure(compiler, options) && compiler.compile(shader_path, shader_source);
+      warmed_up.count_down();
+      go.wait();
+
+      const timer::time_point thread_start = timer::now();
+      for(size_t repetition = 0; ok && repetition < num_repetitions; repetition++)
+      {
+        ok = compiler.compile(shader_path, shader_source);
+      }
+      const std::chrono::duration<double, std::milli> duration = (timer::now() - thread_start);
+      per_thread[thread_index] = duration.count() / static_cast<double>(num_repetitions);
+      succeeded[thread_index]  = ok;
+    };
+
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < num_threads; i++)
+    {
+      threads.emplace_back(worker, i);
+    }
+    // Start timing once every thread is ready, so initialization isn't counted.
+    warmed_up.arrive_and_wait();
+    const timer::time_point start = timer::now();
+    go.count_down();
+    for(std::thread& thread : threads)
+    {
+      thread.join();
+    }
+    const std::chrono::duration<double, std::milli> duration = (timer::now() - start);
+
+    if(std::find(succeeded.begin(), succeeded.end(), 0) != succeeded.end())
+    {
+      return -1.0;
+    }
+    return duration.count();
+  };
+
+  std::vector<double> per_thread;
+  fprintf(stderr, "Compiling %zu times on 1 thread...\n", num_repetitions);
+  const double single_duration = run(1, per_thread);
+  if(single_duration < 0.0)
+  {
+    return false;
+  }
+  const double single_throughput = 1000.0 * static_cast<double>(num_repetitions) / single_duration;
+  printf("1-thread throughput: %f compiles/s (%f ms per compile)\n", single_throughput, per_thread[0]);
+
+  const size_t num_threads = options.num_threads;
+  fprintf(stderr, "Compiling %zu times on each of %zu threads...\n", num_repetitions, num_threads);
+  const double duration = run(num_threads, per_thread);
+  if(duration < 0.0)
+  {
+    return false;
+  }
+  for(size_t i = 0; i < num_threads; i++)
+  {
+    printf("Thread %zu average compilation time: %f ms\n", i, per_thread[i]);
+  }
+  const double throughput = 1000.0 * static_cast<double>(num_threads * num_repetitions) / duration;
+  printf("%zu-thread throughput: %f compiles/s\n", num_threads, throughput);
+  printf("Scaling efficiency: %f%%\n", 100.0 * throughput / (static_cast<double>(num_threads) * single_throughput));
+  if(std::is_same_v<Compiler, SlangCompilerHelper> && options.share_global_session)
+  {
+    printf("(--share-global-session: threads took turns compiling with the shared global session)\n");
+  }
+
+  BenchmarkResult result{.compiler = Compiler::name(), .shader = shader_path};
+  result.num_threads    = num_threads;
+  result.throughput     = throughput;
+  result.summary        = summarize(per_thread);
+  result.samples        = std::move(per_thread);
+  result.peak_rss_bytes = MemorySnapshot::capture().peak_rss_bytes;
+  results.push_back(std::move(result));
+  return true;
+}
+
+// A shader for benchmark_batch().
+struct BatchShader
+{
+  std::string path;
+  std::string source;
+  // Where its SPIR-V goes in the output sink, relative to the sink's root.
+  std::string output_name;
+};
+
+// Compiles every shader in `shaders` with a single compiler, so that caches
+// (e.g. Slang's module cache) are shared between them, as in an application
+// that compiles many shaders that import the same modules. The first pass
+// shows how much later shaders benefit from what earlier ones compiled; the
+// following passes measure recompiling each shader with warm caches.
+template <ShaderCompiler Compiler>
+bool benchmark_batch(const std::vector<BatchShader>& shaders, const BenchmarkOptions& options)
+{
+  Compiler                compiler;
+  const timer::time_point init_start = timer::now();
+  if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+  {
+    return false;
+  }
+  const double init_ms = milliseconds_between(init_start, timer::now());
+  printf("Compiler initialization time: %f ms\n", init_ms);
+
+  // Outputs from the first pass are written while later shaders compile.
+  std::unique_ptr<AsyncOutputSink> sink;
+  if(!make_output_sink(options, sink))
+  {
+    return false;
+  }
+
+  // First pass
+  std::vector<double> first_ms(shaders.size());
+  std::vector<size_t> modules_compiled(shaders.size(), 0);
+  double              first_pass_ms = 0.0;
+  for(size_t i = 0; i < shaders.size(); i++)
+  {
+    size_t compiled_before = 0;
+    if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      compiled_before = compiler.num_modules_compiled();
+    }
+    const timer::time_point start = timer::now();
+    if(!compiler.compile(shaders[i].path.c_str(), shaders[i].source.c_str()))
+    {
+      fprintf(stderr, "Compiling %s failed.\n", shaders[i].path.c_str());
+      return false;
+    }
+    first_ms[i] = milliseconds_between(start, timer::now());
+    first_pass_ms += first_ms[i];
+    if(sink && !sink->write(shaders[i].output_name, compiler.spirv_output()))
+    {
+      return false;
+    }
+    if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      modules_compiled[i] = compiler.num_modules_compiled() - compiled_before;
+    }
+  }
+  // Finish before the timed passes, so that writes don't compete with them.
+  if(sink && !finish_output_sink(*sink))
+  {
+    return false;
+  }
+
+  for(size_t warmup = 1; warmup < options.num_warmups; warmup++)
+  {
+    for(const BatchShader& shader : shaders)
+    {
+      if(!compiler.compile(shader.path.c_str(), shader.source.c_str()))
+      {
+        return false;
+      }
+    }
+  }
+
+  // Timed passes
+  fprintf(stderr, "Compiling %zu shaders %zu times...\n", shaders.size(), options.num_repetitions);
+  std::vector<std::vector<double>> samples(shaders.size());
+  std::vector<double>              pass_ms;
+  for(std::vector<double>& shader_samples : samples)
+  {
+    shader_samples.reserve(options.num_repetitions);
+  }
+  pass_ms.reserve(options.num_repetitions);
+  const timer::time_point loop_start = timer::now();
+  for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+  {
+    double            pass_total = 0.0;
+    timer::time_point end;
+    for(size_t i = 0; i < shaders.size(); i++)
+    {
+      const timer::time_point start = timer::now();
+      if(!compiler.compile(shaders[i].path.c_str(), shaders[i].source.c_str()))
+      {
+        return false;
+      }
+      end = timer::now();
+      samples[i].push_back(milliseconds_between(start, end));
+      pass_total += samples[i].back();
+    }
+    pass_ms.push_back(pass_total);
+
+    if(options.time_budget_s > 0.0 && milliseconds_between(loop_start, end) > 1000.0 * options.time_budget_s)
+    {
+      fprintf(stderr, "Time budget reached after %zu repetitions.\n", repetition + 1);
+      break;
+    }
+  }
+
+  std::vector<BenchmarkResult> results;
+  const uint64_t               peak_rss_bytes = MemorySnapshot::capture().peak_rss_bytes;
+  printf("%-40s %12s %9s %12s %12s %12s\n", "Shader", "first (ms)", "modules", "median (ms)", "mean (ms)", "p95 (ms)");
+  for(size_t i = 0; i < shaders.size(); i++)
+  {
+    std::vector<double> kept = samples[i];
+    if(options.mad_threshold > 0.0)
+    {
+      reject_outliers_mad(kept, options.mad_threshold);
+    }
+    BenchmarkResult result{.compiler         = Compiler::name(),
+                           .compiler_version = compiler.version(),
+                           .shader           = shaders[i].path,
+                           .init_ms          = init_ms,
+                           .first_compile_ms = first_ms[i],
+                           .num_warmups      = options.num_warmups};
+    result.num_rejected   = samples[i].size() - kept.size();
+    result.summary        = summarize(kept);
+    result.samples        = std::move(samples[i]);
+    result.peak_rss_bytes = peak_rss_bytes;
+    if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+    {
+      result.modules_compiled = modules_compiled[i];
+    }
+    printf("%-40s %12.6f %9zu %12.6f %12.6f %12.6f\n", fs::path(shaders[i].path).filename().string().c_str(),
+           first_ms[i], modules_compiled[i], result.summary.median, result.summary.mean, result.summary.p95);
+    results.push_back(std::move(result));
+  }
+  const SampleSummary pass_summary = summarize(pass_ms);
+  printf("First pass over %zu shaders: %f ms\n", shaders.size(), first_pass_ms);
+  printf("Later passes: mean %f ms, median %f ms, min %f ms (%f ms per shader)\n", pass_summary.mean,
+         pass_summary.median, pass_summary.min, pass_summary.mean / static_cast<double>(shaders.size()));
+
+  if(options.json_path && !write_batch_json(options.json_path, results, first_pass_ms, pass_summary))
+  {
+    return false;
+  }
+  return !options.csv_path || write_csv_results(options.csv_path, results);
+}
+
+// Reads a manifest: one shader path per line, relative to the manifest's
+// directory. Blank lines and lines starting with '#' are ignored.
+bool load_manifest(const char* manifest_path, std::vector<std::string>& paths)
+{
+  std::optional<std::string> manifest = load_file(manifest_path);
+  if(!manifest.has_value())
+  {
+    return false;
+  }
+  const fs::path   base = fs::path(manifest_path).parent_path();
+  std::string_view rest = manifest.value();
+  while(!rest.empty())
+  {
+    const size_t     newline = std::min(rest.find('\n'), rest.size());
+    std::string_view line    = rest.substr(0, newline);
+    rest.remove_prefix(std::min(newline + 1, rest.size()));
+    while(!line.empty() && isspace(static_cast<unsigned char>(line.back())))
+    {
+      line.remove_suffix(1);
+    }
+    while(!line.empty() && isspace(static_cast<unsigned char>(line.front())))
+    {
+      line.remove_prefix(1);
+    }
+    if(!line.empty() && line.front() != '#')
+    {
+      paths.push_back((base / fs::path(line)).string());
+    }
+  }
+  return true;
+}
+
+// Returns the files in `directory` (not including subdirectories) with the
+// given extension, sorted by path. Slang modules imported by another of these
+// files aren't included, since they're not main shaders.
+std::vector<std::string> find_directory_shaders(const fs::path& directory, const char* extension, bool is_slang)
+{
+  std::vector<fs::path> files;
+  std::error_code       error;
+  for(const fs::directory_entry& entry : fs::directory_iterator(directory, error))
+  {
+    if(entry.is_regular_file() && entry.path().extension() == extension)
+    {
+      files.push_back(entry.path().lexically_normal());
+    }
+  }
+  if(error)
+  {
+    fprintf(stderr, "Could not list %s: %s\n", directory.string().c_str(), error.message().c_str());
+  }
+  std::sort(files.begin(), files.end());
+
+  std::unordered_set<std::string> imported;
+  if(is_slang)
+  {
+    for(const fs::path& file : files)
+    {
+      const std::optional<std::string> source = load_file(file.string().c_str());
+      for(const std::string& import : find_slang_imports(source.value_or("")))
+      {
+        imported.insert((file.parent_path() / import).lexically_normal().string());
+      }
+    }
+  }
+
+  std::vector<std::string> shaders;
+  for(const fs::path& file : files)
+  {
+    if(imported.count(file.string()) == 0)
+    {
+      shaders.push_back(file.string());
+    }
+  }
+  return shaders;
+}
+
+// Loads the shaders for benchmark_batch() from options.manifest_path or
+// options.batch_dir, and runs it.
+template <ShaderCompiler Compiler>
+bool run_batch(const BenchmarkOptions& options, const char* extension)
+{
+  std::vector<std::string> paths;
+  if(options.manifest_path)
+  {
+    if(!load_manifest(options.manifest_path, paths))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    paths = find_directory_shaders(options.batch_dir, extension, std::is_same_v<Compiler, SlangCompilerHelper>);
+  }
+  if(paths.empty())
+  {
+    fprintf(stderr, "Found no shaders to compile.\n");
+    return false;
+  }
+
+  const fs::path base = options.manifest_path ? fs::path(options.manifest_path).parent_path() : fs::path(options.batch_dir);
+  std::vector<BatchShader> shaders;
+  for(std::string& path : paths)
+  {
+    std::optional<std::string> source = load_file(path.c_str());
+    if(!source.has_value())
+    {
+      return false;
+    }
+    // Outputs mirror the shaders' layout under the manifest or directory.
+    std::string output_name = fs::path(path).lexically_proximate(base).replace_extension(".spv").string();
+    shaders.push_back({std::move(path), std::move(source.value()), std::move(output_name)});
+  }
+  return benchmark_batch<Compiler>(shaders, options);
+}
+
+// Runs the benchmark selected by `options`, appending any results to
+// `results`.
+template <ShaderCompiler Compiler>
+bool run_benchmark(const char* shader_path, const char* shader_source, const BenchmarkOptions& options, std::vector<BenchmarkResult>& results)
+{
+  if(options.num_threads > 0)
+  {
+    return benchmark_threads<Compiler>(shader_path, shader_source, options, results);
+  }
+  return benchmark<Compiler>(shader_path, shader_source, options, results);
+}
+
+// Compiles the shader with each combination of options.sweep_optimization,
+// options.sweep_debug_info, validation on and off, and EmitSpirvDirectly on
+// and off, skipping the settings this backend can't change, and prints the
+// first and median compile times, SPIR-V size and memory use of each. Each
+// combination gets a new compiler, so that one's caches don't help the next.
+template <ShaderCompiler Compiler>
+bool benchmark_sweep(const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  const uint32_t knobs = Compiler::codegen_knobs();
+  // A setting the backend can't change gets one value, which isn't applied.
+  const std::vector<int>  optimization_levels = (knobs & kCodegenOptimization) ? options.sweep_optimization : std::vector<int>{0};
+  const std::vector<int>  debug_info_levels   = (knobs & kCodegenDebugInfo) ? options.sweep_debug_info : std::vector<int>{0};
+  const std::vector<bool> validations         = (knobs & kCodegenValidation) ? std::vector<bool>{true, false} : std::vector<bool>{true};
+  const std::vector<bool> emit_directly       = (knobs & kCodegenEmitSpirvDirectly) ? std::vector<bool>{true, false} : std::vector<bool>{true};
+
+  fprintf(stderr, "Sweeping %s over %zu configurations, compiling each %zu times...\n", Compiler::name(),
+          optimization_levels.size() * debug_info_levels.size() * validations.size() * emit_directly.size(),
+          options.num_repetitions);
+  printf("%s:\n", Compiler::name());
+  printf("%-4s %-5s %-10s %-7s %14s %14s %12s %14s %14s %14s\n", "opt", "debug", "validation", "direct", "first (ms)",
+         "median (ms)", "SPIR-V (B)", "1st alloc (B)", "retained (B)", "RSS delta (B)");
+  for(const int optimization : optimization_levels)
+  {
+    for(const int debug_info : debug_info_levels)
+    {
+      for(const bool validation : validations)
+      {
+        for(const bool emit_spirv_directly : emit_directly)
+        {
+          const MemorySnapshot before = MemorySnapshot::capture();
+          Compiler             compiler;
+          if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+          {
+            return false;
+          }
+          CodegenSettings codegen = compiler.codegen();
+          if(knobs & kCodegenOptimization)
+          {
+            codegen.optimization = optimization;
+          }
+          if(knobs & kCodegenDebugInfo)
+          {
+            codegen.debug_info = debug_info;
+          }
+          if(knobs & kCodegenValidation)
+          {
+            codegen.validation = validation;
+          }
+          if(knobs & kCodegenEmitSpirvDirectly)
+          {
+            codegen.emit_spirv_directly = emit_spirv_directly;
+          }
+          compiler.set_codegen(codegen);
+
+          const MemorySnapshot    before_first = MemorySnapshot::capture();
+          const timer::time_point first_start  = timer::now();
+          if(!compiler.compile(shader_path, shader_source))
+          {
+            fprintf(stderr, "Compilation failed with -O%d -g%d, validation %s, EmitSpirvDirectly %s.\n", codegen.optimization,
+                    codegen.debug_info, codegen.validation ? "on" : "off", codegen.emit_spirv_directly ? "on" : "off");
+            return false;
+          }
+          const double      first_ms    = milliseconds_between(first_start, timer::now());
+          const MemoryDelta first_delta = MemoryDelta::between(before_first, MemorySnapshot::capture());
+          const size_t      spirv_size  = compiler.get_spirv_size();
+          for(size_t warmup = 1; warmup < options.num_warmups; warmup++)
+          {
+            if(!compiler.compile(shader_path, shader_source))
+            {
+              return false;
+            }
+          }
+
+          std::vector<double>     samples;
+          const timer::time_point loop_start = timer::now();
+          for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+          {
+            const timer::time_point start = timer::now();
+            if(!compiler.compile(shader_path, shader_source))
+            {
+              return false;
+            }
+            const timer::time_point end = timer::now();
+            samples.push_back(milliseconds_between(start, end));
+            if(options.time_budget_s > 0.0 && milliseconds_between(loop_start, end) > 1000.0 * options.time_budget_s)
+            {
+              break;
+            }
+          }
+          if(options.mad_threshold > 0.0)
+          {
+            reject_outliers_mad(samples, options.mad_threshold);
+          }
+          const MemoryDelta total_delta = MemoryDelta::between(before, MemorySnapshot::capture());
+
+          const auto setting = [&](uint32_t knob, const char* value) { return (knobs & knob) ? value : "-"; };
+          char       optimization_str[4], debug_info_str[4];
+          snprintf(optimization_str, sizeof(optimization_str), "O%d", codegen.optimization);
+          snprintf(debug_info_str, sizeof(debug_info_str), "g%d", codegen.debug_info);
+          printf("%-4s %-5s %-10s %-7s %14.6f %14.6f %12zu %14llu %14lld %14lld\n", setting(kCodegenOptimization, optimization_str),
+                 setting(kCodegenDebugInfo, debug_info_str), setting(kCodegenValidation, codegen.validation ? "on" : "off"),
+                 setting(kCodegenEmitSpirvDirectly, codegen.emit_spirv_directly ? "on" : "off"), first_ms,
+                 summarize(samples).median, spirv_size, static_cast<unsigned long long>(first_delta.allocated_bytes),
+                 static_cast<long long>(total_delta.live_bytes), static_cast<long long>(total_delta.rss_bytes));
+        }
+      }
+    }
+  }
+  printf("(1st alloc is bytes allocated by the first compile; retained and RSS delta are from before init() to after "
+         "the last compile, with the compiler still alive; - is a setting %s can't change)\n",
+         Compiler::name());
+  return true;
+}
+
+// A power law exponent above this means compile time grows super-linearly
+// with shader size.
+constexpr double kSuperLinearExponent = 1.2;
+
+// Generates shaders of growing size (see shader_generator.h) by multiplying
+// options.scaling_dimension by each of options.scaling_sizes, and compiles
+// each with a new compiler. Then fits a power law to compile time against
+// source size (or the dimension's value, with options.scaling_by_value), and
+// flags super-linear growth: both over all sizes, and for each step from one
+// size to the next.
+template <ShaderCompiler Compiler>
+bool benchmark_scaling(const BenchmarkOptions& options)
+{
+  const std::optional<ShaderLanguage> language = shader_language_for_extension(Compiler::extension());
+  if(!language.has_value())
+  {
+    fprintf(stderr, "The shader generator can't write %s shaders.\n", Compiler::extension());
+    return false;
+  }
+
+  fprintf(stderr, "Scaling %s with %s over %zu sizes, compiling each %zu times...\n", options.scaling_name,
+          Compiler::name(), options.scaling_sizes.size(), options.num_repetitions);
+  printf("%s:\n", Compiler::name());
+  printf("%12s %12s %12s %14s %14s %14s %10s\n", options.scaling_name, "files", "bytes", "first (ms)", "median (ms)",
+         "ms per KiB", "exponent");
+  std::vector<double> sizes, first_ms, median_ms;
+  for(const size_t multiplier : options.scaling_sizes)
+  {
+    GeneratorSettings settings;
+    settings.*options.scaling_dimension *= multiplier;
+    if(options.scaling_limit && settings.*options.scaling_dimension > settings.*options.scaling_limit)
+    {
+      fprintf(stderr, "Skipping %s %zu: values above %zu give the same shader.\n", options.scaling_name,
+              settings.*options.scaling_dimension, settings.*options.scaling_limit);
+      continue;
+    }
+    const GeneratedShader shader = generate_shader(settings, language.value());
+    const std::string dir_name = std::string(Compiler::name()) + "-" + options.scaling_name + "-" + std::to_string(multiplier);
+    const fs::path    dir      = fs::temp_directory_path() / "slang-compile-timer-scaling" / dir_name;
+    std::error_code   error;
+    fs::remove_all(dir, error);
+    const std::string shader_path = write_generated_shader(shader, dir);
+    if(shader_path.empty())
+    {
+      return false;
+    }
+    const std::string& shader_source = shader.main().contents;
+
+    Compiler compiler;
+    if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+    {
+      return false;
+    }
+    const timer::time_point first_start = timer::now();
+    if(!compiler.compile(shader_path.c_str(), shader_source.c_str()))
+    {
+      fprintf(stderr, "Compilation of the generated shader %s failed.\n", shader_path.c_str());
+      return false;
+    }
+    first_ms.push_back(milliseconds_between(first_start, timer::now()));
+    for(size_t warmup = 1; warmup < options.num_warmups; warmup++)
+    {
+      if(!compiler.compile(shader_path.c_str(), shader_source.c_str()))
+      {
+        return false;
+      }
+    }
+    std::vector<double>     samples;
+    const timer::time_point loop_start = timer::now();
+    for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+    {
+      const timer::time_point start = timer::now();
+      if(!compiler.compile(shader_path.c_str(), shader_source.c_str()))
+      {
+        return false;
+      }
+      const timer::time_point end = timer::now();
+      samples.push_back(milliseconds_between(start, end));
+      if(options.time_budget_s > 0.0 && milliseconds_between(loop_start, end) > 1000.0 * options.time_budget_s)
+      {
+        break;
+      }
+    }
+    if(options.mad_threshold > 0.0)
+    {
+      reject_outliers_mad(samples, options.mad_threshold);
+    }
+    sizes.push_back(static_cast<double>(options.scaling_by_value ? settings.*options.scaling_dimension : shader.num_bytes()));
+    median_ms.push_back(summarize(samples).median);
+
+    // The exponent of the step from the previous size.
+    const size_t i                = sizes.size() - 1;
+    char         exponent_str[32] = "-";
+    if(i > 0)
+    {
+      const double exponent = fit_power_law({sizes[i - 1], sizes[i]}, {median_ms[i - 1], median_ms[i]}).exponent;
+      snprintf(exponent_str, sizeof(exponent_str), "%.2f%s", exponent, exponent > kSuperLinearExponent ? " !" : "");
+    }
+    printf("%12zu %12zu %12zu %14.6f %14.6f %14.6f %10s\n", settings.*options.scaling_dimension, shader.files.size(),
+           shader.num_bytes(), first_ms[i], median_ms[i], median_ms[i] * 1024.0 / shader.num_bytes(), exponent_str);
+  }
+
+  const char*       x_name     = options.scaling_by_value ? options.scaling_name : "bytes";
+  const PowerLawFit first_fit  = fit_power_law(sizes, first_ms);
+  const PowerLawFit median_fit = fit_power_law(sizes, median_ms);
+  printf("First compile time ~ %s^%.3f (R^2 %.3f); median compile time ~ %s^%.3f (R^2 %.3f)\n", x_name,
+         first_fit.exponent, first_fit.r_squared, x_name, median_fit.exponent, median_fit.r_squared);
+  if(first_fit.exponent > kSuperLinearExponent || median_fit.exponent > kSuperLinearExponent)
+  {
+    printf("Warning: %s's compile time grows super-linearly with %s (exponent above %.1f).\n", Compiler::name(),
+           options.scaling_by_value ? options.scaling_name : "shader size", kSuperLinearExponent);
+  }
+  printf("(exponent is for the median from the previous size; ! marks steps above %.1f)\n", kSuperLinearExponent);
+  return true;
+}
+
+// Runs in each child process that benchmark_cold_start() starts: initializes
+// a compiler and compiles the shader once, then prints how long it took for
+// main() to start, for init(), and for the compile, and when it finished.
+template <ShaderCompiler Compiler>
+bool cold_start_child(const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  const int64_t spawn_ns = strtoll(options.cold_start_child, nullptr, 0);
+
+  Compiler compiler;
+  if constexpr(std::is_same_v<Compiler, SlangCompilerHelper>)
+  {
+    compiler.set_core_module(find_core_module(options.core_module));
+  }
+  const int64_t init_start_ns = process_clock_ns();
+  if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+  {
+    return false;
+  }
+  const int64_t compile_start_ns = process_clock_ns();
+  if(!compiler.compile(shader_path, shader_source))
+  {
+    return false;
+  }
+  const int64_t end_ns = process_clock_ns();
+  printf("cold-start: %.9g %.9g %.9g %lld\n", 1e-6 * static_cast<double>(options.main_start_ns - spawn_ns),
+         1e-6 * static_cast<double>(compile_start_ns - init_start_ns), 1e-6 * static_cast<double>(end_ns - compile_start_ns),
+         static_cast<long long>(end_ns));
+  return true;
+}
+
+// Starts `options.num_cold_starts` fresh processes, each of which initializes
+// a compiler and compiles the shader once, and reports the distribution of
+// how long each step took: starting the process (including loading the
+// compiler libraries, which are linked at load time, and static
+// initialization), init(), the first compile, and exiting. For Slang, compares
+// loading the core module the default way (usually precompiled and embedded)
+// to compiling it from source, unless --core-module picks one.
+template <ShaderCompiler Compiler>
+bool benchmark_cold_start(const char* shader_path, const BenchmarkOptions& options)
+{
+  const std::string        executable = current_executable_path(options.executable);
+  std::vector<const char*> core_modules;
+  if constexpr(!std::is_same_v<Compiler, SlangCompilerHelper>)
+  {
+    core_modules = {nullptr};
+  }
+  else if(options.core_module)
+  {
+    core_modules = {options.core_module};
+  }
+  else
+  {
+    core_modules = {"default", "source"};
+  }
+
+  for(const char* core_module : core_modules)
+  {
+    // Arguments for the child, which get the same settings as us.
+    std::vector<std::string> args = {executable, "--cold-start-child", "", "--backends", Compiler::name()};
+    if(core_module)
+    {
+      args.insert(args.end(), {"--core-module", core_module});
+    }
+    const std::vector<std::string> settings = settings_arguments(options);
+    args.insert(args.end(), settings.begin(), settings.end());
+    args.push_back(shader_path);
+
+    std::vector<double> process_start_ms, init_ms, first_compile_ms, exit_ms, total_ms;
+    fprintf(stderr, "Starting %zu processes...\n", options.num_cold_starts);
+    for(size_t i = 0; i < options.num_cold_starts; i++)
+    {
+      std::string   output;
+      int           exit_code = 0;
+      const int64_t spawn_ns  = process_clock_ns();
+      args[2]                 = std::to_string(spawn_ns);
+      if(!run_process(args, output, exit_code))
+      {
+        return false;
+      }
+      const int64_t exited_ns = process_clock_ns();
+
+      double       start = 0.0, init = 0.0, compile = 0.0;
+      long long    end_ns = 0;
+      const size_t line   = output.find("cold-start: ");
+      if(exit_code != 0 || line == std::string::npos
+         || sscanf(output.c_str() + line, "cold-start: %lf %lf %lf %lld", &start, &init, &compile, &end_ns) != 4)
+      {
+        fprintf(stderr, "Child process %zu failed (exit code %d).\n", i + 1, exit_code);
+        return false;
+      }
+      process_start_ms.push_back(start);
+      init_ms.push_back(init);
+      first_compile_ms.push_back(compile);
+      exit_ms.push_back(1e-6 * static_cast<double>(exited_ns - end_ns));
+      total_ms.push_back(1e-6 * static_cast<double>(exited_ns - spawn_ns));
+    }
+
+    if(core_module)
+    {
+      printf("Core module: %s\n", core_module);
+    }
+    printf("%-18s %12s %12s %12s %12s\n", "Cold start (ms)", "min", "median", "p95", "max");
+    const struct
+    {
+      const char*                label;
+      const std::vector<double>* samples;
+    } rows[] = {
+        {"Process start", &process_start_ms}, {"Initialization", &init_ms}, {"First compile", &first_compile_ms},
+        {"Exit", &exit_ms},                   {"Total", &total_ms},
+    };
+    for(const auto& row : rows)
+    {
+      const SampleSummary summary = summarize(*row.samples);
+      printf("%-18s %12.6f %12.6f %12.6f %12.6f\n", row.label, summary.min, summary.median, summary.p95, summary.max);
+    }
+  }
+  return true;
+}
+
+// Requests a client can send to run_server(). A compile request is followed by
+// the shader's path and source; the server replies with a status (0 for
+// success), the time compile() took as a double, and the SPIR-V.
+enum ServerRequest : uint64_t
+{
+  kServerCompile  = 1,
+  kServerShutdown = 2,
+};
+
+// Keeps one compiler (and so, for Slang, one global session and module cache)
+// resident, and compiles shaders for clients that connect to `name`, one
+// client at a time. Runs until a client asks it to shut down.
+template <ShaderCompiler Compiler>
+bool run_server(const char* name, const BenchmarkOptions& options)
+{
+  Compiler compiler;
+  if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+  {
+    return false;
+  }
+  // Clients can edit files between requests.
+  compiler.set_track_changes(true);
+  LocalListener listener;
+  if(!listener.listen(name))
+  {
+    return false;
+  }
+  printf("%s compile server listening on %s\n", Compiler::name(), listener.path().c_str());
+  fflush(stdout);
+
+  std::string path, source;
+  while(true)
+  {
+    LocalConnection connection = listener.accept();
+    if(!connection.is_open())
+    {
+      return false;
+    }
+    size_t   num_requests = 0;
+    uint64_t request      = 0;
+    while(connection.receive_u64(request))
+    {
+      if(request == kServerShutdown)
+      {
+        connection.send_u64(0);
+        printf("Shutting down.\n");
+        return true;
+      }
+      if(request != kServerCompile || !connection.receive_bytes(path) || !connection.receive_bytes(source))
+      {
+        fprintf(stderr, "Received an invalid request.\n");
+        break;
+      }
+      const timer::time_point start   = timer::now();
+      const bool              success = compiler.compile(path.c_str(), source.c_str());
+      const double            compile_ms = milliseconds_between(start, timer::now());
+      const std::string_view  spirv =
+          success ? std::string_view(static_cast<const char*>(compiler.get_spirv_data()), compiler.get_spirv_size()) : std::string_view();
+      if(!connection.send_u64(success ? 0 : 1) || !connection.send_u64(std::bit_cast<uint64_t>(compile_ms))
+         || !connection.send_bytes(spirv))
+      {
+        break;
+      }
+      num_requests++;
+    }
+    printf("Client disconnected after %zu requests.\n", num_requests);
+    fflush(stdout);
+  }
+}
+
+// Measures the round-trip latency of compiling a shader on a server started
+// with --server, including IPC and serialization, and compares it to
+// compiling in this process with the same options.
+template <ShaderCompiler Compiler>
+bool benchmark_client(const char* name, const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  const size_t num_repetitions = options.num_repetitions;
+
+  // In-process baseline
+  std::vector<double> local_samples(num_repetitions);
+  std::vector<char>   local_spirv;
+  {
+    Compiler compiler;
+    if(!compiler.init(options.enable_glsl) || !configure(compiler, options)
+       || !compiler.compile(shader_path, shader_source))
+    {
+      return false;
+    }
+    const char* data = static_cast<const char*>(compiler.get_spirv_data());
+    local_spirv.assign(data, data + compiler.get_spirv_size());
+    for(size_t i = 0; i < num_repetitions; i++)
+    {
+      const timer::time_point start = timer::now();
+      if(!compiler.compile(shader_path, shader_source))
+      {
+        return false;
+      }
+      local_samples[i] = milliseconds_between(start, timer::now());
+    }
+  }
+
+  LocalConnection connection;
+  if(!connection.connect(name))
+  {
+    return false;
+  }
+  // The server needs an absolute path, since its working directory may differ.
+  const std::string absolute_path = fs::absolute(shader_path).string();
+  std::string       spirv;
+  double            server_ms = 0.0;
+  const auto        request   = [&]() {
+    uint64_t status = 0, compile_ms_bits = 0;
+    if(!connection.send_u64(kServerCompile) || !connection.send_bytes(absolute_path) || !connection.send_bytes(shader_source)
+       || !connection.receive_u64(status) || !connection.receive_u64(compile_ms_bits) || !connection.receive_bytes(spirv))
+    {
+      fprintf(stderr, "Lost the connection to the server.\n");
+      return false;
+    }
+    if(status != 0)
+    {
+      fprintf(stderr, "The server could not compile %s.\n", absolute_path.c_str());
+      return false;
+    }
+    server_ms = std::bit_cast<double>(compile_ms_bits);
+    return true;
+  };
+
+  // The first request may compile modules the server doesn't have yet.
+  {
+    const timer::time_point start = timer::now();
+    if(!request())
+    {
+      return false;
+    }
+    printf("First request: %f ms round trip (%f ms compiling on the server)\n", milliseconds_between(start, timer::now()), server_ms);
+  }
+  if(spirv.size() != local_spirv.size() || memcmp(spirv.data(), local_spirv.data(), spirv.size()) != 0)
+  {
+    printf("WARNING: The server's SPIR-V differs from this process's; is it using different options?\n");
+  }
+
+  std::vector<double> round_trip_samples(num_repetitions), server_samples(num_repetitions), overhead_samples(num_repetitions);
+  for(size_t i = 0; i < num_repetitions; i++)
+  {
+    const timer::time_point start = timer::now();
+    if(!request())
+    {
+      return false;
+    }
+    round_trip_samples[i] = milliseconds_between(start, timer::now());
+    server_samples[i]     = server_ms;
+    overhead_samples[i]   = round_trip_samples[i] - server_ms;
+  }
+  if(options.stop_server)
+  {
+    uint64_t reply = 0;
+    connection.send_u64(kServerShutdown);
+    connection.receive_u64(reply);
+  }
+
+  printf("Request: %zu bytes; response: %zu bytes\n", 3 * sizeof(uint64_t) + absolute_path.size() + strlen(shader_source),
+         3 * sizeof(uint64_t) + spirv.size());
+  printf("%-28s %12s %12s %12s %12s\n", "Time (ms)", "min", "median", "p95", "mean");
+  const struct
+  {
+    const char*                label;
+    const std::vector<double>* samples;
+  } rows[] = {
+      {"In-process compile", &local_samples},
+      {"Server round trip", &round_trip_samples},
+      {"Compile on server", &server_samples},
+      {"IPC + serialization", &overhead_samples},
+  };
+  for(const auto& row : rows)
+  {
+    const SampleSummary summary = summarize(*row.samples);
+    printf("%-28s %12.6f %12.6f %12.6f %12.6f\n", row.label, summary.min, summary.median, summary.p95, summary.mean);
+  }
+  return true;
+}
+
+// Compares two Slang configurations that differ only in
+// `options.ab_setting`. Compiles alternate between the two (swapping which
+// goes first each time), so that drift such as thermal throttling or other
+// processes affects both equally. Reports the difference in means with a 95%
+// confidence interval, and p-values from Welch's t-test and the Mann-Whitney U
+// test.
+bool benchmark_ab(const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  BenchmarkOptions configs[2] = {options, options};
+  bool*            toggle     = find_toggle(configs[1], options.ab_setting);
+  *toggle                     = !*toggle;
+  const bool  value_a         = *find_toggle(configs[0], options.ab_setting);
+  const char* labels[2]       = {value_a ? "on" : "off", value_a ? "off" : "on"};
+
+  SlangCompilerHelper compilers[2];
+  for(size_t i = 0; i < 2; i++)
+  {
+    if(!compilers[i].init(options.enable_glsl) || !configure(compilers[i], configs[i]))
+    {
+      return false;
+    }
+    for(size_t warmup = 0; warmup < std::max<size_t>(options.num_warmups, 1); warmup++)
+    {
+      if(!compilers[i].compile(shader_path, shader_source))
+      {
+        return false;
+      }
+    }
+  }
+
+  fprintf(stderr, "Compiling %zu times with each configuration...\n", options.num_repetitions);
+  std::vector<double> samples[2];
+  samples[0].reserve(options.num_repetitions);
+  samples[1].reserve(options.num_repetitions);
+  const timer::time_point loop_start = timer::now();
+  for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+  {
+    timer::time_point end;
+    for(size_t order = 0; order < 2; order++)
+    {
+      const size_t i = order ^ (repetition & 1);
+      if(options.cooldown_ms > 0.0)
+      {
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(options.cooldown_ms));
+      }
+      const timer::time_point start = timer::now();
+      if(!compilers[i].compile(shader_path, shader_source))
+      {
+        return false;
+      }
+      end = timer::now();
+      samples[i].push_back(milliseconds_between(start, end));
+    }
+
+    if(options.time_budget_s > 0.0 && milliseconds_between(loop_start, end) > 1000.0 * options.time_budget_s)
+    {
+      fprintf(stderr, "Time budget reached after %zu repetitions.\n", repetition + 1);
+      break;
+    }
+  }
+
+  for(size_t i = 0; i < 2; i++)
+  {
+    if(options.mad_threshold > 0.0)
+    {
+      const size_t num_rejected = reject_outliers_mad(samples[i], options.mad_threshold);
+      printf("Rejected %zu outliers from %c (modified z-score > %g)\n", num_rejected, "AB"[i], options.mad_threshold);
+    }
+    const SampleSummary summary = summarize(samples[i]);
+    printf("%c (%s %s): mean %f ms, median %f ms, stddev %f ms, %zu samples\n", "AB"[i], options.ab_setting,
+           labels[i], summary.mean, summary.median, summary.stddev, summary.count);
+  }
+
+  const WelchTestResult welch = welch_t_test(samples[0], samples[1], 0.95);
+  const double          mean_a = summarize(samples[0]).mean;
+  printf("Delta (B - A): %f ms (%+.2f%%), 95%% CI [%f, %f] ms\n", welch.delta, 100.0 * welch.delta / mean_a,
+         welch.ci_low, welch.ci_high);
+  printf("Welch's t-test: t = %f, df = %f, p = %g\n", welch.t, welch.df, welch.p);
+  const MannWhitneyResult mann_whitney = mann_whitney_u(samples[0], samples[1]);
+  printf("Mann-Whitney U test: U = %f, z = %f, p = %g\n", mann_whitney.u, mann_whitney.z, mann_whitney.p);
+  return true;
+}
+
+// Measures what walking the program's reflection (every parameter, binding
+// range, descriptor set and entry point layout) costs after each compile, as
+// an app that builds descriptor set layouts from reflection would, with the
+// module cache off and on. Once a compile's code comes from cached modules,
+// this shows whether reflection becomes the hot path.
+bool benchmark_reflection(const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  printf("%-14s %14s %14s %14s %14s %9s\n", "Module cache", "compile (ms)", "link (ms)", "reflect (ms)", "first (ms)", "reflect%");
+  for(const bool module_cache : {false, true})
+  {
+    BenchmarkOptions config            = options;
+    config.slang_settings.module_cache = module_cache;
+    SlangCompilerHelper compiler;
+    if(!compiler.init(options.enable_glsl) || !configure(compiler, config) || !compiler.compile(shader_path, shader_source))
+    {
+      return false;
+    }
+    const double                first_reflection_ms = compiler.phase_times().reflection_ms;
+    const SlangReflectionStats& stats               = compiler.reflection_stats();
+    if(!module_cache)
+    {
+      printf("Reflection visited %zu entry points, %zu parameters, %zu variables, %zu binding ranges, and %zu descriptor "
+             "ranges in %zu sets\n",
+             stats.num_entry_points, stats.num_parameters, stats.num_variables, stats.num_binding_ranges,
+             stats.num_descriptor_ranges, stats.num_descriptor_sets);
+    }
+    for(size_t warmup = 1; warmup < options.num_warmups; warmup++)
+    {
+      if(!compiler.compile(shader_path, shader_source))
+      {
+        return false;
+      }
+    }
+
+    std::vector<double> compile_ms, link_ms, reflection_ms;
+    for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+    {
+      const timer::time_point start = timer::now();
+      if(!compiler.compile(shader_path, shader_source))
+      {
+        return false;
+      }
+      const double           total_ms = milliseconds_between(start, timer::now());
+      const SlangPhaseTimes& phases   = compiler.phase_times();
+      compile_ms.push_back(total_ms - phases.layout_link_ms - phases.reflection_ms);
+      link_ms.push_back(phases.layout_link_ms);
+      reflection_ms.push_back(phases.reflection_ms);
+    }
+    const SampleSummary compile = summarize(compile_ms), link = summarize(link_ms), reflection = summarize(reflection_ms);
+    const double        total   = compile.mean + link.mean + reflection.mean;
+    printf("%-14s %14.6f %14.6f %14.6f %14.6f %8.2f%%\n", module_cache ? "on" : "off", compile.median, link.median,
+           reflection.median, first_reflection_ms, total > 0.0 ? 100.0 * (link.mean + reflection.mean) / total : 0.0);
+  }
+  printf("(compile, link and reflect are medians over repetitions; first is the first compile's reflection walk; "
+         "reflect%% is the share of the mean compile spent linking and reflecting)\n");
+  return true;
+}
+
+// Compares two ways of compiling many permutations of one shader: loading
+// the module once and then specializing and linking each entry point from it,
+// and compiling the module from source again, in a new session, for each
+// entry point of each permutation.
+bool benchmark_permutations(const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  SlangCompilerHelper compiler;
+  if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+  {
+    return false;
+  }
+
+  // Warm up both, and check that the permutations compile.
+  for(size_t warmup = 0; warmup < std::max<size_t>(options.num_warmups, 1); warmup++)
+  {
+    if(!compiler.compile_permutations(shader_path, shader_source, options.permutations, true)
+       || !compiler.compile_permutations(shader_path, shader_source, options.permutations, false))
+    {
+      return false;
+    }
+  }
+  const size_t num_outputs = compiler.permutation_outputs().size();
+  size_t       spirv_bytes = 0;
+  for(const Slang::ComPtr<ISlangBlob>& output : compiler.permutation_outputs())
+  {
+    spirv_bytes += output->getBufferSize();
+  }
+  printf("Compiling %zu entry points (%zu bytes of SPIR-V in total).\n", num_outputs, spirv_bytes);
+  if(num_outputs == 0)
+  {
+    return false;
+  }
+
+  // The sink shares ownership of the blobs, so no SPIR-V is copied.
+  std::unique_ptr<AsyncOutputSink> sink;
+  if(!make_output_sink(options, sink))
+  {
+    return false;
+  }
+  if(sink)
+  {
+    for(size_t i = 0; i < num_outputs; i++)
+    {
+      if(!sink->write("permutation-" + std::to_string(i) + ".spv", SlangCompilerHelper::share_blob(compiler.permutation_outputs()[i])))
+      {
+        return false;
+      }
+    }
+    // Finish before timing, so that writes don't compete with compiles.
+    if(!finish_output_sink(*sink))
+    {
+      return false;
+    }
+  }
+
+  fprintf(stderr, "Compiling all permutations %zu times each way...\n", options.num_repetitions);
+  std::vector<double> shared_ms;
+  std::vector<double> separate_ms;
+  std::vector<double> link_ms;
+  shared_ms.reserve(options.num_repetitions);
+  separate_ms.reserve(options.num_repetitions);
+  link_ms.reserve(options.num_repetitions);
+  const timer::time_point loop_start = timer::now();
+  for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+  {
+    timer::time_point start = timer::now();
+    if(!compiler.compile_permutations(shader_path, shader_source, options.permutations, true))
+    {
+      return false;
+    }
+    timer::time_point end = timer::now();
+    shared_ms.push_back(milliseconds_between(start, end));
+    link_ms.push_back(compiler.phase_times().get_target_code_ms);
+
+    start = end;
+    if(!compiler.compile_permutations(shader_path, shader_source, options.permutations, false))
+    {
+      return false;
+    }
+    end = timer::now();
+    separate_ms.push_back(milliseconds_between(start, end));
+
+    if(options.time_budget_s > 0.0 && milliseconds_between(loop_start, end) > 1000.0 * options.time_budget_s)
+    {
+      fprintf(stderr, "Time budget reached after %zu repetitions.\n", repetition + 1);
+      break;
+    }
+  }
+
+  const double        count    = static_cast<double>(num_outputs);
+  const SampleSummary shared   = summarize(shared_ms);
+  const SampleSummary separate = summarize(separate_ms);
+  const SampleSummary linking  = summarize(link_ms);
+  printf("Load once, then specialize and link: mean %f ms, median %f ms (%f ms per permutation)\n", shared.mean,
+         shared.median, shared.mean / count);
+  printf("  Of which specializing and linking: mean %f ms (%f ms per permutation)\n", linking.mean,
+         linking.mean / count);
+  printf("Recompile from source each time: mean %f ms, median %f ms (%f ms per permutation)\n", separate.mean,
+         separate.median, separate.mean / count);
+  printf("Speedup from sharing the module: %fx\n", separate.mean / shared.mean);
+  return true;
+}
+
+// Copies the shader's directory to `work_dir`, so that benchmarks can edit
+// files without modifying the originals. Returns false on failure.
+bool copy_shader_directory(const char* shader_path, const fs::path& work_dir)
+{
+  std::error_code error;
+  fs::remove_all(work_dir, error);
+  // absolute(), since a shader in the current directory has no parent path.
+  fs::copy(fs::absolute(shader_path, error).parent_path(), work_dir, fs::copy_options::recursive, error);
+  if(error)
+  {
+    fprintf(stderr, "Could not copy shaders to %s: %s\n", work_dir.string().c_str(), error.message().c_str());
+    return false;
+  }
+  return true;
+}
+
+// Compares serving the modules a shader imports from one shader archive to
+// loading them from loose files in a disk cache directory: first the latency
+// of looking up each entry and mapping it, then the first compile of the
+// shader in a fresh compiler that uses each one.
+bool benchmark_module_archive(const char* shader_path, const char* shader_source, const BenchmarkOptions& options)
+{
+  // Entries from other runs would make the first compile below a cache hit.
+  const fs::path  loose_dir = fs::temp_directory_path() / "slang-compile-timer-loose-modules";
+  std::error_code error;
+  fs::remove_all(loose_dir, error);
+  BenchmarkOptions source_options = options;
+  source_options.module_archive   = nullptr;
+  source_options.module_cache_dir = nullptr;
+
+  // Compile every module from source once, storing it both ways.
+  double source_ms = 0.0;
+  {
+    SlangCompilerHelper compiler;
+    if(!compiler.init(options.enable_glsl) || !configure(compiler, source_options)
+       || !compiler.set_disk_cache_directory(loose_dir))
+    {
+      return false;
+    }
+    const timer::time_point start = timer::now();
+    if(!compiler.compile(shader_path, shader_source))
+    {
+      return false;
+    }
+    source_ms = milliseconds_between(start, timer::now());
+    if(!compiler.export_module_archive(options.archive_benchmark, options.archive_compression))
+    {
+      return false;
+    }
+  }
+
+  const timer::time_point open_start = timer::now();
+  ArchiveReader           archive;
+  if(!archive.open(options.archive_benchmark))
+  {
+    return false;
+  }
+  const double open_ms = milliseconds_between(open_start, timer::now());
+  if(archive.num_entries() == 0)
+  {
+    fprintf(stderr, "The shader doesn't import any modules.\n");
+    return false;
+  }
+  DiskCache loose;
+  loose.set_directory(loose_dir);
+
+  // Lookups; we touch the first byte of each entry so that both page it in.
+  fprintf(stderr, "Looking up %zu modules %zu times each way...\n", archive.num_entries(), options.num_repetitions);
+  std::vector<double> archive_us, loose_us;
+  std::vector<char>   scratch;
+  uint64_t            checksum = 0;
+  for(size_t repetition = 0; repetition < options.num_repetitions; repetition++)
+  {
+    for(size_t i = 0; i < archive.num_entries(); i++)
+    {
+      const uint64_t key = archive.entry(i).key;
+
+      timer::time_point        start = timer::now();
+      const ArchiveIndexEntry* entry = archive.find(key);
+      std::string_view         payload;
+      if(!entry || !archive.read(*entry, scratch, payload))
+      {
+        return false;
+      }
+      checksum += payload.empty() ? 0 : static_cast<uint8_t>(payload[0]);
+      archive_us.push_back(1000.0 * milliseconds_between(start, timer::now()));
+
+      start = timer::now();
+      MappedFile file;
+      if(!loose.load(key, ".slang-module", file))
+      {
+        fprintf(stderr, "Module %s is missing from %s.\n", std::string(archive.name(archive.entry(i))).c_str(),
+                loose_dir.string().c_str());
+        return false;
+      }
+      checksum += file.size() == 0 ? 0 : static_cast<uint8_t>(file.data()[0]);
+      loose_us.push_back(1000.0 * milliseconds_between(start, timer::now()));
+    }
+  }
+  const SampleSummary archive_summary = summarize(archive_us);
+  const SampleSummary loose_summary   = summarize(loose_us);
+  printf("Archive open: %f ms (%zu entries, checksum %llu)\n", open_ms, archive.num_entries(),
+         static_cast<unsigned long long>(checksum));
+  printf("%-14s %12s %12s %12s\n", "Lookup", "median (us)", "mean (us)", "p95 (us)");
+  printf("%-14s %12.3f %12.3f %12.3f\n", "Archive", archive_summary.median, archive_summary.mean, archive_summary.p95);
+  printf("%-14s %12.3f %12.3f %12.3f\n", "Loose files", loose_summary.median, loose_summary.mean, loose_summary.p95);
+
+  // First compiles in fresh compilers.
+  const auto first_compile = [&](const char* archive_path, const fs::path& cache_dir, const char* label) {
+    SlangCompilerHelper compiler;
+    if(!compiler.init(options.enable_glsl) || !configure(compiler, source_options)
+       || !compiler.set_module_archive(archive_path ? fs::path(archive_path) : fs::path())
+       || !compiler.set_disk_cache_directory(cache_dir))
+    {
+      return false;
+    }
+    const uint64_t          calls_before = filesystem_call_count();
+    const timer::time_point start        = timer::now();
+    if(!compiler.compile(shader_path, shader_source))
+    {
+      return false;
+    }
+    const double compile_ms = milliseconds_between(start, timer::now());
+    printf("First compile, modules from %s: %f ms (%llu file system calls, %zu modules compiled)\n", label, compile_ms,
+           static_cast<unsigned long long>(filesystem_call_count() - calls_before), compiler.num_modules_compiled());
+    return true;
+  };
+  printf("First compile, modules from source: %f ms\n", source_ms);
+  return first_compile(nullptr, loose_dir, "loose files") && first_compile(options.archive_benchmark, fs::path(), "the archive");
+}
+
+// Simulates hot reloading after editing an imported module: appends a comment
+// to one module between repetitions and measures the following compile,
+// compared to rebuilding every module from scratch.
+// To avoid modifying the original files, this works on a copy of the shader's
+// directory.
+bool benchmark_incremental(const char* shader_path, const BenchmarkOptions& options)
+{
+  const fs::path work_dir = fs::temp_directory_path() / "slang-compile-timer-incremental";
+  if(!copy_shader_directory(shader_path, work_dir))
+  {
+    return false;
+  }
+  std::error_code            error;
+  const std::string          work_shader_path = (work_dir / fs::path(shader_path).filename()).string();
+  std::optional<std::string> shader_code      = load_file(work_shader_path.c_str());
+  if(!shader_code.has_value())
+  {
+    return false;
+  }
+
+  if(!options.slang_settings.module_cache)
+  {
+    fprintf(stderr, "--incremental requires the module cache.\n");
+    return false;
+  }
+
+  SlangCompilerHelper compiler;
+  if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+  {
+    return false;
+  }
+  // We edit files between repetitions.
+  compiler.set_track_changes(true);
+
+  // The first compilation builds the dependency graph.
+  if(!compiler.compile(work_shader_path.c_str(), shader_code.value().c_str()))
+  {
+    return false;
+  }
+
+  const std::string edit_path =
+      options.edit_module ? (work_dir / options.edit_module).string() : compiler.find_leaf_module();
+  if(edit_path.empty())
+  {
+    fprintf(stderr, "%s doesn't import any modules, so there's nothing to edit.\n", shader_path);
+    return false;
+  }
+  printf("Editing %s between repetitions.\n", fs::path(edit_path).filename().string().c_str());
+
+  fprintf(stderr, "Compiling %zu times...\n", options.num_repetitions);
+  std::chrono::duration<double, std::milli> incremental_duration{};
+  std::chrono::duration<double, std::milli> full_duration{};
+  size_t                                    num_recompiled = 0;
+  for(size_t repetition = 1; repetition <= options.num_repetitions; repetition++)
+  {
+    // Appending makes the file grow, so its size changes even if the
+    // filesystem's timestamps are coarse.
+    std::ofstream(edit_path, std::ios::app) << "// Edit " << repetition << "\n";
+
+    const size_t            compiled_before = compiler.num_modules_compiled();
+    const timer::time_point start           = timer::now();
+    if(!compiler.compile(work_shader_path.c_str(), shader_code.value().c_str()))
+    {
+      return false;
+    }
+    const timer::time_point end = timer::now();
+    incremental_duration += (end - start);
+    num_recompiled += compiler.num_modules_compiled() - compiled_before;
+
+    compiler.clear_module_cache();
+    const timer::time_point full_start = timer::now();
+    if(!compiler.compile(work_shader_path.c_str(), shader_code.value().c_str()))
+    {
+      return false;
+    }
+    const timer::time_point full_end = timer::now();
+    full_duration += (full_end - full_start);
+  }
+
+  const double num_repetitions = static_cast<double>(options.num_repetitions);
+  printf("Average incremental recompile time: %f ms (%f modules recompiled)\n",
+         incremental_duration.count() / num_repetitions, static_cast<double>(num_recompiled) / num_repetitions);
+  printf("Average full rebuild time: %f ms\n", full_duration.count() / num_repetitions);
+  printf("Incremental speedup: %fx\n", full_duration.count() / incremental_duration.count());
+
+  fs::remove_all(work_dir, error);
+  return true;
+}
+
+// Simulates an editor saving an imported module several times in quick
+// succession (`options.save_burst` saves, `options.save_interval_ms` apart),
+// `options.num_repetitions` times. Compares compiling once per save in order
+// to a CompileScheduler that debounces and coalesces saves, and reports how
+// long it took from the last save in each burst to SPIR-V that includes it,
+// and how much compile work was out of date by the time it finished.
+// Works on a copy of the shader's directory.
+bool benchmark_bursts(const char* shader_path, const BenchmarkOptions& options)
+{
+  if(!options.slang_settings.module_cache)
+  {
+    fprintf(stderr, "--save-burst requires the module cache.\n");
+    return false;
+  }
+  const double debounce_ms = (options.debounce_ms >= 0.0) ? options.debounce_ms : 2.0 * options.save_interval_ms;
+  const fs::path work_dir = fs::temp_directory_path() / "slang-compile-timer-bursts";
+  const std::chrono::duration<double, std::milli> save_interval(options.save_interval_ms);
+
+  printf("%zu bursts of %zu saves, %f ms apart\n", options.num_repetitions, options.save_burst, options.save_interval_ms);
+  printf("%-22s %14s %14s %14s %14s\n", "Mode", "latency (ms)", "compiles", "compile ms", "stale ms");
+  for(const bool coalesce : {false, true})
+  {
+    // Start each mode from the same files and an empty cache.
+    if(!copy_shader_directory(shader_path, work_dir))
+    {
+      return false;
+    }
+    const std::string          work_shader_path = (work_dir / fs::path(shader_path).filename()).string();
+    std::optional<std::string> shader_code      = load_file(work_shader_path.c_str());
+    SlangCompilerHelper        compiler;
+    if(!shader_code.has_value() || !compiler.init(options.enable_glsl) || !configure(compiler, options))
+    {
+      return false;
+    }
+    compiler.set_track_changes(false);
+    if(!compiler.compile(work_shader_path.c_str(), shader_code.value().c_str()))
+    {
+      return false;
+    }
+    const std::string edit_path =
+        options.edit_module ? (work_dir / options.edit_module).string() : compiler.find_leaf_module();
+    if(edit_path.empty())
+    {
+      fprintf(stderr, "%s doesn't import any modules, so there's nothing to edit.\n", shader_path);
+      return false;
+    }
+
+    std::vector<double> latencies;
+    size_t              num_compiles = 0;
+    double              compile_ms = 0.0, stale_ms = 0.0;
+    {
+      CompileScheduler scheduler(compiler, work_shader_path, shader_code.value(), coalesce ? debounce_ms : 0.0, coalesce);
+      size_t           save = 0;
+      for(size_t burst = 0; burst < options.num_repetitions; burst++)
+      {
+        uint64_t          last_generation = 0;
+        timer::time_point last_save;
+        for(size_t i = 0; i < options.save_burst; i++)
+        {
+          if(i > 0)
+          {
+            std::this_thread::sleep_for(save_interval);
+          }
+          std::ofstream(edit_path, std::ios::app) << "// Save " << ++save << "\n";
+          last_save       = timer::now();
+          last_generation = scheduler.submit({edit_path}, std::nullopt);
+        }
+        scheduler.wait_idle();
+
+        bool found = false;
+        for(const ScheduledCompileResult& compile : scheduler.take_results())
+        {
+          num_compiles++;
+          compile_ms += compile.compile_ms;
+          if(compile.stale)
+          {
+            stale_ms += compile.compile_ms;
+          }
+          if(!compile.success)
+          {
+            return false;
+          }
+          if(!found && compile.generation >= last_generation)
+          {
+            latencies.push_back(milliseconds_between(last_save, compile.finished));
+            found = true;
+          }
+        }
+      }
+    }
+
+    const double num_bursts = static_cast<double>(options.num_repetitions);
+    printf("%-22s %14f %14f %14f %14f\n", coalesce ? "Debounced" : "Serial", summarize(latencies).median,
+           static_cast<double>(num_compiles) / num_bursts, compile_ms / num_bursts, stale_ms / num_bursts);
+  }
+  printf("(Latency is the median from the last save in a burst to SPIR-V; the other columns are per burst.)\n");
+
+  std::error_code error;
+  fs::remove_all(work_dir, error);
+  return true;
+}
+
+// Set by SIGINT to stop benchmark_watch().
+volatile std::sig_atomic_t g_stop_watching = 0;
+
+void stop_watching(int)
+{
+  g_stop_watching = 1;
+}
+
+// Returns whether `a` and `b` refer to the same file.
+bool same_file(const std::string& a, const std::string& b)
+{
+  std::error_code error;
+  return fs::weakly_canonical(fs::path(a), error) == fs::weakly_canonical(fs::path(b), error);
+}
+
+// Simulates an artist's hot-reload loop: keeps one compiler and its caches
+// resident, and recompiles the shader each time a file in its directory
+// changes, after throwing away only the module cache entries that the change
+// affects. Reports the latency from each change notification to new SPIR-V.
+// With --debounce, compiles in the background using a CompileScheduler.
+// Runs until interrupted, or until the time budget runs out.
+bool benchmark_watch(const char* shader_path, const BenchmarkOptions& options)
+{
+  if(!options.slang_settings.module_cache)
+  {
+    fprintf(stderr, "--watch requires the module cache.\n");
+    return false;
+  }
+
+  std::optional<std::string> shader_code = load_file(shader_path);
+  if(!shader_code.has_value())
+  {
+    return false;
+  }
+
+  SlangCompilerHelper compiler;
+  if(!compiler.init(options.enable_glsl) || !configure(compiler, options))
+  {
+    return false;
+  }
+  // The watcher tells us what changed, so compile() doesn't need to check.
+  compiler.set_track_changes(false);
+
+  const std::string spirv_path = std::string(SlangCompilerHelper::name()) + ".spv";
+  const auto        write_spirv = [&]() {
+    std::ofstream(spirv_path, std::ios::binary)
+        .write(reinterpret_cast<const char*>(compiler.get_spirv_data()), compiler.get_spirv_size());
+  };
+
+  // The first compilation builds the dependency graph; it can fail, since the
+  // artist might be about to fix the shader.
+  if(compiler.compile(shader_path, shader_code.value().c_str()))
+  {
+    write_spirv();
+  }
+
+  // absolute(), since a shader in the current directory has no parent path.
+  std::error_code error;
+  const fs::path  watch_dir = fs::absolute(shader_path, error).parent_path();
+  FileWatcher     watcher;
+  if(!watcher.watch(watch_dir))
+  {
+    return false;
+  }
+  printf("Watching %s for changes; press Ctrl+C to stop.\n", watch_dir.string().c_str());
+  g_stop_watching = 0;
+  std::signal(SIGINT, stop_watching);
+
+  // With --debounce: the scheduler, when each change was noticed (indexed by
+  // generation - 1), and how much compile work was thrown away.
+  std::unique_ptr<CompileScheduler> scheduler;
+  std::vector<timer::time_point>    notify_times;
+  double                            stale_ms = 0.0;
+  if(options.debounce_ms >= 0.0)
+  {
+    scheduler = std::make_unique<CompileScheduler>(compiler, shader_path, shader_code.value_or(""), options.debounce_ms, true);
+  }
+
+  BenchmarkResult         result{.compiler = SlangCompilerHelper::name(), .shader = shader_path};
+  size_t                  num_edits  = 0;
+  size_t                  num_failed = 0;
+  const timer::time_point watch_start = timer::now();
+  std::vector<std::string> changed;
+  bool                     ok = true;
+  while(!g_stop_watching)
+  {
+    if(options.time_budget_s > 0.0 && milliseconds_between(watch_start, timer::now()) > 1000.0 * options.time_budget_s)
+    {
+      break;
+    }
+    if(scheduler)
+    {
+      // Report compiles that finished in the background.
+      const std::vector<ScheduledCompileResult> results = scheduler->take_results();
+      for(const ScheduledCompileResult& compile : results)
+      {
+        if(compile.stale)
+        {
+          stale_ms += compile.compile_ms;
+          printf("Changes up to %llu: %f ms compile thrown away (newer changes arrived).\n",
+                 static_cast<unsigned long long>(compile.generation), compile.compile_ms);
+          continue;
+        }
+        if(!compile.success)
+        {
+          num_failed++;
+          printf("Changes up to %llu: compilation failed; keeping the previous SPIR-V.\n",
+                 static_cast<unsigned long long>(compile.generation));
+          continue;
+        }
+        // Latency starts at the oldest change the compile included.
+        const double latency_ms = milliseconds_between(notify_times[compile.generation - compile.num_changes], compile.finished);
+        result.samples.push_back(latency_ms);
+        printf("Changes up to %llu (%zu coalesced): %f ms to SPIR-V (compile %f ms)\n",
+               static_cast<unsigned long long>(compile.generation), compile.num_changes, latency_ms, compile.compile_ms);
+      }
+      if(!results.empty())
+      {
+        const std::vector<char> spirv = scheduler->last_good_spirv();
+        std::ofstream(spirv_path, std::ios::binary).write(spirv.data(), spirv.size());
+      }
+    }
+
+    changed.clear();
+    // Wake up regularly to check whether we should stop.
+    if(!watcher.wait(scheduler ? 10 : 100, changed))
+    {
+      ok = false;
+      break;
+    }
+    if(changed.empty())
+    {
+      continue;
+    }
+    // Latency starts when we're notified; an editor's save usually produces
+    // several events at once, so collect any others that are already queued.
+    const timer::time_point notified = timer::now();
+    while(true)
+    {
+      const size_t num_changed = changed.size();
+      if(!watcher.wait(0, changed) || changed.size() == num_changed)
+      {
+        break;
+      }
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+
+    if(scheduler)
+    {
+      // The compiler belongs to the scheduler's thread now, so we can't ask it
+      // which files it uses; just skip our own output.
+      std::erase_if(changed, [&](const std::string& path) { return same_file(path, spirv_path); });
+      if(changed.empty())
+      {
+        continue;
+      }
+      bool                       clear_cache = false;
+      std::optional<std::string> new_source;
+      for(const std::string& path : changed)
+      {
+        clear_cache = clear_cache || (path == watch_dir.string());
+        if(same_file(path, shader_path))
+        {
+          new_source = load_file(shader_path);
+        }
+      }
+      num_edits++;
+      notify_times.push_back(notified);
+      scheduler->submit(changed, std::move(new_source), clear_cache);
+      continue;
+    }
+
+    // Ignore files the shader doesn't use (e.g. our own SPIR-V output), unless
+    // they're new modules that a failing shader might have been missing.
+    bool relevant = false;
+    for(const std::string& path : changed)
+    {
+      if(path == watch_dir.string())
+      {
+        // Events were lost, so anything might have changed.
+        compiler.clear_module_cache();
+        relevant = true;
+      }
+      else if(same_file(path, shader_path))
+      {
+        shader_code = load_file(shader_path);
+        relevant    = true;
+      }
+      else if(fs::path(path).extension() == ".slang")
+      {
+        relevant = true;
+      }
+    }
+    const size_t num_invalidated = compiler.invalidate_files(changed);
+    if(!relevant && num_invalidated == 0)
+    {
+      continue;
+    }
 
-  // Initialization
-  {
-    const timer::time_point start = timer::now();
-    compiler                      = std::make_unique<Compiler>();
-    if(!compiler->init(enable_glsl))
+    num_edits++;
+    const std::string changed_name    = fs::path(changed.front()).filename().string();
+    const size_t      compiled_before = compiler.num_modules_compiled();
+    const uint64_t    calls_before    = filesystem_call_count();
+    if(!shader_code.has_value() || !compiler.compile(shader_path, shader_code.value().c_str()))
     {
-      return false;
+      num_failed++;
+      printf("Edit %zu (%s): compilation failed; keeping the previous SPIR-V.\n", num_edits, changed_name.c_str());
+      continue;
     }
-    const timer::time_point                         end      = timer::now();
-    const std::chrono::duration<double, std::milli> duration = (end - start);
-    printf("Compiler initialization time: %f ms\n", duration.count());
+    write_spirv();
+    const double latency_ms = milliseconds_between(notified, timer::now());
+    result.samples.push_back(latency_ms);
+    result.filesystem_calls.push_back(filesystem_call_count() - calls_before);
+    printf("Edit %zu (%s): %f ms to SPIR-V (%zu cache entries invalidated, %zu modules recompiled)\n", num_edits,
+           changed_name.c_str(), latency_ms, num_invalidated, compiler.num_modules_compiled() - compiled_before);
+  }
+  std::signal(SIGINT, SIG_DFL);
+  if(scheduler)
+  {
+    // Stop the scheduler; results that finish after this aren't reported.
+    scheduler.reset();
+    printf("Compile work thrown away: %f ms\n", stale_ms);
   }
 
-  // First compilation to warm up caches
+  printf("%zu edits, %zu failed to compile.\n", num_edits, num_failed);
+  if(!result.samples.empty())
   {
-    const timer::time_point start = timer::now();
-    if(!compiler->compile(shader_path, shader_source))
+    result.summary = summarize(result.samples);
+    printf("Edit-to-SPIR-V latency (ms): min %f, median %f, p95 %f, max %f\n", result.summary.min,
+           result.summary.median, result.summary.p95, result.summary.max);
+    if(options.json_path && !write_json_result(options.json_path, result))
     {
       return false;
     }
-    const timer::time_point                         end      = timer::now();
-    const std::chrono::duration<double, std::milli> duration = (end - start);
-    printf("First compilation (building caches): %f ms\n", duration.count());
-
-    const void*  spirv_data = compiler->get_spirv_data();
-    const size_t spirv_size = compiler->get_spirv_size();
-    fprintf(stderr, "SPIR-V output is %zu bytes long.\n", spirv_size);
-    std::ofstream(std::string(Compiler::name()) + ".spv", std::ios::binary).write(reinterpret_cast<const char*>(spirv_data), spirv_size);
-  }
-
-  // Benchmark
-  {
-    fprintf(stderr, "Compiling %zu times...\n", num_repetitions);
-    const timer::time_point start = timer::now();
-    for(size_t repetition = 1; repetition <= num_repetitions; repetition++)
+    if(options.csv_path && !write_csv_result(options.csv_path, result))
     {
-#ifdef VERBOSE
-      // Power of 2 iteration printer
-      if((repetition & (repetition - 1)) == 0)
-      {
-        fprintf(stderr, "Repetition %zu\n", repetition);
-      }
-#endif
-
-      if(!compiler->compile(shader_path, shader_source))
-      {
-        return false;
-      }
+      return false;
     }
-    const timer::time_point                         end      = timer::now();
-    const std::chrono::duration<double, std::milli> duration = (end - start);
-    printf("Average compilation time: %f ms\n", duration.count() / static_cast<double>(num_repetitions));
   }
-
-  return true;
+  return ok;
 }
 
 void print_help()
 {
   printf(
       "slang-compile-timer: Benchmarks how long Slang takes to compile a shader.\n"
-      "Usage: slang-compile-timer [options] filename\n"
+      "Usage: slang-compile-timer [options] filename...\n"
       "Options\n"
       "  -h: Print this text and exit.\n"
       "  -r: Number of repetitions (default: 128)\n"
+      "  --warmup <N>: Number of compiles before timing starts (default: 1).\n"
+      "  --time-budget <seconds>: Stop after this long, even if fewer than -r\n"
+      "    repetitions ran.\n"
+      "  --reject-outliers <k>: Exclude samples with a MAD-based modified\n"
+      "    z-score above k (e.g. 3.5) from summary statistics.\n"
+      "  --memory: Report allocations, bytes allocated and RSS for initialization,\n"
+      "    the first compile and each repetition, and warn if memory keeps\n"
+      "    growing.\n"
+      "  --output-cache: Cache each compiler's SPIR-V, keyed by its version,\n"
+      "    options, and source, and reuse it while no file the compile read\n"
+      "    changed. Reports hit rate and hit latency.\n"
+      "  --output-cache-dir <dir>: Like --output-cache, and also store entries\n"
+      "    in <dir> for later runs.\n"
+      "  --preprocess-cache: shaderc and DXC only: preprocess each source once\n"
+      "    (PreprocessGlsl() or -P), and compile the flattened source while\n"
+      "    neither it nor its includes change. Reports how long preprocessing\n"
+      "    took and the cache's hit rate.\n"
+      "  --sweep: For each backend, compile with every combination of\n"
+      "    optimization level, debug info level, validation on and off, and\n"
+      "    (Slang only) EmitSpirvDirectly on and off, and print a table of\n"
+      "    first and median compile times, SPIR-V size and memory use.\n"
+      "  --sweep-opt <levels>, --sweep-debug <levels>: Like --sweep, with these\n"
+      "    comma-separated optimization or debug info levels from 0 to 3\n"
+      "    (default: 0,2 for both).\n"
+      "  --scaling <dimension>: For each backend, generate shaders (see\n"
+      "    shader_generator.h) with the default number of modules, import depth,\n"
+      "    functions, generic instantiations or entry points (<dimension> is\n"
+      "    modules, depth, functions, generics or entry-points) multiplied by\n"
+      "    each of --scaling-sizes, compile each, fit compile time to a power of\n"
+      "    source size (of the depth itself for depth, which barely changes the\n"
+      "    source; depths above the number of modules are skipped), and warn\n"
+      "    about super-linear growth.\n"
+      "  --scaling-sizes <list>: Comma-separated multipliers for --scaling\n"
+      "    (default: 1,2,4,8).\n"
+      "  --json <file>: Write results as JSON.\n"
+      "  --csv <file>: Write one row per repetition as CSV.\n"
+      "  --trace <file>: Record when each compile phase (session creation,\n"
+      "    module loads and cache hits, serialization, code generation) ran on\n"
+      "    each thread, and write it as Chrome trace JSON on exit.\n"
+      "  -j <N>: Compile on N threads at once, each with its own compiler, and\n"
+      "    compare throughput to 1 thread (0: one per core).\n"
+      "  --pin <cpus>: Pin the compiling thread to the first of these CPUs (e.g.\n"
+      "    2 or 2,4-7, like taskset), -j's threads to each in turn, and helper\n"
+      "    threads (precompile workers, output sinks) to all of them.\n"
+      "  --high-priority: Raise the process's priority (needs CAP_SYS_NICE or\n"
+      "    root on Linux).\n"
+      "  --cooldown <ms>: Sleep this long before each timed compile (not\n"
+      "    counted), so that frequency boost affects every sample alike. With\n"
+      "    --ab, this also applies between the alternating configurations.\n"
+      "  --perf-counters: Read cycles, instructions, last-level cache and\n"
+      "    branch counters around each repetition, and report IPC and miss\n"
+      "    rates. On Windows, only cycles are counted.\n"
       "  --enable-glsl: Sets SlangGlobalSessionDesc::enableGLSL to true.\n"
+      "  --reflection: After each Slang compile, link the module with its entry\n"
+      "    points and walk its whole layout (parameters, binding ranges,\n"
+      "    descriptor sets, entry points), timed as separate phases. Not with\n"
+      "    --output-cache.\n"
+      "  --reflection-benchmark: Compare compile, link and reflection times with\n"
+      "    the module cache off and on.\n"
+      "  --pool-sessions: Reuse Slang sessions between compiles when the search\n"
+      "    path, options, and modules haven't changed.\n"
+      "  --share-global-session: With -j, make all threads share one Slang\n"
+      "    global session. Each thread holds it for a whole compile, so threads\n"
+      "    take turns; this measures that lock, not contention inside Slang.\n"
+      "  --module-cache <on|off>, --filesystem-ext <on|off>, --validation <on|off>,\n"
+      "  --arena-glue <on|off>: Override Slang helper settings (defaults are set\n"
+      "    in compiler_slang.h and arena.h).\n"
+      "  --manifest <file>: Compile every shader listed in <file> (one path per\n"
+      "    line, relative to <file>) with one compiler, and report per-shader and\n"
+      "    total times.\n"
+      "  --dir <dir>: Like --manifest, with the main shaders in <dir> (files with\n"
+      "    the compiler's extension that no other file imports).\n"
+      "  --output-archive <file>: With --manifest, --dir or --permutation, write\n"
+      "    each shader's SPIR-V to a single archive file, on a background thread.\n"
+      "  --output-dir <dir>: Like --output-archive, but write one file per shader\n"
+      "    in <dir>.\n"
+      "  --archive-compression <none|lz4|zstd>: Compress entries in archives we\n"
+      "    write, if this build has the library.\n"
+      "  --module-archive <file>: Serve Slang modules from a shader archive\n"
+      "    written by --archive-benchmark before compiling them.\n"
+      "  --archive-benchmark <file>: Write the modules the shader imports to a\n"
+      "    shader archive and to loose files, and compare lookup latency and\n"
+      "    first-compile time with each.\n"
+      "  --permutation <entry>[:<type>,...]: Compile entry point <entry> (or every\n"
+      "    entry point, for *), specialized with the given types. Can be given\n"
+      "    more than once; compares loading the module once and linking each\n"
+      "    permutation to recompiling the module (in a new session) for each\n"
+      "    entry point.\n"
+      "  --ab <setting>: Compare two Slang configurations that differ only in\n"
+      "    <setting> (module-cache, filesystem-ext, validation, arena-glue, or\n"
+      "    pool-sessions),\n"
+      "    alternating between them, and test whether the difference is\n"
+      "    significant.\n"
+      "  --module-cache-dir <dir>: Also cache Slang modules on disk in <dir>, so\n"
+      "    that later runs can load them instead of compiling them.\n"
+      "  --precompile-threads <N>: Compile modules imported by the shader in\n"
+      "    parallel on N threads (0: one per core) before compiling the shader.\n"
+      "  --incremental: Edit an imported module between repetitions, and compare\n"
+      "    recompiling only what changed to rebuilding all modules.\n"
+      "  --edit <module>: Module for --incremental to edit, relative to the\n"
+      "    shader's directory (default: the most widely imported leaf module).\n"
+      "  --watch: Keep the compiler resident and recompile whenever a file in the\n"
+      "    shader's directory changes, reporting edit-to-SPIR-V latency. Runs\n"
+      "    until Ctrl+C or --time-budget.\n"
+      "  --cold-start <N>: Start N fresh processes that each initialize the\n"
+      "    compiler and compile the shader once, and report how long starting\n"
+      "    the process, initialization, the compile, and exiting took.\n"
+      "  --core-module <default|embedded|source>: Where Slang gets its core\n"
+      "    module from during initialization (default: let Slang decide). If\n"
+      "    not set, --cold-start compares default and source.\n"
+      "  --server <name>: Keep one compiler resident and compile shaders sent by\n"
+      "    clients over a local socket (named pipe on Windows) called <name>.\n"
+      "    Use --shaderc or --dxc to serve those compilers instead of Slang.\n"
+      "  --client <name>: Compile the shader on the server called <name>, and\n"
+      "    compare round-trip latency to compiling in this process.\n"
+      "  --stop-server: With --client, shut the server down afterwards.\n"
+      "  --debounce <ms>: With --watch, compile in the background once changes\n"
+      "    stop arriving for this long, and throw away out-of-date compiles.\n"
+      "  --save-burst <N>: Simulate -r bursts of N quick saves to an imported\n"
+      "    module, and compare compiling once per save to debouncing.\n"
+      "  --save-interval <ms>: Time between saves in a burst (default: 20).\n"
+      "  --backends <list>: Benchmark each compiler in the comma-separated list\n"
+      "    (e.g. slang,shaderc,dxc) in turn, and compare them side by side. Each\n"
+      "    compiles the filename ending in its extension (.slang, .glsl, .hlsl),\n"
+      "    or the only filename given.\n"
 #ifdef HAS_SHADERC
-      "  --shaderc: Benchmark shaderc instead of Slang.\n"
+      "  --shaderc: Benchmark shaderc instead of Slang (same as --backends shaderc).\n"
+#endif
+#ifdef HAS_DXC
+      "  --dxc: Benchmark DXC instead of Slang (same as --backends dxc).\n"
 #endif
   );
 }
 
 int main(int argc, char* argv[])
 {
+  // For cold-start benchmarks, this is as close as we can get to when the
+  // process started.
+  const int64_t main_start_ns = process_clock_ns();
+
   // Parse arguments
-  size_t      num_repetitions = 128;
-  bool        enable_glsl     = false;
-  bool        test_shaderc    = false;
-  bool test_dxc = false;
-  const char* filename        = "shader.slang";
+  BenchmarkOptions options;
+  options.main_start_ns = main_start_ns;
+  options.executable    = argv[0];
+  // Bit i selects Backends' i-th compiler; none means Slang.
+  uint32_t                 backends = 0;
+  std::vector<const char*> filenames;
   for(int argi = 1; argi < argc; argi++)
   {
     const char* arg = argv[argi];
@@ -119,66 +3170,516 @@ int main(int argc, char* argv[])
         fprintf(stderr, "-r must be followed by the number of repetitions.\n");
         return EXIT_FAILURE;
       }
-      num_repetitions = strtoull(argv[argi], nullptr, 0);
+      options.num_repetitions = strtoull(argv[argi], nullptr, 0);
+    }
+    else if(strcmp("--warmup", arg) == 0 || strcmp("--time-budget", arg) == 0 || strcmp("--reject-outliers", arg) == 0
+            || strcmp("--json", arg) == 0 || strcmp("--csv", arg) == 0 || strcmp("--trace", arg) == 0 || strcmp("--ab", arg) == 0
+            || strcmp("--manifest", arg) == 0 || strcmp("--dir", arg) == 0 || strcmp("--permutation", arg) == 0
+            || strcmp("--module-cache", arg) == 0 || strcmp("--filesystem-ext", arg) == 0 || strcmp("--validation", arg) == 0
+            || strcmp("--arena-glue", arg) == 0
+            || strcmp("--cold-start", arg) == 0 || strcmp("--cold-start-child", arg) == 0
+            || strcmp("--core-module", arg) == 0 || strcmp("--server", arg) == 0 || strcmp("--client", arg) == 0 || strcmp("--debounce", arg) == 0 || strcmp("--output-cache-dir", arg) == 0
+            || strcmp("--output-archive", arg) == 0 || strcmp("--output-dir", arg) == 0
+            || strcmp("--archive-compression", arg) == 0 || strcmp("--module-archive", arg) == 0
+            || strcmp("--archive-benchmark", arg) == 0 || strcmp("--backends", arg) == 0
+            || strcmp("--save-burst", arg) == 0 || strcmp("--save-interval", arg) == 0
+            || strcmp("--sweep-opt", arg) == 0 || strcmp("--sweep-debug", arg) == 0
+            || strcmp("--scaling", arg) == 0 || strcmp("--scaling-sizes", arg) == 0
+            || strcmp("--pin", arg) == 0 || strcmp("--cooldown", arg) == 0)
+    {
+      argi++;
+      if(argi == argc)
+      {
+        fprintf(stderr, "%s must be followed by a value.\n", arg);
+        return EXIT_FAILURE;
+      }
+      const char* value = argv[argi];
+      if(strcmp("--warmup", arg) == 0)
+      {
+        options.num_warmups = strtoull(value, nullptr, 0);
+      }
+      else if(strcmp("--time-budget", arg) == 0)
+      {
+        options.time_budget_s = strtod(value, nullptr);
+      }
+      else if(strcmp("--reject-outliers", arg) == 0)
+      {
+        options.mad_threshold = strtod(value, nullptr);
+      }
+      else if(strcmp("--cold-start", arg) == 0)
+      {
+        options.num_cold_starts = strtoull(value, nullptr, 0);
+      }
+      else if(strcmp("--cold-start-child", arg) == 0)
+      {
+        options.cold_start_child = value;
+      }
+      else if(strcmp("--core-module", arg) == 0)
+      {
+        options.core_module = value;
+        if(find_core_module(value) == SlangCoreModule::kDefault && strcmp("default", value) != 0)
+        {
+          fprintf(stderr, "--core-module must be followed by default, embedded, or source.\n");
+          return EXIT_FAILURE;
+        }
+      }
+      else if(strcmp("--server", arg) == 0)
+      {
+        options.server_name = value;
+      }
+      else if(strcmp("--client", arg) == 0)
+      {
+        options.client_name = value;
+      }
+      else if(strcmp("--output-archive", arg) == 0)
+      {
+        options.output_archive = value;
+      }
+      else if(strcmp("--output-dir", arg) == 0)
+      {
+        options.output_dir = value;
+      }
+      else if(strcmp("--archive-compression", arg) == 0)
+      {
+        const auto it = std::find_if(std::begin(kArchiveCompressions), std::end(kArchiveCompressions),
+                                     [&](const auto& compression) { return strcmp(compression.name, value) == 0; });
+        if(it == std::end(kArchiveCompressions) || !archive_compression_supported(it->value))
+        {
+          fprintf(stderr, "--archive-compression must be followed by none, lz4 or zstd, and this build must support it.\n");
+          return EXIT_FAILURE;
+        }
+        options.archive_compression = it->value;
+      }
+      else if(strcmp("--module-archive", arg) == 0)
+      {
+        options.module_archive = value;
+      }
+      else if(strcmp("--archive-benchmark", arg) == 0)
+      {
+        options.archive_benchmark = value;
+      }
+      else if(strcmp("--backends", arg) == 0)
+      {
+        if(!parse_backends(value, backends))
+        {
+          return EXIT_FAILURE;
+        }
+      }
+      else if(strcmp("--output-cache-dir", arg) == 0)
+      {
+        options.output_cache     = true;
+        options.output_cache_dir = value;
+      }
+      else if(strcmp("--debounce", arg) == 0)
+      {
+        options.debounce_ms = strtod(value, nullptr);
+      }
+      else if(strcmp("--save-burst", arg) == 0)
+      {
+        options.save_burst = strtoull(value, nullptr, 0);
+      }
+      else if(strcmp("--save-interval", arg) == 0)
+      {
+        options.save_interval_ms = strtod(value, nullptr);
+      }
+      else if(strcmp("--json", arg) == 0)
+      {
+        options.json_path = value;
+      }
+      else if(strcmp("--csv", arg) == 0)
+      {
+        options.csv_path = value;
+      }
+      else if(strcmp("--trace", arg) == 0)
+      {
+        options.trace_path = value;
+      }
+      else if(strcmp("--manifest", arg) == 0)
+      {
+        options.manifest_path = value;
+      }
+      else if(strcmp("--dir", arg) == 0)
+      {
+        options.batch_dir = value;
+      }
+      else if(strcmp("--permutation", arg) == 0)
+      {
+        // <entry>[:<type>,<type>...]
+        SlangPermutation permutation;
+        std::string_view rest  = value;
+        const size_t     colon = std::min(rest.find(':'), rest.size());
+        permutation.entry_point = std::string(rest.substr(0, colon));
+        if(permutation.entry_point == "*")
+        {
+          permutation.entry_point.clear();
+        }
+        rest.remove_prefix(std::min(colon + 1, rest.size()));
+        while(!rest.empty())
+        {
+          const size_t comma = std::min(rest.find(','), rest.size());
+          permutation.type_args.emplace_back(rest.substr(0, comma));
+          rest.remove_prefix(std::min(comma + 1, rest.size()));
+        }
+        options.permutations.push_back(std::move(permutation));
+      }
+      else if(strcmp("--sweep-opt", arg) == 0 || strcmp("--sweep-debug", arg) == 0)
+      {
+        std::vector<int>& levels = (strcmp("--sweep-opt", arg) == 0) ? options.sweep_optimization : options.sweep_debug_info;
+        if(!parse_levels(value, levels))
+        {
+          fprintf(stderr, "%s must be followed by a comma-separated list of levels from 0 to 3.\n", arg);
+          return EXIT_FAILURE;
+        }
+        options.sweep = true;
+      }
+      else if(strcmp("--scaling", arg) == 0)
+      {
+        for(const ScalingDimension& dimension : kScalingDimensions)
+        {
+          if(strcmp(dimension.name, value) == 0)
+          {
+            options.scaling_dimension = dimension.member;
+            options.scaling_name      = dimension.name;
+            options.scaling_by_value  = !dimension.grows_source;
+            options.scaling_limit     = dimension.limit;
+          }
+        }
+        if(!options.scaling_dimension)
+        {
+          fprintf(stderr, "Unknown dimension for --scaling: %s\n", value);
+          return EXIT_FAILURE;
+        }
+      }
+      else if(strcmp("--scaling-sizes", arg) == 0)
+      {
+        if(!parse_sizes(value, options.scaling_sizes))
+        {
+          fprintf(stderr, "--scaling-sizes must be followed by a comma-separated list of positive numbers.\n");
+          return EXIT_FAILURE;
+        }
+      }
+      else if(strcmp("--pin", arg) == 0)
+      {
+        if(!parse_cpu_list(value, options.pin_cpus))
+        {
+          fprintf(stderr, "--pin must be followed by a comma-separated list of CPUs or ranges (e.g. 2,4-7).\n");
+          return EXIT_FAILURE;
+        }
+      }
+      else if(strcmp("--cooldown", arg) == 0)
+      {
+        options.cooldown_ms = strtod(value, nullptr);
+      }
+      else if(strcmp("--ab", arg) == 0)
+      {
+        if(!find_toggle(options, value))
+        {
+          fprintf(stderr, "Unknown setting for --ab: %s\n", value);
+          return EXIT_FAILURE;
+        }
+        options.ab_setting = value;
+      }
+      else
+      {
+        if(strcmp("on", value) != 0 && strcmp("off", value) != 0)
+        {
+          fprintf(stderr, "%s must be followed by on or off.\n", arg);
+          return EXIT_FAILURE;
+        }
+        // arg + 2 skips "--".
+        *find_toggle(options, arg + 2) = (strcmp("on", value) == 0);
+      }
+    }
+    else if(strcmp("-j", arg) == 0)
+    {
+      argi++;
+      if(argi == argc)
+      {
+        fprintf(stderr, "-j must be followed by the number of threads.\n");
+        return EXIT_FAILURE;
+      }
+      options.num_threads = strtoull(argv[argi], nullptr, 0);
+      if(options.num_threads == 0)
+      {
+        options.num_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
     }
     else if(strcmp("--enable-glsl", arg) == 0)
     {
-      enable_glsl = true;
+      options.enable_glsl = true;
+    }
+    else if(strcmp("--memory", arg) == 0)
+    {
+      options.track_memory = true;
+    }
+    else if(strcmp("--pool-sessions", arg) == 0)
+    {
+      options.pool_sessions = true;
+    }
+    else if(strcmp("--share-global-session", arg) == 0)
+    {
+      options.share_global_session = true;
+    }
+    else if(strcmp("--module-cache-dir", arg) == 0)
+    {
+      argi++;
+      if(argi == argc)
+      {
+        fprintf(stderr, "--module-cache-dir must be followed by a directory.\n");
+        return EXIT_FAILURE;
+      }
+      options.module_cache_dir = argv[argi];
+    }
+    else if(strcmp("--precompile-threads", arg) == 0)
+    {
+      argi++;
+      if(argi == argc)
+      {
+        fprintf(stderr, "--precompile-threads must be followed by the number of threads.\n");
+        return EXIT_FAILURE;
+      }
+      options.precompile_threads = strtoull(argv[argi], nullptr, 0);
+      if(options.precompile_threads == 0)
+      {
+        options.precompile_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+    }
+    else if(strcmp("--incremental", arg) == 0)
+    {
+      options.incremental = true;
+    }
+    else if(strcmp("--watch", arg) == 0)
+    {
+      options.watch = true;
+    }
+    else if(strcmp("--output-cache", arg) == 0)
+    {
+      options.output_cache = true;
+    }
+    else if(strcmp("--preprocess-cache", arg) == 0)
+    {
+      options.preprocess_cache = true;
+    }
+    else if(strcmp("--reflection", arg) == 0)
+    {
+      options.reflection = true;
+    }
+    else if(strcmp("--reflection-benchmark", arg) == 0)
+    {
+      options.reflection_benchmark = true;
+    }
+    else if(strcmp("--sweep", arg) == 0)
+    {
+      options.sweep = true;
+    }
+    else if(strcmp("--stop-server", arg) == 0)
+    {
+      options.stop_server = true;
+    }
+    else if(strcmp("--high-priority", arg) == 0)
+    {
+      options.high_priority = true;
+    }
+    else if(strcmp("--perf-counters", arg) == 0)
+    {
+      options.perf_counters = true;
+    }
+    else if(strcmp("--edit", arg) == 0)
+    {
+      argi++;
+      if(argi == argc)
+      {
+        fprintf(stderr, "--edit must be followed by a module path.\n");
+        return EXIT_FAILURE;
+      }
+      options.edit_module = argv[argi];
     }
 #ifdef HAS_SHADERC
     else if(strcmp("--shaderc", arg) == 0)
     {
-      test_shaderc = true;
+      parse_backends("shaderc", backends);
     }
 #endif
 #ifdef HAS_DXC
-    else if (strcmp("--dxc", arg) == 0)
+    else if(strcmp("--dxc", arg) == 0)
     {
-        test_dxc = true;
+      parse_backends("dxc", backends);
     }
 #endif
     else
     {
-      filename = arg;
+      filenames.push_back(arg);
     }
   }
+  if(filenames.empty())
+  {
+    filenames.push_back("shader.slang");
+  }
 
-  // Find the shader; search up at most 3 directories.
-  std::string                shader_path;
-  std::optional<std::string> shader_code = find_file(filename, &shader_path);
-  if(!shader_code.has_value())
+  // Writes the trace when main() returns.
+  const ScopedTraceFile trace_file(options.trace_path);
+
+  // Only modes that report allocations pay for counting them.
+  if(options.track_memory || options.sweep)
   {
-    fprintf(stderr, "Could not load %s.\n", filename);
-    return EXIT_FAILURE;
+    memory_stats::enable();
   }
 
-  if(!test_shaderc && !test_dxc)
+  // Threads we start inherit the main thread's priority. The main thread
+  // compiles, so it gets the first CPU; helper threads get all of them (see
+  // pin_helper_thread()), and -j's threads one each.
+  if(!options.pin_cpus.empty())
   {
-    if(!benchmark<SlangCompilerHelper>(shader_path.c_str(), shader_code.value().c_str(), num_repetitions, enable_glsl))
+    if(!pin_current_thread(options.pin_cpus[0]))
     {
       return EXIT_FAILURE;
     }
+    g_helper_cpus = options.pin_cpus;
   }
-
-#ifdef HAS_SHADERC
-  if(test_shaderc)
+  if(options.high_priority && !raise_priority())
+  {
+    fprintf(stderr, "Continuing at normal priority.\n");
+  }
+  if(!options.pin_cpus.empty() || options.high_priority || options.perf_counters)
   {
-    if(!benchmark<ShadercGlslCompilerHelper>(shader_path.c_str(), shader_code.value().c_str(), num_repetitions, enable_glsl))
+    if(cpu_boost_enabled().value_or(false))
     {
-      return EXIT_FAILURE;
+      fprintf(stderr,
+              "Warning: CPU frequency boost is on, so clock speeds (and so compile times) can drift between\n"
+              "repetitions. Turn it off (e.g. write 0 to /sys/devices/system/cpu/cpufreq/boost), or use\n"
+              "--cooldown, or compare configurations with --ab, which alternates between them.\n");
     }
   }
-#endif
 
-#ifdef HAS_DXC
-  if (test_dxc)
+  if(backends == 0)
   {
-      if (!benchmark<DXCompilerHelper>(shader_path.c_str(), shader_code.value().c_str(), num_repetitions, enable_glsl))
-      {
-          return EXIT_FAILURE;
-      }
+    backends = 1;  // Slang
+  }
+  // Modes that keep one compiler around, or that a parent process started
+  // with one backend, only run one.
+  if((options.server_name || options.client_name || options.cold_start_child) && std::popcount(backends) != 1)
+  {
+    fprintf(stderr, "--server, --client and --cold-start-child need exactly one backend.\n");
+    return EXIT_FAILURE;
+  }
+  // Output cache hits skip loading the module, so there'd be nothing to walk.
+  if((options.reflection || options.reflection_benchmark) && options.output_cache)
+  {
+    fprintf(stderr, "--reflection and --reflection-benchmark can't be used with the output cache.\n");
+    return EXIT_FAILURE;
+  }
+
+  if(options.manifest_path || options.batch_dir)
+  {
+    const bool ok = Backends::for_each(backends, [&]<ShaderCompiler Compiler>() {
+      return run_batch<Compiler>(options, Compiler::extension());
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if(options.server_name)
+  {
+    const bool ok = Backends::for_each(backends, [&]<ShaderCompiler Compiler>() {
+      return run_server<Compiler>(options.server_name, options);
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if(options.cold_start_child)
+  {
+    const bool ok = for_each_backend_shader(backends, filenames, [&]<ShaderCompiler Compiler>(const char* shader_path, const char* shader_source) {
+      return cold_start_child<Compiler>(shader_path, shader_source, options);
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.num_cold_starts > 0)
+  {
+    const bool ok = for_each_backend_shader(backends, filenames, [&]<ShaderCompiler Compiler>(const char* shader_path, const char*) {
+      return benchmark_cold_start<Compiler>(shader_path, options);
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.client_name)
+  {
+    const bool ok = for_each_backend_shader(backends, filenames, [&]<ShaderCompiler Compiler>(const char* shader_path, const char* shader_source) {
+      return benchmark_client<Compiler>(options.client_name, shader_path, shader_source, options);
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if(options.scaling_dimension)
+  {
+    const bool ok = Backends::for_each(backends, [&]<ShaderCompiler Compiler>() { return benchmark_scaling<Compiler>(options); });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.sweep)
+  {
+    const bool ok = for_each_backend_shader(backends, filenames, [&]<ShaderCompiler Compiler>(const char* shader_path, const char* shader_source) {
+      return benchmark_sweep<Compiler>(shader_path, shader_source, options);
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // The remaining modes besides the default benchmark are Slang-only.
+  std::string slang_path, slang_source;
+  const bool  slang_only = options.archive_benchmark || options.incremental || options.save_burst > 0 || options.watch
+                          || !options.permutations.empty() || options.ab_setting || options.reflection_benchmark;
+  if(slang_only && !load_shader(filenames, SlangCompilerHelper::extension(), slang_path, slang_source))
+  {
+    return EXIT_FAILURE;
+  }
+  if(options.archive_benchmark)
+  {
+    return benchmark_module_archive(slang_path.c_str(), slang_source.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.incremental)
+  {
+    return benchmark_incremental(slang_path.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.save_burst > 0)
+  {
+    return benchmark_bursts(slang_path.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.watch)
+  {
+    return benchmark_watch(slang_path.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(!options.permutations.empty())
+  {
+    return benchmark_permutations(slang_path.c_str(), slang_source.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.ab_setting)
+  {
+    return benchmark_ab(slang_path.c_str(), slang_source.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if(options.reflection_benchmark)
+  {
+    return benchmark_reflection(slang_path.c_str(), slang_source.c_str(), options) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  std::vector<BenchmarkResult> results;
+  const bool ok = for_each_backend_shader(backends, filenames, [&]<ShaderCompiler Compiler>(const char* shader_path, const char* shader_source) {
+    return run_benchmark<Compiler>(shader_path, shader_source, options, results);
+  });
+  if(!ok)
+  {
+    return EXIT_FAILURE;
+  }
+  if(results.size() > 1)
+  {
+    print_backend_comparison(results);
+  }
+  if(!results.empty())
+  {
+    if(options.json_path && !write_json_results(options.json_path, results))
+    {
+      return EXIT_FAILURE;
+    }
+    if(options.csv_path && !write_csv_results(options.csv_path, results))
+    {
+      return EXIT_FAILURE;
+    }
   }
-#endif
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,165 @@
+#pragma once
+
+// Read-only memory-mapped files.
+// This lets us hand file contents (e.g. source files, or serialized modules
+// from the disk cache) to a compiler without reading them into a separate
+// buffer first.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <filesystem>
+#include <stddef.h>
+#include <stdio.h>
+#include <string_view>
+#include <utility>
+
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile&)            = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+  MappedFile& operator=(MappedFile&& other) noexcept
+  {
+    if(this != &other)
+    {
+      close();
+      std::swap(m_data, other.m_data);
+      std::swap(m_size, other.m_size);
+      std::swap(m_isOpen, other.m_isOpen);
+#ifdef _WIN32
+      std::swap(m_file, other.m_file);
+      std::swap(m_mapping, other.m_mapping);
+#endif
+    }
+    return *this;
+  }
+
+  // Maps the whole file; returns false on failure.
+  // Empty files can't be mapped, so they open as an empty buffer instead.
+  bool open(const std::filesystem::path& path)
+  {
+    close();
+#ifdef _WIN32
+    // Let other processes keep editing the file (e.g. while hot reloading).
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(m_file == INVALID_HANDLE_VALUE)
+    {
+      return false;
+    }
+    LARGE_INTEGER size{};
+    if(!GetFileSizeEx(m_file, &size))
+    {
+      close();
+      return false;
+    }
+    if(size.QuadPart == 0)
+    {
+      CloseHandle(m_file);
+      m_file   = INVALID_HANDLE_VALUE;
+      m_isOpen = true;
+      return true;
+    }
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(m_mapping == nullptr)
+    {
+      close();
+      return false;
+    }
+    m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if(m_data == nullptr)
+    {
+      close();
+      return false;
+    }
+    m_size   = static_cast<size_t>(size.QuadPart);
+    m_isOpen = true;
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+      return false;
+    }
+    struct stat info{};
+    if(fstat(fd, &info) != 0)
+    {
+      ::close(fd);
+      return false;
+    }
+    if(info.st_size == 0)
+    {
+      ::close(fd);
+      m_isOpen = true;
+      return true;
+    }
+    void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+      return false;
+    }
+    m_data   = data;
+    m_size   = static_cast<size_t>(info.st_size);
+    m_isOpen = true;
+#endif
+    return true;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if(m_data != nullptr)
+    {
+      UnmapViewOfFile(m_data);
+    }
+    if(m_mapping != nullptr)
+    {
+      CloseHandle(m_mapping);
+    }
+    if(m_file != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file    = INVALID_HANDLE_VALUE;
+#else
+    if(m_data != nullptr)
+    {
+      munmap(m_data, m_size);
+    }
+#endif
+    m_data   = nullptr;
+    m_size   = 0;
+    m_isOpen = false;
+  }
+
+  bool is_open() const { return m_isOpen; }
+  // Never null while the file is open, even if it's empty.
+  const char* data() const { return m_data ? static_cast<const char*>(m_data) : ""; }
+  size_t      size() const { return m_size; }
+  std::string_view view() const { return std::string_view(data(), m_size); }
+
+private:
+  void*  m_data   = nullptr;
+  size_t m_size   = 0;
+  bool   m_isOpen = false;
+#ifdef _WIN32
+  HANDLE m_file    = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+#endif
+};
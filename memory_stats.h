@@ -0,0 +1,290 @@
+#pragma once
+
+// Memory usage instrumentation.
+// This replaces the global operator new and delete to count allocations, and
+// queries the OS for the process's resident set size (RSS).
+//
+// Counting is off until enable() is called (for --memory and --sweep), so
+// that other benchmarks' allocations go straight to malloc() and free()
+// without touching shared counters. Blocks have no header: live bytes are
+// counted in the allocator's usable sizes (which round requests up), so
+// counting can start while blocks allocated before it are still live. Freeing
+// those makes g_live_bytes a little low, but not changes between snapshots
+// taken after enable().
+//
+// On Linux, shared libraries (including Slang, shaderc and DXC) also call our
+// operator new, so the counts include the compilers' own allocations. On
+// Windows, each DLL has its own C runtime, so only allocations made by this
+// executable are counted; RSS covers everything on both.
+//
+// Since replacement allocation functions can only be defined once, this must
+// only be included in one translation unit.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <psapi.h>
+#else
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace memory_stats {
+inline std::atomic<bool>     g_enabled         = false;
+inline std::atomic<uint64_t> g_allocations     = 0;
+inline std::atomic<uint64_t> g_allocated_bytes = 0;
+// Usable bytes of unaligned operator new blocks that are still live.
+inline std::atomic<int64_t> g_live_bytes = 0;
+
+// Starts counting allocations. Counting can't be turned off again.
+inline void enable()
+{
+  g_enabled.store(true, std::memory_order_relaxed);
+}
+
+inline bool enabled()
+{
+  return g_enabled.load(std::memory_order_relaxed);
+}
+
+inline size_t usable_size(void* block)
+{
+#if defined(_WIN32)
+  return _msize(block);
+#elif defined(__APPLE__)
+  return malloc_size(block);
+#else
+  return malloc_usable_size(block);
+#endif
+}
+
+inline void* allocate(size_t size)
+{
+  // operator new(0) must return a unique pointer, which malloc(0) needn't.
+  void* block = std::malloc(size ? size : 1);
+  if(block && enabled())
+  {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    g_live_bytes.fetch_add(static_cast<int64_t>(usable_size(block)), std::memory_order_relaxed);
+  }
+  return block;
+}
+
+inline void deallocate(void* block)
+{
+  if(!block)
+  {
+    return;
+  }
+  if(enabled())
+  {
+    g_live_bytes.fetch_sub(static_cast<int64_t>(usable_size(block)), std::memory_order_relaxed);
+  }
+  std::free(block);
+}
+
+// Over-aligned allocations are counted, but not included in g_live_bytes.
+inline void* allocate_aligned(size_t size, std::align_val_t alignment)
+{
+  if(enabled())
+  {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+#ifdef _WIN32
+  return _aligned_malloc(size, static_cast<size_t>(alignment));
+#else
+  // aligned_alloc() requires the size to be a multiple of the alignment.
+  const size_t align = static_cast<size_t>(alignment);
+  return std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+}
+
+inline void deallocate_aligned(void* ptr)
+{
+#ifdef _WIN32
+  _aligned_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+}  // namespace memory_stats
+
+// The replacements aren't inlined into callers; otherwise, GCC's
+// -Wmismatched-new-delete sees pointers from operator new reach free().
+#if defined(_MSC_VER)
+#define MEMORY_STATS_NOINLINE __declspec(noinline)
+#else
+#define MEMORY_STATS_NOINLINE __attribute__((noinline))
+#endif
+
+MEMORY_STATS_NOINLINE void* operator new(size_t size)
+{
+  void* ptr = memory_stats::allocate(size);
+  if(!ptr)
+  {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+MEMORY_STATS_NOINLINE void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+MEMORY_STATS_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return memory_stats::allocate(size);
+}
+MEMORY_STATS_NOINLINE void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return memory_stats::allocate(size);
+}
+MEMORY_STATS_NOINLINE void operator delete(void* ptr) noexcept
+{
+  memory_stats::deallocate(ptr);
+}
+MEMORY_STATS_NOINLINE void operator delete[](void* ptr) noexcept
+{
+  memory_stats::deallocate(ptr);
+}
+MEMORY_STATS_NOINLINE void operator delete(void* ptr, size_t) noexcept
+{
+  memory_stats::deallocate(ptr);
+}
+MEMORY_STATS_NOINLINE void operator delete[](void* ptr, size_t) noexcept
+{
+  memory_stats::deallocate(ptr);
+}
+
+MEMORY_STATS_NOINLINE void* operator new(size_t size, std::align_val_t alignment)
+{
+  void* ptr = memory_stats::allocate_aligned(size, alignment);
+  if(!ptr)
+  {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+MEMORY_STATS_NOINLINE void* operator new[](size_t size, std::align_val_t alignment)
+{
+  return operator new(size, alignment);
+}
+MEMORY_STATS_NOINLINE void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  memory_stats::deallocate_aligned(ptr);
+}
+MEMORY_STATS_NOINLINE void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+  memory_stats::deallocate_aligned(ptr);
+}
+MEMORY_STATS_NOINLINE void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+  memory_stats::deallocate_aligned(ptr);
+}
+MEMORY_STATS_NOINLINE void operator delete[](void* ptr, size_t, std::align_val_t) noexcept
+{
+  memory_stats::deallocate_aligned(ptr);
+}
+
+// Memory usage at a point in time.
+struct MemorySnapshot
+{
+  uint64_t allocations     = 0;  // Since the process started
+  uint64_t allocated_bytes = 0;  // Since the process started
+  int64_t  live_bytes      = 0;
+  uint64_t rss_bytes       = 0;
+  uint64_t peak_rss_bytes  = 0;
+
+  static MemorySnapshot capture()
+  {
+    MemorySnapshot snapshot;
+    snapshot.allocations     = memory_stats::g_allocations.load(std::memory_order_relaxed);
+    snapshot.allocated_bytes = memory_stats::g_allocated_bytes.load(std::memory_order_relaxed);
+    snapshot.live_bytes      = memory_stats::g_live_bytes.load(std::memory_order_relaxed);
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+      snapshot.rss_bytes      = counters.WorkingSetSize;
+      snapshot.peak_rss_bytes = counters.PeakWorkingSetSize;
+    }
+#else
+    // The second field of statm is the number of resident pages.
+    if(FILE* statm = fopen("/proc/self/statm", "r"))
+    {
+      unsigned long long total_pages = 0, resident_pages = 0;
+      if(fscanf(statm, "%llu %llu", &total_pages, &resident_pages) == 2)
+      {
+        snapshot.rss_bytes = resident_pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+      }
+      fclose(statm);
+    }
+    struct rusage usage{};
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+      snapshot.peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss);  // Bytes
+#else
+      snapshot.peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;  // Kilobytes
+#endif
+    }
+#endif
+    return snapshot;
+  }
+};
+
+// What happened between two snapshots.
+struct MemoryDelta
+{
+  uint64_t allocations     = 0;
+  uint64_t allocated_bytes = 0;
+  int64_t  live_bytes      = 0;  // Change in live bytes
+  int64_t  rss_bytes       = 0;  // Change in RSS
+  uint64_t peak_rss_bytes  = 0;  // Peak RSS at the end
+
+  static MemoryDelta between(const MemorySnapshot& start, const MemorySnapshot& end)
+  {
+    return {.allocations     = end.allocations - start.allocations,
+            .allocated_bytes = end.allocated_bytes - start.allocated_bytes,
+            .live_bytes      = end.live_bytes - start.live_bytes,
+            .rss_bytes       = static_cast<int64_t>(end.rss_bytes) - static_cast<int64_t>(start.rss_bytes),
+            .peak_rss_bytes  = end.peak_rss_bytes};
+  }
+};
+
+// Returns the least-squares slope of `values` against their indices.
+inline double growth_per_sample(const std::vector<double>& values)
+{
+  const double n = static_cast<double>(values.size());
+  if(values.size() < 2)
+  {
+    return 0.0;
+  }
+  double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+  for(size_t i = 0; i < values.size(); i++)
+  {
+    const double x = static_cast<double>(i);
+    sum_x += x;
+    sum_y += values[i];
+    sum_xx += x * x;
+    sum_xy += x * values[i];
+  }
+  return (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+// A cache of final compiler outputs (SPIR-V), in front of the compiler
+// helpers' compile() methods.
+//
+// Entries are keyed by a hash of the compiler's version and options, the main
+// shader's path and source. Each entry also records the files the compile
+// read (imported modules and includes), with their sizes, timestamps and
+// hashes; an entry is only used if all of them are unchanged. Checking a file
+// only stats it, unless its size or timestamp changed, in which case we rehash
+// it, so saving a file without editing it doesn't cause a miss.
+//
+// Callers describe the files a compile read with the bytes the compiler
+// actually consumed (which their include and module caches already hold),
+// stamped before they were read: if a file changes during or after the
+// compile, its stamp no longer matches, and the rehash finds the change.
+//
+// Entries are kept in memory, and optionally in a DiskCache directory so that
+// other processes can use them. This isn't thread-safe; each helper has its
+// own.
+//
+// The shaderc and DXC helpers can also use one to cache preprocessed sources
+// (see PreprocessTimes): the output is the flattened translation unit, and
+// the dependencies are the files it includes.
+
+#include "disk_cache.h"
+#include "mapped_file.h"
+#include "utilities.h"
+
+#include <memory>
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+// How long a helper with a preprocessed-source cache spent in the last
+// compile() preprocessing (zero if the cache hit) and compiling the
+// preprocessed source, in milliseconds.
+struct PreprocessTimes
+{
+  double preprocess_ms = 0.0;
+  double compile_ms    = 0.0;
+};
+
+class OutputCache
+{
+public:
+  using Output = std::shared_ptr<const std::vector<char>>;
+
+  // A file a compile read.
+  struct Dependency
+  {
+    std::string path;
+    int64_t     write_time = 0;  // fs::file_time_type ticks
+    uint64_t    size       = 0;
+    uint64_t    hash       = 0;  // hash_contents() of what the compiler read
+  };
+
+  // Hashes a dependency's contents.
+  static uint64_t hash_contents(std::string_view contents) { return xxh64(contents.data(), contents.size()); }
+
+  // Describes the file at `path` whose stamp (taken before reading it) was
+  // `stamp`, and that the compiler read as `contents`.
+  static Dependency make_dependency(std::string path, const FileStamp& stamp, std::string_view contents)
+  {
+    return {.path       = std::move(path),
+            .write_time = static_cast<int64_t>(stamp.write_time.time_since_epoch().count()),
+            .size       = static_cast<uint64_t>(stamp.size),
+            .hash       = hash_contents(contents)};
+  }
+
+  // Describes the file at `path` by reading it now, for files that the
+  // caller doesn't hold. Returns empty if it can't be read.
+  static std::optional<Dependency> read_dependency(std::string path)
+  {
+    const FileStamp            stamp    = file_stamp(path);
+    std::optional<std::string> contents = load_file(path.c_str());
+    if(!contents.has_value())
+    {
+      return std::nullopt;
+    }
+    return make_dependency(std::move(path), stamp, contents.value());
+  }
+
+  struct Stats
+  {
+    uint64_t lookups     = 0;
+    uint64_t memory_hits = 0;
+    uint64_t disk_hits   = 0;
+    // Lookups that found an entry whose files had changed.
+    uint64_t stale = 0;
+    // Time spent looking up entries that were hits, in milliseconds.
+    double hit_ms = 0.0;
+  };
+
+  void set_enabled(bool enabled) { m_enabled = enabled; }
+  bool enabled() const { return m_enabled; }
+
+  // Also stores entries in `directory`; an empty path disables the disk tier.
+  // Returns false on failure.
+  bool set_directory(const fs::path& directory) { return m_disk.set_directory(directory); }
+
+  // Returns the key for compiling `source` (the main shader at `path`) with
+  // a compiler whose version and options hash to `fingerprint`.
+  static uint64_t make_key(uint64_t fingerprint, std::string_view path, std::string_view source)
+  {
+    return xxh64(source.data(), source.size(), Hasher().add_int(fingerprint).add_string(path).get());
+  }
+
+  // Returns the output for `key` if there's an up-to-date entry, or nullptr.
+  // If `dependencies` isn't null, a hit also appends the files the entry
+  // depends on to it.
+  Output find(uint64_t key, std::vector<Dependency>* dependencies = nullptr)
+  {
+    const timer::time_point start = timer::now();
+    m_stats.lookups++;
+
+    auto it = m_entries.find(key);
+    bool from_disk = false;
+    if(it == m_entries.end())
+    {
+      Entry      entry;
+      MappedFile file;
+      if(!m_disk.load(key, ".spv-entry", file) || !deserialize(file.view(), entry))
+      {
+        return nullptr;
+      }
+      it        = m_entries.emplace(key, std::move(entry)).first;
+      from_disk = true;
+    }
+
+    if(!isUpToDate(it->second))
+    {
+      m_stats.stale++;
+      m_entries.erase(it);
+      return nullptr;
+    }
+    (from_disk ? m_stats.disk_hits : m_stats.memory_hits)++;
+    if(dependencies)
+    {
+      dependencies->insert(dependencies->end(), it->second.dependencies.begin(), it->second.dependencies.end());
+    }
+    m_stats.hit_ms += milliseconds_between(start, timer::now());
+    return it->second.output;
+  }
+
+  // Stores the output of a compile that read `dependencies`, and returns the
+  // stored copy.
+  Output store(uint64_t key, std::vector<Dependency> dependencies, const void* data, size_t size)
+  {
+    Entry entry;
+    entry.dependencies = std::move(dependencies);
+    const char* bytes  = static_cast<const char*>(data);
+    entry.output      = std::make_shared<const std::vector<char>>(bytes, bytes + size);
+
+    if(m_disk.enabled())
+    {
+      const std::vector<char> serialized = serialize(entry);
+      m_disk.store(key, ".spv-entry", serialized.data(), serialized.size());
+    }
+    Output output  = entry.output;
+    m_entries[key] = std::move(entry);
+    return output;
+  }
+
+  // Forgets the in-memory entries (but not the ones on disk).
+  void clear() { m_entries.clear(); }
+
+  const Stats& stats() const { return m_stats; }
+  void         reset_stats() { m_stats = {}; }
+
+private:
+  struct Entry
+  {
+    std::vector<Dependency> dependencies;
+    Output                  output;
+  };
+
+  static bool stat(const std::string& path, int64_t& write_time, uint64_t& size)
+  {
+    count_filesystem_call(2);
+    std::error_code error;
+    write_time = static_cast<int64_t>(fs::last_write_time(path, error).time_since_epoch().count());
+    if(error)
+    {
+      return false;
+    }
+    size = static_cast<uint64_t>(fs::file_size(path, error));
+    return !error;
+  }
+
+  static bool isUpToDate(Entry& entry)
+  {
+    for(Dependency& dependency : entry.dependencies)
+    {
+      int64_t  write_time = 0;
+      uint64_t size       = 0;
+      if(!stat(dependency.path, write_time, size))
+      {
+        return false;
+      }
+      if(write_time == dependency.write_time && size == dependency.size)
+      {
+        continue;
+      }
+      std::optional<std::string> contents = load_file(dependency.path.c_str());
+      if(!contents.has_value() || hash_contents(contents.value()) != dependency.hash)
+      {
+        return false;
+      }
+      // Only the timestamp changed; don't rehash it next time.
+      dependency.write_time = write_time;
+      dependency.size       = size;
+    }
+    return true;
+  }
+
+  // Disk format: the number of dependencies; for each, the path's length, the
+  // path, the timestamp, size and hash; then the output's size and the output.
+  // Integers are native-endian uint64_ts.
+  static void append(std::vector<char>& out, const void* data, size_t size)
+  {
+    out.insert(out.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+  }
+  static void append(std::vector<char>& out, uint64_t value) { append(out, &value, sizeof(value)); }
+
+  static std::vector<char> serialize(const Entry& entry)
+  {
+    std::vector<char> out;
+    append(out, entry.dependencies.size());
+    for(const Dependency& dependency : entry.dependencies)
+    {
+      append(out, dependency.path.size());
+      append(out, dependency.path.data(), dependency.path.size());
+      append(out, static_cast<uint64_t>(dependency.write_time));
+      append(out, dependency.size);
+      append(out, dependency.hash);
+    }
+    append(out, entry.output->size());
+    append(out, entry.output->data(), entry.output->size());
+    return out;
+  }
+
+  static bool deserialize(std::string_view in, Entry& entry)
+  {
+    const auto read = [&](uint64_t& value) {
+      if(in.size() < sizeof(value))
+      {
+        return false;
+      }
+      memcpy(&value, in.data(), sizeof(value));
+      in.remove_prefix(sizeof(value));
+      return true;
+    };
+    uint64_t num_dependencies = 0;
+    if(!read(num_dependencies))
+    {
+      return false;
+    }
+    for(uint64_t i = 0; i < num_dependencies; i++)
+    {
+      Dependency dependency;
+      uint64_t   path_size = 0, write_time = 0;
+      if(!read(path_size) || in.size() < path_size)
+      {
+        return false;
+      }
+      dependency.path = std::string(in.substr(0, path_size));
+      in.remove_prefix(path_size);
+      if(!read(write_time) || !read(dependency.size) || !read(dependency.hash))
+      {
+        return false;
+      }
+      dependency.write_time = static_cast<int64_t>(write_time);
+      entry.dependencies.push_back(std::move(dependency));
+    }
+    uint64_t output_size = 0;
+    if(!read(output_size) || in.size() != output_size)
+    {
+      return false;
+    }
+    entry.output = std::make_shared<const std::vector<char>>(in.begin(), in.end());
+    return true;
+  }
+
+  bool                                  m_enabled = false;
+  std::unordered_map<uint64_t, Entry>   m_entries;
+  DiskCache                             m_disk;
+  Stats                                 m_stats;
+};
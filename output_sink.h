@@ -0,0 +1,320 @@
+#pragma once
+
+// Destinations for compiled outputs, so that a pipeline producing many of
+// them (e.g. --dir, or --permutation) can hand each compiler's result
+// straight to a consumer without copying it.
+//
+// A CompiledOutput shares ownership of the compiler's own result (a Slang or
+// DXC blob, a shaderc result, or an output cache entry), so it stays valid
+// after the compiler moves on to the next shader. Sinks write outputs to an
+// archive (ArchiveSink), to memory-mapped files (MappedFileSink), or pass them
+// to a function (CallbackSink). AsyncOutputSink wraps another sink and writes
+// to it in batches on a background thread, so that disk I/O overlaps the
+// next compile.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "cpu_control.h"
+#include "shader_archive.h"
+#include "utilities.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct CompiledOutput
+{
+  std::shared_ptr<const void> owner;  // Keeps `data` alive
+  const void*                 data = nullptr;
+  size_t                      size = 0;
+
+  // Shares ownership of `holder` (e.g. a std::shared_ptr to a COM pointer, or
+  // to a vector), whose bytes are `data` and `size`.
+  template <class T>
+  static CompiledOutput share(std::shared_ptr<T> holder, const void* data, size_t size)
+  {
+    return CompiledOutput{.owner = std::move(holder), .data = data, .size = size};
+  }
+
+  std::string_view view() const { return std::string_view(static_cast<const char*>(data), size); }
+};
+
+class OutputSink
+{
+public:
+  virtual ~OutputSink() = default;
+
+  // Consumes `output`, called `name` (a relative path). Returns false on
+  // failure.
+  virtual bool write(std::string_view name, const CompiledOutput& output) = 0;
+
+  // Finishes writing everything written so far. Returns false if anything
+  // failed.
+  virtual bool finish() { return true; }
+};
+
+// Passes each output to a function.
+class CallbackSink : public OutputSink
+{
+public:
+  using Callback = std::function<bool(std::string_view name, const CompiledOutput& output)>;
+
+  explicit CallbackSink(Callback callback)
+      : m_callback(std::move(callback))
+  {
+  }
+
+  bool write(std::string_view name, const CompiledOutput& output) override { return m_callback(name, output); }
+
+private:
+  Callback m_callback;
+};
+
+// Appends each output to a shader archive, keyed by the hash of its name.
+class ArchiveSink : public OutputSink
+{
+public:
+  // Returns false if the archive couldn't be created, or this build doesn't
+  // support `compression`.
+  bool open(const fs::path& path, ArchiveCompression compression = ArchiveCompression::kNone)
+  {
+    return m_writer.set_compression(compression) && m_writer.open(path);
+  }
+
+  bool write(std::string_view name, const CompiledOutput& output) override
+  {
+    return m_writer.add(xxh64(name.data(), name.size()), name, output.data, output.size);
+  }
+
+  bool finish() override { return m_writer.finish(); }
+
+private:
+  ArchiveWriter m_writer;
+};
+
+// Writes each output to its own file in a directory, by mapping the file and
+// copying the output into the mapping.
+class MappedFileSink : public OutputSink
+{
+public:
+  explicit MappedFileSink(fs::path directory)
+      : m_directory(std::move(directory))
+  {
+  }
+
+  bool write(std::string_view name, const CompiledOutput& output) override
+  {
+    const fs::path  path = m_directory / fs::path(name);
+    std::error_code error;
+    if(path.has_parent_path())
+    {
+      fs::create_directories(path.parent_path(), error);
+    }
+    count_filesystem_call();
+    if(!writeMapped(path, output.data, output.size))
+    {
+      fprintf(stderr, "Could not write %s.\n", path.string().c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static bool writeMapped(const fs::path& path, const void* data, size_t size)
+  {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+      return false;
+    }
+    // Empty files can't be mapped.
+    bool ok = true;
+    if(size > 0)
+    {
+      const uint64_t size64  = size;
+      HANDLE         mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, DWORD(size64 >> 32), DWORD(size64), nullptr);
+      void*          view    = mapping ? MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size) : nullptr;
+      ok                     = (view != nullptr);
+      if(view)
+      {
+        memcpy(view, data, size);
+        UnmapViewOfFile(view);
+      }
+      if(mapping)
+      {
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+    return ok;
+#else
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0)
+    {
+      return false;
+    }
+    bool ok = true;
+    if(size > 0)
+    {
+      void* view = MAP_FAILED;
+      if(ftruncate(fd, static_cast<off_t>(size)) == 0)
+      {
+        view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+      ok = (view != MAP_FAILED);
+      if(ok)
+      {
+        memcpy(view, data, size);
+        munmap(view, size);
+      }
+    }
+    ::close(fd);
+    return ok;
+#endif
+  }
+
+  fs::path m_directory;
+};
+
+// Queues outputs and writes them to another sink on a background thread,
+// taking everything queued at once each time it wakes up.
+class AsyncOutputSink : public OutputSink
+{
+public:
+  struct Stats
+  {
+    uint64_t num_outputs = 0;
+    uint64_t num_bytes   = 0;
+    uint64_t num_batches = 0;
+    // Time the background thread spent writing, in milliseconds.
+    double write_ms = 0.0;
+    // Time finish() waited for the background thread, in milliseconds.
+    double finish_wait_ms = 0.0;
+  };
+
+  explicit AsyncOutputSink(std::unique_ptr<OutputSink> sink)
+      : m_sink(std::move(sink))
+  {
+    m_worker = std::thread([this]() {
+      pin_helper_thread();
+      run();
+    });
+  }
+
+  ~AsyncOutputSink() override { finish(); }
+
+  AsyncOutputSink(const AsyncOutputSink&)            = delete;
+  AsyncOutputSink& operator=(const AsyncOutputSink&) = delete;
+
+  // Returns false if an earlier write failed.
+  bool write(std::string_view name, const CompiledOutput& output) override
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_failed || m_stop)
+      {
+        return false;
+      }
+      m_queue.push_back({std::string(name), output});
+    }
+    m_wake.notify_one();
+    return true;
+  }
+
+  // Waits for every queued output to be written, and finishes the wrapped
+  // sink.
+  bool finish() override
+  {
+    if(!m_worker.joinable())
+    {
+      return !m_failed;
+    }
+    const timer::time_point start = timer::now();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+    if(!m_sink->finish())
+    {
+      m_failed = true;
+    }
+    m_stats.finish_wait_ms = milliseconds_between(start, timer::now());
+    return !m_failed;
+  }
+
+  // Only valid after finish().
+  const Stats& stats() const { return m_stats; }
+
+private:
+  struct Item
+  {
+    std::string    name;
+    CompiledOutput output;
+  };
+
+  void run()
+  {
+    std::vector<Item>            batch;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+      m_wake.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+      if(m_queue.empty())
+      {
+        return;  // Stopping, and everything's written.
+      }
+      batch.swap(m_queue);
+      lock.unlock();
+
+      const timer::time_point start = timer::now();
+      bool                    ok    = true;
+      for(const Item& item : batch)
+      {
+        ok = ok && m_sink->write(item.name, item.output);
+        m_stats.num_bytes += item.output.size;
+      }
+      m_stats.write_ms += milliseconds_between(start, timer::now());
+      m_stats.num_outputs += batch.size();
+      m_stats.num_batches++;
+      // Release the compilers' results outside the lock.
+      batch.clear();
+
+      lock.lock();
+      m_failed = m_failed || !ok;
+    }
+  }
+
+  std::unique_ptr<OutputSink> m_sink;  // Only used by m_worker until finish()
+  Stats                       m_stats;  // Likewise
+
+  std::mutex              m_mutex;
+  std::condition_variable m_wake;
+  std::vector<Item>       m_queue;
+  bool                    m_stop   = false;
+  bool                    m_failed = false;
+  std::thread             m_worker;
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+// Hardware performance counters around each compile: cycles, instructions,
+// last-level cache references and misses, and branches and branch misses.
+// From these, IPC and the LLC miss rate show whether a compile is bound by
+// computation or by memory.
+//
+// On Linux, this uses perf_event_open() on the calling thread. Each ratio's
+// two counters (cycles and instructions, LLC references and misses, branches
+// and branch misses) form a group, so that they're always scheduled together;
+// small groups still get scheduled on PMUs with few counters, or when the NMI
+// watchdog holds one. If the kernel multiplexes the groups, values are scaled
+// by how long each ran, and a group that never ran isn't counted for that
+// compile (see PerfCounterValues::counted). Only user-space events are
+// counted, which works with the default perf_event_paranoid setting of 2.
+// Threads the compiler starts (e.g. for --precompile-threads) aren't counted.
+// If the CPU (or VM) has no PMU, open() fails.
+//
+// Windows has no user-mode API for hardware counters (they need a kernel
+// driver or ETW with administrator rights), so there this only counts cycles,
+// with QueryThreadCycleTime(). Those include time the thread spent in the
+// kernel.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Bits for PerfCounterValues::counted, in the order of kPerfCounterMembers.
+enum PerfCounter : uint32_t
+{
+  kPerfCycles        = 1 << 0,
+  kPerfInstructions  = 1 << 1,
+  kPerfLlcReferences = 1 << 2,
+  kPerfLlcMisses     = 1 << 3,
+  kPerfBranches      = 1 << 4,
+  kPerfBranchMisses  = 1 << 5,
+};
+
+struct PerfCounterValues
+{
+  uint64_t cycles         = 0;
+  uint64_t instructions   = 0;
+  uint64_t llc_references = 0;
+  uint64_t llc_misses     = 0;
+  uint64_t branches       = 0;
+  uint64_t branch_misses  = 0;
+  // PerfCounter bits for the values that were counted; the others are 0
+  // because the CPU doesn't have the counter, or it wasn't scheduled.
+  uint32_t counted = 0;
+
+  bool has(uint32_t counters) const { return (counted & counters) == counters; }
+
+  double instructions_per_cycle() const { return cycles ? double(instructions) / double(cycles) : 0.0; }
+  double llc_miss_rate() const { return llc_references ? double(llc_misses) / double(llc_references) : 0.0; }
+  // LLC misses per thousand instructions
+  double llc_mpki() const { return instructions ? 1000.0 * double(llc_misses) / double(instructions) : 0.0; }
+  double branch_miss_rate() const { return branches ? double(branch_misses) / double(branches) : 0.0; }
+};
+
+// Where each counter goes in PerfCounterValues, in PerfCounter bit order.
+constexpr uint64_t PerfCounterValues::*kPerfCounterMembers[] = {
+    &PerfCounterValues::cycles,     &PerfCounterValues::instructions, &PerfCounterValues::llc_references,
+    &PerfCounterValues::llc_misses, &PerfCounterValues::branches,     &PerfCounterValues::branch_misses,
+};
+
+class PerfCounters
+{
+public:
+  static constexpr size_t kNumCounters = sizeof(kPerfCounterMembers) / sizeof(kPerfCounterMembers[0]);
+  // Counters 2i and 2i + 1 form a group, led by counter 2i.
+  static constexpr size_t kGroupSize = 2;
+
+  PerfCounters() = default;
+  ~PerfCounters() { close(); }
+  PerfCounters(const PerfCounters&)            = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Opens the counters for the calling thread. Counters the CPU doesn't have
+  // are never counted. Returns false if there's no cycle counter, in which
+  // case start() and stop() do nothing.
+  bool open()
+  {
+    close();
+#ifdef __linux__
+    static constexpr uint64_t kConfigs[kNumCounters] = {
+        PERF_COUNT_HW_CPU_CYCLES,   PERF_COUNT_HW_INSTRUCTIONS,        PERF_COUNT_HW_CACHE_REFERENCES,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    for(size_t i = 0; i < kNumCounters; i++)
+    {
+      const bool is_leader = (i % kGroupSize == 0);
+      const int  group_fd  = is_leader ? -1 : m_fds[i - i % kGroupSize];
+      if(!is_leader && group_fd < 0)
+      {
+        continue;  // The group has no leader.
+      }
+      perf_event_attr attr{};
+      attr.type           = PERF_TYPE_HARDWARE;
+      attr.size           = sizeof(attr);
+      attr.config         = kConfigs[i];
+      attr.disabled       = is_leader ? 1 : 0;  // Each group starts with its leader
+      attr.exclude_kernel = 1;
+      attr.exclude_hv     = 1;
+      attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      const int fd        = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+      if(fd < 0)
+      {
+        if(i == 0)
+        {
+          fprintf(stderr, "Could not open hardware performance counters: %s\n", strerror(errno));
+          return false;
+        }
+        continue;  // This counter is never counted.
+      }
+      m_fds[i] = fd;
+      ioctl(fd, PERF_EVENT_IOC_ID, &m_ids[i]);
+    }
+#elif defined(_WIN32)
+    m_open = true;
+#else
+    fprintf(stderr, "Performance counters are only supported on Linux and Windows.\n");
+    return false;
+#endif
+    return true;
+  }
+
+  bool is_open() const
+  {
+#ifdef __linux__
+    return m_fds[0] >= 0;
+#else
+    return m_open;
+#endif
+  }
+
+  // Resets and starts the counters.
+  void start()
+  {
+#ifdef __linux__
+    for(size_t leader = 0; leader < kNumCounters; leader += kGroupSize)
+    {
+      if(m_fds[leader] >= 0)
+      {
+        ioctl(m_fds[leader], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_fds[leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      }
+    }
+#elif defined(_WIN32)
+    if(m_open)
+    {
+      QueryThreadCycleTime(GetCurrentThread(), &m_startCycles);
+    }
+#endif
+  }
+
+  // Stops the counters, and returns what they counted since start().
+  PerfCounterValues stop()
+  {
+    PerfCounterValues values;
+#ifdef __linux__
+    for(size_t leader = 0; leader < kNumCounters; leader += kGroupSize)
+    {
+      if(m_fds[leader] >= 0)
+      {
+        ioctl(m_fds[leader], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      }
+    }
+    for(size_t leader = 0; leader < kNumCounters; leader += kGroupSize)
+    {
+      if(m_fds[leader] < 0)
+      {
+        continue;
+      }
+      // With PERF_FORMAT_GROUP: nr, time_enabled, time_running, and then a
+      // (value, id) pair for each counter.
+      uint64_t       buffer[3 + 2 * kGroupSize] = {};
+      const ssize_t  size                       = read(m_fds[leader], buffer, sizeof(buffer));
+      const uint64_t running                    = buffer[2];
+      if(size < static_cast<ssize_t>(3 * sizeof(uint64_t)) || running == 0)
+      {
+        continue;  // The group was never scheduled, so it counted nothing.
+      }
+      const uint64_t count   = buffer[0];
+      const uint64_t enabled = buffer[1];
+      // Scales multiplexed counts up to the whole time the group was enabled.
+      const double scale = (running < enabled) ? double(enabled) / double(running) : 1.0;
+      for(uint64_t i = 0; i < count && i < kGroupSize; i++)
+      {
+        const uint64_t value = buffer[3 + 2 * i];
+        const uint64_t id    = buffer[4 + 2 * i];
+        for(size_t counter = leader; counter < leader + kGroupSize; counter++)
+        {
+          if(m_fds[counter] >= 0 && m_ids[counter] == id)
+          {
+            values.*kPerfCounterMembers[counter] = static_cast<uint64_t>(double(value) * scale);
+            values.counted |= 1u << counter;
+          }
+        }
+      }
+    }
+#elif defined(_WIN32)
+    ULONG64 end_cycles = 0;
+    if(m_open && QueryThreadCycleTime(GetCurrentThread(), &end_cycles))
+    {
+      values.cycles  = end_cycles - m_startCycles;
+      values.counted = kPerfCycles;
+    }
+#endif
+    return values;
+  }
+
+  void close()
+  {
+#ifdef __linux__
+    // Members before their leaders.
+    for(size_t i = kNumCounters; i-- > 0;)
+    {
+      if(m_fds[i] >= 0)
+      {
+        ::close(m_fds[i]);
+      }
+      m_fds[i] = -1;
+    }
+#else
+    m_open = false;
+#endif
+  }
+
+private:
+#ifdef __linux__
+  int      m_fds[kNumCounters] = {-1, -1, -1, -1, -1, -1};
+  uint64_t m_ids[kNumCounters] = {};
+#else
+  bool m_open = false;
+#ifdef _WIN32
+  ULONG64 m_startCycles = 0;
+#endif
+#endif
+};
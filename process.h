@@ -0,0 +1,190 @@
+#pragma once
+
+// Runs child processes and captures their standard output.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+#include "utilities.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Returns a timestamp in nanoseconds that's comparable between processes:
+// std::chrono::steady_clock uses CLOCK_MONOTONIC on Linux and
+// QueryPerformanceCounter on Windows, both of which are system-wide.
+inline int64_t process_clock_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Returns the path of this executable, or `fallback` (e.g. argv[0]) if the
+// OS can't tell us.
+inline std::string current_executable_path(const char* fallback)
+{
+#ifdef _WIN32
+  wchar_t     path[MAX_PATH];
+  const DWORD length = GetModuleFileNameW(nullptr, path, MAX_PATH);
+  if(length > 0 && length < MAX_PATH)
+  {
+    return fs::path(path).string();
+  }
+#else
+  std::error_code error;
+  const fs::path  path = fs::read_symlink("/proc/self/exe", error);
+  if(!error)
+  {
+    return path.string();
+  }
+#endif
+  return fallback;
+}
+
+// Returns the path of the executable or shared library that contains
+// `address` (e.g. a function in a compiler library), or an empty string if the
+// OS can't tell us.
+inline std::string module_path_containing(const void* address)
+{
+#ifdef _WIN32
+  HMODULE module = nullptr;
+  if(GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                        static_cast<LPCWSTR>(address), &module))
+  {
+    wchar_t     path[MAX_PATH];
+    const DWORD length = GetModuleFileNameW(module, path, MAX_PATH);
+    if(length > 0 && length < MAX_PATH)
+    {
+      return fs::path(path).string();
+    }
+  }
+#else
+  Dl_info info{};
+  if(dladdr(address, &info) && info.dli_fname)
+  {
+    return info.dli_fname;
+  }
+#endif
+  return std::string();
+}
+
+// Runs `args[0]` with arguments `args`, waits for it to exit, and stores its
+// standard output in `output` and its exit code in `exit_code`. Standard
+// error goes to ours. Returns false if the process couldn't be started.
+inline bool run_process(const std::vector<std::string>& args, std::string& output, int& exit_code)
+{
+  output.clear();
+  exit_code = -1;
+#ifdef _WIN32
+  SECURITY_ATTRIBUTES security{.nLength = sizeof(SECURITY_ATTRIBUTES), .lpSecurityDescriptor = nullptr, .bInheritHandle = TRUE};
+  HANDLE              read_pipe = nullptr, write_pipe = nullptr;
+  if(!CreatePipe(&read_pipe, &write_pipe, &security, 0))
+  {
+    fprintf(stderr, "CreatePipe() failed.\n");
+    return false;
+  }
+  SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+  std::wstring command_line;
+  for(const std::string& arg : args)
+  {
+    // Our arguments are paths and options, which don't contain quotes.
+    command_line += (command_line.empty() ? L"\"" : L" \"") + fs::path(arg).wstring() + L"\"";
+  }
+  STARTUPINFOW startup{};
+  startup.cb         = sizeof(startup);
+  startup.dwFlags    = STARTF_USESTDHANDLES;
+  startup.hStdInput  = GetStdHandle(STD_INPUT_HANDLE);
+  startup.hStdOutput = write_pipe;
+  startup.hStdError  = GetStdHandle(STD_ERROR_HANDLE);
+  PROCESS_INFORMATION process{};
+  const BOOL created = CreateProcessW(nullptr, command_line.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process);
+  CloseHandle(write_pipe);
+  if(!created)
+  {
+    fprintf(stderr, "Could not start %s.\n", args[0].c_str());
+    CloseHandle(read_pipe);
+    return false;
+  }
+
+  char  buffer[4096];
+  DWORD num_read = 0;
+  while(ReadFile(read_pipe, buffer, sizeof(buffer), &num_read, nullptr) && num_read > 0)
+  {
+    output.append(buffer, num_read);
+  }
+  CloseHandle(read_pipe);
+  WaitForSingleObject(process.hProcess, INFINITE);
+  DWORD code = 0;
+  GetExitCodeProcess(process.hProcess, &code);
+  exit_code = static_cast<int>(code);
+  CloseHandle(process.hThread);
+  CloseHandle(process.hProcess);
+  return true;
+#else
+  int pipe_fds[2];
+  if(pipe(pipe_fds) != 0)
+  {
+    fprintf(stderr, "pipe() failed: %s\n", strerror(errno));
+    return false;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+  posix_spawn_file_actions_addclose(&actions, pipe_fds[1]);
+
+  std::vector<char*> argv;
+  for(const std::string& arg : args)
+  {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  pid_t     pid    = 0;
+  const int result = posix_spawn(&pid, args[0].c_str(), &actions, nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(pipe_fds[1]);
+  if(result != 0)
+  {
+    fprintf(stderr, "Could not start %s: %s\n", args[0].c_str(), strerror(result));
+    close(pipe_fds[0]);
+    return false;
+  }
+
+  char buffer[4096];
+  while(true)
+  {
+    const ssize_t num_read = read(pipe_fds[0], buffer, sizeof(buffer));
+    if(num_read < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if(num_read <= 0)
+    {
+      break;
+    }
+    output.append(buffer, static_cast<size_t>(num_read));
+  }
+  close(pipe_fds[0]);
+  int status = 0;
+  while(waitpid(pid, &status, 0) < 0 && errno == EINTR)
+  {
+  }
+  exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  return true;
+#endif
+}
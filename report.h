@@ -0,0 +1,159 @@
+#pragma once
+
+// Writers for machine-readable benchmark results.
+
+#include <cmath>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A minimal streaming JSON writer. Callers are responsible for nesting
+// begin/end calls correctly; in objects, each value must be preceded by key().
+class JsonWriter
+{
+public:
+  explicit JsonWriter(FILE* file)
+      : m_file(file)
+  {
+  }
+
+  ~JsonWriter()
+  {
+    if(m_wroteAnything)
+    {
+      fputc('\n', m_file);
+    }
+  }
+
+  JsonWriter& begin_object() { return open('{'); }
+  JsonWriter& end_object() { return close('}'); }
+  JsonWriter& begin_array() { return open('['); }
+  JsonWriter& end_array() { return close(']'); }
+
+  JsonWriter& key(std::string_view name)
+  {
+    separate();
+    write_string(name);
+    fputc(':', m_file);
+    m_afterKey = true;
+    return *this;
+  }
+
+  JsonWriter& value(std::string_view str)
+  {
+    separate();
+    write_string(str);
+    return *this;
+  }
+  JsonWriter& value(const char* str) { return value(std::string_view(str ? str : "")); }
+  // JSON has no NaN or infinity (e.g. from a rate with nothing to divide by),
+  // so those are written as null.
+  JsonWriter& value(double number)
+  {
+    separate();
+    if(std::isfinite(number))
+    {
+      fprintf(m_file, "%.9g", number);
+    }
+    else
+    {
+      fputs("null", m_file);
+    }
+    return *this;
+  }
+  JsonWriter& value(uint64_t number)
+  {
+    separate();
+    fprintf(m_file, "%llu", static_cast<unsigned long long>(number));
+    return *this;
+  }
+  JsonWriter& value(bool boolean)
+  {
+    separate();
+    fputs(boolean ? "true" : "false", m_file);
+    return *this;
+  }
+
+  // Shorthand for key(name).value(v).
+  template <class T>
+  JsonWriter& field(std::string_view name, const T& v)
+  {
+    return key(name).value(v);
+  }
+
+private:
+  JsonWriter& open(char bracket)
+  {
+    separate();
+    fputc(bracket, m_file);
+    m_needsComma.push_back(false);
+    return *this;
+  }
+
+  JsonWriter& close(char bracket)
+  {
+    m_needsComma.pop_back();
+    fputc(bracket, m_file);
+    return *this;
+  }
+
+  // Writes a comma if this isn't the first item in the current object or array.
+  void separate()
+  {
+    m_wroteAnything = true;
+    if(m_afterKey)
+    {
+      m_afterKey = false;
+      return;
+    }
+    if(!m_needsComma.empty())
+    {
+      if(m_needsComma.back())
+      {
+        fputc(',', m_file);
+      }
+      m_needsComma.back() = true;
+    }
+  }
+
+  void write_string(std::string_view str)
+  {
+    fputc('"', m_file);
+    for(const char c : str)
+    {
+      switch(c)
+      {
+        case '"':
+          fputs("\\\"", m_file);
+          break;
+        case '\\':
+          fputs("\\\\", m_file);
+          break;
+        case '\n':
+          fputs("\\n", m_file);
+          break;
+        case '\t':
+          fputs("\\t", m_file);
+          break;
+        default:
+          if(static_cast<unsigned char>(c) < 0x20)
+          {
+            fprintf(m_file, "\\u%04x", static_cast<unsigned>(c));
+          }
+          else
+          {
+            fputc(c, m_file);
+          }
+      }
+    }
+    fputc('"', m_file);
+  }
+
+  FILE*             m_file;
+  std::vector<bool> m_needsComma;
+  bool              m_afterKey      = false;
+  bool              m_wroteAnything = false;
+};
@@ -0,0 +1,442 @@
+#pragma once
+
+// A single-file archive of compiled outputs (SPIR-V, serialized modules),
+// for pipelines that produce too many outputs to write one file each.
+//
+// Format (integers are native-endian):
+// - An ArchiveHeader.
+// - The payloads, each starting at a multiple of kArchiveAlignment.
+// - The index: one ArchiveIndexEntry per entry, sorted by key.
+// - The names, concatenated (not null-terminated).
+// The writer appends payloads as they arrive and writes the index and names
+// when it's finished, then fills in the header; until then, the header's
+// magic is zeroed, so an interrupted write doesn't look like an archive.
+//
+// Payloads can be compressed with LZ4 or zstd, if the build found them
+// (HAS_LZ4, HAS_ZSTD). Each entry records its own compression, and entries
+// that don't get smaller are stored uncompressed. The reader maps the whole
+// archive, so uncompressed payloads can be used in place.
+
+#ifdef HAS_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "mapped_file.h"
+#include "utilities.h"
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+constexpr char     kArchiveMagic[8]  = {'S', 'C', 'T', 'A', 'R', 'C', 'H', '\0'};
+constexpr uint32_t kArchiveVersion   = 1;
+constexpr uint64_t kArchiveAlignment = 64;
+
+enum class ArchiveCompression : uint32_t
+{
+  kNone = 0,
+  kLz4  = 1,
+  kZstd = 2,
+};
+
+// Returns whether this build can read and write `compression`.
+inline bool archive_compression_supported(ArchiveCompression compression)
+{
+  switch(compression)
+  {
+    case ArchiveCompression::kNone:
+      return true;
+#ifdef HAS_LZ4
+    case ArchiveCompression::kLz4:
+      return true;
+#endif
+#ifdef HAS_ZSTD
+    case ArchiveCompression::kZstd:
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+// Compresses `size` bytes at `data` into `out`. Returns false on failure.
+inline bool archive_compress(ArchiveCompression compression, [[maybe_unused]] const void* data, [[maybe_unused]] size_t size,
+                             [[maybe_unused]] std::vector<char>& out)
+{
+  switch(compression)
+  {
+#ifdef HAS_LZ4
+    case ArchiveCompression::kLz4:
+    {
+      if(size > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+      {
+        return false;
+      }
+      out.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(size))));
+      const int compressed_size =
+          LZ4_compress_default(static_cast<const char*>(data), out.data(), static_cast<int>(size), static_cast<int>(out.size()));
+      out.resize(compressed_size > 0 ? static_cast<size_t>(compressed_size) : 0);
+      return compressed_size > 0;
+    }
+#endif
+#ifdef HAS_ZSTD
+    case ArchiveCompression::kZstd:
+    {
+      out.resize(ZSTD_compressBound(size));
+      const size_t compressed_size = ZSTD_compress(out.data(), out.size(), data, size, ZSTD_CLEVEL_DEFAULT);
+      out.resize(ZSTD_isError(compressed_size) ? 0 : compressed_size);
+      return !ZSTD_isError(compressed_size);
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+// Decompresses `input` into `out`, which must already have the uncompressed
+// size. Returns false on failure.
+inline bool archive_decompress(ArchiveCompression compression, [[maybe_unused]] std::string_view input, [[maybe_unused]] std::vector<char>& out)
+{
+  switch(compression)
+  {
+#ifdef HAS_LZ4
+    case ArchiveCompression::kLz4:
+      return input.size() <= static_cast<size_t>(INT32_MAX) && out.size() <= static_cast<size_t>(INT32_MAX)
+             && LZ4_decompress_safe(input.data(), out.data(), static_cast<int>(input.size()), static_cast<int>(out.size()))
+                    == static_cast<int>(out.size());
+#endif
+#ifdef HAS_ZSTD
+    case ArchiveCompression::kZstd:
+      return ZSTD_decompress(out.data(), out.size(), input.data(), input.size()) == out.size();
+#endif
+    default:
+      return false;
+  }
+}
+
+// Returns whether `size` bytes could be what `stored` decompresses to, so
+// that a corrupt index can't make the reader allocate far more than the
+// archive could hold. Compressions this build doesn't support pass; reading
+// them fails anyway.
+inline bool archive_size_plausible(ArchiveCompression compression, std::string_view stored, uint64_t size)
+{
+  switch(compression)
+  {
+    case ArchiveCompression::kNone:
+      return size == stored.size();
+    case ArchiveCompression::kLz4:
+      // Each LZ4 input byte decodes to at most 255 bytes.
+      return size <= uint64_t(255) * stored.size();
+    case ArchiveCompression::kZstd:
+#ifdef HAS_ZSTD
+    {
+      // ZSTD_compress() records the size in the frame header.
+      const unsigned long long content_size = ZSTD_getFrameContentSize(stored.data(), stored.size());
+      return content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR && content_size == size;
+    }
+#else
+      return true;
+#endif
+    default:
+      return false;  // Not a compression any writer uses.
+  }
+}
+
+struct ArchiveHeader
+{
+  char     magic[8]     = {};
+  uint32_t version      = 0;
+  uint32_t reserved     = 0;
+  uint64_t num_entries  = 0;
+  uint64_t index_offset = 0;
+  uint64_t names_offset = 0;
+  uint64_t names_size   = 0;
+};
+
+struct ArchiveIndexEntry
+{
+  uint64_t           key         = 0;  // Usually xxh64() of the name
+  uint64_t           offset      = 0;  // Of the payload, from the start of the file
+  uint64_t           stored_size = 0;  // Of the payload
+  uint64_t           size        = 0;  // After decompression
+  uint64_t           name_offset = 0;  // From the start of the names
+  uint64_t           name_size   = 0;
+  ArchiveCompression compression = ArchiveCompression::kNone;
+  uint32_t           reserved    = 0;
+};
+
+class ArchiveWriter
+{
+public:
+  ArchiveWriter() = default;
+  ~ArchiveWriter() { finish(); }
+
+  ArchiveWriter(const ArchiveWriter&)            = delete;
+  ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+  // Creates (or truncates) the archive at `path`. Returns false on failure.
+  bool open(const fs::path& path)
+  {
+    finish();
+#ifdef _WIN32
+    m_file = _wfopen(path.c_str(), L"wb");
+#else
+    m_file = fopen(path.c_str(), "wb");
+#endif
+    if(!m_file)
+    {
+      fprintf(stderr, "Could not open %s for writing.\n", path.string().c_str());
+      return false;
+    }
+    // Payloads are usually large, so a bigger buffer saves system calls.
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+    m_path   = path;
+    m_failed = false;
+    m_offset = 0;
+    m_entries.clear();
+    m_entryIndices.clear();
+    m_names.clear();
+    const ArchiveHeader placeholder{};
+    return writeBytes(&placeholder, sizeof(placeholder));
+  }
+
+  bool is_open() const { return m_file != nullptr; }
+
+  // Compresses entries added from now on, if that makes them smaller.
+  // Returns false if this build doesn't support `compression`.
+  bool set_compression(ArchiveCompression compression)
+  {
+    if(!archive_compression_supported(compression))
+    {
+      return false;
+    }
+    m_compression = compression;
+    return true;
+  }
+
+  // Appends an entry. If an entry with the same key was already added, this
+  // one replaces it. Returns false on failure.
+  bool add(uint64_t key, std::string_view name, const void* data, size_t size)
+  {
+    if(!m_file || m_failed)
+    {
+      return false;
+    }
+    if(!pad())
+    {
+      return false;
+    }
+    ArchiveIndexEntry entry{.key         = key,
+                            .offset      = m_offset,
+                            .stored_size = size,
+                            .size        = size,
+                            .name_offset = m_names.size(),
+                            .name_size   = name.size()};
+    const void* payload = data;
+    if(m_compression != ArchiveCompression::kNone && archive_compress(m_compression, data, size, m_compressed)
+       && m_compressed.size() < size)
+    {
+      payload           = m_compressed.data();
+      entry.stored_size = m_compressed.size();
+      entry.compression = m_compression;
+    }
+    if(!writeBytes(payload, entry.stored_size))
+    {
+      return false;
+    }
+    m_names.append(name);
+
+    const auto& [it, inserted] = m_entryIndices.try_emplace(key, m_entries.size());
+    if(inserted)
+    {
+      m_entries.push_back(entry);
+    }
+    else
+    {
+      m_entries[it->second] = entry;
+    }
+    return true;
+  }
+
+  size_t num_entries() const { return m_entries.size(); }
+
+  // Writes the index and header, and closes the file. Returns false if
+  // anything failed since open().
+  bool finish()
+  {
+    if(!m_file)
+    {
+      return !m_failed;
+    }
+    std::sort(m_entries.begin(), m_entries.end(),
+              [](const ArchiveIndexEntry& a, const ArchiveIndexEntry& b) { return a.key < b.key; });
+    ArchiveHeader header{.version = kArchiveVersion, .num_entries = m_entries.size()};
+    pad();  // So that readers can use the index in place
+    header.index_offset = m_offset;
+    writeBytes(m_entries.data(), m_entries.size() * sizeof(ArchiveIndexEntry));
+    header.names_offset = m_offset;
+    header.names_size   = m_names.size();
+    writeBytes(m_names.data(), m_names.size());
+
+    memcpy(header.magic, kArchiveMagic, sizeof(kArchiveMagic));
+    if(!m_failed && (fseek(m_file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, m_file) != 1))
+    {
+      m_failed = true;
+    }
+    if(fclose(m_file) != 0)
+    {
+      m_failed = true;
+    }
+    m_file = nullptr;
+    if(m_failed)
+    {
+      fprintf(stderr, "Could not write archive %s.\n", m_path.string().c_str());
+    }
+    return !m_failed;
+  }
+
+private:
+  // Pads the file to a multiple of kArchiveAlignment.
+  bool pad()
+  {
+    static const char zeros[kArchiveAlignment] = {};
+    return writeBytes(zeros, (kArchiveAlignment - m_offset % kArchiveAlignment) % kArchiveAlignment);
+  }
+
+  bool writeBytes(const void* data, size_t size)
+  {
+    if(m_failed || (size > 0 && fwrite(data, 1, size, m_file) != size))
+    {
+      m_failed = true;
+      return false;
+    }
+    m_offset += size;
+    return true;
+  }
+
+  FILE*                                  m_file   = nullptr;
+  fs::path                               m_path;
+  bool                                   m_failed = false;
+  uint64_t                               m_offset = 0;  // Bytes written so far
+  std::vector<ArchiveIndexEntry>         m_entries;
+  std::unordered_map<uint64_t, size_t>   m_entryIndices;  // Key -> index in m_entries
+  std::string                            m_names;
+  ArchiveCompression                     m_compression = ArchiveCompression::kNone;
+  std::vector<char>                      m_compressed;  // Reused between entries
+};
+
+class ArchiveReader
+{
+public:
+  // Maps the archive at `path` and checks its header and index. Returns false
+  // if it can't be opened or isn't a valid archive.
+  bool open(const fs::path& path)
+  {
+    close();
+    count_filesystem_call();
+    if(!m_file.open(path))
+    {
+      return false;
+    }
+    ArchiveHeader header;
+    const size_t  file_size = m_file.size();
+    if(file_size < sizeof(header))
+    {
+      return fail(path);
+    }
+    memcpy(&header, m_file.data(), sizeof(header));
+    if(memcmp(header.magic, kArchiveMagic, sizeof(kArchiveMagic)) != 0 || header.version != kArchiveVersion
+       || header.index_offset % alignof(ArchiveIndexEntry) != 0 || header.index_offset > file_size
+       || header.num_entries > (file_size - header.index_offset) / sizeof(ArchiveIndexEntry)
+       || header.names_offset > file_size || header.names_size > file_size - header.names_offset)
+    {
+      return fail(path);
+    }
+    // The index is aligned, so we can use it in place.
+    m_entries    = reinterpret_cast<const ArchiveIndexEntry*>(m_file.data() + header.index_offset);
+    m_numEntries = static_cast<size_t>(header.num_entries);
+    m_names      = std::string_view(m_file.data() + header.names_offset, header.names_size);
+    for(size_t i = 0; i < m_numEntries; i++)
+    {
+      const ArchiveIndexEntry& entry = m_entries[i];
+      if(entry.offset > file_size || entry.stored_size > file_size - entry.offset || entry.name_offset > m_names.size()
+         || entry.name_size > m_names.size() - entry.name_offset
+         || !archive_size_plausible(entry.compression, std::string_view(m_file.data() + entry.offset, entry.stored_size), entry.size)
+         || (i > 0 && m_entries[i - 1].key >= entry.key))
+      {
+        return fail(path);
+      }
+    }
+    return true;
+  }
+
+  void close()
+  {
+    m_file.close();
+    m_entries    = nullptr;
+    m_numEntries = 0;
+    m_names      = {};
+  }
+
+  bool   is_open() const { return m_file.is_open(); }
+  size_t num_entries() const { return m_numEntries; }
+  const ArchiveIndexEntry& entry(size_t index) const { return m_entries[index]; }
+
+  // Returns the entry for `key`, or nullptr if there isn't one.
+  const ArchiveIndexEntry* find(uint64_t key) const
+  {
+    const ArchiveIndexEntry* end = m_entries + m_numEntries;
+    const ArchiveIndexEntry* it =
+        std::lower_bound(m_entries, end, key, [](const ArchiveIndexEntry& entry, uint64_t k) { return entry.key < k; });
+    return (it != end && it->key == key) ? it : nullptr;
+  }
+
+  std::string_view name(const ArchiveIndexEntry& entry) const { return m_names.substr(entry.name_offset, entry.name_size); }
+
+  // Sets `out` to `entry`'s payload. Uncompressed payloads point into the
+  // mapping; others are decompressed into `scratch`. Returns false if the
+  // payload can't be decompressed.
+  bool read(const ArchiveIndexEntry& entry, std::vector<char>& scratch, std::string_view& out) const
+  {
+    const std::string_view stored(m_file.data() + entry.offset, entry.stored_size);
+    if(entry.compression == ArchiveCompression::kNone)
+    {
+      out = stored;
+      return true;
+    }
+    if(!archive_compression_supported(entry.compression))
+    {
+      return false;
+    }
+    // open() checked that the size is plausible.
+    scratch.resize(static_cast<size_t>(entry.size));
+    if(!archive_decompress(entry.compression, stored, scratch))
+    {
+      return false;
+    }
+    out = std::string_view(scratch.data(), scratch.size());
+    return true;
+  }
+
+private:
+  bool fail(const fs::path& path)
+  {
+    fprintf(stderr, "%s is not a valid shader archive.\n", path.string().c_str());
+    close();
+    return false;
+  }
+
+  MappedFile               m_file;
+  const ArchiveIndexEntry* m_entries    = nullptr;
+  size_t                   m_numEntries = 0;
+  std::string_view         m_names;
+};
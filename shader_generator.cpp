@@ -0,0 +1,108 @@
+// slang-shader-generator: Writes a synthetic shader of a chosen size (see
+// shader_generator.h) in Slang, GLSL and HLSL, for benchmarking how compile
+// time scales with shader size.
+
+#include "shader_generator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+void print_help()
+{
+  printf(
+      "slang-shader-generator: Writes a synthetic compute shader in Slang, GLSL\n"
+      "and HLSL, with the same modules, imports, functions, generics and entry\n"
+      "points in each.\n"
+      "Usage: slang-shader-generator [options] directory\n"
+      "Options\n"
+      "  -h: Print this text and exit.\n"
+      "  --modules <N>: Number of modules (default: 8).\n"
+      "  --depth <N>: Length of each chain of imports (default: 2).\n"
+      "  --functions <N>: Functions per module (default: 16).\n"
+      "  --generics <N>: Generic instantiations per module (default: 4).\n"
+      "  --entry-points <N>: Number of entry points (default: 1).\n"
+      "  --language <slang|glsl|hlsl>: Only write this language (default: all\n"
+      "    three, side by side).\n");
+}
+
+int main(int argc, char* argv[])
+{
+  GeneratorSettings           settings;
+  std::vector<ShaderLanguage> languages = {ShaderLanguage::kSlang, ShaderLanguage::kGlsl, ShaderLanguage::kHlsl};
+  const char*                 directory = nullptr;
+  for(int argi = 1; argi < argc; argi++)
+  {
+    const char* arg = argv[argi];
+    if(strcmp("-h", arg) == 0)
+    {
+      print_help();
+      return EXIT_SUCCESS;
+    }
+    else if(strcmp("--modules", arg) == 0 || strcmp("--depth", arg) == 0 || strcmp("--functions", arg) == 0
+            || strcmp("--generics", arg) == 0 || strcmp("--entry-points", arg) == 0 || strcmp("--language", arg) == 0)
+    {
+      argi++;
+      if(argi == argc)
+      {
+        fprintf(stderr, "%s must be followed by a value.\n", arg);
+        return EXIT_FAILURE;
+      }
+      const char*  value  = argv[argi];
+      const size_t number = strtoull(value, nullptr, 0);
+      if(strcmp("--modules", arg) == 0)
+      {
+        settings.num_modules = number;
+      }
+      else if(strcmp("--depth", arg) == 0)
+      {
+        settings.import_depth = number;
+      }
+      else if(strcmp("--functions", arg) == 0)
+      {
+        settings.functions_per_module = number;
+      }
+      else if(strcmp("--generics", arg) == 0)
+      {
+        settings.generic_instantiations = number;
+      }
+      else if(strcmp("--entry-points", arg) == 0)
+      {
+        settings.num_entry_points = number;
+      }
+      else
+      {
+        const std::string                   extension = std::string(".") + value;
+        const std::optional<ShaderLanguage> language  = shader_language_for_extension(extension);
+        if(!language.has_value())
+        {
+          fprintf(stderr, "Unknown language %s; expected slang, glsl or hlsl.\n", value);
+          return EXIT_FAILURE;
+        }
+        languages = {language.value()};
+      }
+    }
+    else
+    {
+      directory = arg;
+    }
+  }
+  if(!directory)
+  {
+    print_help();
+    return EXIT_FAILURE;
+  }
+
+  for(const ShaderLanguage language : languages)
+  {
+    const GeneratedShader shader = generate_shader(settings, language);
+    const std::string     path   = write_generated_shader(shader, directory);
+    if(path.empty())
+    {
+      return EXIT_FAILURE;
+    }
+    printf("Wrote %s (%zu files, %zu bytes)\n", path.c_str(), shader.files.size(), shader.num_bytes());
+  }
+  return EXIT_SUCCESS;
+}
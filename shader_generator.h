@@ -0,0 +1,396 @@
+#pragma once
+
+// Generates synthetic compute shaders of a chosen size, in Slang, GLSL and
+// HLSL, so that benchmarks can measure how compile time scales as shaders
+// grow (see --scaling) instead of only having the examples' fixed sizes.
+//
+// A generated shader has `num_modules` modules, in chains of `import_depth`:
+// each module imports the one before it in its chain, and the main shader
+// imports the last module of each chain. Each module has
+// `functions_per_module` functions, each calling the one before it (the first
+// calls the last function of the module it imports), and makes
+// `generic_instantiations` calls of generic functions with different types.
+// The main shader has `num_entry_points` kernels, which each call every
+// chain.
+//
+// The three languages get the same program as far as they can express it:
+// Slang modules are `module`s with public functions and generics with an
+// IArithmetic constraint; GLSL and HLSL modules are headers with include
+// guards. HLSL generics are templates, and GLSL, which has no generics, gets
+// an overload for each type used. Since GLSL and HLSL have one entry point
+// per compile, their `main` calls every kernel, while Slang compiles each
+// kernel as its own entry point.
+//
+// slang-shader-generator (shader_generator.cpp) writes these to a directory.
+
+#include "utilities.h"
+
+#include <algorithm>
+#include <optional>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+struct GeneratorSettings
+{
+  size_t num_modules            = 8;
+  size_t import_depth           = 2;  // Modules per import chain
+  size_t functions_per_module   = 16;
+  size_t generic_instantiations = 4;  // Per module
+  size_t num_entry_points       = 1;
+};
+
+enum class ShaderLanguage
+{
+  kSlang,
+  kGlsl,
+  kHlsl,
+};
+
+// Returns the language of shaders ending in `extension` (e.g. a compiler
+// helper's extension()), if the generator can write it.
+inline std::optional<ShaderLanguage> shader_language_for_extension(std::string_view extension)
+{
+  if(extension == ".slang")
+  {
+    return ShaderLanguage::kSlang;
+  }
+  if(extension == ".glsl")
+  {
+    return ShaderLanguage::kGlsl;
+  }
+  if(extension == ".hlsl")
+  {
+    return ShaderLanguage::kHlsl;
+  }
+  return std::nullopt;
+}
+
+struct GeneratedFile
+{
+  std::string name;  // Relative to the shader's directory
+  std::string contents;
+};
+
+struct GeneratedShader
+{
+  // The main shader is first.
+  std::vector<GeneratedFile> files;
+
+  const GeneratedFile& main() const { return files.front(); }
+
+  size_t num_bytes() const
+  {
+    size_t total = 0;
+    for(const GeneratedFile& file : files)
+    {
+      total += file.contents.size();
+    }
+    return total;
+  }
+};
+
+namespace shader_generator {
+// Appends printf-style formatted text to `out`.
+inline void appendf(std::string& out, const char* format, ...)
+{
+  va_list args, args_copy;
+  va_start(args, format);
+  va_copy(args_copy, args);
+  const int length = vsnprintf(nullptr, 0, format, args_copy);
+  va_end(args_copy);
+  if(length > 0)
+  {
+    const size_t start = out.size();
+    out.resize(start + static_cast<size_t>(length) + 1);
+    vsnprintf(out.data() + start, static_cast<size_t>(length) + 1, format, args);
+    out.resize(start + static_cast<size_t>(length));
+  }
+  va_end(args);
+}
+
+// A type that generic functions are instantiated with, how to make one from
+// a float `x`, and how to turn one back into a float.
+struct GenericType
+{
+  const char* name;       // In Slang and HLSL
+  const char* glsl_name;  // In GLSL
+  const char* arguments;  // Constructor arguments, in terms of x
+  const char* prefix;     // Turns a value of this type into a float...
+  const char* suffix;     // ...with this after it
+};
+
+inline constexpr GenericType kGenericTypes[] = {
+    {"float", "float", "x", "(", ")"},
+    {"float2", "vec2", "x, x + 1.0", "(", ").y"},
+    {"float3", "vec3", "x, x + 1.0, x + 2.0", "(", ").z"},
+    {"float4", "vec4", "x, x + 1.0, x + 2.0, x + 3.0", "(", ").w"},
+    {"int", "int", "int(x)", "float(", ")"},
+    {"int2", "ivec2", "int(x), 2", "float((", ").y)"},
+    {"int3", "ivec3", "int(x), 2, 3", "float((", ").z)"},
+    {"int4", "ivec4", "int(x), 2, 3, 4", "float((", ").w)"},
+    {"uint", "uint", "uint(x)", "float(", ")"},
+    {"uint2", "uvec2", "uint(x), 2u", "float((", ").y)"},
+    {"uint3", "uvec3", "uint(x), 2u, 3u", "float((", ").z)"},
+    {"uint4", "uvec4", "uint(x), 2u, 3u, 4u", "float((", ").w)"},
+};
+inline constexpr size_t kNumGenericTypes = sizeof(kGenericTypes) / sizeof(kGenericTypes[0]);
+
+inline const char* module_extension(ShaderLanguage language)
+{
+  switch(language)
+  {
+    case ShaderLanguage::kSlang:
+      return ".slang";
+    case ShaderLanguage::kGlsl:
+      return ".h";
+    default:
+      return ".hlsli";
+  }
+}
+
+inline const char* main_file_name(ShaderLanguage language)
+{
+  switch(language)
+  {
+    case ShaderLanguage::kSlang:
+      return "gen_main.slang";
+    case ShaderLanguage::kGlsl:
+      return "gen_main.comp.glsl";
+    default:
+      return "gen_main.hlsl";
+  }
+}
+
+inline void append_import(std::string& out, ShaderLanguage language, size_t module)
+{
+  if(language == ShaderLanguage::kSlang)
+  {
+    appendf(out, "import gen_m%zu;\n", module);
+  }
+  else
+  {
+    appendf(out, "#include \"gen_m%zu%s\"\n", module, module_extension(language));
+  }
+}
+
+inline void append_header(std::string& out, const GeneratorSettings& settings)
+{
+  appendf(out, "// Generated by slang-shader-generator: %zu modules in chains of %zu, %zu functions per module,\n",
+          settings.num_modules, settings.import_depth, settings.functions_per_module);
+  appendf(out, "// %zu generic instantiations per module, %zu entry points.\n\n", settings.generic_instantiations,
+          settings.num_entry_points);
+}
+
+inline std::string generate_module(const GeneratorSettings& settings, ShaderLanguage language, size_t module)
+{
+  const bool slang = (language == ShaderLanguage::kSlang);
+  // Only the first module in each chain doesn't import anything.
+  const bool imports = (module % settings.import_depth) != 0;
+
+  std::string out;
+  append_header(out, settings);
+  if(slang)
+  {
+    appendf(out, "module gen_m%zu;\n\n", module);
+  }
+  else
+  {
+    appendf(out, "#ifndef GEN_M%zu\n#define GEN_M%zu\n\n", module, module);
+  }
+  if(imports)
+  {
+    append_import(out, language, module - 1);
+    out += "\n";
+  }
+
+  // Instantiation i calls generic function i / kNumGenericTypes with type
+  // i % kNumGenericTypes, so each group of types gets a new function.
+  const size_t num_generics = (settings.generic_instantiations + kNumGenericTypes - 1) / kNumGenericTypes;
+  for(size_t generic = 0; generic < num_generics; generic++)
+  {
+    if(slang)
+    {
+      appendf(out, "T gen_m%zu_g%zu<T : IArithmetic>(T a, T b) { return a * b + a; }\n", module, generic);
+    }
+    else if(language == ShaderLanguage::kHlsl)
+    {
+      appendf(out, "template <typename T> T gen_m%zu_g%zu(T a, T b) { return a * b + a; }\n", module, generic);
+    }
+    else
+    {
+      const size_t num_types = std::min(kNumGenericTypes, settings.generic_instantiations - generic * kNumGenericTypes);
+      for(size_t type = 0; type < num_types; type++)
+      {
+        const char* name = kGenericTypes[type].glsl_name;
+        appendf(out, "%s gen_m%zu_g%zu(%s a, %s b) { return a * b + a; }\n", name, module, generic, name, name);
+      }
+    }
+  }
+  if(settings.generic_instantiations > 0)
+  {
+    appendf(out, "\nfloat gen_m%zu_generics(float x)\n{\n  float sum = 0.0;\n", module);
+    for(size_t instantiation = 0; instantiation < settings.generic_instantiations; instantiation++)
+    {
+      const GenericType& type  = kGenericTypes[instantiation % kNumGenericTypes];
+      const char*        name  = slang || language == ShaderLanguage::kHlsl ? type.name : type.glsl_name;
+      const std::string  value = std::string(name) + "(" + type.arguments + ")";
+      appendf(out, "  sum += %sgen_m%zu_g%zu(%s, %s)%s;\n", type.prefix, module, instantiation / kNumGenericTypes,
+              value.c_str(), value.c_str(), type.suffix);
+    }
+    out += "  return sum;\n}\n";
+  }
+  out += "\n";
+
+  const char* visibility = slang ? "public " : "";
+  for(size_t function = 0; function < settings.functions_per_module; function++)
+  {
+    appendf(out, "%sfloat gen_m%zu_f%zu(float x) { return ", visibility, module, function);
+    if(function > 0)
+    {
+      appendf(out, "gen_m%zu_f%zu(x) * 0.5 + sin(x + %zu.0); }\n", module, function - 1, function);
+      continue;
+    }
+    if(imports)
+    {
+      appendf(out, "gen_m%zu_f%zu(x) * 0.5", module - 1, settings.functions_per_module - 1);
+    }
+    else
+    {
+      out += "x * 0.5";
+    }
+    if(settings.generic_instantiations > 0)
+    {
+      appendf(out, " + gen_m%zu_generics(x); }\n", module);
+    }
+    else
+    {
+      out += " + 1.0; }\n";
+    }
+  }
+
+  if(!slang)
+  {
+    appendf(out, "\n#endif  // GEN_M%zu\n", module);
+  }
+  return out;
+}
+
+inline std::string generate_main(const GeneratorSettings& settings, ShaderLanguage language)
+{
+  // The last module in each chain.
+  std::vector<size_t> chain_ends;
+  for(size_t start = 0; start < settings.num_modules; start += settings.import_depth)
+  {
+    chain_ends.push_back(std::min(start + settings.import_depth, settings.num_modules) - 1);
+  }
+
+  std::string out;
+  if(language == ShaderLanguage::kGlsl)
+  {
+    out += "#version 460\n#extension GL_GOOGLE_include_directive : require\n\n";
+  }
+  append_header(out, settings);
+  for(const size_t module : chain_ends)
+  {
+    append_import(out, language, module);
+  }
+  out += "\n";
+  switch(language)
+  {
+    case ShaderLanguage::kSlang:
+      out += "[[vk::binding(0)]] RWStructuredBuffer<float> g_output;\n\n";
+      break;
+    case ShaderLanguage::kGlsl:
+      out += "layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;\n";
+      out += "layout(std430, binding = 0) buffer Output\n{\n  float g_output[];\n};\n\n";
+      break;
+    case ShaderLanguage::kHlsl:
+      out += "RWStructuredBuffer<float> g_output : register(u0);\n\n";
+      break;
+  }
+
+  for(size_t kernel = 0; kernel < settings.num_entry_points; kernel++)
+  {
+    appendf(out, "float kernel_%zu(float x)\n{\n  float sum = 0.0;\n", kernel);
+    for(const size_t module : chain_ends)
+    {
+      appendf(out, "  sum += gen_m%zu_f%zu(x + %zu.0);\n", module, settings.functions_per_module - 1, kernel);
+    }
+    out += "  return sum;\n}\n\n";
+    if(language == ShaderLanguage::kSlang)
+    {
+      appendf(out,
+              "[shader(\"compute\")]\n[numthreads(64, 1, 1)]\nvoid main_%zu(uint3 id : SV_DispatchThreadID)\n{\n"
+              "  g_output[id.x] = kernel_%zu(float(id.x));\n}\n\n",
+              kernel, kernel);
+    }
+  }
+
+  if(language == ShaderLanguage::kSlang)
+  {
+    return out;
+  }
+  if(language == ShaderLanguage::kGlsl)
+  {
+    out += "void main()\n{\n  const uint index = gl_GlobalInvocationID.x;\n  float      sum   = 0.0;\n";
+  }
+  else
+  {
+    out += "[numthreads(64, 1, 1)]\nvoid main(uint3 id : SV_DispatchThreadID)\n{\n  const uint index = id.x;\n  float      sum   = 0.0;\n";
+  }
+  for(size_t kernel = 0; kernel < settings.num_entry_points; kernel++)
+  {
+    appendf(out, "  sum += kernel_%zu(float(index));\n", kernel);
+  }
+  out += "  g_output[index] = sum;\n}\n";
+  return out;
+}
+}  // namespace shader_generator
+
+// Generates a shader in `language`. Settings below 1 (except
+// generic_instantiations) are treated as 1.
+inline GeneratedShader generate_shader(GeneratorSettings settings, ShaderLanguage language)
+{
+  settings.num_modules          = std::max<size_t>(settings.num_modules, 1);
+  settings.import_depth         = std::max<size_t>(settings.import_depth, 1);
+  settings.functions_per_module = std::max<size_t>(settings.functions_per_module, 1);
+  settings.num_entry_points     = std::max<size_t>(settings.num_entry_points, 1);
+
+  GeneratedShader shader;
+  shader.files.push_back({shader_generator::main_file_name(language), shader_generator::generate_main(settings, language)});
+  for(size_t module = 0; module < settings.num_modules; module++)
+  {
+    shader.files.push_back({"gen_m" + std::to_string(module) + shader_generator::module_extension(language),
+                            shader_generator::generate_module(settings, language, module)});
+  }
+  return shader;
+}
+
+// Writes each of the shader's files to `directory`, creating it if needed,
+// and returns the main shader's path. Returns an empty string on failure.
+inline std::string write_generated_shader(const GeneratedShader& shader, const fs::path& directory)
+{
+  std::error_code error;
+  fs::create_directories(directory, error);
+  if(error)
+  {
+    fprintf(stderr, "Could not create %s: %s\n", directory.string().c_str(), error.message().c_str());
+    return {};
+  }
+  for(const GeneratedFile& file : shader.files)
+  {
+    const fs::path path = directory / file.name;
+    std::ofstream  stream(path, std::ios::binary);
+    if(!stream.write(file.contents.data(), static_cast<std::streamsize>(file.contents.size())))
+    {
+      fprintf(stderr, "Could not write %s.\n", path.string().c_str());
+      return {};
+    }
+  }
+  return (directory / shader.main().name).string();
+}
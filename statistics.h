@@ -0,0 +1,322 @@
+#pragma once
+
+// Summary statistics and significance tests for benchmark samples.
+
+#include <algorithm>
+#include <cmath>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+struct SampleSummary
+{
+  size_t count  = 0;
+  double min    = 0.0;
+  double median = 0.0;
+  double p90    = 0.0;
+  double p95    = 0.0;
+  double p99    = 0.0;
+  double max    = 0.0;
+  double mean   = 0.0;
+  double stddev = 0.0;  // Sample standard deviation
+};
+
+// Returns the `fraction` quantile of sorted samples, interpolating linearly
+// between the closest ranks.
+inline double quantile_of_sorted(const std::vector<double>& sorted, double fraction)
+{
+  if(sorted.empty())
+  {
+    return 0.0;
+  }
+  const double position = fraction * static_cast<double>(sorted.size() - 1);
+  const size_t lower    = static_cast<size_t>(std::floor(position));
+  const size_t upper    = std::min(lower + 1, sorted.size() - 1);
+  const double t        = position - static_cast<double>(lower);
+  return sorted[lower] + t * (sorted[upper] - sorted[lower]);
+}
+
+inline SampleSummary summarize(std::vector<double> samples)
+{
+  SampleSummary summary;
+  summary.count = samples.size();
+  if(samples.empty())
+  {
+    return summary;
+  }
+  std::sort(samples.begin(), samples.end());
+  summary.min    = samples.front();
+  summary.max    = samples.back();
+  summary.median = quantile_of_sorted(samples, 0.5);
+  summary.p90    = quantile_of_sorted(samples, 0.90);
+  summary.p95    = quantile_of_sorted(samples, 0.95);
+  summary.p99    = quantile_of_sorted(samples, 0.99);
+  double sum     = 0.0;
+  for(double sample : samples)
+  {
+    sum += sample;
+  }
+  summary.mean = sum / static_cast<double>(samples.size());
+  if(samples.size() > 1)
+  {
+    double sum_of_squares = 0.0;
+    for(double sample : samples)
+    {
+      sum_of_squares += (sample - summary.mean) * (sample - summary.mean);
+    }
+    summary.stddev = std::sqrt(sum_of_squares / static_cast<double>(samples.size() - 1));
+  }
+  return summary;
+}
+
+// Removes samples whose modified z-score, based on the median absolute
+// deviation (MAD), is greater than `threshold` (3.5 is a common choice).
+// Unlike a mean/stddev test, a few huge outliers can't hide each other.
+// Returns how many samples were removed.
+inline size_t reject_outliers_mad(std::vector<double>& samples, double threshold)
+{
+  if(samples.size() < 3)
+  {
+    return 0;
+  }
+  std::vector<double> sorted = samples;
+  std::sort(sorted.begin(), sorted.end());
+  const double median = quantile_of_sorted(sorted, 0.5);
+  for(double& value : sorted)
+  {
+    value = std::abs(value - median);
+  }
+  std::sort(sorted.begin(), sorted.end());
+  const double mad = quantile_of_sorted(sorted, 0.5);
+  if(mad == 0.0)
+  {
+    return 0;
+  }
+
+  // 0.6745 makes the MAD consistent with the standard deviation for normally
+  // distributed samples.
+  const size_t original_size = samples.size();
+  std::erase_if(samples, [&](double value) { return 0.6745 * std::abs(value - median) / mad > threshold; });
+  return original_size - samples.size();
+}
+
+// Returns the regularized incomplete beta function I_x(a, b), using the
+// continued fraction from Numerical Recipes (evaluated with Lentz's method).
+inline double incomplete_beta(double a, double b, double x)
+{
+  if(x <= 0.0)
+  {
+    return 0.0;
+  }
+  if(x >= 1.0)
+  {
+    return 1.0;
+  }
+  // The continued fraction converges quickly for x < (a + 1) / (a + b + 2);
+  // otherwise, use the symmetry relation.
+  if(x > (a + 1.0) / (a + b + 2.0))
+  {
+    return 1.0 - incomplete_beta(b, a, 1.0 - x);
+  }
+
+  const double tiny = 1e-300;
+  const double front =
+      std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1.0 - x)) / a;
+  double c = 1.0;
+  double d = 1.0 - (a + b) * x / (a + 1.0);
+  d        = 1.0 / (std::abs(d) < tiny ? tiny : d);
+  double f = d;
+  for(int m = 1; m <= 300; m++)
+  {
+    // Even and odd steps of the continued fraction.
+    for(int step = 0; step < 2; step++)
+    {
+      const double numerator = (step == 0) ? (m * (b - m) * x) / ((a + 2.0 * m - 1.0) * (a + 2.0 * m)) :
+                                             -((a + m) * (a + b + m) * x) / ((a + 2.0 * m) * (a + 2.0 * m + 1.0));
+      d = 1.0 + numerator * d;
+      d = 1.0 / (std::abs(d) < tiny ? tiny : d);
+      c = 1.0 + numerator / c;
+      c = (std::abs(c) < tiny ? tiny : c);
+      f *= c * d;
+    }
+    if(std::abs(c * d - 1.0) < 1e-12)
+    {
+      break;
+    }
+  }
+  return front * f;
+}
+
+// Returns the probability that |T| >= |t| for Student's t distribution with
+// `df` degrees of freedom.
+inline double student_t_two_sided_p(double t, double df)
+{
+  return incomplete_beta(0.5 * df, 0.5, df / (df + t * t));
+}
+
+// Returns the t such that student_t_two_sided_p(t, df) == p.
+inline double student_t_critical_value(double p, double df)
+{
+  double low  = 0.0;
+  double high = 1e3;
+  for(int i = 0; i < 100; i++)
+  {
+    const double middle = 0.5 * (low + high);
+    (student_t_two_sided_p(middle, df) > p ? low : high) = middle;
+  }
+  return 0.5 * (low + high);
+}
+
+struct WelchTestResult
+{
+  double delta   = 0.0;  // mean(b) - mean(a)
+  double ci_low  = 0.0;  // Confidence interval for delta
+  double ci_high = 0.0;
+  double t       = 0.0;
+  double df      = 0.0;  // Welch-Satterthwaite degrees of freedom
+  double p       = 1.0;  // Two-sided
+};
+
+// Welch's t-test for whether samples `a` and `b` have different means, which
+// doesn't assume they have the same variance. `confidence` is the confidence
+// level of the interval, e.g. 0.95.
+inline WelchTestResult welch_t_test(const std::vector<double>& a, const std::vector<double>& b, double confidence)
+{
+  WelchTestResult result;
+  const SampleSummary summary_a = summarize(a);
+  const SampleSummary summary_b = summarize(b);
+  result.delta                  = summary_b.mean - summary_a.mean;
+  if(a.size() < 2 || b.size() < 2)
+  {
+    return result;
+  }
+  const double variance_a = summary_a.stddev * summary_a.stddev / static_cast<double>(a.size());
+  const double variance_b = summary_b.stddev * summary_b.stddev / static_cast<double>(b.size());
+  const double std_error  = std::sqrt(variance_a + variance_b);
+  if(std_error == 0.0)
+  {
+    result.ci_low = result.ci_high = result.delta;
+    result.p                       = (result.delta == 0.0) ? 1.0 : 0.0;
+    return result;
+  }
+  result.t  = result.delta / std_error;
+  result.df = (variance_a + variance_b) * (variance_a + variance_b)
+              / (variance_a * variance_a / static_cast<double>(a.size() - 1)
+                 + variance_b * variance_b / static_cast<double>(b.size() - 1));
+  result.p                  = student_t_two_sided_p(result.t, result.df);
+  const double half_width   = student_t_critical_value(1.0 - confidence, result.df) * std_error;
+  result.ci_low             = result.delta - half_width;
+  result.ci_high            = result.delta + half_width;
+  return result;
+}
+
+struct MannWhitneyResult
+{
+  double u = 0.0;  // U statistic for `a`
+  double z = 0.0;  // Normal approximation of U
+  double p = 1.0;  // Two-sided
+};
+
+// The Mann-Whitney U test for whether values from `a` tend to be larger or
+// smaller than values from `b`. Unlike the t-test, this only uses ranks, so it
+// isn't thrown off by a skewed distribution or a few slow outliers. Uses the
+// normal approximation with a tie correction, which is accurate for more than
+// about 20 samples each.
+inline MannWhitneyResult mann_whitney_u(const std::vector<double>& a, const std::vector<double>& b)
+{
+  MannWhitneyResult result;
+  const double      n_a = static_cast<double>(a.size());
+  const double      n_b = static_cast<double>(b.size());
+  if(a.empty() || b.empty())
+  {
+    return result;
+  }
+
+  // (value, whether it's from a), sorted by value.
+  std::vector<std::pair<double, bool>> values;
+  values.reserve(a.size() + b.size());
+  for(double value : a)
+  {
+    values.push_back({value, true});
+  }
+  for(double value : b)
+  {
+    values.push_back({value, false});
+  }
+  std::sort(values.begin(), values.end());
+
+  // Tied values get the average of their ranks.
+  double rank_sum_a = 0.0;
+  double tie_sum    = 0.0;
+  for(size_t start = 0; start < values.size();)
+  {
+    size_t end = start + 1;
+    while(end < values.size() && values[end].first == values[start].first)
+    {
+      end++;
+    }
+    const double ties         = static_cast<double>(end - start);
+    const double average_rank = 0.5 * static_cast<double>(start + 1 + end);
+    for(size_t i = start; i < end; i++)
+    {
+      rank_sum_a += values[i].second ? average_rank : 0.0;
+    }
+    tie_sum += ties * ties * ties - ties;
+    start = end;
+  }
+
+  const double n        = n_a + n_b;
+  result.u              = rank_sum_a - n_a * (n_a + 1.0) / 2.0;
+  const double mean     = n_a * n_b / 2.0;
+  const double variance = n_a * n_b / 12.0 * ((n + 1.0) - tie_sum / (n * (n - 1.0)));
+  if(variance <= 0.0)
+  {
+    return result;
+  }
+  // With a continuity correction
+  const double difference = result.u - mean;
+  result.z = (difference - std::copysign(std::min(0.5, std::abs(difference)), difference)) / std::sqrt(variance);
+  result.p = std::erfc(std::abs(result.z) / std::sqrt(2.0));
+  return result;
+}
+
+struct PowerLawFit
+{
+  double exponent    = 0.0;  // b in y = a * x^b
+  double coefficient = 0.0;  // a
+  double r_squared   = 0.0;  // Of the fit to log(y) against log(x)
+};
+
+// Fits y = a * x^b by least squares on log(x) and log(y), e.g. to see how
+// compile time grows with shader size: an exponent of 1 is linear, and 2 is
+// quadratic. Ignores points that aren't positive.
+inline PowerLawFit fit_power_law(const std::vector<double>& x, const std::vector<double>& y)
+{
+  PowerLawFit result;
+  double      n = 0.0, sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0, sum_yy = 0.0;
+  for(size_t i = 0; i < std::min(x.size(), y.size()); i++)
+  {
+    if(x[i] <= 0.0 || y[i] <= 0.0)
+    {
+      continue;
+    }
+    const double log_x = std::log(x[i]), log_y = std::log(y[i]);
+    n += 1.0;
+    sum_x += log_x;
+    sum_y += log_y;
+    sum_xx += log_x * log_x;
+    sum_xy += log_x * log_y;
+    sum_yy += log_y * log_y;
+  }
+  const double variance_x = n * sum_xx - sum_x * sum_x;
+  if(n < 2.0 || variance_x <= 0.0)
+  {
+    return result;
+  }
+  result.exponent           = (n * sum_xy - sum_x * sum_y) / variance_x;
+  result.coefficient        = std::exp((sum_y - result.exponent * sum_x) / n);
+  const double variance_y   = n * sum_yy - sum_y * sum_y;
+  const double covariance   = n * sum_xy - sum_x * sum_y;
+  result.r_squared          = (variance_y > 0.0) ? covariance * covariance / (variance_x * variance_y) : 1.0;
+  return result;
+}
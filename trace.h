@@ -0,0 +1,274 @@
+#pragma once
+
+// Scoped trace zones for seeing what the harness and the compiler helpers do
+// on a timeline, e.g. how parallel precompilation overlaps and which imports
+// hit the module cache.
+//
+// A TraceZone records its label, thread and begin/end times when it goes out
+// of scope. Each thread writes to its own fixed-size ring buffer, so recording
+// takes no locks (only a thread's first zone registers its buffer); when a
+// buffer is full, its oldest events are overwritten. Zones are only recorded
+// after trace_enable(true); otherwise they cost one relaxed atomic load.
+// write_chrome_trace() writes everything recorded in Chrome's trace_event JSON
+// format, which chrome://tracing, Perfetto and Speedscope can open.
+
+// If defined, TraceZones are compiled in. Without it, they do nothing.
+#define USE_TRACE_ZONES
+
+// If defined, each zone is also an Intel ITT task (e.g. for VTune), in the
+// "slang-compile-timer" domain. This needs ittnotify.h and libittnotify.
+// #define USE_ITT
+
+#ifdef USE_ITT
+#include <ittnotify.h>
+#endif
+
+#include "report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct TraceEvent
+{
+  const char* label    = nullptr;  // Must be a string literal (or outlive the trace)
+  int64_t     begin_ns = 0;
+  int64_t     end_ns   = 0;
+};
+
+// One thread's events. Only its own thread writes to it.
+class TraceBuffer
+{
+public:
+  static constexpr size_t kCapacity = size_t(1) << 16;  // Events; a power of 2
+
+  explicit TraceBuffer(uint32_t thread_id)
+      : m_threadId(thread_id)
+      , m_events(std::make_unique<TraceEvent[]>(kCapacity))
+  {
+  }
+
+  void push(const TraceEvent& event)
+  {
+    const uint64_t count             = m_count.load(std::memory_order_relaxed);
+    m_events[count & (kCapacity - 1)] = event;
+    m_count.store(count + 1, std::memory_order_release);
+  }
+
+  uint32_t thread_id() const { return m_threadId; }
+  // How many events were ever pushed; only the last kCapacity are kept.
+  uint64_t          count() const { return m_count.load(std::memory_order_acquire); }
+  const TraceEvent& event(uint64_t index) const { return m_events[index & (kCapacity - 1)]; }
+
+private:
+  const uint32_t                m_threadId;
+  std::unique_ptr<TraceEvent[]> m_events;
+  std::atomic<uint64_t>         m_count = 0;
+};
+
+// Owns every thread's buffer, so that events outlive the threads that
+// recorded them.
+class TraceRegistry
+{
+public:
+  static TraceRegistry& get()
+  {
+    static TraceRegistry registry;
+    return registry;
+  }
+
+  std::atomic<bool> enabled = false;
+
+  // Returns the calling thread's buffer, creating it on first use.
+  TraceBuffer& thread_buffer()
+  {
+    thread_local TraceBuffer* buffer = nullptr;
+    if(!buffer)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_buffers.push_back(std::make_unique<TraceBuffer>(static_cast<uint32_t>(m_buffers.size() + 1)));
+      buffer = m_buffers.back().get();
+    }
+    return *buffer;
+  }
+
+  // Calls `function` with each buffer. Other threads shouldn't be recording
+  // zones at the same time, or we might read events as they're overwritten.
+  template <class Function>
+  void for_each_buffer(Function&& function)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(const std::unique_ptr<TraceBuffer>& buffer : m_buffers)
+    {
+      function(*buffer);
+    }
+  }
+
+#ifdef USE_ITT
+  __itt_domain* itt_domain = __itt_domain_create("slang-compile-timer");
+#endif
+
+private:
+  TraceRegistry() = default;
+
+  std::mutex                                m_mutex;
+  std::vector<std::unique_ptr<TraceBuffer>> m_buffers;
+};
+
+inline void trace_enable(bool enabled)
+{
+  TraceRegistry::get().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+inline bool trace_enabled()
+{
+#ifdef USE_TRACE_ZONES
+  return TraceRegistry::get().enabled.load(std::memory_order_relaxed);
+#else
+  return false;
+#endif
+}
+
+inline int64_t trace_clock_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the time from its construction to its destruction, labeled with
+// `label`, which must be a string literal.
+class TraceZone
+{
+public:
+#ifdef USE_TRACE_ZONES
+  explicit TraceZone(const char* label)
+  {
+    if(!trace_enabled())
+    {
+      return;
+    }
+    m_label   = label;
+    m_beginNs = trace_clock_ns();
+#ifdef USE_ITT
+    __itt_task_begin(TraceRegistry::get().itt_domain, __itt_null, __itt_null, __itt_string_handle_create(label));
+#endif
+  }
+
+  ~TraceZone()
+  {
+    if(!m_label)
+    {
+      return;
+    }
+#ifdef USE_ITT
+    __itt_task_end(TraceRegistry::get().itt_domain);
+#endif
+    TraceRegistry::get().thread_buffer().push({.label = m_label, .begin_ns = m_beginNs, .end_ns = trace_clock_ns()});
+  }
+#else
+  explicit TraceZone(const char*) {}
+#endif
+
+  TraceZone(const TraceZone&)            = delete;
+  TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+#ifdef USE_TRACE_ZONES
+  const char* m_label   = nullptr;  // nullptr if we're not recording
+  int64_t     m_beginNs = 0;
+#endif
+};
+
+// Writes every recorded event to `path` as Chrome trace_event JSON, with
+// times relative to the first event. Returns false on failure.
+inline bool write_chrome_trace(const char* path)
+{
+  FILE* file = fopen(path, "w");
+  if(!file)
+  {
+    fprintf(stderr, "Could not open %s for writing.\n", path);
+    return false;
+  }
+
+  TraceRegistry& registry   = TraceRegistry::get();
+  int64_t        first_ns   = INT64_MAX;
+  uint64_t       num_events = 0, num_dropped = 0;
+  registry.for_each_buffer([&](const TraceBuffer& buffer) {
+    const uint64_t count = buffer.count();
+    const uint64_t first = (count > TraceBuffer::kCapacity) ? count - TraceBuffer::kCapacity : 0;
+    for(uint64_t i = first; i < count; i++)
+    {
+      first_ns = std::min(first_ns, buffer.event(i).begin_ns);
+    }
+    num_events += count - first;
+    num_dropped += first;
+  });
+
+  {
+    JsonWriter json(file);
+    json.begin_object().field("displayTimeUnit", "ms").key("traceEvents").begin_array();
+    registry.for_each_buffer([&](const TraceBuffer& buffer) {
+      const uint64_t count = buffer.count();
+      const uint64_t first = (count > TraceBuffer::kCapacity) ? count - TraceBuffer::kCapacity : 0;
+      for(uint64_t i = first; i < count; i++)
+      {
+        const TraceEvent& event = buffer.event(i);
+        // Timestamps are in microseconds.
+        json.begin_object()
+            .field("name", event.label)
+            .field("cat", "compile")
+            .field("ph", "X")
+            .field("ts", double(event.begin_ns - first_ns) / 1000.0)
+            .field("dur", double(event.end_ns - event.begin_ns) / 1000.0)
+            .field("pid", uint64_t(1))
+            .field("tid", uint64_t(buffer.thread_id()))
+            .end_object();
+      }
+    });
+    json.end_array().end_object();
+  }
+
+  const bool ok = (fclose(file) == 0);
+  printf("Wrote %llu trace events to %s\n", static_cast<unsigned long long>(num_events), path);
+  if(num_dropped > 0)
+  {
+    fprintf(stderr, "Warning: %llu trace events were dropped because a thread's ring buffer was full.\n",
+            static_cast<unsigned long long>(num_dropped));
+  }
+  return ok;
+}
+
+// Enables tracing if `path` isn't null, and writes the trace there when it
+// goes out of scope.
+class ScopedTraceFile
+{
+public:
+  explicit ScopedTraceFile(const char* path)
+      : m_path(path)
+  {
+    if(m_path)
+    {
+      trace_enable(true);
+    }
+  }
+
+  ~ScopedTraceFile()
+  {
+    if(m_path)
+    {
+      trace_enable(false);
+      write_chrome_trace(m_path);
+    }
+  }
+
+  ScopedTraceFile(const ScopedTraceFile&)            = delete;
+  ScopedTraceFile& operator=(const ScopedTraceFile&) = delete;
+
+private:
+  const char* m_path;
+};
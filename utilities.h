@@ -5,26 +5,54 @@
 // If defined, prints more messages.
 #define VERBOSE
 
+#include "mapped_file.h"
+
+#include <atomic>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <string_view>
 #include <type_traits>
 
 namespace fs = std::filesystem;
 using timer  = std::chrono::high_resolution_clock;
 
+// Counts operations that go to the OS's file system (opening, reading, or
+// querying files), so that benchmarks can check that compiles with warm caches
+// don't touch the disk.
+inline std::atomic<uint64_t> g_filesystem_calls = 0;
+
+inline void count_filesystem_call(uint64_t count = 1)
+{
+  g_filesystem_calls.fetch_add(count, std::memory_order_relaxed);
+}
+
+inline uint64_t filesystem_call_count()
+{
+  return g_filesystem_calls.load(std::memory_order_relaxed);
+}
+
+// Returns the time between two time points in milliseconds.
+inline double milliseconds_between(timer::time_point start, timer::time_point end)
+{
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
 // Loads a file from a path; returns empty on failure.
 template <class file_char_type>
 std::optional<std::string> load_file(const file_char_type* filename)
 {
+  count_filesystem_call();
   try
   {
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+    std::ifstream file(fs::path(filename), std::ios::ate | std::ios::binary);
     file.exceptions(std::ios::badbit);
     const std::streampos size_signed = file.tellg();
     if(size_signed < 0)
@@ -72,6 +100,66 @@ std::optional<std::string> load_file(const file_char_type* filename)
   return {};  // Only reached on exception
 }
 
+// Like load_file(), but memory-maps the file instead of copying it, so that
+// its contents can be handed to compilers without any copies; returns false
+// on failure.
+// Since the mapping shares pages with the file, the file must not be truncated
+// while it's mapped; replacing it (writing a new file and renaming it over the
+// old one, as most editors do) is fine.
+template <class file_char_type>
+bool map_file(const file_char_type* filename, MappedFile& out)
+{
+  count_filesystem_call();
+  if(!out.open(fs::path(filename)))
+  {
+#ifdef VERBOSE
+    if constexpr(std::is_same_v<file_char_type, wchar_t>)
+    {
+      fprintf(stderr, "Could not map %S\n", filename);
+    }
+    else
+    {
+      fprintf(stderr, "Could not map %s\n", filename);
+    }
+#endif
+    return false;
+  }
+  if constexpr(std::is_same_v<file_char_type, wchar_t>)
+  {
+    fprintf(stderr, "Mapped %S; size %zu bytes.\n", filename, out.size());
+  }
+  else
+  {
+    fprintf(stderr, "Mapped %s; size %zu bytes.\n", filename, out.size());
+  }
+  return true;
+}
+
+// A file's last write time and size. Comparing stamps is a cheap way to tell
+// whether a cached copy of a file is out of date.
+struct FileStamp
+{
+  fs::file_time_type write_time{};
+  uintmax_t          size = 0;
+
+  bool operator==(const FileStamp&) const = default;
+};
+
+// Returns the stamp of the file at `path`, or an empty one if it doesn't
+// exist.
+inline FileStamp file_stamp(const fs::path& path)
+{
+  count_filesystem_call(2);
+  std::error_code error;
+  FileStamp       stamp;
+  stamp.write_time = fs::last_write_time(path, error);
+  if(!error)
+  {
+    stamp.size = fs::file_size(path, error);
+  }
+  return error ? FileStamp() : stamp;
+}
+
 // Finds and loads a file, searching up at most 3 directories; returns empty
 // on failure.
 std::optional<std::string> find_file(const char* filename, std::string* found_path)
@@ -93,3 +181,106 @@ std::optional<std::string> find_file(const char* filename, std::string* found_pa
   }
   return result;
 }
+
+
+// Incremental 64-bit FNV-1a hash, used to build cache keys.
+// Not cryptographic; only meant to tell inputs apart.
+class Hasher
+{
+public:
+  Hasher& add_bytes(const void* data, size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++)
+    {
+      m_state = (m_state ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return *this;
+  }
+
+  Hasher& add_int(uint64_t value) { return add_bytes(&value, sizeof(value)); }
+
+  // Strings are length-prefixed so that e.g. ("ab", "c") and ("a", "bc") hash
+  // differently.
+  Hasher& add_string(std::string_view str)
+  {
+    add_int(str.size());
+    return add_bytes(str.data(), str.size());
+  }
+
+  uint64_t get() const { return m_state; }
+
+private:
+  uint64_t m_state = 0xcbf29ce484222325ULL;
+};
+
+// XXH64 (https://github.com/Cyan4973/xxHash), for hashing large inputs like
+// shader sources; it processes 32 bytes per round, so it's much faster than
+// Hasher's byte-at-a-time FNV-1a.
+inline uint64_t xxh64(const void* data, size_t size, uint64_t seed = 0)
+{
+  constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+  constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+  constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+  constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+  constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+  const auto         rotl    = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  const auto         read64  = [](const unsigned char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  };
+  const auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * kPrime2, 31) * kPrime1; };
+  const auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * kPrime1 + kPrime4; };
+
+  const unsigned char* p   = static_cast<const unsigned char*>(data);
+  const unsigned char* end = p + size;
+  uint64_t             h;
+  if(size >= 32)
+  {
+    uint64_t v1 = seed + kPrime1 + kPrime2, v2 = seed + kPrime2, v3 = seed, v4 = seed - kPrime1;
+    for(; p + 32 <= end; p += 32)
+    {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+    }
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+  }
+  else
+  {
+    h = seed + kPrime5;
+  }
+  h += size;
+  for(; p + 8 <= end; p += 8)
+  {
+    h = rotl(h ^ round(0, read64(p)), 27) * kPrime1 + kPrime4;
+  }
+  if(p + 4 <= end)
+  {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    h = rotl(h ^ (value * kPrime1), 23) * kPrime2 + kPrime3;
+    p += 4;
+  }
+  for(; p < end; p++)
+  {
+    h = rotl(h ^ (*p * kPrime5), 11) * kPrime1;
+  }
+  h ^= h >> 33;
+  h *= kPrime2;
+  h ^= h >> 29;
+  h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Formats a 64-bit value as 16 hex digits.
+inline std::string hex_string(uint64_t value)
+{
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+  return buffer;
+}